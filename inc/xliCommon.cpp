@@ -124,3 +124,29 @@ uint64_t StringToUInt64(const char *strData)
 
   return retValue;
 }
+
+// Base64 encode, return the length of output string
+/// The caller must reserve ((len + 2) / 3 * 4 + 1) bytes
+int Base64Encode(char *buf, const uint8_t *data, int len)
+{
+  static const char b64Table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  int i, nPos = 0;
+  uint32_t triple;
+  for( i = 0; i + 2 < len; i += 3 ) {
+    triple = ((uint32_t)data[i] << 16) | ((uint32_t)data[i+1] << 8) | data[i+2];
+    buf[nPos++] = b64Table[(triple >> 18) & 0x3F];
+    buf[nPos++] = b64Table[(triple >> 12) & 0x3F];
+    buf[nPos++] = b64Table[(triple >> 6) & 0x3F];
+    buf[nPos++] = b64Table[triple & 0x3F];
+  }
+  if( i < len ) {
+    triple = (uint32_t)data[i] << 16;
+    if( i + 1 < len ) triple |= (uint32_t)data[i+1] << 8;
+    buf[nPos++] = b64Table[(triple >> 18) & 0x3F];
+    buf[nPos++] = b64Table[(triple >> 12) & 0x3F];
+    buf[nPos++] = (i + 1 < len ? b64Table[(triple >> 6) & 0x3F] : '=');
+    buf[nPos++] = '=';
+  }
+  buf[nPos] = '\0';
+  return nPos;
+}
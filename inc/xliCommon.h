@@ -65,7 +65,7 @@ enum FLASH_FLAG {UNSAVED, SAVED};
 enum RUN_FLAG {UNEXECUTED, EXECUTED};
 
 //enum values for CldJSONCommand()
-enum COMMAND {CMD_SERIAL, CMD_POWER, CMD_COLOR, CMD_BRIGHTNESS, CMD_SCENARIO, CMD_CCT, CMD_QUERY, CMD_EFFECT, CMD_EXT};
+enum COMMAND {CMD_SERIAL, CMD_POWER, CMD_COLOR, CMD_BRIGHTNESS, CMD_SCENARIO, CMD_CCT, CMD_QUERY, CMD_EFFECT, CMD_EXT, CMD_REPORT};
 
 // Switch value for set power command
 #define DEVICE_SW_OFF               0       // Turn Off
@@ -197,6 +197,20 @@ typedef enum
 #define RING_ID_2                   2
 #define RING_ID_3                   3
 
+// Packed scene of all rings in one V_RGBW payload: a header per ring, followed
+// by the fields flagged in it. Fields are absolute values, flagged only if they
+// differ from the last reported state, so a repeated frame does no harm.
+#define SCN_HDR_PACKED              0x80    // Set in every header, never a ring ID
+#define SCN_HDR_STATE               0x40    // Ring is on
+#define SCN_HDR_SAME                0x20    // Same as the previous ring, no field follows
+#define SCN_FLD_BR                  0x01
+#define SCN_FLD_W                   0x02
+#define SCN_FLD_R                   0x04
+#define SCN_FLD_G                   0x08
+#define SCN_FLD_B                   0x10
+#define SCN_FLD_ALL                 0x1F
+#define SCN_MAX_PACKED_LEN          (MAX_RING_NUM * 6)
+
 #define IS_SUNNY(DevType)           ((DevType) >= devtypWRing3 && (DevType) <= devtypWRing1)
 #define IS_RAINBOW(DevType)         ((DevType) >= devtypCRing3 && (DevType) <= devtypCRing1)
 #define IS_MIRAGE(DevType)          ((DevType) >= devtypMRing3 && (DevType) <= devtypMRing1)
@@ -247,6 +261,7 @@ uint8_t h2i(const char c);
 char* PrintUint64(char *buf, uint64_t value, bool bHex = true);
 char* PrintMacAddress(char *buf, const uint8_t *mac, char delim = ':', bool bShort = true);
 uint64_t StringToUInt64(const char *strData);
+int Base64Encode(char *buf, const uint8_t *data, int len);
 inline time_t tmConvert_t(US YYYY, UC MM, UC DD, UC hh, UC mm, UC ss)  // inlined for speed
 {
   struct tm t;
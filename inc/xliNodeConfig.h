@@ -17,6 +17,7 @@
 #define NCF_DEV_CONFIG_MODE             14      // Put Device into Config Mode, payload length = 2
 #define NCF_DEV_SET_RELAY_NODE          15      // Set relay node id & subID, payload length = 2
 #define NCF_DEV_SET_RELAY_KEYS          16      // Set relay keys, payload length = 2 to 4
+#define NCF_DEV_SET_RF_CHANNEL          17      // Move to RF channel b1 in b2 seconds, b2=0 to stay on b1 and drop the pending move, payload length = 2
 
 #define NCF_PAN_SET_BTN_1               20      // Set Panel Button Action, payload length = 2
 #define NCF_PAN_SET_BTN_2               21      // Set Panel Button Action, payload length = 2
@@ -0,0 +1,331 @@
+/**
+ * xlxAlarmGraph.cpp - Xlight rule, schedule, alarm and scenario dependencies
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. TimeAlarms has only dtNBR_ALARMS alarms. Before, each schedule took
+ *    one tagged with the first rule using it, so a second rule on the
+ *    same schedule never fired; now all rules of a trigger share it
+ * 2. The alarm tag is the trigger index, the fan-out is read when it
+ *    fires, so attaching or detaching a rule never touches the alarm
+ * 3. Next firings are computed like TimeAlarms does, in local time
+ *
+ * ToDo:
+ * 1.
+**/
+
+#include "xlxAlarmGraph.h"
+#include "xlSmartController.h"
+#include "xlxLogger.h"
+
+//------------------------------------------------------------------
+// the one and only instance of AlarmGraphClass
+//------------------------------------------------------------------
+AlarmGraphClass theAlarmGraph;
+
+// Alarm callback
+void AlarmGraphTriggered(uint32_t tag)
+{
+  theAlarmGraph.OnAlarm((UC)tag);
+}
+
+//------------------------------------------------------------------
+// Xlight Alarm Graph Class
+//------------------------------------------------------------------
+AlarmGraphClass::AlarmGraphClass()
+{
+  memset(m_trigger, 0x00, sizeof(m_trigger));
+  for( UC i = 0; i < AGR_MAX_TRIGGERS; i++ ) m_trigger[i].alarm_id = dtINVALID_ALARM_ID;
+  memset(m_ruleTrigger, AGR_NONE, sizeof(m_ruleTrigger));
+  m_firings = 0;
+  m_executions = 0;
+  m_rebuilds = 0;
+}
+
+AlarmId AlarmGraphClass::Attach(UC rule_uid, const ScheduleRow_t &schedule)
+{
+  if( rule_uid >= MAX_RT_ROWS ) return dtINVALID_ALARM_ID;
+
+  UC lv_index = FindTrigger(schedule);
+  if( lv_index != AGR_NONE && m_ruleTrigger[rule_uid] == lv_index ) {
+    // Already there
+    return m_trigger[lv_index].alarm_id;
+  }
+
+  Detach(rule_uid);
+  if( lv_index == AGR_NONE ) {
+    lv_index = NewTrigger(schedule);
+    if( lv_index == AGR_NONE ) {
+      LOGW(LOGTAG_MSG, "No alarm for UID:%c%d via UID:%c%d", CLS_SCHEDULE, schedule.uid, CLS_RULE, rule_uid);
+      return dtINVALID_ALARM_ID;
+    }
+  }
+
+  agr_trigger_t &lv_trigger = m_trigger[lv_index];
+  lv_trigger.fanout[rule_uid / 8] |= (1 << (rule_uid % 8));
+  lv_trigger.rules++;
+  m_ruleTrigger[rule_uid] = lv_index;
+  LOGD(LOGTAG_MSG, "UID:%c%d on alarm %u with %d rules", CLS_RULE, rule_uid, lv_trigger.alarm_id, lv_trigger.rules);
+  return lv_trigger.alarm_id;
+}
+
+void AlarmGraphClass::Detach(UC rule_uid)
+{
+  if( !IsAttached(rule_uid) ) return;
+
+  UC lv_index = m_ruleTrigger[rule_uid];
+  agr_trigger_t &lv_trigger = m_trigger[lv_index];
+  lv_trigger.fanout[rule_uid / 8] &= ~(1 << (rule_uid % 8));
+  if( lv_trigger.rules > 0 ) lv_trigger.rules--;
+  m_ruleTrigger[rule_uid] = AGR_NONE;
+  if( lv_trigger.rules == 0 ) FreeTrigger(lv_index);
+}
+
+BOOL AlarmGraphClass::IsAttached(UC rule_uid)
+{
+  return(rule_uid < MAX_RT_ROWS && m_ruleTrigger[rule_uid] != AGR_NONE);
+}
+
+// Only the rule itself moves
+void AlarmGraphClass::OnRuleChanged(const RuleRow_t &rule)
+{
+  if( !IsAttached(rule.uid) ) return;
+
+  ListNode<ScheduleRow_t> *pSchedule = NULL;
+  if( rule.op_flag != DELETE && rule.SCT_uid < 255 ) pSchedule = theSys.SearchSchedule(rule.SCT_uid);
+  if( pSchedule && pSchedule->data.op_flag != DELETE ) {
+    pSchedule->data.alarm_id = Attach(rule.uid, pSchedule->data);
+  } else {
+    Detach(rule.uid);
+  }
+}
+
+// Only the rules on this schedule move
+void AlarmGraphClass::OnScheduleChanged(const ScheduleRow_t &schedule)
+{
+  AlarmId lv_alarm = dtINVALID_ALARM_ID;
+  BOOL lv_moved = false;
+  ListNode<RuleRow_t> *pRule = theSys.Rule_table.getRoot();
+  while( pRule ) {
+    if( pRule->data.SCT_uid == schedule.uid && IsAttached(pRule->data.uid) ) {
+      lv_moved = true;
+      if( schedule.op_flag == DELETE ) {
+        Detach(pRule->data.uid);
+      } else {
+        lv_alarm = Attach(pRule->data.uid, schedule);
+      }
+    }
+    pRule = pRule->next;
+  }
+
+  ListNode<ScheduleRow_t> *pSchedule = theSys.Schedule_table.search(schedule.uid);
+  if( pSchedule ) {
+    pSchedule->data.alarm_id = lv_alarm;
+    // Acted on, as Action_Schedule() would
+    if( lv_moved ) pSchedule->data.run_flag = EXECUTED;
+  }
+}
+
+void AlarmGraphClass::OnAlarm(UC index)
+{
+  if( index >= AGR_MAX_TRIGGERS || m_trigger[index].rules == 0 ) return;
+
+  // A rule may change the graph, work on a copy
+  UC lv_fanout[AGR_RULE_BYTES];
+  memcpy(lv_fanout, m_trigger[index].fanout, sizeof(lv_fanout));
+  m_firings++;
+  SERIAL_LN("Alarm %u triggered, %d rules", m_trigger[index].alarm_id, m_trigger[index].rules);
+
+  // TimeAlarms has freed a one shot alarm already
+  if( !m_trigger[index].isRepeat ) {
+    for( UC uid = 0; uid < MAX_RT_ROWS; uid++ ) {
+      if( m_ruleTrigger[uid] == index ) m_ruleTrigger[uid] = AGR_NONE;
+    }
+    // Clear the id from schedules while we still know it, FreeTrigger must not touch the alarm
+    ListNode<ScheduleRow_t> *pSchedule = theSys.Schedule_table.getRoot();
+    while( pSchedule ) {
+      if( pSchedule->data.alarm_id == m_trigger[index].alarm_id ) pSchedule->data.alarm_id = dtINVALID_ALARM_ID;
+      pSchedule = pSchedule->next;
+    }
+    m_trigger[index].alarm_id = dtINVALID_ALARM_ID;
+    FreeTrigger(index);
+  }
+
+  for( UC uid = 0; uid < MAX_RT_ROWS; uid++ ) {
+    if( !(lv_fanout[uid / 8] & (1 << (uid % 8))) ) continue;
+    ListNode<RuleRow_t> *pRule = theSys.Rule_table.search(uid);
+    if( pRule ) {
+      // Execute the rule with init-flag
+      theSys.Execute_Rule(pRule, true);
+      m_executions++;
+    } else {
+      LOGE(LOGTAG_MSG, "Error, could not locate UID:%c%d of alarm", CLS_RULE, uid);
+    }
+  }
+}
+
+UC AlarmGraphClass::GetTriggerCount()
+{
+  UC lv_num = 0;
+  for( UC i = 0; i < AGR_MAX_TRIGGERS; i++ ) {
+    if( m_trigger[i].rules > 0 ) lv_num++;
+  }
+  return lv_num;
+}
+
+time_t AlarmGraphClass::GetNextFiring(UC index, time_t after)
+{
+  if( index >= AGR_MAX_TRIGGERS || m_trigger[index].rules == 0 ) return 0;
+
+  const agr_trigger_t &lv_trigger = m_trigger[index];
+  time_t lv_value = AlarmHMS((time_t)lv_trigger.hour, (time_t)lv_trigger.minute, 0);
+  time_t lv_period;
+  if( lv_trigger.weekdays == 0 ) {
+    lv_value += (time_t)previousMidnight(after);
+    lv_period = (time_t)SECS_PER_DAY;
+  } else {
+    lv_value += (time_t)previousSunday(after) + (time_t)(lv_trigger.weekdays - 1) * (time_t)SECS_PER_DAY;
+    lv_period = (time_t)SECS_PER_WEEK;
+  }
+  return(lv_value > after ? lv_value : lv_value + lv_period);
+}
+
+void AlarmGraphClass::ShowGraph()
+{
+  SERIAL_LN("** Alarms, %d of %d used **", GetTriggerCount(), AGR_MAX_TRIGGERS);
+  for( UC i = 0; i < AGR_MAX_TRIGGERS; i++ ) {
+    const agr_trigger_t &lv_trigger = m_trigger[i];
+    if( lv_trigger.rules == 0 ) continue;
+    SERIAL_LN("  alarm %u: day %d %02d:%02d %s, %d rules", lv_trigger.alarm_id, lv_trigger.weekdays,
+        lv_trigger.hour, lv_trigger.minute, (lv_trigger.isRepeat ? "repeat" : "once"), lv_trigger.rules);
+    for( UC uid = 0; uid < MAX_RT_ROWS; uid++ ) {
+      if( m_ruleTrigger[uid] != i ) continue;
+      ListNode<RuleRow_t> *pRule = theSys.Rule_table.search(uid);
+      if( pRule ) {
+        SERIAL_LN("    %c%d <- %c%d -> %c%d", CLS_RULE, uid, CLS_SCHEDULE, pRule->data.SCT_uid, CLS_SCENARIO, pRule->data.SNT_uid);
+      }
+    }
+  }
+  SERIAL_LN("  firings %lu, rules executed %lu, alarms created %lu\n\r", m_firings, m_executions, m_rebuilds);
+}
+
+// Merge the firings of all triggers in time order
+void AlarmGraphClass::ShowNext(UC num)
+{
+  time_t lv_next[AGR_MAX_TRIGGERS];
+  time_t lv_now = now_tz();
+  UC i, lv_shown;
+
+  for( i = 0; i < AGR_MAX_TRIGGERS; i++ ) lv_next[i] = GetNextFiring(i, lv_now);
+
+  SERIAL_LN("** Next %d firings **", num);
+  for( lv_shown = 0; lv_shown < num; lv_shown++ ) {
+    UC lv_index = AGR_NONE;
+    for( i = 0; i < AGR_MAX_TRIGGERS; i++ ) {
+      if( lv_next[i] > 0 && (lv_index == AGR_NONE || lv_next[i] < lv_next[lv_index]) ) lv_index = i;
+    }
+    if( lv_index == AGR_NONE ) break;
+
+    const agr_trigger_t &lv_trigger = m_trigger[lv_index];
+    SERIAL("  %s alarm %u:", Time.format(lv_next[lv_index] - time_zone_cache, "%a %Y-%m-%d %H:%M").c_str(), lv_trigger.alarm_id);
+    for( UC uid = 0; uid < MAX_RT_ROWS; uid++ ) {
+      if( m_ruleTrigger[uid] != lv_index ) continue;
+      ListNode<RuleRow_t> *pRule = theSys.Rule_table.search(uid);
+      SERIAL(" %c%d->%c%d", CLS_RULE, uid, CLS_SCENARIO, (pRule ? pRule->data.SNT_uid : 255));
+    }
+    SERIAL_LN("");
+
+    lv_next[lv_index] = (lv_trigger.isRepeat ? GetNextFiring(lv_index, lv_next[lv_index]) : 0);
+  }
+  if( lv_shown == 0 ) SERIAL_LN("  none");
+  SERIAL_LN("");
+}
+
+//------------------------------------------------------------------
+// Internal functions
+//------------------------------------------------------------------
+UC AlarmGraphClass::FindTrigger(const ScheduleRow_t &schedule)
+{
+  for( UC i = 0; i < AGR_MAX_TRIGGERS; i++ ) {
+    const agr_trigger_t &lv_trigger = m_trigger[i];
+    if( lv_trigger.rules > 0 && lv_trigger.weekdays == schedule.weekdays && lv_trigger.hour == schedule.hour
+        && lv_trigger.minute == schedule.minute && lv_trigger.isRepeat == schedule.isRepeat ) {
+      return i;
+    }
+  }
+  return AGR_NONE;
+}
+
+UC AlarmGraphClass::NewTrigger(const ScheduleRow_t &schedule)
+{
+  UC lv_index;
+  for( lv_index = 0; lv_index < AGR_MAX_TRIGGERS; lv_index++ ) {
+    if( m_trigger[lv_index].rules == 0 ) break;
+  }
+  if( lv_index >= AGR_MAX_TRIGGERS ) return AGR_NONE;
+
+  //If isRepeat is 1 AND:
+    //if weekdays value is between 1 and 7, the alarm is to be repeated weekly on the specified weekday
+    //if weekdays value is 0, alarm is to be repeated daily
+  //if isRepeat is 0:
+    //alarm is to to be triggered on specified weekday; weekday cannot be 0.
+  AlarmId alarm_id = dtINVALID_ALARM_ID;
+  if( schedule.isRepeat ) {
+    if( schedule.weekdays > 0 && schedule.weekdays <= 7 ) {
+      alarm_id = Alarm.alarmRepeat((timeDayOfWeek_t)(int)schedule.weekdays, (int)schedule.hour, (int)schedule.minute, 0, AlarmGraphTriggered);
+    } else if( schedule.weekdays == 0 ) {
+      alarm_id = Alarm.alarmRepeat(AlarmHMS((int)schedule.hour, (int)schedule.minute, 0), AlarmGraphTriggered);
+    }
+  } else if( schedule.weekdays > 0 && schedule.weekdays <= 7 ) {
+    alarm_id = Alarm.alarmOnce((timeDayOfWeek_t)(int)schedule.weekdays, (int)schedule.hour, (int)schedule.minute, 0, AlarmGraphTriggered);
+  }
+  if( alarm_id == dtINVALID_ALARM_ID ) return AGR_NONE;
+  Alarm.setAlarmTag(alarm_id, lv_index);
+
+  agr_trigger_t &lv_trigger = m_trigger[lv_index];
+  memset(&lv_trigger, 0x00, sizeof(lv_trigger));
+  lv_trigger.weekdays = schedule.weekdays;
+  lv_trigger.hour = schedule.hour;
+  lv_trigger.minute = schedule.minute;
+  lv_trigger.isRepeat = schedule.isRepeat;
+  lv_trigger.alarm_id = alarm_id;
+  m_rebuilds++;
+  LOGI(LOGTAG_MSG, "Alarm %u created for day %d %02d:%02d via UID:%c%d", alarm_id,
+      (int)schedule.weekdays, (int)schedule.hour, (int)schedule.minute, CLS_SCHEDULE, schedule.uid);
+  return lv_index;
+}
+
+void AlarmGraphClass::FreeTrigger(UC index)
+{
+  agr_trigger_t &lv_trigger = m_trigger[index];
+  if( lv_trigger.alarm_id != dtINVALID_ALARM_ID && Alarm.isAllocated(lv_trigger.alarm_id) ) {
+    Alarm.disable(lv_trigger.alarm_id);
+    Alarm.free(lv_trigger.alarm_id);
+    LOGN(LOGTAG_MSG, "Alarm %u freed", lv_trigger.alarm_id);
+  }
+
+  // Schedules no longer have it
+  ListNode<ScheduleRow_t> *pSchedule = theSys.Schedule_table.getRoot();
+  while( pSchedule ) {
+    if( pSchedule->data.alarm_id == lv_trigger.alarm_id ) pSchedule->data.alarm_id = dtINVALID_ALARM_ID;
+    pSchedule = pSchedule->next;
+  }
+
+  memset(&lv_trigger, 0x00, sizeof(lv_trigger));
+  lv_trigger.alarm_id = dtINVALID_ALARM_ID;
+}
@@ -0,0 +1,78 @@
+//  xlxAlarmGraph.h - Xlight rule, schedule, alarm and scenario dependencies
+
+#ifndef xlxAlarmGraph_h
+#define xlxAlarmGraph_h
+
+#include "xliCommon.h"
+#include "xlxConfig.h"
+#include "TimeAlarms.h"
+
+// One trigger per alarm of TimeAlarms
+#define AGR_MAX_TRIGGERS        dtNBR_ALARMS
+#define AGR_RULE_BYTES          ((MAX_RT_ROWS + 7) / 8)
+#define AGR_NONE                0xFF
+// Firings listed when not specified
+#define AGR_SHOW_FIRINGS        8
+
+typedef struct
+{
+  UC weekdays;                      // 0: daily, 1..7: Sunday..Saturday
+  UC hour;
+  UC minute;
+  BOOL isRepeat;
+  AlarmId alarm_id;                 // dtINVALID_ALARM_ID if the slot is free
+  UC rules;                         // Number of rules in the fan-out
+  UC fanout[AGR_RULE_BYTES];        // Bit per rule uid
+} agr_trigger_t;
+
+//------------------------------------------------------------------
+// Xlight Alarm Graph Class
+// A rule fires on a schedule, a schedule is a (weekdays, hour, minute,
+// repeat) trigger, and a trigger owns one alarm whose fan-out lists the
+// rules to execute; the scenario of each rule is in its SNT_uid. Rules
+// and schedules with the same trigger share the alarm. An edit only
+// moves the rules it touches to another trigger; an alarm is created
+// for the first rule of a trigger and freed with the last one.
+//------------------------------------------------------------------
+class AlarmGraphClass
+{
+public:
+  AlarmGraphClass();
+
+  // Attach the rule to the trigger of the schedule, moving it if needed.
+  // Return the alarm, dtINVALID_ALARM_ID if it couldn't be created
+  AlarmId Attach(UC rule_uid, const ScheduleRow_t &schedule);
+  void Detach(UC rule_uid);
+  BOOL IsAttached(UC rule_uid);
+  // After Change_Rule() and Change_Schedule(), for rules already attached
+  void OnRuleChanged(const RuleRow_t &rule);
+  void OnScheduleChanged(const ScheduleRow_t &schedule);
+  // Alarm callback, tag is the trigger index
+  void OnAlarm(UC index);
+
+  UC GetTriggerCount();
+  // Local time of the next firing after 'after', 0 if none
+  time_t GetNextFiring(UC index, time_t after);
+  void ShowGraph();
+  void ShowNext(UC num = AGR_SHOW_FIRINGS);
+
+  UL m_firings;
+  UL m_executions;                  // Rules executed by all firings
+  UL m_rebuilds;                    // Alarms created
+
+protected:
+  UC FindTrigger(const ScheduleRow_t &schedule);
+  UC NewTrigger(const ScheduleRow_t &schedule);
+  void FreeTrigger(UC index);
+
+private:
+  agr_trigger_t m_trigger[AGR_MAX_TRIGGERS];
+  UC m_ruleTrigger[MAX_RT_ROWS];    // Trigger of each rule, AGR_NONE if not attached
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern AlarmGraphClass theAlarmGraph;
+
+#endif /* xlxAlarmGraph_h */
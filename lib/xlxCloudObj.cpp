@@ -28,6 +28,7 @@
 #include "xlxConfig.h"
 #include "xlxLogger.h"
 #include "xlxPublishQueue.h"
+#include "xlxTelemetry.h"
 
 //------------------------------------------------------------------
 // Xlight Cloud Object Class
@@ -39,50 +40,8 @@ CloudObjClass::CloudObjClass()
   m_nAppVersion = VERSION_CONFIG_DATA;
   m_SysStatus = STATUS_OFF;
 
-  m_temperature.node_id = 0;
-  m_temperature.data = 0.0;
-
-  m_humidity.node_id = 0;
-  m_humidity.data = 0.0;
-
-  m_brightness.node_id = 0;
-  m_brightness.data = 0;
-
-  m_motion.node_id = 0;
-  m_motion.data = false;
-
-  m_irKey.node_id = 0;
-  m_irKey.data = false;
-
-  m_sound.node_id = 0;
-  m_sound.data = false;
-
-  m_gas.node_id = 0;
-  m_gas.data = 0;
-
-
-  m_smoke.node_id = 0;
-  m_smoke.data = 0;
-
-  m_noise.node_id = 0;
-  m_noise.data = 0;
-
-  m_pm25.node_id = 0;
-  m_pm25.data = 0;
-
-  m_pm10.node_id = 0;
-  m_pm10.data = 0;
-
-  m_tvoc.node_id = 0;
-  m_tvoc.data = 0;
-
-  m_ch2o.node_id = 0;
-  m_ch2o.data = 0;
-
-  m_co2.node_id = 0;
-  m_co2.data = 0;
-
   m_strCldCmd = "";
+  m_pCldCmd = NULL;
 }
 
 // Initialize Cloud Variables & Functions
@@ -137,46 +96,29 @@ int CloudObjClass::CldJSONConfig(String jsonData)
 
 BOOL CloudObjClass::UpdateDHT(uint8_t nid, float _temp, float _humi)
 {
-  static float preTemp = 255;
-  static float preHumi = 255;
-
   if( _temp > 100 && (_humi > 100 || _humi < 0) ) return false;
 
   BOOL temp_ok = false;
   BOOL humi_ok = false;
   if( nid > 0 ) {
     if( _humi >= 0 && _humi <= 100 ) {
-      if( m_humidity.data != _humi || m_humidity.node_id != nid ) {
-        m_humidity.node_id = nid;
-        m_humidity.data = _humi;
-        humi_ok = true;
-      }
+      humi_ok = m_sensors.Update(nid, sensorDHT_h, _humi);
     }
     if( _temp <= 100 ) {
-      if( m_temperature.data != _temp || m_temperature.node_id != nid )
-      {
-        m_temperature.node_id = nid;
-        m_temperature.data = _temp;
-        temp_ok = true;
-      }
+      temp_ok = m_sensors.Update(nid, sensorDHT, _temp);
     }
   } else {
+    // Controller's own sensor is smoothed before stored
     if( _humi >= 0 && _humi <= 100 ) {
       if( m_sysHumi.AddData(_humi) ) {
         _humi = m_sysHumi.GetValue();
-        if( _humi != preHumi ) {
-          preHumi = _humi;
-          humi_ok = true;
-        }
+        humi_ok = m_sensors.Update(nid, sensorDHT_h, _humi);
       }
     }
     if( _temp <= 100 ) {
       if( m_sysTemp.AddData(_temp) ) {
         _temp = m_sysTemp.GetValue();
-        if( _temp != preTemp ) {
-          preTemp = _temp;
-          temp_ok = true;
-        }
+        temp_ok = m_sensors.Update(nid, sensorDHT, _temp);
       }
     }
   }
@@ -184,7 +126,10 @@ BOOL CloudObjClass::UpdateDHT(uint8_t nid, float _temp, float _humi)
   if( temp_ok ) OnSensorDataChanged(sensorDHT, nid);
   if( humi_ok ) OnSensorDataChanged(sensorDHT_h, nid);
 
-  if( !theConfig.GetDisableWiFi() ) {
+  if( theTelemetry.IsEnabled() ) {
+    if( temp_ok ) theTelemetry.Update(nid, sensorDHT, _temp);
+    if( humi_ok ) theTelemetry.Update(nid, sensorDHT_h, _humi);
+  } else if( !theConfig.GetDisableWiFi() ) {
     // Publis right away
     if( Particle.connected() && (temp_ok || humi_ok) ) {
       String strTemp;
@@ -209,11 +154,11 @@ BOOL CloudObjClass::UpdateDHT(uint8_t nid, float _temp, float _humi)
 
 BOOL CloudObjClass::UpdateBrightness(uint8_t nid, uint8_t value)
 {
-  if( m_brightness.data != value || m_brightness.node_id != nid ) {
-    m_brightness.node_id = nid;
-    m_brightness.data = value;
+  if( m_sensors.Update(nid, sensorALS, value) ) {
     OnSensorDataChanged(sensorALS, nid);
-    if( !theConfig.GetDisableWiFi() ) {
+    if( theTelemetry.IsEnabled() ) {
+      theTelemetry.Update(nid, sensorALS, value);
+    } else if( !theConfig.GetDisableWiFi() ) {
       // Publis right away
       if( Particle.connected() ) {
         String strTemp = String::format("{'nd':%d,'ALS':%d}", nid, value);
@@ -230,15 +175,11 @@ BOOL CloudObjClass::UpdateMotion(uint8_t nid, uint8_t sensor, uint8_t value)
 {
   if( sensor == S_MOTION || sensor == S_IR ) {
     if( sensor == S_MOTION ) {
-      if( m_motion.data != value || m_motion.node_id != nid ) {
-        m_motion.node_id = nid;
-        m_motion.data = value;
+      if( m_sensors.Update(nid, sensorPIR, value) ) {
         OnSensorDataChanged(sensorPIR, nid);
       }
     } else if( sensor == S_IR ) {
-      if( m_irKey.data != value || m_irKey.node_id != nid ) {
-        m_irKey.node_id = nid;
-        m_irKey.data = value;
+      if( m_sensors.Update(nid, sensorIRKey, value) ) {
         OnSensorDataChanged(sensorIRKey, nid);
       }
     }
@@ -258,11 +199,11 @@ BOOL CloudObjClass::UpdateMotion(uint8_t nid, uint8_t sensor, uint8_t value)
 
 BOOL CloudObjClass::UpdateGas(uint8_t nid, uint16_t value)
 {
-  if( m_gas.data != value || m_gas.node_id != nid ) {
-    m_gas.node_id = nid;
-    m_gas.data = value;
+  if( m_sensors.Update(nid, sensorGAS, value) ) {
     OnSensorDataChanged(sensorGAS, nid);
-    if( !theConfig.GetDisableWiFi() ) {
+    if( theTelemetry.IsEnabled() ) {
+      theTelemetry.Update(nid, sensorGAS, value);
+    } else if( !theConfig.GetDisableWiFi() ) {
       // Publis right away
       if( Particle.connected() ) {
         String strTemp = String::format("{'nd':%d,'GAS':%d}", nid, value);
@@ -278,44 +219,42 @@ BOOL CloudObjClass::UpdateGas(uint8_t nid, uint16_t value)
 BOOL CloudObjClass::UpdateAirQuality(uint8_t nid, uint16_t pm25,uint16_t pm10,float tvoc,float ch2o,uint16_t co2)
 {
 	BOOL bNeedSendMsg = false;
-	if( m_pm25.data != pm25 || m_pm25.node_id != nid )
+	if( m_sensors.Update(nid, sensorPM25, pm25) )
 		{
-			m_pm25.node_id = nid;
-			m_pm25.data = pm25;
 			OnSensorDataChanged(sensorPM25, nid);
 			bNeedSendMsg = true;
 		}
-		if( m_pm10.data != pm10 || m_pm10.node_id != nid )
+		if( m_sensors.Update(nid, sensorPM10, pm10) )
 		{
-			m_pm10.node_id = nid;
-			m_pm10.data = pm10;
 			OnSensorDataChanged(sensorPM10, nid);
 			bNeedSendMsg = true;
 		}
-		if( m_tvoc.data != tvoc || m_tvoc.node_id != nid )
+		if( m_sensors.Update(nid, sensorTVOC, tvoc) )
 		{
-			m_tvoc.node_id = nid;
-			m_tvoc.data = tvoc;
 			OnSensorDataChanged(sensorTVOC, nid);
 			bNeedSendMsg = true;
 		}
-		if( m_ch2o.data != ch2o || m_ch2o.node_id != nid )
+		if( m_sensors.Update(nid, sensorCH2O, ch2o) )
 		{
-			m_ch2o.node_id = nid;
-			m_ch2o.data = ch2o;
 			OnSensorDataChanged(sensorCH2O, nid);
 			bNeedSendMsg = true;
 		}
-		if( m_co2.data != co2 || m_co2.node_id != nid )
+		if( m_sensors.Update(nid, sensorCO2, co2) )
 		{
-			m_co2.node_id = nid;
-			m_co2.data = co2;
 			OnSensorDataChanged(sensorCO2, nid);
 			bNeedSendMsg = true;
 		}
 
 
-		if( !theConfig.GetDisableWiFi() && bNeedSendMsg ) {
+		if( theTelemetry.IsEnabled() ) {
+			if( bNeedSendMsg ) {
+				theTelemetry.Update(nid, sensorPM25, pm25);
+				theTelemetry.Update(nid, sensorPM10, pm10);
+				theTelemetry.Update(nid, sensorTVOC, tvoc);
+				theTelemetry.Update(nid, sensorCH2O, ch2o);
+				theTelemetry.Update(nid, sensorCO2, co2);
+			}
+		} else if( !theConfig.GetDisableWiFi() && bNeedSendMsg ) {
 			// Publis right away
 			if( Particle.connected() ) {
 				String strTemp = String::format("{'nd':%d,'PM25':%d,'PM10':%d,'TVOC':%.2f,'CH2O':%.2f,'CO2':%d}", nid,pm25,pm10,tvoc,ch2o,co2 );
@@ -328,11 +267,11 @@ BOOL CloudObjClass::UpdateAirQuality(uint8_t nid, uint16_t pm25,uint16_t pm10,fl
 
 BOOL CloudObjClass::UpdateDust(uint8_t nid, uint16_t value)
 {
-  if( m_pm25.data != value || m_pm25.node_id != nid ) {
-    m_pm25.node_id = nid;
-    m_pm25.data = value;
+  if( m_sensors.Update(nid, sensorPM25, value) ) {
     OnSensorDataChanged(sensorPM25, nid);
-    if( !theConfig.GetDisableWiFi() ) {
+    if( theTelemetry.IsEnabled() ) {
+      theTelemetry.Update(nid, sensorPM25, value);
+    } else if( !theConfig.GetDisableWiFi() ) {
       // Publis right away
       if( Particle.connected() ) {
         String strTemp = String::format("{'nd':%d,'PM25':%d}", nid, value);
@@ -347,11 +286,11 @@ BOOL CloudObjClass::UpdateDust(uint8_t nid, uint16_t value)
 
 BOOL CloudObjClass::UpdateSmoke(uint8_t nid, uint16_t value)
 {
-  if( m_smoke.data != value || m_smoke.node_id != nid ) {
-    m_smoke.node_id = nid;
-    m_smoke.data = value;
+  if( m_sensors.Update(nid, sensorSMOKE, value) ) {
     OnSensorDataChanged(sensorSMOKE, nid);
-    if( !theConfig.GetDisableWiFi() ) {
+    if( theTelemetry.IsEnabled() ) {
+      theTelemetry.Update(nid, sensorSMOKE, value);
+    } else if( !theConfig.GetDisableWiFi() ) {
       // Publis right away
       if( Particle.connected() ) {
         String strTemp = String::format("{'nd':%d,'SMK':%d}", nid, value);
@@ -366,11 +305,11 @@ BOOL CloudObjClass::UpdateSmoke(uint8_t nid, uint16_t value)
 
 BOOL CloudObjClass::UpdateSound(uint8_t nid, uint8_t value)
 {
-  if( m_sound.data != value || m_sound.node_id != nid ) {
-    m_sound.node_id = nid;
-    m_sound.data = value;
+  if( m_sensors.Update(nid, sensorMIC_b, value) ) {
     OnSensorDataChanged(sensorMIC_b, nid);
-    if( !theConfig.GetDisableWiFi() ) {
+    if( theTelemetry.IsEnabled() ) {
+      theTelemetry.Update(nid, sensorMIC_b, value);
+    } else if( !theConfig.GetDisableWiFi() ) {
       // Publis right away
       if( Particle.connected() ) {
         String strTemp = String::format("{'nd':%d,'MIC':%d}", nid, value);
@@ -385,11 +324,11 @@ BOOL CloudObjClass::UpdateSound(uint8_t nid, uint8_t value)
 
 BOOL CloudObjClass::UpdateNoise(uint8_t nid, uint16_t value)
 {
-  if( m_noise.data != value || m_noise.node_id != nid ) {
-    m_noise.node_id = nid;
-    m_noise.data = value;
+  if( m_sensors.Update(nid, sensorMIC, value) ) {
     OnSensorDataChanged(sensorMIC, nid);
-    if( !theConfig.GetDisableWiFi() ) {
+    if( theTelemetry.IsEnabled() ) {
+      theTelemetry.Update(nid, sensorMIC, value);
+    } else if( !theConfig.GetDisableWiFi() ) {
       // Publis right away
       if( Particle.connected() ) {
         String strTemp = String::format("{'nd':%d,'NOS':%d}", nid, value);
@@ -403,7 +342,7 @@ BOOL CloudObjClass::UpdateNoise(uint8_t nid, uint16_t value)
 }
 
 // Publish LOG message and update cloud variable
-BOOL CloudObjClass::PublishMsg(uint8_t msgType,const char *msg,uint8_t len,uint8_t nid,UC bNeedReplace)
+BOOL CloudObjClass::PublishMsg(uint8_t msgType,const char *msg,US len,uint8_t nid,UC bNeedReplace)
 {
   BOOL rc = true;
   if(msgType == CLT_ID_LOGMSG)
@@ -438,54 +377,32 @@ void CloudObjClass::GotNodeConfigAck(const UC _nodeID, const UC *data)
 /// -1 - error
 int CloudObjClass::ProcessJSONString(const String& inStr)
 {
-  String strTemp = inStr;
-  StaticJsonBuffer<COMMAND_JSON_SIZE * 8> lv_jBuf;
-  m_jpCldCmd = &(lv_jBuf.parseObject(const_cast<char*>(inStr.c_str())));
-  /*char* tst = const_cast<char*>(inStr.c_str());
-  SERIAL("ptr addr = %p",tst);
-  //SERIAL(tst);
-  SERIAL(" ,index = ");
-  Serial.println(inStr.indexOf("cmd"));*/
-  if (!m_jpCldCmd->success())
-  {
-		if( m_strCldCmd.length() > 0 ) {
-
-			m_strCldCmd.concat(inStr);
-			String debugstr = m_strCldCmd;
-			StaticJsonBuffer<COMMAND_JSON_SIZE*3 * 8> lv_jBuf2; //buffer size must be larger than COMMAND_JSON_SIZE
-			m_jpCldCmd = &(lv_jBuf2.parseObject(const_cast<char*>(m_strCldCmd.c_str())));
-			m_strCldCmd = "";		// Already concatenated
-			if (!m_jpCldCmd->success()) {
-				SERIAL_LN("Could not parse the concatenated string: %s", debugstr.c_str());
-				return -1;
-			}
-		} else {
-			return -1;
-		}
-  }
-
-	if (m_jpCldCmd->containsKey("x0") ) {
+  char lv_part[COMMAND_JSON_SIZE];
+  jsr_field_t lv_fields[] = {
+    JSR_FIELD("x0", JSR_STR, sizeof(lv_part), lv_part),
+    JSR_FIELD("x1", JSR_STR, sizeof(lv_part), lv_part)
+  };
+
+  m_pCldCmd = NULL;
+  BOOL lv_ok = JsonReaderClass::Parse(inStr.c_str(), lv_fields, 2);
+  if( lv_ok && lv_fields[0].found ) {
 		// Begin of a new string
-		m_strCldCmd = (*m_jpCldCmd)["x0"];
+		m_strCldCmd = lv_part;
 		return 1;
-	}
-	else if (m_jpCldCmd->containsKey("x1")) {
+	} else if( lv_ok && lv_fields[1].found ) {
 		// Concatenate
-		strTemp = (*m_jpCldCmd)["x1"];
-		m_strCldCmd.concat(strTemp);
+		m_strCldCmd.concat(lv_part);
 		return 1;
   } else if( m_strCldCmd.length() > 0 ) {
+		// Last part, the whole command is checked when it is executed
 		m_strCldCmd.concat(inStr);
-		String debugstr = m_strCldCmd;
-		StaticJsonBuffer<COMMAND_JSON_SIZE * 8> lv_jBuf3;
-		m_jpCldCmd = &(lv_jBuf3.parseObject(const_cast<char*>(m_strCldCmd.c_str())));
-
+		m_strCldJSON = m_strCldCmd;
 		m_strCldCmd = "";		// Already concatenated
-		if (!m_jpCldCmd->success()) {
-			SERIAL_LN("Could not parse the string: %s", debugstr.c_str());
-			return -1;
-		}
+		m_pCldCmd = m_strCldJSON.c_str();
+		return 0;
   }
 
+  if( !lv_ok ) return -1;
+  m_pCldCmd = inStr.c_str();
   return 0;
 }
@@ -4,9 +4,10 @@
 #define xliCloudObj_h
 
 #include "xliCommon.h"
-#include "ArduinoJson.h"
+#include "xlxJsonReader.h"
 #include "LinkedList.h"
 #include "MoveAverage.h"
+#include "xlxSensorStore.h"
 
 // Comment it off if we don't use Particle public cloud
 /// Notes:
@@ -28,24 +29,6 @@
 #define CLF_JSONConfig          "JSONConfig"      // Can also be a Particle Object
 #define CLF_SetCurTime          "SetCurTime"
 
-typedef struct
-{
-  UC node_id;                       // RF nodeID
-  float data;
-} nd_float_t;
-
-typedef struct
-{
-  UC node_id;                       // RF nodeID
-  US data;
-} nd_us_t;
-
-typedef struct
-{
-  UC node_id;                       // RF nodeID
-  UC data;
-} nd_uc_t;
-
 //------------------------------------------------------------------
 // Xlight CloudObj Class
 //------------------------------------------------------------------
@@ -65,21 +48,8 @@ public:
   CMoveAverage m_sysTemp;
   CMoveAverage m_sysHumi;
 
-  // Sensor Data from Node
-  nd_float_t m_temperature;
-  nd_float_t m_humidity;
-  nd_us_t m_brightness;
-  nd_uc_t m_motion;
-  nd_uc_t m_irKey;
-  nd_us_t m_gas;
-  nd_us_t m_smoke;
-  nd_uc_t m_sound;
-  nd_us_t m_noise;
-  nd_us_t m_pm25;
-  nd_us_t m_pm10;
-  nd_float_t m_tvoc;
-  nd_float_t m_ch2o;
-  nd_us_t m_co2;
+  // Sensor Data from Nodes and Controller (node 0)
+  SensorStoreClass m_sensors;
 
 public:
   CloudObjClass();
@@ -105,7 +75,7 @@ public:
   BOOL UpdateNoise(uint8_t nid, uint16_t value);
   BOOL UpdateAirQuality(uint8_t nid, uint16_t pm25,uint16_t pm10,float tvoc,float ch2o,uint16_t co2);
 
-  BOOL PublishMsg(uint8_t msgType,const char *msg,uint8_t len,uint8_t nid=0xff,UC bNeedReplace=0);
+  BOOL PublishMsg(uint8_t msgType,const char *msg,US len,uint8_t nid=0xff,UC bNeedReplace=0);
   //BOOL PublishDeviceStatus(const char *msg,uint8_t len);
   //BOOL PublishDeviceConfig(const char *msg,uint8_t len);
   //BOOL PublishACDeviceStatus(const char *msg,uint8_t len);
@@ -116,7 +86,9 @@ public:
 protected:
   void InitCloudObj();
 
-  JsonObject *m_jpCldCmd;
+  // Complete command text of the last ProcessJSONString(), valid until the next call
+  const char *m_pCldCmd;
+  String m_strCldJSON;
 
   LinkedList<String> m_cmdList;
   LinkedList<String> m_configList;
@@ -25,6 +25,8 @@
  *     3rd party API currently.
  * 2. Use EEPROM class (high level API) to access the emulated EEPROM.
  * 3. Use spark-flashee-eeprom (low level 3rd party API) to access P1 external Flash.
+ * 3.1 Each area of P1 Flash is a FlashRegionClass with a write-combining
+ *     cache, dirty lines are programmed by FlushFlash() in SaveConfig()
  * 4. Please refer to xliMemoryMap.h for memory allocation.
  *
  * ToDo:
@@ -42,6 +44,7 @@
 #include "xlxRF433Server.h"
 #include "xlSmartController.h"
 #include "xlxPublishQueue.h"
+#include "xlxJsonWriter.h"
 
 using namespace Flashee;
 
@@ -66,20 +69,23 @@ BOOL NodeListClass::LoadNodeFlash(uint32_t startAddr,uint16_t len)
 	NodeIdRow_t NodeArray[MAX_NODE_PER_CONTROLLER];
 	if (sizeof(NodeIdRow_t)*MAX_NODE_PER_CONTROLLER <= len)
 	{
-		if (theConfig.getP1Flash()->read<NodeIdRow_t[MAX_NODE_PER_CONTROLLER]>(NodeArray, startAddr))
+		if (theConfig.getFlash(FLR_MISC)->read<NodeIdRow_t[MAX_NODE_PER_CONTROLLER]>(NodeArray, startAddr - MEM_MISC_OFFSET))
 		{
-			for (int i = 0; i < theConfig.GetNumNodes(); i++) //interate through RuleArray for non-empty rows
+			UC lv_num = min(theConfig.GetNumNodes(), MAX_NODE_PER_CONTROLLER);
+			for (int i = 0; i < lv_num; i++) //interate through NodeArray for non-empty rows
 			{
-				if ((NodeArray[i].nid != 0xFF && NodeArray[i].nid != 0) && add(&NodeArray[i]) > 0)
-				{
-					LOGW(LOGTAG_MSG, "Node row %d success load nodeid=%d from flash %d", i,NodeArray[i].nid,startAddr);
-				}
-				else
+				if (NodeArray[i].nid == 0xFF || NodeArray[i].nid == 0)
 				{
 					LOGW(LOGTAG_MSG, "Node row %d failed to load from flash %d", i,startAddr);
 					return false;
 				}
 			}
+			// Rows were saved in order, one sorted copy
+			if (assign(NodeArray, lv_num) != lv_num)
+			{
+				LOGW(LOGTAG_MSG, "Node list from flash %d has duplicated rows", startAddr);
+				return false;
+			}
 		}
 		else
 		{
@@ -128,7 +134,9 @@ bool NodeListClass::saveList()
 		uint8_t attemps = 0;
 		while(++attemps <=3 )
 		{
-			if(theConfig.getP1Flash()->write<NodeIdRow_t[MAX_NODE_PER_CONTROLLER]>(lv_buf, MEM_NODELIST_OFFSET))
+			// Write through, the backup copy is only of use once this one is programmed
+			if(theConfig.getFlash(FLR_MISC)->write<NodeIdRow_t[MAX_NODE_PER_CONTROLLER]>(lv_buf, MEM_NODELIST_OFFSET - MEM_MISC_OFFSET)
+					&& theConfig.getFlash(FLR_MISC)->Flush())
 			{
 				LOGN(LOGTAG_MSG, "write nodelist success!");
 				ret = true;
@@ -142,7 +150,8 @@ bool NodeListClass::saveList()
 		attemps = 0;
 		while(++attemps <=3 )
 		{
-			if(theConfig.getP1Flash()->write<NodeIdRow_t[MAX_NODE_PER_CONTROLLER]>(lv_buf, MEM_NODELIST_BACKUP_OFFSET))
+			if(theConfig.getFlash(FLR_MISC)->write<NodeIdRow_t[MAX_NODE_PER_CONTROLLER]>(lv_buf, MEM_NODELIST_BACKUP_OFFSET - MEM_MISC_OFFSET)
+					&& theConfig.getFlash(FLR_MISC)->Flush())
 			{
 				LOGN(LOGTAG_MSG, "write nodelist backup success!");
 				ret = true;
@@ -160,19 +169,18 @@ bool NodeListClass::saveList()
 
 void NodeListClass::publishNode(NodeIdRow_t _node)
 {
-	String strTemp;
+	char strTemp[96];
 	char strDisplay[64];
 
 	UL lv_now = Time.now();
-	strTemp = String::format("{'nd':%d,'mac':'%s','device':%d,'recent':%d}", _node.nid,
+	int nLen = snprintf(strTemp, sizeof(strTemp), "{'nd':%d,'mac':'%s','device':%d,'recent':%ld}", _node.nid,
 			PrintMacAddress(strDisplay, _node.identity, false), _node.device,
-			(_node.recentActive > 0 ? lv_now - _node.recentActive : -1));
-	theSys.PublishMsg(CLT_ID_DeviceConfig,strTemp.c_str(),strTemp.length(),_node.nid);
+			(_node.recentActive > 0 ? (long)(lv_now - _node.recentActive) : -1L));
+	theSys.PublishMsg(CLT_ID_DeviceConfig, strTemp, nLen, _node.nid);
 }
 
 void NodeListClass::showList(BOOL toCloud, UC nid)
 {
-	String strTemp;
 	char strDisplay[64];
 
 	if( nid > 0 ) {
@@ -184,31 +192,28 @@ void NodeListClass::showList(BOOL toCloud, UC nid)
 				publishNode(lv_Node);
 			}
 		}
+	} else if( toCloud ) {
+		// Node list, as many frames as needed: {'nlist':48,'nids':[1,2,..]}
+		JsonWriterClass lv_writer(JSW_SINK_CLOUD, CLT_ID_DeviceConfig);
+		snprintf(strDisplay, sizeof(strDisplay), "{'nlist':%d,'nids':[", _count);
+		lv_writer.Begin(strDisplay);
+		for(int i=0; i < _count; i++) {
+			lv_writer.Add("%d", _pItems[i].nid);
+		}
+		lv_writer.End();
+		if( lv_writer.m_stopped ) LOGE(LOGTAG_MSG, "Node list incomplete, publish queue full");
+		LOGD(LOGTAG_MSG, "Node list: %d frames, free memory %lu, lowest %lu", lv_writer.m_frames,
+				lv_writer.m_heapStart, lv_writer.m_heapMin);
 	} else {
 		UL lv_now = Time.now();
-		// Node list
-		if( toCloud ) {
-			strTemp = String::format("{'nlist':%d,'nids':[%d", _count, _pItems[0].nid);
-		}
 		for(int i=0; i < _count; i++) {
-			if( toCloud ) {
-				if( i > 0 ) {
-					sprintf(strDisplay, ",%d", _pItems[i].nid);
-					strTemp = strTemp + strDisplay;
-				}
-			} else {
-				SERIAL_LN("%cNo.%d - NodeID: %d (%s) actived %ds ago associated device: %d",
-						_pItems[i].nid == CURRENT_DEVICE ? '*' : ' ', i,
-				    _pItems[i].nid, PrintMacAddress(strDisplay, _pItems[i].identity, false),
-						(_pItems[i].recentActive > 0 ? lv_now - _pItems[i].recentActive : -1),
-					  _pItems[i].device);
-			}
+			SERIAL_LN("%cNo.%d - NodeID: %d (%s) actived %ds ago associated device: %d",
+					_pItems[i].nid == CURRENT_DEVICE ? '*' : ' ', i,
+			    _pItems[i].nid, PrintMacAddress(strDisplay, _pItems[i].identity, false),
+					(_pItems[i].recentActive > 0 ? lv_now - _pItems[i].recentActive : -1),
+				  _pItems[i].device);
 		}
-	}
-
-	if( toCloud ) {
-		strTemp = strTemp + "]}";
-		theSys.PublishMsg(CLT_ID_DeviceConfig,strTemp.c_str(),strTemp.length());
+		SERIAL_LN("  free memory %lu\n\r", System.freeMemory());
 	}
 }
 
@@ -230,6 +235,18 @@ BOOL NodeListClass::clearNodeId(UC nodeID)
 		// remove item
 		lv_Node.nid = nodeID;
 		remove(&lv_Node);
+		theSys.m_sensors.RemoveNode(nodeID);
+		theSys.m_liveness.Remove(nodeID);
+		// Nodes associated with it, e.g. remotes, lose the association
+		UC lv_nids[MAX_NODE_PER_CONTROLLER];
+		UC lv_num = findDevice(nodeID, lv_nids, MAX_NODE_PER_CONTROLLER);
+		for( UC i = 0; i < lv_num; i++ ) {
+			lv_Node.nid = lv_nids[i];
+			if( get(&lv_Node) >= 0 ) {
+				lv_Node.device = 0;
+				update(&lv_Node);
+			}
+		}
 		if( nodeID >= NODEID_MIN_LAMP && nodeID <= NODEID_MAX_LAMP ) {
 			theConfig.SetNumDevices(theConfig.GetNumDevices() - 1);
 		}
@@ -241,12 +258,128 @@ BOOL NodeListClass::clearNodeId(UC nodeID)
 	return true;
 }
 
+int NodeListClass::add(NodeIdRow_t *_pT)
+{
+	BOOL bChanged = IsIndexChanged(_pT);
+	int pos = OrderdList::add(_pT);
+	if( pos >= 0 && bChanged ) m_idxDirty = true;
+	return pos;
+}
+
+int NodeListClass::update(NodeIdRow_t *_pT)
+{
+	BOOL bChanged = IsIndexChanged(_pT);
+	int pos = OrderdList::update(_pT);
+	if( pos >= 0 && bChanged ) m_idxDirty = true;
+	return pos;
+}
+
+bool NodeListClass::remove(NodeIdRow_t *_pT)
+{
+	bool rc = OrderdList::remove(_pT);
+	if( rc ) m_idxDirty = true;
+	return rc;
+}
+
+void NodeListClass::removeAll()
+{
+	OrderdList::removeAll();
+	m_idxDirty = true;
+}
+
+uint8_t NodeListClass::assign(const NodeIdRow_t *_pT, uint8_t nCount)
+{
+	uint8_t rc = OrderdList::assign(_pT, nCount);
+	m_idxDirty = true;
+	return rc;
+}
+
+// Hash of identity or device into [0..NDL_HASH_SIZE)
+static UC NodeIndexHash(uint64_t _key)
+{
+	UL lv_key = (UL)(_key ^ (_key >> 32));
+	return (UC)((lv_key * 2654435761UL) >> (32 - NDL_HASH_BITS));
+}
+
+UC NodeListClass::findIdentity(uint64_t _identity, UC _except)
+{
+	if( _identity == 0 ) return 0;
+	if( m_idxDirty ) RebuildIndexes();
+
+	NodeIdRow_t lv_Node;
+	UC slot = NodeIndexHash(_identity);
+	for( UC i = 0; i < NDL_HASH_SIZE && m_idxIdentity[slot]; i++ ) {
+		lv_Node.nid = m_idxIdentity[slot];
+		if( lv_Node.nid != _except && get(&lv_Node) >= 0 && getIdentity(lv_Node.identity) == _identity ) return lv_Node.nid;
+		slot = (slot + 1) & (NDL_HASH_SIZE - 1);
+	}
+	return 0;
+}
+
+UC NodeListClass::findDevice(UC _device, UC *pNids, UC nMax)
+{
+	if( _device == 0 || !pNids ) return 0;
+	if( m_idxDirty ) RebuildIndexes();
+
+	NodeIdRow_t lv_Node;
+	UC lv_num = 0;
+	UC slot = NodeIndexHash(_device);
+	for( UC i = 0; i < NDL_HASH_SIZE && m_idxDevice[slot] && lv_num < nMax; i++ ) {
+		lv_Node.nid = m_idxDevice[slot];
+		if( get(&lv_Node) >= 0 && lv_Node.device == _device ) pNids[lv_num++] = lv_Node.nid;
+		slot = (slot + 1) & (NDL_HASH_SIZE - 1);
+	}
+	return lv_num;
+}
+
+// Only identity and device are indexed, recentActive etc. don't matter
+BOOL NodeListClass::IsIndexChanged(const NodeIdRow_t *_pT)
+{
+	if( !_pT ) return false;
+	NodeIdRow_t lv_Node;
+	lv_Node.nid = _pT->nid;
+	if( OrderdList::get(&lv_Node) < 0 ) return true;
+	return( getIdentity(lv_Node.identity) != getIdentity(_pT->identity) || lv_Node.device != _pT->device );
+}
+
+void NodeListClass::RebuildIndexes()
+{
+	memset(m_idxIdentity, 0x00, sizeof(m_idxIdentity));
+	memset(m_idxDevice, 0x00, sizeof(m_idxDevice));
+	uint64_t lv_id;
+	UC slot;
+	for( UC i = 0; i < _count; i++ ) {
+		lv_id = getIdentity(_pItems[i].identity);
+		if( lv_id ) {
+			slot = NodeIndexHash(lv_id);
+			while( m_idxIdentity[slot] ) slot = (slot + 1) & (NDL_HASH_SIZE - 1);
+			m_idxIdentity[slot] = _pItems[i].nid;
+		}
+		if( _pItems[i].device ) {
+			slot = NodeIndexHash(_pItems[i].device);
+			while( m_idxDevice[slot] ) slot = (slot + 1) & (NDL_HASH_SIZE - 1);
+			m_idxDevice[slot] = _pItems[i].nid;
+		}
+	}
+	m_idxDirty = false;
+}
+
 //------------------------------------------------------------------
 // Xlight Config Class
 //------------------------------------------------------------------
 ConfigClass::ConfigClass()
 {
 	P1Flash = Devices::createWearLevelErase();
+	// Regions share the wear levelling of the whole chip, each with own cache lines
+	memset(m_flash, 0x00, sizeof(m_flash));
+	if( P1Flash ) {
+		m_flash[FLR_RULES] = new FlashRegionClass(*P1Flash, MEM_RULES_OFFSET, MEM_RULES_LEN, 4, "rules");
+		m_flash[FLR_SCENARIOS] = new FlashRegionClass(*P1Flash, MEM_SCENARIOS_OFFSET, MEM_SCENARIOS_LEN, 4, "scenarios");
+		m_flash[FLR_MAC_LIST] = new FlashRegionClass(*P1Flash, MEM_MAC_LIST_OFFSET, MEM_MAC_LIST_LEN, 0, "maclist");
+		m_flash[FLR_OFFLINE_DATA] = new FlashRegionClass(*P1Flash, MEM_OFFLINE_DATA_OFFSET, MEM_OFFLINE_DATA_LEN, 1, "offline");
+		m_flash[FLR_REPORT] = new FlashRegionClass(*P1Flash, MEM_REPORT_OFFSET, MEM_REPORT_LEN, 1, "report");
+		m_flash[FLR_MISC] = new FlashRegionClass(*P1Flash, MEM_MISC_OFFSET, MEM_MISC_LEN, 4, "misc");
+	}
 
   m_isLoaded = false;
   m_isChanged = false;
@@ -293,10 +426,14 @@ void ConfigClass::InitConfig()
 	m_config.ndMsgRtpTimes = 1;
 	m_config.relay_key_value = 0xff;
 	m_config.tmLoopKC = RTE_TM_LOOP_KEYCODE;
+	m_config.tmTelemetry = RTE_TM_TELEMETRY;
+	m_config.tlmPacked = 0;
+	m_config.rfSurvey = RF_SURVEY_OFF;
 	memset(m_config.keyMap, 0x00, MAX_KEY_MAP_ITEMS * sizeof(HardKeyMap_t));
 	for(UC _btn = 0; _btn < MAX_NUM_BUTTONS; _btn++ ) {
 		SetExtBtnAction(_btn, 0, DEVICE_SW_TOGGLE, 0x01 << _btn);
 	}
+	InitSensorFilters();
 }
 
 BOOL ConfigClass::InitDevStatus(UC nodeID)
@@ -333,7 +470,7 @@ BOOL ConfigClass::InitDevStatus(UC nodeID)
 BOOL ConfigClass::MemWriteScenarioRow(ScenarioRow_t row, uint32_t address)
 {
 #ifdef MCU_TYPE_P1
-	return P1Flash->write<ScenarioRow_t>(row, address);
+	return m_flash[FLR_SCENARIOS]->write<ScenarioRow_t>(row, address);
 #else
 	return false;
 #endif
@@ -342,7 +479,7 @@ BOOL ConfigClass::MemWriteScenarioRow(ScenarioRow_t row, uint32_t address)
 BOOL ConfigClass::MemReadScenarioRow(ScenarioRow_t &row, uint32_t address)
 {
 #ifdef MCU_TYPE_P1
-	return P1Flash->read<ScenarioRow_t>(row, address);
+	return m_flash[FLR_SCENARIOS]->read<ScenarioRow_t>(row, address);
 #else
 	return false;
 #endif
@@ -395,11 +532,23 @@ BOOL ConfigClass::LoadConfig()
     }
     else
     {
-			m_config.version = VERSION_CONFIG_DATA;
       LOGW(LOGTAG_MSG, "Sysconfig loaded.");
     }
     m_isLoaded = true;
     m_isChanged = false;
+		// Migrate the copy actually loaded, the backup may be older
+		UC lv_version = m_config.version;
+		m_config.version = VERSION_CONFIG_DATA;
+		if( lv_version < 28 ) {
+			// Sensor filters were appended in version 28
+			InitSensorFilters();
+			m_isChanged = true;
+		}
+		if( lv_version < 29 ) {
+			// Telemetry window took over Reserved_UC1 in version 29
+			m_config.tmTelemetry = RTE_TM_TELEMETRY;
+			m_isChanged = true;
+		}
 		UpdateTimeZone();
   } else {
     LOGE(LOGTAG_MSG, "Failed to load Sysconfig, too large.");
@@ -460,10 +609,31 @@ BOOL ConfigClass::SaveConfig()
 
 	// Save NodeID List
 	SaveNodeIDList();
+
+	// Program the rows combined in cache
+	FlushFlash();
   interrupts();
   return true;
 }
 
+BOOL ConfigClass::FlushFlash()
+{
+	BOOL rc = true;
+	for( UC i = 0; i < FLR_DUMMY; i++ ) {
+		if( m_flash[i] && !m_flash[i]->Flush() ) rc = false;
+	}
+	return rc;
+}
+
+void ConfigClass::ShowFlashStatistics()
+{
+	SERIAL_LN("** P1 Flash regions, line %d bytes **", FLC_LINE_SIZE);
+	for( UC i = 0; i < FLR_DUMMY; i++ ) {
+		if( m_flash[i] ) m_flash[i]->ShowStatistics();
+	}
+	SERIAL_LN("");
+}
+
 BOOL ConfigClass::IsConfigLoaded()
 {
   return m_isLoaded;
@@ -997,6 +1167,23 @@ BOOL ConfigClass::SetRFChannel(UC channel)
 	return false;
 }
 
+UC ConfigClass::GetRFSurvey()
+{
+	return m_config.rfSurvey;
+}
+
+BOOL ConfigClass::SetRFSurvey(UC _mode)
+{
+	if( _mode > RF_SURVEY_AUTO ) _mode = RF_SURVEY_AUTO;
+	theRadio.SetSurveyMode(_mode);
+	if( _mode != m_config.rfSurvey ) {
+		m_config.rfSurvey = _mode;
+		m_isChanged = true;
+		return true;
+	}
+	return false;
+}
+
 UC ConfigClass::GetRFAddr()
 {
 	return m_config.rfAddr;
@@ -1044,6 +1231,80 @@ BOOL ConfigClass::SetNdMsgRptTimes(UC _times)
   return false;
 }
 
+// Default sensor filters, in 0.01 unit of the sensor
+const SensorFilter_t defSensorFilters[SNS_COL_MAX] = {
+  // Deadband   Hysteresis  Interval
+  {30,          20,         10},        // Temperature: 0.3 degree
+  {100,         50,         10},        // Humidity: 1%
+  {300,         200,        5},         // ALS
+  {300,         200,        5},         // Noise
+  {0,           0,          0},         // Sound (event)
+  {0,           0,          0},         // PIR (event)
+  {0,           0,          0},         // IR key (event)
+  {500,         0,          10},        // Smoke
+  {500,         0,          10},        // Gas
+  {500,         200,        10},        // PM2.5
+  {500,         200,        10},        // PM10
+  {2,           1,          10},        // TVOC
+  {1,           1,          10},        // CH2O
+  {5000,        2000,       10}         // CO2: 50ppm
+};
+
+void ConfigClass::InitSensorFilters()
+{
+	memcpy(m_config.snsFilter, defSensorFilters, sizeof(m_config.snsFilter));
+}
+
+const SensorFilter_t *ConfigClass::GetSensorFilter(UC _col)
+{
+	if( _col >= SNS_COL_MAX ) return NULL;
+	return &(m_config.snsFilter[_col]);
+}
+
+BOOL ConfigClass::SetSensorFilter(UC _col, US _deadband, US _hysteresis, UC _interval)
+{
+	if( _col >= SNS_COL_MAX ) return false;
+	SensorFilter_t *pFilter = &(m_config.snsFilter[_col]);
+	if( pFilter->deadband != _deadband || pFilter->hysteresis != _hysteresis || pFilter->minInterval != _interval ) {
+		pFilter->deadband = _deadband;
+		pFilter->hysteresis = _hysteresis;
+		pFilter->minInterval = _interval;
+		m_isChanged = true;
+		return true;
+	}
+	return false;
+}
+
+UC ConfigClass::GetTelemetryWindow()
+{
+	return m_config.tmTelemetry;
+}
+
+BOOL ConfigClass::SetTelemetryWindow(UC _seconds)
+{
+	if( _seconds != m_config.tmTelemetry ) {
+    m_config.tmTelemetry = _seconds;
+    m_isChanged = true;
+    return true;
+  }
+  return false;
+}
+
+BOOL ConfigClass::IsTelemetryPacked()
+{
+	return m_config.tlmPacked;
+}
+
+BOOL ConfigClass::SetTelemetryPacked(BOOL _packed)
+{
+	if( _packed != m_config.tlmPacked ) {
+    m_config.tlmPacked = _packed;
+    m_isChanged = true;
+    return true;
+  }
+  return false;
+}
+
 UC ConfigClass::GetRelayKeys()
 {
 	return(m_config.relay_key_value);
@@ -1279,7 +1540,7 @@ BOOL ConfigClass::LoadDeviceStatus()
 BOOL ConfigClass::LoadBackupConfig()
 {
 #ifdef MCU_TYPE_P1
-	return P1Flash->read<Config_t>(m_config, MEM_CONFIG_BACKUP_OFFSET);
+	return m_flash[FLR_MISC]->read<Config_t>(m_config, MEM_CONFIG_BACKUP_OFFSET - MEM_MISC_OFFSET);
 #else
 	return false;
 #endif
@@ -1288,7 +1549,8 @@ BOOL ConfigClass::LoadBackupConfig()
 BOOL ConfigClass::SaveBackupConfig()
 {
 #ifdef MCU_TYPE_P1
-	return P1Flash->write<Config_t>(m_config, MEM_CONFIG_BACKUP_OFFSET);
+	return( m_flash[FLR_MISC]->write<Config_t>(m_config, MEM_CONFIG_BACKUP_OFFSET - MEM_MISC_OFFSET)
+			&& m_flash[FLR_MISC]->Flush() );
 #else
 	return false;
 #endif
@@ -1455,7 +1717,7 @@ BOOL ConfigClass::SaveScenarioTable()
 			  if (row_index < MAX_SNT_ROWS)
 			  {
 #ifdef MCU_TYPE_P1
-				  P1Flash->write<ScenarioRow_t>(tmpRow, MEM_SCENARIOS_OFFSET + row_index*SNT_ROW_SIZE);
+				  m_flash[FLR_SCENARIOS]->write<ScenarioRow_t>(tmpRow, row_index*SNT_ROW_SIZE);
 #endif
 				  rowptr->data.flash_flag = SAVED; //toggle flash flag
 			  }
@@ -1490,7 +1752,7 @@ BOOL ConfigClass::LoadRuleTable()
 	RuleRow_t RuleArray[MAX_RT_ROWS];
 	if (RT_ROW_SIZE*MAX_RT_ROWS <= MEM_RULES_LEN)
 	{
-		if (P1Flash->read<RuleRow_t[MAX_RT_ROWS]>(RuleArray, MEM_RULES_OFFSET))
+		if (m_flash[FLR_RULES]->read<RuleRow_t[MAX_RT_ROWS]>(RuleArray, 0))
 		{
 			for (int i = 0; i < MAX_RT_ROWS; i++) //interate through RuleArray for non-empty rows
 			{
@@ -1566,7 +1828,7 @@ BOOL ConfigClass::SaveRuleTable()
 				if (row_index < MAX_RT_ROWS)
 				{
 	#ifdef MCU_TYPE_P1
-					P1Flash->write<RuleRow_t>(tmpRow, MEM_RULES_OFFSET + row_index*RT_ROW_SIZE);
+					m_flash[FLR_RULES]->write<RuleRow_t>(tmpRow, row_index*RT_ROW_SIZE);
 	#endif
 					rowptr->data.flash_flag = SAVED; //toggle flash flag
 				}
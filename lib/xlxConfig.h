@@ -5,9 +5,11 @@
 
 #include "xliCommon.h"
 #include "xliMemoryMap.h"
+#include "xlxSensorStore.h"
 #include "TimeAlarms.h"
 #include "OrderedList.h"
 #include "flashee-eeprom.h"
+#include "xlxFlashRegion.h"
 
 /*Note: if any of these structures are modified, the following print functions may need updating:
  - ConfigClass::print_config()
@@ -54,6 +56,17 @@ typedef struct
   UC keyMap;                                // Button Key Map: 8 bits for each button, one bit corresponds to one relay key
 } Button_Action_t;
 
+// Sensor event filter, values are in 0.01 unit of the sensor
+typedef struct
+#ifdef PACK
+	__attribute__((packed))
+#endif
+{
+  US deadband;                              // Minimum change from the last event
+  US hysteresis;                            // Extra change required when direction reverses
+  UC minInterval;                           // Minimum seconds between two events
+} SensorFilter_t;
+
 typedef struct
 #ifdef PACK
 	__attribute__((packed))
@@ -105,10 +118,13 @@ typedef struct
   US maxBaseNetworkDuration;
   UC tmLoopKC;                              // Loop Keycode timeout
   BOOL disableLamp            :1;           // if disable lamp
-  UC reserved                 :7;           // reserved
-  UC Reserved_UC1[1];
+  BOOL tlmPacked              :1;           // Telemetry frame in packed binary (base64)
+  UC rfSurvey                 :2;           // RF channel survey, off by default
+  UC reserved                 :4;           // reserved
+  UC tmTelemetry;                           // Telemetry window in seconds, 0 to publish every reading
   HardKeyMap_t keyMap[MAX_KEY_MAP_ITEMS];
   Button_Action_t btnAction[MAX_NUM_BUTTONS][MAX_BTN_OP_TYPE];  // 0: press, 1: long press
+  SensorFilter_t snsFilter[SNS_COL_MAX];    // Sensor event filter, indexed by sensor store column
 } Config_t;
 
 //------------------------------------------------------------------
@@ -183,8 +199,17 @@ typedef struct    // Exact 16 bytes
   UC type;      // sensor type
 } NodeIdRow_t;
 
+// Identity as one integer, the row is packed so it may be unaligned
+inline uint64_t getIdentity(const UC *pId)
+{
+  uint64_t nId = 0;
+  memcpy(&nId, pId, min(LEN_NODE_IDENTITY, sizeof(uint64_t)));
+  return nId;
+};
+
 inline BOOL isIdentityEmpty(UC *pId, UC nLen = LEN_NODE_IDENTITY)
 {
+  if( nLen == LEN_NODE_IDENTITY ) return(getIdentity(pId) == 0);
   for( int i = 0; i < nLen; i++ ) { if(pId[i] > 0) return FALSE; }
   return TRUE;
 };
@@ -200,15 +225,14 @@ inline void resetIdentity(UC *pId, UC nLen = LEN_NODE_IDENTITY)
 
 inline BOOL isIdentityEqual(UC *pId1, UC *pId2, UC nLen = LEN_NODE_IDENTITY)
 {
+  if( nLen == LEN_NODE_IDENTITY ) return(getIdentity(pId1) == getIdentity(pId2));
   for( int i = 0; i < nLen; i++ ) { if(pId1[i] != pId2[i]) return false; }
   return true;
 };
 
 inline BOOL isIdentityEqual(UC *pId1, uint64_t *pData)
 {
-  UC nLen = min(LEN_NODE_IDENTITY, sizeof(uint64_t));
-  UC pId2[LEN_NODE_IDENTITY]; copyIdentity(pId2, pData);
-  return isIdentityEqual(pId1, pId2, nLen);
+  return(getIdentity(pId1) == *pData);
 };
 
 //------------------------------------------------------------------
@@ -300,15 +324,19 @@ typedef struct
 #define NCT_ROW_SIZE	    sizeof(NodeConfig_t)
 #define MAX_NCT_ROWS	    (int)(MEM_NODECONFIG_LEN / NCT_ROW_SIZE)
 
+// Secondary indexes of node list: open addressing tables of nid, 0 for empty slot
+#define NDL_HASH_BITS       7
+#define NDL_HASH_SIZE       (1 << NDL_HASH_BITS)      // Must be larger than MAX_NODE_PER_CONTROLLER
+
 // Node List Class
 class NodeListClass : public OrderdList<NodeIdRow_t>
 {
 public:
   bool m_isChanged;
 
-  NodeListClass(uint8_t maxl = 64, bool desc = false, uint8_t initlen = 8) : OrderdList(maxl, desc, initlen) {
-    m_isChanged = false; };
-  virtual int compare(NodeIdRow_t _first, NodeIdRow_t _second) {
+  NodeListClass(uint8_t maxl = MAX_NODE_PER_CONTROLLER, bool desc = false, uint8_t initlen = 8) : OrderdList(maxl, desc, initlen) {
+    m_isChanged = false; m_idxDirty = true; };
+  virtual int compare(const NodeIdRow_t &_first, const NodeIdRow_t &_second) {
     if( _first.nid > _second.nid ) {
       return 1;
     } else if( _first.nid < _second.nid ) {
@@ -326,6 +354,26 @@ public:
   void publishNode(NodeIdRow_t _node);
   BOOL clearNodeId(UC nodeID);
 
+  // Keep secondary indexes consistent
+  virtual int add(NodeIdRow_t *_pT);
+  virtual int update(NodeIdRow_t *_pT);
+  virtual bool remove(NodeIdRow_t *_pT);
+  virtual void removeAll();
+  virtual uint8_t assign(const NodeIdRow_t *_pT, uint8_t nCount);
+
+  // Lookup by secondary index, return nid, or 0 if not found
+  UC findIdentity(uint64_t _identity, UC _except = 0);
+  // Nodes associated with device, return the number of nids
+  UC findDevice(UC _device, UC *pNids, UC nMax);
+
+protected:
+  BOOL IsIndexChanged(const NodeIdRow_t *_pT);
+  void RebuildIndexes();
+
+private:
+  UC m_idxIdentity[NDL_HASH_SIZE];
+  UC m_idxDevice[NDL_HASH_SIZE];
+  BOOL m_idxDirty;                          // Rebuild on next lookup
 };
 
 //------------------------------------------------------------------
@@ -344,6 +392,7 @@ private:
 
   Config_t m_config;
   Flashee::FlashDevice* P1Flash;
+  FlashRegionClass* m_flash[FLR_DUMMY];
 
   void UpdateTimeZone();
   void DoTimeSync();
@@ -352,12 +401,15 @@ public:
   ConfigClass();
   void InitConfig();
   BOOL InitDevStatus(UC nodeID);
-  Flashee::FlashDevice* getP1Flash()
+  // P1 external flash region FLR_*, addressed from the region start
+  FlashRegionClass* getFlash(UC _region)
   {
-	  return P1Flash;
+	  return(_region < FLR_DUMMY ? m_flash[_region] : NULL);
   }
+  BOOL FlushFlash();
+  void ShowFlashStatistics();
 
-  // write to P1 using spark-flashee-eeprom
+  // write to P1 using spark-flashee-eeprom, address within FLR_SCENARIOS
   BOOL MemWriteScenarioRow(ScenarioRow_t row, uint32_t address);
   BOOL MemReadScenarioRow(ScenarioRow_t &row, uint32_t address);
 
@@ -483,12 +535,24 @@ public:
   UC GetRFAddr();
   BOOL SetRFAddr(UC addr);
 
+  UC GetRFSurvey();
+  BOOL SetRFSurvey(UC _mode);
+
   UC GetBcMsgRptTimes();
   BOOL SetBcMsgRptTimes(UC _times);
 
   UC GetNdMsgRptTimes();
   BOOL SetNdMsgRptTimes(UC _times);
 
+  const SensorFilter_t *GetSensorFilter(UC _col);
+  BOOL SetSensorFilter(UC _col, US _deadband, US _hysteresis, UC _interval);
+  void InitSensorFilters();
+
+  UC GetTelemetryWindow();
+  BOOL SetTelemetryWindow(UC _seconds);
+  BOOL IsTelemetryPacked();
+  BOOL SetTelemetryPacked(BOOL _packed);
+
   UC GetRelayKeys();
   BOOL SetRelayKeys(const UC _keys);
   UC GetRelayKey(const UC _code);
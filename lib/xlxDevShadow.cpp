@@ -0,0 +1,207 @@
+/**
+ * xlxDevShadow.cpp - Xlight lamp shadow with desired and reported state
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Keep desired (commanded) and reported (confirmed) on/off, brightness
+ *    and CCT per lamp, plus a version counter of desired changes
+ * 2. O(1) lookup: lamp nid is the index
+ * 3. Sync and pending state kept as bitmaps by nid, cheap for dashboards
+ * 4. GetDueNode() drives the reconciler in SmartControllerClass, which
+ *    resends only the fields in GetDiff()
+ *
+ * ToDo:
+ * 1. Hue (W/R/G/B) of Rainbow and Mirage rings is not tracked yet
+**/
+
+#include "xlxDevShadow.h"
+#include "xlxLogger.h"
+
+#define SHD_BIT(nid)            (1UL << (nid))
+
+//------------------------------------------------------------------
+// Xlight Device Shadow Class
+//------------------------------------------------------------------
+DevShadowClass::DevShadowClass()
+{
+  memset(m_shadow, 0x00, sizeof(m_shadow));
+  m_known = 0;
+  m_sync = 0;
+  m_pending = 0;
+  m_nextDue = 0;
+  m_resent = 0;
+  m_adopted = 0;
+  m_givenUp = 0;
+}
+
+void DevShadowClass::SetDesired(UC nid, UC fields, UC sw, UC br, US cct)
+{
+  if( nid >= SHD_MAX_NODES || !IS_LAMP_NODEID(nid) ) return;
+  DevShadow_t *p = &m_shadow[nid];
+
+  if( fields & SHD_FLD_SW ) p->desiredSW = sw;
+  if( fields & SHD_FLD_BR ) p->desiredBR = br;
+  if( fields & SHD_FLD_CCT ) p->desiredCCT = cct;
+  p->desired |= (fields & SHD_FLD_ALL);
+  p->version++;
+  p->retries = 0;
+  p->changedTime = millis();
+  m_known |= SHD_BIT(nid);
+  UpdateBits(nid);
+}
+
+void DevShadowClass::Report(UC nid, UC fields, UC sw, UC br, US cct)
+{
+  if( nid >= SHD_MAX_NODES || !IS_LAMP_NODEID(nid) ) return;
+  DevShadow_t *p = &m_shadow[nid];
+
+  if( fields & SHD_FLD_SW ) p->reportedSW = sw;
+  if( fields & SHD_FLD_BR ) p->reportedBR = br;
+  if( fields & SHD_FLD_CCT ) p->reportedCCT = cct;
+  p->reported |= (fields & SHD_FLD_ALL);
+  m_known |= SHD_BIT(nid);
+
+  UC lv_diff = GetDiff(nid);
+  if( p->version != p->synced ) {
+    // Pending: done once the lamp reports what we asked for,
+    // otherwise GetDueNode() resends after the timeout
+    if( !lv_diff ) {
+      p->synced = p->version;
+      p->retries = 0;
+    }
+  } else if( lv_diff & fields ) {
+    // Changed at the lamp, take it as the new desired state
+    if( lv_diff & SHD_FLD_SW ) p->desiredSW = sw;
+    if( lv_diff & SHD_FLD_BR ) p->desiredBR = br;
+    if( lv_diff & SHD_FLD_CCT ) p->desiredCCT = cct;
+    m_adopted++;
+  }
+  UpdateBits(nid);
+}
+
+void DevShadowClass::Remove(UC nid)
+{
+  if( nid >= SHD_MAX_NODES ) return;
+  memset(&m_shadow[nid], 0x00, sizeof(DevShadow_t));
+  m_known &= ~SHD_BIT(nid);
+  m_sync &= ~SHD_BIT(nid);
+  m_pending &= ~SHD_BIT(nid);
+}
+
+UC DevShadowClass::GetDiff(UC nid)
+{
+  if( nid >= SHD_MAX_NODES ) return 0;
+  const DevShadow_t *p = &m_shadow[nid];
+
+  // A field never reported differs from whatever we asked for
+  UC lv_diff = p->desired & ~p->reported;
+  if( (p->desired & p->reported & SHD_FLD_SW) && p->desiredSW != p->reportedSW ) lv_diff |= SHD_FLD_SW;
+  if( (p->desired & p->reported & SHD_FLD_BR) && p->desiredBR != p->reportedBR ) lv_diff |= SHD_FLD_BR;
+  if( (p->desired & p->reported & SHD_FLD_CCT) && p->desiredCCT != p->reportedCCT ) lv_diff |= SHD_FLD_CCT;
+  return lv_diff;
+}
+
+const DevShadow_t *DevShadowClass::GetShadow(UC nid)
+{
+  if( nid >= SHD_MAX_NODES || !(m_known & SHD_BIT(nid)) ) return NULL;
+  return &m_shadow[nid];
+}
+
+UC DevShadowClass::GetDueNode(UL now, UL _skip)
+{
+  if( !m_pending ) return NODEID_DUMMY;
+
+  UC nid;
+  DevShadow_t *p;
+  for( UC i = 0; i < SHD_MAX_NODES; i++ ) {
+    nid = (m_nextDue + i) % SHD_MAX_NODES;
+    if( !(m_pending & SHD_BIT(nid)) ) continue;
+    if( _skip & SHD_BIT(nid) ) continue;
+    p = &m_shadow[nid];
+
+    if( !GetDiff(nid) ) {
+      p->synced = p->version;
+      UpdateBits(nid);
+      continue;
+    }
+    if( now - p->changedTime < ((UL)SHD_SYNC_TIMEOUT << p->retries) ) continue;
+    if( p->retries >= SHD_MAX_RETRY ) {
+      // Stop resending; the next report from the lamp becomes desired
+      LOGW(LOGTAG_MSG, "Shadow of node:%d gave up version %d, diff:0x%x", nid, p->version, GetDiff(nid));
+      p->synced = p->version;
+      m_givenUp++;
+      UpdateBits(nid);
+      continue;
+    }
+    p->retries++;
+    p->changedTime = now;
+    m_resent++;
+    m_nextDue = nid + 1;
+    return nid;
+  }
+  return NODEID_DUMMY;
+}
+
+BOOL DevShadowClass::IsInSync(UC nid)
+{
+  if( nid >= SHD_MAX_NODES ) return false;
+  return((m_sync & SHD_BIT(nid)) != 0);
+}
+
+UL DevShadowClass::GetSyncBitmap()
+{
+  return m_sync;
+}
+
+UL DevShadowClass::GetPendingBitmap()
+{
+  return m_pending;
+}
+
+void DevShadowClass::ShowTable()
+{
+  SERIAL_LN("** Device Shadow: sync 0x%08lx, pending 0x%08lx **", m_sync, m_pending);
+  const DevShadow_t *p;
+  for( UC nid = 0; nid < SHD_MAX_NODES; nid++ ) {
+    if( !(m_known & SHD_BIT(nid)) ) continue;
+    p = &m_shadow[nid];
+    SERIAL_LN("  nd:%d desired(0x%x) sw:%d br:%d cct:%d, reported(0x%x) sw:%d br:%d cct:%d, ver:%d/%d retry:%d %s",
+        nid, p->desired, p->desiredSW, p->desiredBR, p->desiredCCT,
+        p->reported, p->reportedSW, p->reportedBR, p->reportedCCT,
+        p->synced, p->version, p->retries, (IsInSync(nid) ? "in sync" : "out of sync"));
+  }
+  SERIAL_LN("  resent:%lu adopted:%lu given up:%lu\n\r", m_resent, m_adopted, m_givenUp);
+}
+
+//------------------------------------------------------------------
+// Internal functions
+//------------------------------------------------------------------
+void DevShadowClass::UpdateBits(UC nid)
+{
+  const DevShadow_t *p = &m_shadow[nid];
+  if( GetDiff(nid) ) {
+    m_sync &= ~SHD_BIT(nid);
+  } else {
+    m_sync |= SHD_BIT(nid);
+  }
+  if( p->version != p->synced ) {
+    m_pending |= SHD_BIT(nid);
+  } else {
+    m_pending &= ~SHD_BIT(nid);
+  }
+}
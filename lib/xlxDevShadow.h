@@ -0,0 +1,82 @@
+//  xlxDevShadow.h - Xlight lamp shadow with desired and reported state
+
+#ifndef xlxDevShadow_h
+#define xlxDevShadow_h
+
+#include "xliCommon.h"
+
+// Lamp nodes are NODEID_MAINDEVICE and [NODEID_MIN_LAMP..NODEID_MAX_LAMP],
+// so a shadow is indexed by nid directly and a bitmap of lamps fits in an UL
+#define SHD_MAX_NODES           (NODEID_MAX_LAMP + 1)
+
+// State fields
+#define SHD_FLD_SW              0x01
+#define SHD_FLD_BR              0x02
+#define SHD_FLD_CCT             0x04
+#define SHD_FLD_ALL             0x07
+
+// Reconciler: first resend after SHD_SYNC_TIMEOUT ms, doubled on each retry
+#define SHD_SYNC_TIMEOUT        3000
+#define SHD_MAX_RETRY           3
+
+typedef struct
+{
+  UC desiredSW;
+  UC desiredBR;
+  US desiredCCT;
+  UC reportedSW;
+  UC reportedBR;
+  US reportedCCT;
+  UC desired;                       // SHD_FLD_* ever set by controller
+  UC reported;                      // SHD_FLD_* ever reported by lamp
+  UC retries;
+  US version;                       // Increased on every desired change
+  US synced;                        // Last version reported back, or given up
+  UL changedTime;                   // millis() of desired change or resend
+} DevShadow_t;
+
+//------------------------------------------------------------------
+// Xlight Device Shadow Class
+// Desired state comes from commands, reported state from lamp replies.
+// While a version is pending, a different report means the command got
+// lost and the diff is resent; once synced, a different report means the
+// lamp was changed locally (remote, hard switch) and becomes desired.
+//------------------------------------------------------------------
+class DevShadowClass
+{
+public:
+  DevShadowClass();
+
+  void SetDesired(UC nid, UC fields, UC sw, UC br = 0, US cct = 0);
+  void Report(UC nid, UC fields, UC sw, UC br = 0, US cct = 0);
+  void Remove(UC nid);
+
+  // Fields of desired state not reported yet, 0 if in sync
+  UC GetDiff(UC nid);
+  const DevShadow_t *GetShadow(UC nid);
+  // Next pending lamp due for a resend, NODEID_DUMMY if none.
+  // Counts the retry, or gives the version up after SHD_MAX_RETRY.
+  // Lamps in _skip (e.g. not present) stay pending without retries.
+  UC GetDueNode(UL now, UL _skip = 0);
+
+  BOOL IsInSync(UC nid);
+  UL GetSyncBitmap();               // Bit nid: lamp reported desired state
+  UL GetPendingBitmap();            // Bit nid: version waiting for report
+  void ShowTable();
+
+  UL m_resent;
+  UL m_adopted;
+  UL m_givenUp;
+
+protected:
+  void UpdateBits(UC nid);
+
+private:
+  DevShadow_t m_shadow[SHD_MAX_NODES];
+  UL m_known;
+  UL m_sync;
+  UL m_pending;
+  UC m_nextDue;                     // Round robin start of GetDueNode()
+};
+
+#endif /* xlxDevShadow_h */
@@ -0,0 +1,309 @@
+/**
+ * xlxFlashRegion.cpp - Xlight flash region with write-combining cache
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. One region per xliMemoryMap.h area on top of the one wear levelling
+ *    device, so the flash layout stays as it was
+ * 2. Region addresses start from 0, out of range access fails
+ * 3. Erase works on device pages. The wear levelling device keeps a 2-byte
+ *    header per page, so its pages are 4094 bytes and the region bases are
+ *    not on page boundaries; a page that crosses the region edge is never
+ *    erased, it would wipe the neighbour region
+ * 4. Write-back cache of FLC_LINE_SIZE lines, LRU replacement; a write
+ *    larger than the whole cache goes straight through
+ * 5. Before programming, the old bytes are checked: a program that has to
+ *    clear bits needs a page erase (relocation) and is counted as such
+ *
+ * ToDo:
+ * 1.
+**/
+
+#include "xlxFlashRegion.h"
+#include "xlxLogger.h"
+
+using namespace Flashee;
+
+#define FLC_CHECK_CHUNK         32
+
+//------------------------------------------------------------------
+// Xlight Flash Region Class
+//------------------------------------------------------------------
+FlashRegionClass::FlashRegionClass(FlashDevice &storage, flash_addr_t base, flash_addr_t len, UC lines, const char *name)
+  : m_flash(storage), m_base(base), m_len(len), m_name(name), m_numLines(lines)
+{
+  page_size_t lv_size = m_flash.pageSize();
+  m_first = (lv_size > 0 ? (lv_size - m_base % lv_size) % lv_size : 0);
+  m_lines = (lines > 0 ? new flc_line_t[lines] : NULL);
+  m_buf = (lines > 0 ? new UC[lines * FLC_LINE_SIZE] : NULL);
+  if( !m_lines || !m_buf ) m_numLines = 0;
+  for( UC i = 0; i < m_numLines; i++ ) {
+    m_lines[i].tag = FLC_NO_LINE;
+    m_lines[i].dirtyFrom = m_lines[i].dirtyTo = 0;
+    m_lines[i].lastUse = 0;
+  }
+  m_useStamp = 0;
+  m_hits = 0;
+  m_misses = 0;
+  m_writes = 0;
+  m_programs = 0;
+  m_erases = 0;
+}
+
+FlashRegionClass::~FlashRegionClass()
+{
+  if( m_lines ) delete []m_lines;
+  if( m_buf ) delete []m_buf;
+}
+
+page_size_t FlashRegionClass::pageSize() const
+{
+  return m_flash.pageSize();
+}
+
+// Whole device pages inside the region
+page_count_t FlashRegionClass::pageCount() const
+{
+  if( m_first >= m_len ) return 0;
+  return (m_len - m_first) / pageSize();
+}
+
+flash_addr_t FlashRegionClass::PageOffset(page_count_t page) const
+{
+  return m_first + (flash_addr_t)page * pageSize();
+}
+
+bool FlashRegionClass::erasePage(flash_addr_t address)
+{
+  flash_addr_t lv_start;
+  if( !PageInside(address, &lv_start) ) {
+    LOGW(LOGTAG_MSG, "Refused to erase %s page at 0x%lx", m_name, (UL)address);
+    return false;
+  }
+  // A line may stick out of the page, its other bytes must not be lost
+  if( !FlushRange(lv_start, pageSize(), false) ) return false;
+  return m_flash.erasePage(m_base + lv_start);
+}
+
+// Raw program bypasses the cache
+bool FlashRegionClass::writePage(const void* data, flash_addr_t address, page_size_t length)
+{
+  if( address + length > m_len ) return false;
+  if( !FlushRange(address, length, false) ) return false;
+  return m_flash.writePage(data, m_base + address, length);
+}
+
+bool FlashRegionClass::readPage(void* data, flash_addr_t address, page_size_t length) const
+{
+  if( address + length > m_len ) return false;
+
+  UC *pData = (UC *)data;
+  page_size_t offset = 0, chunk;
+  UL tag;
+  int idx;
+  while( offset < length ) {
+    tag = (address + offset) - ((address + offset) % FLC_LINE_SIZE);
+    chunk = tag + FLC_LINE_SIZE - (address + offset);
+    if( chunk > length - offset ) chunk = length - offset;
+    idx = FindLine(tag);
+    if( idx >= 0 ) {
+      memcpy(pData + offset, m_buf + idx * FLC_LINE_SIZE + (address + offset - tag), chunk);
+      m_hits += chunk;
+    } else {
+      if( !m_flash.readPage(pData + offset, m_base + address + offset, chunk) ) return false;
+      m_misses += chunk;
+    }
+    offset += chunk;
+  }
+  return true;
+}
+
+bool FlashRegionClass::writeErasePage(const void* data, flash_addr_t address, page_size_t length)
+{
+  if( address + length > m_len ) return false;
+  m_writes++;
+
+  // Too large to combine
+  if( length > (page_size_t)m_numLines * FLC_LINE_SIZE ) {
+    if( !FlushRange(address, length, false) ) return false;
+    return Program((const UC *)data, address, length);
+  }
+
+  const UC *pData = (const UC *)data;
+  page_size_t offset = 0, chunk, lineOfs;
+  UL tag;
+  int idx;
+  flc_line_t *pLine;
+  while( offset < length ) {
+    tag = (address + offset) - ((address + offset) % FLC_LINE_SIZE);
+    lineOfs = address + offset - tag;
+    chunk = FLC_LINE_SIZE - lineOfs;
+    if( chunk > length - offset ) chunk = length - offset;
+    idx = FindLine(tag);
+    if( idx < 0 ) idx = AllocLine(tag, chunk < FLC_LINE_SIZE);
+    if( idx < 0 ) return false;
+
+    pLine = &m_lines[idx];
+    memcpy(m_buf + idx * FLC_LINE_SIZE + lineOfs, pData + offset, chunk);
+    if( pLine->dirtyFrom >= pLine->dirtyTo ) {
+      pLine->dirtyFrom = lineOfs;
+      pLine->dirtyTo = lineOfs + chunk;
+    } else {
+      if( lineOfs < pLine->dirtyFrom ) pLine->dirtyFrom = lineOfs;
+      if( lineOfs + chunk > pLine->dirtyTo ) pLine->dirtyTo = lineOfs + chunk;
+    }
+    pLine->lastUse = ++m_useStamp;
+    offset += chunk;
+  }
+  return true;
+}
+
+bool FlashRegionClass::copyPage(flash_addr_t address, TransferHandler handler, void* data, uint8_t* buf, page_size_t bufSize)
+{
+  flash_addr_t lv_start;
+  if( !PageInside(address, &lv_start) ) return false;
+  if( !FlushRange(lv_start, pageSize(), false) ) return false;
+  return m_flash.copyPage(m_base + lv_start, handler, data, buf, bufSize);
+}
+
+BOOL FlashRegionClass::Flush()
+{
+  BOOL rc = true;
+  for( UC i = 0; i < m_numLines; i++ ) {
+    if( !FlushLine(i) ) rc = false;
+  }
+  return rc;
+}
+
+BOOL FlashRegionClass::IsDirty()
+{
+  for( UC i = 0; i < m_numLines; i++ ) {
+    if( m_lines[i].dirtyFrom < m_lines[i].dirtyTo ) return true;
+  }
+  return false;
+}
+
+void FlashRegionClass::ShowStatistics()
+{
+  UC lv_used = 0, lv_dirty = 0;
+  for( UC i = 0; i < m_numLines; i++ ) {
+    if( m_lines[i].tag != FLC_NO_LINE ) lv_used++;
+    if( m_lines[i].dirtyFrom < m_lines[i].dirtyTo ) lv_dirty++;
+  }
+  SERIAL_LN("  %-9s 0x%06lx %4luK lines:%d/%d dirty:%d hit:%lu miss:%lu write:%lu program:%lu erase:%lu",
+      m_name, (UL)m_base, (UL)m_len / 1024, lv_used, m_numLines, lv_dirty,
+      m_hits, m_misses, m_writes, m_programs, m_erases);
+}
+
+//------------------------------------------------------------------
+// Internal functions
+//------------------------------------------------------------------
+int FlashRegionClass::FindLine(UL _tag) const
+{
+  for( UC i = 0; i < m_numLines; i++ ) {
+    if( m_lines[i].tag == _tag ) return i;
+  }
+  return -1;
+}
+
+// Take a free or the least recently used line, write back its dirty bytes
+int FlashRegionClass::AllocLine(UL _tag, BOOL bLoad)
+{
+  if( m_numLines == 0 ) return -1;
+  UC lv_idx = 0;
+  for( UC i = 0; i < m_numLines; i++ ) {
+    if( m_lines[i].tag == FLC_NO_LINE ) {
+      lv_idx = i;
+      break;
+    }
+    if( m_lines[i].lastUse < m_lines[lv_idx].lastUse ) lv_idx = i;
+  }
+  if( !FlushLine(lv_idx) ) return -1;
+
+  flc_line_t *pLine = &m_lines[lv_idx];
+  pLine->tag = FLC_NO_LINE;
+  if( bLoad && !m_flash.readPage(m_buf + lv_idx * FLC_LINE_SIZE, m_base + _tag, FLC_LINE_SIZE) ) return -1;
+  pLine->tag = _tag;
+  pLine->dirtyFrom = pLine->dirtyTo = 0;
+  return lv_idx;
+}
+
+BOOL FlashRegionClass::FlushLine(UC _idx)
+{
+  flc_line_t *pLine = &m_lines[_idx];
+  if( pLine->dirtyFrom >= pLine->dirtyTo ) return true;
+  if( !Program(m_buf + _idx * FLC_LINE_SIZE + pLine->dirtyFrom, pLine->tag + pLine->dirtyFrom,
+      pLine->dirtyTo - pLine->dirtyFrom) ) {
+    LOGW(LOGTAG_MSG, "Failed to flush %s line 0x%lx", m_name, pLine->tag);
+    return false;
+  }
+  pLine->dirtyFrom = pLine->dirtyTo = 0;
+  return true;
+}
+
+// Write back (or drop) the lines overlapping a range and free them
+BOOL FlashRegionClass::FlushRange(flash_addr_t address, page_size_t length, BOOL bDrop)
+{
+  BOOL rc = true;
+  for( UC i = 0; i < m_numLines; i++ ) {
+    if( m_lines[i].tag == FLC_NO_LINE ) continue;
+    if( m_lines[i].tag + FLC_LINE_SIZE <= address || m_lines[i].tag >= address + length ) continue;
+    if( !bDrop && !FlushLine(i) ) {
+      rc = false;
+      continue;
+    }
+    m_lines[i].tag = FLC_NO_LINE;
+    m_lines[i].dirtyFrom = m_lines[i].dirtyTo = 0;
+  }
+  return rc;
+}
+
+// Region address of the device page holding address, false if the page crosses the region
+BOOL FlashRegionClass::PageInside(flash_addr_t address, flash_addr_t *pStart) const
+{
+  if( address >= m_len ) return false;
+  flash_addr_t lv_abs = m_base + address;
+  flash_addr_t lv_start = lv_abs - lv_abs % pageSize();
+  if( lv_start < m_base || lv_start + pageSize() > m_base + m_len ) return false;
+  *pStart = lv_start - m_base;
+  return true;
+}
+
+BOOL FlashRegionClass::Program(const UC *data, flash_addr_t address, page_size_t length)
+{
+  // Flash can only clear bits, anything else needs the page erased
+  UC lv_old[FLC_CHECK_CHUNK];
+  page_size_t offset, chunk, i;
+  BOOL bErase = false;
+  for( offset = 0; offset < length && !bErase; offset += chunk ) {
+    chunk = FLC_CHECK_CHUNK;
+    if( chunk > length - offset ) chunk = length - offset;
+    if( !m_flash.readPage(lv_old, m_base + address + offset, chunk) ) break;
+    for( i = 0; i < chunk; i++ ) {
+      if( (lv_old[i] & data[offset + i]) != data[offset + i] ) {
+        bErase = true;
+        break;
+      }
+    }
+  }
+
+  if( !m_flash.writeErasePage(data, m_base + address, length) ) return false;
+  m_programs++;
+  if( bErase ) m_erases++;
+  return true;
+}
@@ -0,0 +1,90 @@
+//  xlxFlashRegion.h - Xlight flash region with write-combining cache
+
+#ifndef xlxFlashRegion_h
+#define xlxFlashRegion_h
+
+#include "xliCommon.h"
+#include "flashee-eeprom.h"
+
+// Regions of P1 external flash, see xliMemoryMap.h
+enum {
+  FLR_RULES = 0,
+  FLR_SCENARIOS,
+  FLR_MAC_LIST,
+  FLR_OFFLINE_DATA,
+  FLR_REPORT,
+  FLR_MISC,
+  FLR_DUMMY
+};
+
+// Cache line size, region offsets are aligned to it
+#define FLC_LINE_SIZE           256
+#define FLC_NO_LINE             0xFFFFFFFF
+
+typedef struct
+{
+  UL tag;                           // Region address of the line, FLC_NO_LINE if free
+  US dirtyFrom;                     // Dirty bytes are [dirtyFrom, dirtyTo)
+  US dirtyTo;
+  UL lastUse;                       // LRU stamp
+} flc_line_t;
+
+//------------------------------------------------------------------
+// Xlight Flash Region Class
+// A window [base, base+len) of the wear levelling device, addressed from 0.
+// Pages are those of the device: region bases are not page aligned, so the
+// region's pages are the whole device pages inside it, from PageOffset(0).
+// Writes land in RAM lines and Flush() programs each dirty line with one
+// write, so row by row table saves cost one page update per line instead
+// of one per row. Reads see the cached lines, other bytes are read through.
+//------------------------------------------------------------------
+class FlashRegionClass : public Flashee::FlashDevice
+{
+public:
+  FlashRegionClass(Flashee::FlashDevice &storage, Flashee::flash_addr_t base, Flashee::flash_addr_t len,
+      UC lines, const char *name);
+  virtual ~FlashRegionClass();
+
+  virtual Flashee::page_size_t pageSize() const;
+  virtual Flashee::page_count_t pageCount() const;
+  virtual bool erasePage(Flashee::flash_addr_t address);
+  virtual bool writePage(const void* data, Flashee::flash_addr_t address, Flashee::page_size_t length);
+  virtual bool readPage(void* data, Flashee::flash_addr_t address, Flashee::page_size_t length) const;
+  virtual bool writeErasePage(const void* data, Flashee::flash_addr_t address, Flashee::page_size_t length);
+  virtual bool copyPage(Flashee::flash_addr_t address, Flashee::TransferHandler handler, void* data,
+      uint8_t* buf, Flashee::page_size_t bufSize);
+
+  // Region address of a whole device page, the erase unit
+  Flashee::flash_addr_t PageOffset(Flashee::page_count_t page) const;
+  // Program all dirty lines
+  BOOL Flush();
+  BOOL IsDirty();
+  void ShowStatistics();
+
+  mutable UL m_hits;                // Bytes read from cache
+  mutable UL m_misses;              // Bytes read from flash
+  UL m_writes;                      // Write calls
+  UL m_programs;                    // Line or write-through programs
+  UL m_erases;                      // Programs that needed an erase
+
+protected:
+  int FindLine(UL _tag) const;
+  int AllocLine(UL _tag, BOOL bLoad);
+  BOOL FlushLine(UC _idx);
+  BOOL FlushRange(Flashee::flash_addr_t address, Flashee::page_size_t length, BOOL bDrop);
+  BOOL Program(const UC *data, Flashee::flash_addr_t address, Flashee::page_size_t length);
+  BOOL PageInside(Flashee::flash_addr_t address, Flashee::flash_addr_t *pStart) const;
+
+private:
+  Flashee::FlashDevice &m_flash;
+  Flashee::flash_addr_t m_base;
+  Flashee::flash_addr_t m_len;
+  Flashee::flash_addr_t m_first;    // Region address of the first whole device page
+  const char *m_name;
+  UC m_numLines;
+  flc_line_t *m_lines;
+  UC *m_buf;
+  UL m_useStamp;
+};
+
+#endif /* xlxFlashRegion_h */
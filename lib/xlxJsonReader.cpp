@@ -0,0 +1,352 @@
+/**
+ * xlxJsonReader.cpp - Xlight one pass JSON reader for cloud commands
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Replaces StaticJsonBuffer + parseObject() on the command path, which
+ *    took 512 bytes of stack (1.5K for fragments) and left the command
+ *    object pointing into the buffer after it went out of scope
+ * 2. Only the top level object is read into fields; nested values of
+ *    unknown keys are validated and skipped, up to JSR_MAX_DEPTH
+ * 3. Arrays of objects are taken as spans and walked with GetElement()
+ *
+ * ToDo:
+ * 1. \uXXXX escapes become '?'
+**/
+
+#include "xlxJsonReader.h"
+#include <stdlib.h>
+
+//------------------------------------------------------------------
+// Xlight JSON Reader Class
+//------------------------------------------------------------------
+JsonReaderClass::JsonReaderClass(const char *json, US len)
+{
+  m_pos = json;
+  m_end = json + (len > 0 ? len : strlen(json));
+}
+
+BOOL JsonReaderClass::Parse(const char *json, jsr_field_t *pFields, UC nFields, US len)
+{
+  if( !json ) return false;
+  for( UC i = 0; i < nFields; i++ ) {
+    pFields[i].count = 0;
+    pFields[i].found = false;
+  }
+
+  JsonReaderClass lv_reader(json, len);
+  if( !lv_reader.ParseObject(pFields, nFields) ) return false;
+  // Nothing but blanks after the object
+  lv_reader.SkipSpace();
+  return(lv_reader.m_pos >= lv_reader.m_end || *lv_reader.m_pos == '\0');
+}
+
+BOOL JsonReaderClass::Parse(const jsr_span_t &span, jsr_field_t *pFields, UC nFields)
+{
+  if( span.len == 0 ) return false;
+  return Parse(span.start, pFields, nFields, span.len);
+}
+
+BOOL JsonReaderClass::GetElement(const jsr_span_t &array, UC index, jsr_span_t &elem)
+{
+  if( array.len == 0 ) return false;
+  JsonReaderClass lv_reader(array.start, array.len);
+  if( lv_reader.Peek() != '[' ) return false;
+  lv_reader.m_pos++;
+
+  for( UC i = 0; ; i++ ) {
+    lv_reader.SkipSpace();
+    if( lv_reader.Peek() == ']' ) return false;
+    const char *lv_start = lv_reader.m_pos;
+    if( !lv_reader.SkipValue(1) ) return false;
+    if( i == index ) {
+      elem.start = lv_start;
+      elem.len = lv_reader.m_pos - lv_start;
+      return true;
+    }
+    lv_reader.SkipSpace();
+    if( lv_reader.Peek() != ',' ) return false;
+    lv_reader.m_pos++;
+  }
+  return false;
+}
+
+//------------------------------------------------------------------
+// Internal functions
+//------------------------------------------------------------------
+void JsonReaderClass::SkipSpace()
+{
+  while( m_pos < m_end && (*m_pos == ' ' || *m_pos == '\t' || *m_pos == '\r' || *m_pos == '\n') ) m_pos++;
+}
+
+char JsonReaderClass::Peek()
+{
+  SkipSpace();
+  return(m_pos < m_end ? *m_pos : '\0');
+}
+
+BOOL JsonReaderClass::ParseObject(jsr_field_t *pFields, UC nFields)
+{
+  char lv_key[24];
+  US lv_len;
+
+  if( Peek() != '{' ) return false;
+  m_pos++;
+  if( Peek() == '}' ) {
+    m_pos++;
+    return true;
+  }
+
+  while( true ) {
+    if( !ReadString(lv_key, sizeof(lv_key), &lv_len) ) return false;
+    if( Peek() != ':' ) return false;
+    m_pos++;
+
+    jsr_field_t *lv_pField = NULL;
+    for( UC i = 0; i < nFields; i++ ) {
+      if( strcmp(pFields[i].key, lv_key) == 0 ) {
+        lv_pField = pFields + i;
+        break;
+      }
+    }
+    if( lv_pField ) {
+      if( !ReadValue(lv_pField) ) return false;
+    } else {
+      if( !SkipValue(1) ) return false;
+    }
+
+    char lv_ch = Peek();
+    m_pos++;
+    if( lv_ch == '}' ) return true;
+    if( lv_ch != ',' ) return false;
+  }
+}
+
+// Read a quoted string into buf, NULL to skip it
+BOOL JsonReaderClass::ReadString(char *buf, US size, US *pLen)
+{
+  char lv_quote = Peek();
+  if( lv_quote != '"' && lv_quote != '\'' ) return false;
+  m_pos++;
+
+  US lv_len = 0;
+  while( m_pos < m_end ) {
+    char lv_ch = *m_pos++;
+    if( lv_ch == lv_quote ) {
+      if( buf && size > 0 ) buf[lv_len < size ? lv_len : size - 1] = '\0';
+      if( pLen ) *pLen = lv_len;
+      return true;
+    }
+    if( lv_ch == '\0' ) break;
+    if( lv_ch == '\\' ) {
+      if( m_pos >= m_end ) break;
+      lv_ch = *m_pos++;
+      switch( lv_ch ) {
+      case 'n': lv_ch = '\n'; break;
+      case 'r': lv_ch = '\r'; break;
+      case 't': lv_ch = '\t'; break;
+      case 'b': lv_ch = '\b'; break;
+      case 'f': lv_ch = '\f'; break;
+      case 'u':
+        if( m_end - m_pos < 4 ) return false;
+        m_pos += 4;
+        lv_ch = '?';
+        break;
+      }
+    }
+    if( buf && lv_len + 1 < size ) buf[lv_len] = lv_ch;
+    lv_len++;
+  }
+  return false;
+}
+
+// Integer part of a number, fraction and exponent are dropped
+BOOL JsonReaderClass::ReadNumber(long *pValue)
+{
+  BOOL lv_neg = false;
+  long lv_value = 0;
+
+  if( Peek() == '-' ) {
+    lv_neg = true;
+    m_pos++;
+  }
+  if( m_pos >= m_end || *m_pos < '0' || *m_pos > '9' ) return false;
+  while( m_pos < m_end && *m_pos >= '0' && *m_pos <= '9' ) {
+    lv_value = lv_value * 10 + (*m_pos - '0');
+    m_pos++;
+  }
+  if( m_pos < m_end && *m_pos == '.' ) {
+    m_pos++;
+    while( m_pos < m_end && *m_pos >= '0' && *m_pos <= '9' ) m_pos++;
+  }
+  if( m_pos < m_end && (*m_pos == 'e' || *m_pos == 'E') ) {
+    m_pos++;
+    if( m_pos < m_end && (*m_pos == '+' || *m_pos == '-') ) m_pos++;
+    while( m_pos < m_end && *m_pos >= '0' && *m_pos <= '9' ) m_pos++;
+  }
+  if( pValue ) *pValue = (lv_neg ? -lv_value : lv_value);
+  return true;
+}
+
+// Next number of an array field, items beyond size are dropped
+BOOL JsonReaderClass::ReadItem(jsr_field_t *pField)
+{
+  long lv_value;
+  if( !ReadNumber(&lv_value) ) return false;
+  if( pField->count < pField->size ) {
+    if( pField->type == JSR_BYTES ) {
+      ((UC *)pField->pValue)[pField->count] = (UC)lv_value;
+    } else {
+      ((long *)pField->pValue)[pField->count] = lv_value;
+    }
+    pField->count++;
+  }
+  return true;
+}
+
+// Read the value into the field. A value of another type is skipped and
+// the field stays not found, like a wrong cast returned 0 before
+BOOL JsonReaderClass::ReadValue(jsr_field_t *pField)
+{
+  char lv_ch = Peek();
+  const char *lv_start = m_pos;
+  long *lv_pInts = (long *)pField->pValue;
+
+  switch( pField->type ) {
+  case JSR_INT:
+    if( lv_ch == '"' || lv_ch == '\'' ) {
+      char lv_num[12];
+      if( !ReadString(lv_num, sizeof(lv_num), NULL) ) return false;
+      *lv_pInts = atol(lv_num);
+    } else if( lv_ch == 't' || lv_ch == 'f' ) {
+      if( !SkipValue(1) ) return false;
+      *lv_pInts = (lv_ch == 't' ? 1 : 0);
+    } else if( lv_ch == '-' || (lv_ch >= '0' && lv_ch <= '9') ) {
+      if( !ReadNumber(lv_pInts) ) return false;
+    } else {
+      return SkipValue(1);
+    }
+    pField->count = 1;
+    break;
+
+  case JSR_STR:
+    if( lv_ch != '"' && lv_ch != '\'' ) return SkipValue(1);
+    if( !ReadString((char *)pField->pValue, pField->size, &pField->count) ) return false;
+    if( pField->count >= pField->size ) pField->count = pField->size - 1;
+    break;
+
+  case JSR_INTS:
+  case JSR_BYTES:
+    if( lv_ch != '[' ) {
+      if( lv_ch != '-' && (lv_ch < '0' || lv_ch > '9') ) return SkipValue(1);
+      if( !ReadItem(pField) ) return false;
+      break;
+    }
+    m_pos++;
+    if( Peek() == ']' ) {
+      m_pos++;
+      break;
+    }
+    while( true ) {
+      lv_ch = Peek();
+      if( lv_ch == '-' || (lv_ch >= '0' && lv_ch <= '9') ) {
+        if( !ReadItem(pField) ) return false;
+      } else {
+        if( !SkipValue(2) ) return false;
+      }
+      lv_ch = Peek();
+      m_pos++;
+      if( lv_ch == ']' ) break;
+      if( lv_ch != ',' ) return false;
+    }
+    break;
+
+  case JSR_SPAN:
+    if( !SkipValue(1) ) return false;
+    ((jsr_span_t *)pField->pValue)->start = lv_start;
+    ((jsr_span_t *)pField->pValue)->len = m_pos - lv_start;
+    pField->count = 1;
+    break;
+
+  default:
+    return SkipValue(1);
+  }
+
+  pField->found = true;
+  return true;
+}
+
+BOOL JsonReaderClass::SkipValue(UC depth)
+{
+  if( depth > JSR_MAX_DEPTH ) return false;
+
+  char lv_ch = Peek();
+  switch( lv_ch ) {
+  case '"':
+  case '\'':
+    return ReadString(NULL, 0, NULL);
+
+  case '{':
+    m_pos++;
+    if( Peek() == '}' ) {
+      m_pos++;
+      return true;
+    }
+    while( true ) {
+      if( !ReadString(NULL, 0, NULL) ) return false;
+      if( Peek() != ':' ) return false;
+      m_pos++;
+      if( !SkipValue(depth + 1) ) return false;
+      lv_ch = Peek();
+      m_pos++;
+      if( lv_ch == '}' ) return true;
+      if( lv_ch != ',' ) return false;
+    }
+
+  case '[':
+    m_pos++;
+    if( Peek() == ']' ) {
+      m_pos++;
+      return true;
+    }
+    while( true ) {
+      if( !SkipValue(depth + 1) ) return false;
+      lv_ch = Peek();
+      m_pos++;
+      if( lv_ch == ']' ) return true;
+      if( lv_ch != ',' ) return false;
+    }
+
+  case 't':
+    if( m_end - m_pos < 4 || strncmp(m_pos, "true", 4) ) return false;
+    m_pos += 4;
+    return true;
+
+  case 'f':
+    if( m_end - m_pos < 5 || strncmp(m_pos, "false", 5) ) return false;
+    m_pos += 5;
+    return true;
+
+  case 'n':
+    if( m_end - m_pos < 4 || strncmp(m_pos, "null", 4) ) return false;
+    m_pos += 4;
+    return true;
+  }
+
+  return ReadNumber(NULL);
+}
@@ -0,0 +1,72 @@
+//  xlxJsonReader.h - Xlight one pass JSON reader for cloud commands
+
+#ifndef xlxJsonReader_h
+#define xlxJsonReader_h
+
+#include "xliCommon.h"
+
+// Nesting limit of skipped values
+#define JSR_MAX_DEPTH           8
+
+// Type of a declared field
+enum {
+  JSR_INT = 0,                      // long, also from true/false or a quoted number
+  JSR_STR,                          // char[size], unescaped and '\0' terminated, truncated if longer
+  JSR_INTS,                         // long[size], a single number counts as one item
+  JSR_BYTES,                        // UC[size], like JSR_INTS
+  JSR_SPAN                          // jsr_span_t of the raw value, e.g. an array of rows
+};
+
+typedef struct
+{
+  const char *start;
+  US len;
+} jsr_span_t;
+
+typedef struct
+{
+  const char *key;
+  UC type;                          // JSR_*
+  US size;                          // Chars of JSR_STR or items of JSR_INTS/JSR_BYTES
+  void *pValue;
+  US count;                         // Out: chars, items, or 1
+  BOOL found;                       // Out: key present and value of the type
+} jsr_field_t;
+
+#define JSR_FIELD(key, type, size, value)     {key, type, size, (void *)(value), 0, false}
+
+//------------------------------------------------------------------
+// Xlight JSON Reader Class
+// A command declares the keys it takes and where to put them; Parse()
+// reads the object once, fills the fields and skips everything else.
+// No DOM and no buffer: the input is not modified and strings are
+// copied straight into the field. Keys are matched like before,
+// case sensitive; single quoted strings are accepted.
+//------------------------------------------------------------------
+class JsonReaderClass
+{
+public:
+  // Return false on a syntax error. len 0: up to '\0'
+  static BOOL Parse(const char *json, jsr_field_t *pFields, UC nFields, US len = 0);
+  static BOOL Parse(const jsr_span_t &span, jsr_field_t *pFields, UC nFields);
+  // The index-th element of an array span
+  static BOOL GetElement(const jsr_span_t &array, UC index, jsr_span_t &elem);
+
+protected:
+  JsonReaderClass(const char *json, US len);
+
+  BOOL ParseObject(jsr_field_t *pFields, UC nFields);
+  BOOL ReadString(char *buf, US size, US *pLen);
+  BOOL ReadNumber(long *pValue);
+  BOOL ReadItem(jsr_field_t *pField);
+  BOOL ReadValue(jsr_field_t *pField);
+  BOOL SkipValue(UC depth = 0);
+  void SkipSpace();
+  char Peek();
+
+private:
+  const char *m_pos;
+  const char *m_end;
+};
+
+#endif /* xlxJsonReader_h */
@@ -0,0 +1,167 @@
+/**
+ * xlxJsonWriter.cpp - Xlight streaming JSON writer for table dumps
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Rows are formatted straight into the frame buffer with vsnprintf(),
+ *    a row that overflows is rolled back and goes into the next frame
+ * 2. Cloud frames go to the publish queue, they are sent at its rate.
+ *    A dump is not allowed to evict its own frames: once the queue is
+ *    full the writer stops, and the caller answers with an error
+ * 3. Free memory is sampled at Begin() and at each frame, so a dump can
+ *    be checked for heap use with "show table" / "show nlist"
+ *
+ * ToDo:
+ * 1.
+**/
+
+#include "xlxJsonWriter.h"
+#include "xlxLogger.h"
+
+//------------------------------------------------------------------
+// Xlight JSON Writer Class
+//------------------------------------------------------------------
+JsonWriterClass::JsonWriterClass(UC sink, UC msgType, UC nid)
+{
+  m_sink = sink;
+  m_msgType = msgType;
+  m_nid = nid;
+  m_head[0] = '\0';
+  m_tail[0] = '\0';
+  m_headLen = 0;
+  m_tailLen = 0;
+  m_pos = 0;
+  m_frameItems = 0;
+  m_frames = 0;
+  m_items = 0;
+  m_dropped = 0;
+  m_stopped = false;
+  m_bytes = 0;
+  m_heapStart = 0;
+  m_heapMin = 0;
+}
+
+void JsonWriterClass::Begin(const char *head, const char *tail)
+{
+  strncpy(m_head, head, sizeof(m_head) - 1);
+  m_head[sizeof(m_head) - 1] = '\0';
+  strncpy(m_tail, tail, sizeof(m_tail) - 1);
+  m_tail[sizeof(m_tail) - 1] = '\0';
+  m_headLen = strlen(m_head);
+  m_tailLen = strlen(m_tail);
+  m_heapStart = m_heapMin = System.freeMemory();
+
+  if( m_sink == JSW_SINK_SERIAL ) {
+    SERIAL_LN("%s", m_head);
+  } else {
+    strcpy(m_buf, m_head);
+    m_pos = m_headLen;
+  }
+  m_frameItems = 0;
+}
+
+BOOL JsonWriterClass::Add(const char *fmt, ...)
+{
+  va_list args;
+  int nLen;
+
+  if( m_sink == JSW_SINK_SERIAL ) {
+    va_start(args, fmt);
+    nLen = vsnprintf(m_buf, sizeof(m_buf), fmt, args);
+    va_end(args);
+    SERIAL_LN("  %s", m_buf);
+    m_items++;
+    m_bytes += nLen;
+    return true;
+  }
+
+  for( UC lv_try = 0; lv_try < 2 && !m_stopped; lv_try++ ) {
+    // Separator, then the row, leave room for the tail
+    int nRoom = (int)sizeof(m_buf) - m_pos - m_tailLen - 1;
+    if( m_frameItems > 0 ) {
+      m_buf[m_pos] = ',';
+      nRoom--;
+    }
+    if( nRoom > 0 ) {
+      va_start(args, fmt);
+      nLen = vsnprintf(m_buf + m_pos + (m_frameItems > 0 ? 1 : 0), nRoom + 1, fmt, args);
+      va_end(args);
+      if( nLen >= 0 && nLen <= nRoom ) {
+        m_pos += nLen + (m_frameItems > 0 ? 1 : 0);
+        m_frameItems++;
+        m_items++;
+        return true;
+      }
+    }
+    // Doesn't fit, roll back and start a new frame
+    m_buf[m_pos] = '\0';
+    if( m_frameItems == 0 ) break;
+    Flush();
+  }
+  m_dropped++;
+  return false;
+}
+
+UC JsonWriterClass::End()
+{
+  if( m_sink == JSW_SINK_SERIAL ) {
+    SERIAL_LN("%s", m_tail);
+  } else if( !m_stopped && (m_frameItems > 0 || m_frames == 0) ) {
+    // An empty table still answers with one frame
+    Flush();
+  }
+  SampleHeap();
+  return m_frames;
+}
+
+void JsonWriterClass::ShowStatistics()
+{
+  SERIAL_LN("  %d items, %d frames, %lu bytes, %d dropped%s; free memory %lu, lowest %lu\n\r",
+      m_items, m_frames, m_bytes, m_dropped, (m_stopped ? " (queue full)" : ""), m_heapStart, m_heapMin);
+}
+
+//------------------------------------------------------------------
+// Internal functions
+//------------------------------------------------------------------
+BOOL JsonWriterClass::Flush()
+{
+  strcpy(m_buf + m_pos, m_tail);
+  m_pos += m_tailLen;
+  SampleHeap();
+  // A full queue would evict the oldest frames of this same dump
+  BOOL rc = (!theCloudQue.IsFull() && theCloudQue.AddPublishMsg(m_msgType, m_buf, m_pos, m_nid));
+  if( rc ) {
+    m_frames++;
+    m_bytes += m_pos;
+  } else {
+    LOGW(LOGTAG_MSG, "JSON dump stopped after %d frames, queue full: %s", m_frames, m_head);
+    m_dropped += m_frameItems;
+    m_stopped = true;
+  }
+
+  strcpy(m_buf, m_head);
+  m_pos = m_headLen;
+  m_frameItems = 0;
+  return rc;
+}
+
+void JsonWriterClass::SampleHeap()
+{
+  UL lv_free = System.freeMemory();
+  if( lv_free < m_heapMin ) m_heapMin = lv_free;
+}
@@ -0,0 +1,62 @@
+//  xlxJsonWriter.h - Xlight streaming JSON writer for table dumps
+
+#ifndef xlxJsonWriter_h
+#define xlxJsonWriter_h
+
+#include "xliCommon.h"
+#include "xlxPublishQueue.h"
+
+// Where the frames go
+#define JSW_SINK_SERIAL         0           // Head, one line per item, tail
+#define JSW_SINK_CLOUD          1           // Publish frames of up to PUBQ_MSG_SIZE
+
+#define JSW_HEAD_SIZE           48
+#define JSW_TAIL_SIZE           8
+
+//------------------------------------------------------------------
+// Xlight JSON Writer Class
+// Serialises an array row by row into one fixed buffer, no heap. To the
+// cloud, a row that does not fit closes the frame, and the next frame
+// starts with the same head, so each frame is a valid message:
+//   {'nlist':48,'nids':[1,2,..,30]} {'nlist':48,'nids':[31,..,48]}
+// A frame never evicts queued ones, the writer stops when the queue is full
+//------------------------------------------------------------------
+class JsonWriterClass
+{
+public:
+  JsonWriterClass(UC sink, UC msgType = CLT_ID_DeviceConfig, UC nid = 0xFF);
+
+  // Open the array, e.g. head "{'nlist':48,'nids':[", tail "]}"
+  void Begin(const char *head, const char *tail = "]}");
+  // Append one element, false if dropped
+  BOOL Add(const char *fmt, ...);
+  // Close the last frame, return the number of frames
+  UC End();
+  void ShowStatistics();
+
+  UC m_frames;
+  US m_items;
+  US m_dropped;                     // Rows too large or frames the queue refused
+  BOOL m_stopped;                   // Queue was full, the rest is dropped
+  UL m_bytes;
+  UL m_heapStart;                   // Free memory at Begin()
+  UL m_heapMin;                     // Lowest free memory seen while writing
+
+protected:
+  BOOL Flush();
+  void SampleHeap();
+
+private:
+  UC m_sink;
+  UC m_msgType;
+  UC m_nid;
+  char m_head[JSW_HEAD_SIZE];
+  char m_tail[JSW_TAIL_SIZE];
+  US m_headLen;
+  US m_tailLen;
+  US m_pos;
+  US m_frameItems;
+  char m_buf[PUBQ_MSG_SIZE];
+};
+
+#endif /* xlxJsonWriter_h */
@@ -0,0 +1,145 @@
+/**
+ * xlxLiveness.cpp - Xlight node liveness tracker based on a timer wheel
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Keepalive deadline of each node is RTE_TM_KEEP_ALIVE seconds after
+ *    the last frame received from it
+ * 2. Wheel of LVN_WHEEL_SLOTS one-second slots, the cursor moves one slot
+ *    per Tick() and the nodes in that slot are expired
+ * 3. Time is counted in ticks, not millis(), so neither clock sync nor
+ *    millis() overflow affects the deadlines
+ * 4. Remotes are never tracked. Sleepy flags are only known after a
+ *    presentation, so remote IDs are the one thing to go by at boot
+ *
+ * ToDo:
+ * 1.
+**/
+
+#include "xlxLiveness.h"
+#include "xlxLogger.h"
+
+//------------------------------------------------------------------
+// Xlight Node Liveness Class
+//------------------------------------------------------------------
+LivenessClass::LivenessClass()
+{
+  memset(m_head, LVN_NULL, sizeof(m_head));
+  memset(m_next, LVN_NULL, sizeof(m_next));
+  memset(m_prev, LVN_NULL, sizeof(m_prev));
+  memset(m_slot, LVN_NULL, sizeof(m_slot));
+  m_cursor = 0;
+  m_count = 0;
+  m_refreshes = 0;
+  m_expired = 0;
+}
+
+void LivenessClass::Refresh(UC nid)
+{
+  if( nid >= LVN_MAX_NODES || nid == NODEID_GATEWAY ) return;
+  // Remotes only talk on a key press, they have no keepalive
+  if( IS_REMOTE_NODEID(nid) ) return;
+  Unlink(nid);
+  // Expire once silent for more than RTE_TM_KEEP_ALIVE seconds
+  Link(nid, (m_cursor + RTE_TM_KEEP_ALIVE + 1) & LVN_WHEEL_MASK);
+  m_refreshes++;
+}
+
+void LivenessClass::Remove(UC nid)
+{
+  if( nid >= LVN_MAX_NODES ) return;
+  Unlink(nid);
+}
+
+UC LivenessClass::Tick(UC *pExpired, UC nMax)
+{
+  m_cursor = (m_cursor + 1) & LVN_WHEEL_MASK;
+
+  UC lv_num = 0;
+  UC nid;
+  while( (nid = m_head[m_cursor]) != LVN_NULL ) {
+    Unlink(nid);
+    if( pExpired && lv_num < nMax ) {
+      pExpired[lv_num++] = nid;
+      m_expired++;
+    } else {
+      // No room, report it on the next tick
+      Link(nid, (m_cursor + 1) & LVN_WHEEL_MASK);
+    }
+  }
+  return lv_num;
+}
+
+BOOL LivenessClass::IsTracked(UC nid)
+{
+  if( nid >= LVN_MAX_NODES ) return false;
+  return(m_slot[nid] != LVN_NULL);
+}
+
+UC LivenessClass::GetRemaining(UC nid)
+{
+  if( !IsTracked(nid) ) return 0;
+  return((m_slot[nid] - m_cursor) & LVN_WHEEL_MASK);
+}
+
+UC LivenessClass::GetCount()
+{
+  return m_count;
+}
+
+void LivenessClass::ShowWheel()
+{
+  SERIAL_LN("** Node Liveness: %d nodes tracked, keepalive %ds **", m_count, RTE_TM_KEEP_ALIVE);
+  UC nid;
+  for( UC i = 1; i <= LVN_WHEEL_MASK; i++ ) {
+    nid = m_head[(m_cursor + i) & LVN_WHEEL_MASK];
+    while( nid != LVN_NULL ) {
+      SERIAL_LN("  nd:%d expires in %ds", nid, i);
+      nid = m_next[nid];
+    }
+  }
+  SERIAL_LN("  refreshes:%lu expired:%lu\n\r", m_refreshes, m_expired);
+}
+
+//------------------------------------------------------------------
+// Internal functions
+//------------------------------------------------------------------
+void LivenessClass::Link(UC nid, UC slot)
+{
+  m_slot[nid] = slot;
+  m_prev[nid] = LVN_NULL;
+  m_next[nid] = m_head[slot];
+  if( m_head[slot] != LVN_NULL ) m_prev[m_head[slot]] = nid;
+  m_head[slot] = nid;
+  m_count++;
+}
+
+void LivenessClass::Unlink(UC nid)
+{
+  UC slot = m_slot[nid];
+  if( slot == LVN_NULL ) return;
+  if( m_prev[nid] != LVN_NULL ) {
+    m_next[m_prev[nid]] = m_next[nid];
+  } else {
+    m_head[slot] = m_next[nid];
+  }
+  if( m_next[nid] != LVN_NULL ) m_prev[m_next[nid]] = m_prev[nid];
+  m_next[nid] = m_prev[nid] = LVN_NULL;
+  m_slot[nid] = LVN_NULL;
+  m_count--;
+}
@@ -0,0 +1,58 @@
+//  xlxLiveness.h - Xlight node liveness tracker based on a timer wheel
+
+#ifndef xlxLiveness_h
+#define xlxLiveness_h
+
+#include "xliCommon.h"
+
+// One slot per second, must cover RTE_TM_KEEP_ALIVE plus some tick lag
+#define LVN_WHEEL_SLOTS         64
+#define LVN_WHEEL_MASK          (LVN_WHEEL_SLOTS - 1)
+#define LVN_MAX_NODES           NODEID_DUMMY
+#define LVN_NULL                0xFF
+
+#if RTE_TM_KEEP_ALIVE + 2 >= LVN_WHEEL_SLOTS
+#error "LVN_WHEEL_SLOTS must be larger than RTE_TM_KEEP_ALIVE"
+#endif
+
+//------------------------------------------------------------------
+// Xlight Node Liveness Class
+// Every tracked node sits in the slot of its keepalive deadline, in a
+// doubly linked list threaded through per-nid arrays. Refresh() moves a
+// node to a new slot and Tick() only looks at the slot due, so both are
+// O(1) regardless of the number of nodes.
+//------------------------------------------------------------------
+class LivenessClass
+{
+public:
+  LivenessClass();
+
+  // Any frame received from the node, (re)arm its deadline
+  void Refresh(UC nid);
+  void Remove(UC nid);
+  // Call once per second, return the nodes whose deadline passed.
+  // They are no longer tracked until the next Refresh().
+  UC Tick(UC *pExpired, UC nMax);
+
+  BOOL IsTracked(UC nid);
+  UC GetRemaining(UC nid);          // Seconds to deadline, 0 if not tracked
+  UC GetCount();
+  void ShowWheel();
+
+  UL m_refreshes;
+  UL m_expired;
+
+protected:
+  void Link(UC nid, UC slot);
+  void Unlink(UC nid);
+
+private:
+  UC m_head[LVN_WHEEL_SLOTS];
+  UC m_next[LVN_MAX_NODES];
+  UC m_prev[LVN_MAX_NODES];
+  UC m_slot[LVN_MAX_NODES];         // LVN_NULL if not tracked
+  UC m_cursor;                      // Slot of the current second
+  UC m_count;
+};
+
+#endif /* xlxLiveness_h */
@@ -0,0 +1,324 @@
+/**
+ * xlxOfflineStore.cpp - Xlight offline data store and cloud back-fill
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. While Wi-Fi is enabled but the cloud is unreachable, sensor changes
+ *    and node presence are appended as 16-byte records to MEM_OFFLINE_DATA
+ * 2. Ring of erase sectors, a sector is erased when the head enters it,
+ *    dropping its oldest records if not uploaded yet. Sectors are the whole
+ *    pages of the region, so records never sit on a page that is shared
+ *    with the neighbour region
+ * 3. Records go through the region cache and are programmed by
+ *    FlushFlash() in SaveConfig(), i.e. within 30 seconds
+ * 4. Uploaded records get their flags byte programmed to 0, no erase, so
+ *    Init() finds head and tail after reboot by binary search:
+ *    in ring order, uploaded records come first, then pending, then free
+ * 5. Back-fill, oldest first, after OFS_BACKFILL_DELAY from reconnect,
+ *    one batch per OFS_BACKFILL_INTERVAL and only while the publish queue
+ *    is empty, so live messages always go first:
+ *    {'bf':<left>,'sq':<seq of first>,'d':[[ts,nd,'DHTt',23.50],[ts,nd,'up',0]]}
+ *
+ * ToDo:
+ * 1.
+**/
+
+#include <stddef.h>
+#include "xlxOfflineStore.h"
+#include "xlxConfig.h"
+#include "xlxLogger.h"
+#include "xlxPublishQueue.h"
+#include "xlxTelemetry.h"
+
+#define OFS_FIND_FREE           0
+#define OFS_FIND_PENDING        1
+
+// the one and only instance of OfflineStoreClass
+OfflineStoreClass theOfflineStore;
+
+//------------------------------------------------------------------
+// Xlight Offline Store Class
+//------------------------------------------------------------------
+OfflineStoreClass::OfflineStoreClass()
+{
+  m_ready = false;
+  m_connected = false;
+  m_sectors = 0;
+  m_recsPerSector = 0;
+  m_maxRecords = 0;
+  m_head = 0;
+  m_tail = 0;
+  m_pending = 0;
+  m_seq = 1;
+  m_lastBackfill = 0;
+  m_stored = 0;
+  m_uploaded = 0;
+  m_dropped = 0;
+  m_batches = 0;
+}
+
+BOOL OfflineStoreClass::Init()
+{
+  FlashRegionClass *pFlash = theConfig.getFlash(FLR_OFFLINE_DATA);
+  if( pFlash ) {
+    m_sectors = (UC)pFlash->pageCount();
+    m_recsPerSector = pFlash->pageSize() / sizeof(ofs_record_t);
+    m_maxRecords = m_sectors * m_recsPerSector;
+  }
+  m_ready = (pFlash != NULL && m_sectors >= 2 && m_recsPerSector > 0);
+  if( !m_ready ) {
+    LOGW(LOGTAG_MSG, "Offline store not available");
+    return false;
+  }
+
+  // Sectors whose first record is the newest and the oldest
+  ofs_record_t lv_rec;
+  UL lv_newSeq = 0, lv_oldSeq = OFS_SEQ_FREE;
+  UC lv_new = m_sectors, lv_old = m_sectors;
+  for( UC s = 0; s < m_sectors; s++ ) {
+    if( !ReadRecord(s * m_recsPerSector, lv_rec) || lv_rec.seq == OFS_SEQ_FREE ) continue;
+    if( lv_new == m_sectors || lv_rec.seq > lv_newSeq ) {
+      lv_new = s;
+      lv_newSeq = lv_rec.seq;
+    }
+    if( lv_rec.seq < lv_oldSeq ) {
+      lv_old = s;
+      lv_oldSeq = lv_rec.seq;
+    }
+  }
+  if( lv_new == m_sectors ) {
+    m_head = m_tail = 0;
+    m_pending = 0;
+    m_seq = 1;
+    return true;
+  }
+
+  US lv_start = lv_new * m_recsPerSector;
+  US lv_used = FindFirst(lv_start, m_recsPerSector, OFS_FIND_FREE);
+  ReadRecord(lv_start + lv_used - 1, lv_rec);
+  m_seq = lv_rec.seq + 1;
+  m_head = (lv_start + lv_used) % m_maxRecords;
+
+  US lv_oldest = lv_old * m_recsPerSector;
+  US lv_count = (m_head + m_maxRecords - lv_oldest) % m_maxRecords;
+  if( lv_count == 0 ) lv_count = m_maxRecords;
+  US lv_done = FindFirst(lv_oldest, lv_count, OFS_FIND_PENDING);
+  m_tail = (lv_oldest + lv_done) % m_maxRecords;
+  m_pending = lv_count - lv_done;
+  if( m_pending > 0 ) {
+    LOGN(LOGTAG_MSG, "Offline store: %d records to back-fill", m_pending);
+  }
+  return true;
+}
+
+// Cloud expected but not there
+BOOL OfflineStoreClass::IsOffline()
+{
+  return( !theConfig.GetDisableWiFi() && !Particle.connected() );
+}
+
+BOOL OfflineStoreClass::AddSensor(UC nid, UC sensor, float value)
+{
+  ofs_record_t lv_rec;
+  lv_rec.type = OFS_REC_SENSOR;
+  lv_rec.nid = nid;
+  lv_rec.sensor = sensor;
+  lv_rec.value = value;
+  return Append(lv_rec);
+}
+
+BOOL OfflineStoreClass::AddPresence(UC nid, BOOL up)
+{
+  ofs_record_t lv_rec;
+  lv_rec.type = OFS_REC_PRESENCE;
+  lv_rec.nid = nid;
+  lv_rec.sensor = 0;
+  lv_rec.value = (up ? 1 : 0);
+  return Append(lv_rec);
+}
+
+// Call it in SelfCheck
+void OfflineStoreClass::Process()
+{
+  if( !m_ready ) return;
+  if( theConfig.GetDisableWiFi() || !Particle.connected() ) {
+    m_connected = false;
+    return;
+  }
+  if( !m_connected ) {
+    // Let the status snapshot and queued messages go first
+    m_connected = true;
+    m_lastBackfill = millis() + OFS_BACKFILL_DELAY - OFS_BACKFILL_INTERVAL;
+  }
+  if( m_pending == 0 ) return;
+  if( theCloudQue.GetPending() > 0 ) return;
+  if( (long)(millis() - m_lastBackfill) < OFS_BACKFILL_INTERVAL ) return;
+
+  m_lastBackfill = millis();
+  BackfillBatch();
+}
+
+void OfflineStoreClass::Clear()
+{
+  FlashRegionClass *pFlash = theConfig.getFlash(FLR_OFFLINE_DATA);
+  if( !m_ready ) return;
+  for( UC s = 0; s < m_sectors; s++ ) {
+    pFlash->erasePage(pFlash->PageOffset(s));
+  }
+  m_dropped += m_pending;
+  m_head = m_tail = 0;
+  m_pending = 0;
+  m_seq = 1;
+}
+
+void OfflineStoreClass::ShowStatus()
+{
+  SERIAL_LN("** Offline Store: %s, %d of %d records pending **", (m_ready ? "ready" : "not available"),
+      m_pending, m_maxRecords);
+  SERIAL_LN("  head:%d tail:%d next seq:%lu, %d sectors of %d records", m_head, m_tail, m_seq, m_sectors, m_recsPerSector);
+  SERIAL_LN("  stored:%lu uploaded:%lu dropped:%lu batches:%lu\n\r", m_stored, m_uploaded, m_dropped, m_batches);
+}
+
+//------------------------------------------------------------------
+// Internal functions
+//------------------------------------------------------------------
+BOOL OfflineStoreClass::Append(ofs_record_t &_rec)
+{
+  if( !m_ready ) return false;
+  FlashRegionClass *pFlash = theConfig.getFlash(FLR_OFFLINE_DATA);
+
+  if( m_head % m_recsPerSector == 0 ) {
+    // Entering a sector, its records are the oldest ones
+    if( m_pending > 0 && m_tail / m_recsPerSector == m_head / m_recsPerSector ) {
+      US lv_lost = m_recsPerSector - m_tail % m_recsPerSector;
+      if( lv_lost > m_pending ) lv_lost = m_pending;
+      m_pending -= lv_lost;
+      m_dropped += lv_lost;
+      m_tail = (m_tail + lv_lost) % m_maxRecords;
+    }
+    if( !pFlash->erasePage(RecordAddress(m_head)) ) return false;
+  }
+
+  _rec.seq = m_seq;
+  _rec.ts = Time.now();
+  _rec.flags = OFS_FLAG_PENDING;
+  if( !pFlash->write<ofs_record_t>(_rec, RecordAddress(m_head)) ) return false;
+
+  if( m_pending == 0 ) m_tail = m_head;
+  m_pending++;
+  m_seq++;
+  m_stored++;
+  m_head = (m_head + 1) % m_maxRecords;
+  return true;
+}
+
+// Region address of a ring slot, records do not span sectors
+UL OfflineStoreClass::RecordAddress(US pos)
+{
+  FlashRegionClass *pFlash = theConfig.getFlash(FLR_OFFLINE_DATA);
+  pos %= m_maxRecords;
+  return pFlash->PageOffset(pos / m_recsPerSector) + (UL)(pos % m_recsPerSector) * sizeof(ofs_record_t);
+}
+
+BOOL OfflineStoreClass::ReadRecord(US pos, ofs_record_t &_rec)
+{
+  FlashRegionClass *pFlash = theConfig.getFlash(FLR_OFFLINE_DATA);
+  return pFlash->read<ofs_record_t>(_rec, RecordAddress(pos));
+}
+
+// Offset of the first record from 'from' (in ring order) that is free,
+// or with OFS_FIND_PENDING, not uploaded yet. Return count if none.
+US OfflineStoreClass::FindFirst(US from, US count, BOOL bPending)
+{
+  ofs_record_t lv_rec;
+  US lo = 0, hi = count, mid;
+  BOOL bMatch;
+  while( lo < hi ) {
+    mid = lo + (hi - lo) / 2;
+    bMatch = false;
+    if( ReadRecord(from + mid, lv_rec) ) {
+      bMatch = (lv_rec.seq == OFS_SEQ_FREE || (bPending && lv_rec.flags != OFS_FLAG_UPLOADED));
+    }
+    if( bMatch ) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+BOOL OfflineStoreClass::BackfillBatch()
+{
+  FlashRegionClass *pFlash = theConfig.getFlash(FLR_OFFLINE_DATA);
+  char strItems[PUBQ_MSG_SIZE];
+  char strItem[48];
+  char buf[PUBQ_MSG_SIZE];
+  US lv_pos[OFS_BATCH_RECORDS];
+  UC lv_num = 0;
+  US lv_advance = 0, pos;
+  UL lv_firstSeq = 0;
+  UC lv_flag;
+  int nPos = 0, nLen;
+  ofs_record_t lv_rec;
+
+  while( lv_num < OFS_BATCH_RECORDS && lv_advance < m_pending ) {
+    pos = (m_tail + lv_advance) % m_maxRecords;
+    if( !ReadRecord(pos, lv_rec) || lv_rec.seq == OFS_SEQ_FREE || lv_rec.flags != OFS_FLAG_PENDING ) {
+      // Torn or lost, skip it for good so the uploaded part stays in front
+      lv_flag = OFS_FLAG_UPLOADED;
+      pFlash->writePage(&lv_flag, RecordAddress(pos) + offsetof(ofs_record_t, flags), 1);
+      m_dropped++;
+      lv_advance++;
+      continue;
+    }
+    if( lv_rec.type == OFS_REC_PRESENCE ) {
+      nLen = snprintf(strItem, sizeof(strItem), "%s[%lu,%d,'up',%d]", (lv_num > 0 ? "," : ""),
+          lv_rec.ts, lv_rec.nid, (int)lv_rec.value);
+    } else if( lv_rec.value == (long)lv_rec.value ) {
+      nLen = snprintf(strItem, sizeof(strItem), "%s[%lu,%d,'%s',%ld]", (lv_num > 0 ? "," : ""),
+          lv_rec.ts, lv_rec.nid, GetSensorKey(lv_rec.sensor), (long)lv_rec.value);
+    } else {
+      nLen = snprintf(strItem, sizeof(strItem), "%s[%lu,%d,'%s',%.2f]", (lv_num > 0 ? "," : ""),
+          lv_rec.ts, lv_rec.nid, GetSensorKey(lv_rec.sensor), lv_rec.value);
+    }
+    // Leave room for the head and "]}"
+    if( nPos + nLen + 40 >= (int)sizeof(buf) ) break;
+    strcpy(strItems + nPos, strItem);
+    nPos += nLen;
+    if( lv_num == 0 ) lv_firstSeq = lv_rec.seq;
+    lv_pos[lv_num++] = pos;
+    lv_advance++;
+  }
+
+  if( lv_num > 0 ) {
+    strItems[nPos] = '\0';
+    nLen = snprintf(buf, sizeof(buf), "{'bf':%d,'sq':%lu,'d':[%s]}", m_pending - lv_advance, lv_firstSeq, strItems);
+    if( !theCloudQue.AddPublishMsg(CLT_ID_SensorData, buf, nLen) ) return false;
+
+    lv_flag = OFS_FLAG_UPLOADED;
+    for( UC i = 0; i < lv_num; i++ ) {
+      pFlash->writePage(&lv_flag, RecordAddress(lv_pos[i]) + offsetof(ofs_record_t, flags), 1);
+    }
+    m_uploaded += lv_num;
+    m_batches++;
+  }
+  m_tail = (m_tail + lv_advance) % m_maxRecords;
+  m_pending -= lv_advance;
+  return true;
+}
@@ -0,0 +1,85 @@
+//  xlxOfflineStore.h - Xlight offline data store and cloud back-fill
+
+#ifndef xlxOfflineStore_h
+#define xlxOfflineStore_h
+
+#include "xliCommon.h"
+#include "xliMemoryMap.h"
+
+// Ring of erase sectors in MEM_OFFLINE_DATA. A sector is one page of the
+// flash region, its size is taken from the device (4094 bytes with wear
+// levelling), so the geometry is known after Init()
+
+// Record types
+#define OFS_REC_SENSOR          1           // sensor: sensors_t, value: reading
+#define OFS_REC_PRESENCE        2           // value: 1 up, 0 down
+
+#define OFS_SEQ_FREE            0xFFFFFFFF
+#define OFS_FLAG_PENDING        0xFF
+#define OFS_FLAG_UPLOADED       0x00
+
+// Back-fill: wait after reconnect, then one batch per interval while the
+// publish queue is idle, in ms
+#define OFS_BACKFILL_DELAY      10000
+#define OFS_BACKFILL_INTERVAL   5000
+#define OFS_BATCH_RECORDS       8
+
+typedef struct
+{
+  UL seq;                           // OFS_SEQ_FREE if the slot was never written
+  UL ts;                            // Time.now()
+  UC type;                          // OFS_REC_*
+  UC nid;
+  UC sensor;
+  UC flags;                         // Programmed to OFS_FLAG_UPLOADED, no erase needed
+  float value;
+} ofs_record_t;
+
+//------------------------------------------------------------------
+// Xlight Offline Store Class
+//------------------------------------------------------------------
+class OfflineStoreClass
+{
+public:
+  OfflineStoreClass();
+
+  // Find head and tail after reboot
+  BOOL Init();
+  BOOL IsOffline();
+  BOOL AddSensor(UC nid, UC sensor, float value);
+  BOOL AddPresence(UC nid, BOOL up);
+  void Process();
+  void Clear();
+  void ShowStatus();
+
+  US m_pending;                     // Records waiting for back-fill
+  UL m_seq;                         // Sequence of the next record
+  UL m_stored;
+  UL m_uploaded;
+  UL m_dropped;                     // Overwritten or unreadable before upload
+  UL m_batches;
+
+protected:
+  BOOL Append(ofs_record_t &_rec);
+  UL RecordAddress(US pos);
+  BOOL ReadRecord(US pos, ofs_record_t &_rec);
+  US FindFirst(US from, US count, BOOL bPending);
+  BOOL BackfillBatch();
+
+private:
+  BOOL m_ready;
+  BOOL m_connected;
+  UC m_sectors;
+  US m_recsPerSector;
+  US m_maxRecords;
+  US m_head;                        // Next slot to write
+  US m_tail;                        // Oldest pending record
+  UL m_lastBackfill;
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern OfflineStoreClass theOfflineStore;
+
+#endif /* xlxOfflineStore_h */
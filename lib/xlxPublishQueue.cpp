@@ -0,0 +1,275 @@
+/**
+ * xlxPublishQueue.cpp - Xlight cloud publish queue
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Fixed number of message slots, no heap allocation
+ * 2. Priority by topic, alarms go first, FIFO within the same priority
+ * 3. One token bucket for the Particle cloud limit, plus one per topic
+ * 4. State-like topics (bNeedReplace) overwrite the pending message
+ *    of the same (type, nid) instead of queuing another one
+ * 5. When full, the oldest message of the lowest priority is dropped
+ *
+ * Notes:
+ * Do not call LOGx() here, logs above LEVEL_NOTICE are published
+ * through this queue.
+ *
+**/
+
+#include "xlxPublishQueue.h"
+#include "xlxConfig.h"
+
+#define PUBQ_SLOT_FREE          0xFF
+
+// the one and only instance of PublishQueueClass
+PublishQueueClass theCloudQue;
+
+// Topic attributes, indexed by CLT_ID_*
+typedef struct
+{
+  const char *name;
+  int ttl;
+  UC priority;
+  US rate;                          // Milliseconds per token
+  UC burst;
+} pubq_topic_t;
+
+const pubq_topic_t pubqTopics[CLT_ID_MAX] = {
+  // Name                 TTL                   Priority          Rate    Burst
+  {CLT_NAME_LOGMSG,       CLT_TTL_LOGMSG,       PUBQ_PRI_LOG,     10000,  2},
+  {CLT_NAME_SensorData,   CLT_TTL_SensorData,   PUBQ_PRI_SENSOR,  3000,   2},
+  {CLT_NAME_DeviceStatus, CLT_TTL_DeviceStatus, PUBQ_PRI_STATUS,  1000,   4},
+  {CLT_NAME_DeviceConfig, CLT_TTL_DeviceConfig, PUBQ_PRI_CONFIG,  2000,   2},
+  {CLT_NAME_Alarm,        CLT_TTL_Alarm,        PUBQ_PRI_ALARM,   1000,   4},
+  {CLT_NAME_ACTION,       CLT_TTL_ACTION,       PUBQ_PRI_ACTION,  1000,   2}
+};
+
+char strTopicNames[][7] = {"log", "sensor", "status", "config", "alarm", "action"};
+
+//------------------------------------------------------------------
+// Xlight Publish Queue Class
+//------------------------------------------------------------------
+PublishQueueClass::PublishQueueClass()
+{
+  UL now = millis();
+  for( UC i = 0; i < MQ_MAX_PUBLISH_MSG; i++ ) {
+    m_items[i].type = PUBQ_SLOT_FREE;
+  }
+  m_global.burst = PUBQ_CLOUD_BURST;
+  m_global.tokens = PUBQ_CLOUD_BURST;
+  m_global.rate = PUBQ_CLOUD_RATE_MS;
+  m_global.lastRefill = now;
+  for( UC i = 0; i < CLT_ID_MAX; i++ ) {
+    m_topic[i].burst = pubqTopics[i].burst;
+    m_topic[i].tokens = pubqTopics[i].burst;
+    m_topic[i].rate = pubqTopics[i].rate;
+    m_topic[i].lastRefill = now;
+  }
+  memset(m_stat, 0x00, sizeof(m_stat));
+  m_seq = 0;
+  m_pending = 0;
+}
+
+// Add message into queue
+/// Return false if the message was dropped
+BOOL PublishQueueClass::AddPublishMsg(UC msgType, const char *msg, US len, UC nid, UC bNeedReplace)
+{
+  if( msgType >= CLT_ID_MAX || !msg ) return false;
+  if( len >= PUBQ_MSG_SIZE ) len = PUBQ_MSG_SIZE - 1;
+
+  m_stat[msgType].added++;
+  int pos = -1;
+  if( bNeedReplace ) {
+    pos = FindReplace(msgType, nid);
+    if( pos >= 0 ) {
+      // Keep the queue position, only the latest state matters
+      m_stat[msgType].replaced++;
+      memcpy(m_items[pos].data, msg, len);
+      m_items[pos].data[len] = '\0';
+      m_items[pos].len = len;
+      return true;
+    }
+  }
+
+  pos = FindFree();
+  if( pos < 0 ) {
+    pos = FindVictim(pubqTopics[msgType].priority);
+    if( pos < 0 ) {
+      m_stat[msgType].dropped++;
+      return false;
+    }
+    m_stat[m_items[pos].type].dropped++;
+    m_pending--;
+  }
+
+  m_items[pos].type = msgType;
+  m_items[pos].nid = nid;
+  m_items[pos].len = len;
+  m_items[pos].seq = m_seq++;
+  memcpy(m_items[pos].data, msg, len);
+  m_items[pos].data[len] = '\0';
+  m_pending++;
+  return true;
+}
+
+// Publish at most one message per call
+/// Return true if a message was published
+BOOL PublishQueueClass::ProcessPublishMsg()
+{
+  if( m_pending == 0 ) return false;
+  if( theConfig.GetDisableWiFi() || !Particle.connected() ) return false;
+
+  UL now = millis();
+  RefillBucket(&m_global, now);
+  if( m_global.tokens == 0 ) return false;
+  for( UC i = 0; i < CLT_ID_MAX; i++ ) {
+    RefillBucket(&m_topic[i], now);
+  }
+
+  int pos = FindNext();
+  if( pos < 0 ) return false;
+
+  pubq_item_t *pItem = &m_items[pos];
+  const pubq_topic_t *pTopic = &pubqTopics[pItem->type];
+  // Tokens are consumed even on failure, the cloud counts the attempt
+  m_global.tokens--;
+  m_topic[pItem->type].tokens--;
+  if( Particle.publish(pTopic->name, pItem->data, pTopic->ttl, PRIVATE) ) {
+    m_stat[pItem->type].sent++;
+    pItem->type = PUBQ_SLOT_FREE;
+    m_pending--;
+    return true;
+  }
+
+  // Leave it in queue and retry later
+  m_stat[pItem->type].failed++;
+  return false;
+}
+
+UC PublishQueueClass::GetPending()
+{
+  return m_pending;
+}
+
+// No free slot, the next message would evict a queued one
+BOOL PublishQueueClass::IsFull()
+{
+  return(m_pending >= MQ_MAX_PUBLISH_MSG);
+}
+
+// Whether a message of (type, nid) is still waiting to be published
+BOOL PublishQueueClass::IsPending(UC msgType, UC nid)
+{
+  return(FindReplace(msgType, nid) >= 0);
+}
+
+void PublishQueueClass::SetTopicRate(UC msgType, US rate, UC burst)
+{
+  if( msgType >= CLT_ID_MAX || burst == 0 ) return;
+  m_topic[msgType].rate = rate;
+  m_topic[msgType].burst = burst;
+  if( m_topic[msgType].tokens > burst ) m_topic[msgType].tokens = burst;
+}
+
+const pubq_stat_t *PublishQueueClass::GetStatistics(UC msgType)
+{
+  if( msgType >= CLT_ID_MAX ) return NULL;
+  return &m_stat[msgType];
+}
+
+void PublishQueueClass::ShowStatistics()
+{
+  SERIAL_LN("** Publish Queue: %d of %d pending, cloud tokens %d **", m_pending, MQ_MAX_PUBLISH_MSG, m_global.tokens);
+  SERIAL_LN("  topic\tadded\tsent\treplaced\tdropped\tfailed\ttokens");
+  for( UC i = 0; i < CLT_ID_MAX; i++ ) {
+    SERIAL_LN("  %s\t%lu\t%lu\t%lu\t\t%lu\t%lu\t%d/%d", strTopicNames[i],
+        m_stat[i].added, m_stat[i].sent, m_stat[i].replaced,
+        m_stat[i].dropped, m_stat[i].failed, m_topic[i].tokens, m_topic[i].burst);
+  }
+  SERIAL_LN("");
+}
+
+//------------------------------------------------------------------
+// Internal functions
+//------------------------------------------------------------------
+void PublishQueueClass::RefillBucket(pubq_bucket_t *pBucket, UL now)
+{
+  if( pBucket->tokens >= pBucket->burst || pBucket->rate == 0 ) {
+    pBucket->tokens = pBucket->burst;
+    pBucket->lastRefill = now;
+    return;
+  }
+
+  UL elapsed = now - pBucket->lastRefill;
+  UL newTokens = elapsed / pBucket->rate;
+  if( newTokens > 0 ) {
+    newTokens += pBucket->tokens;
+    pBucket->tokens = (newTokens > pBucket->burst ? pBucket->burst : newTokens);
+    // Keep the remainder, so the average rate is accurate
+    pBucket->lastRefill += (elapsed / pBucket->rate) * pBucket->rate;
+  }
+}
+
+int PublishQueueClass::FindReplace(UC msgType, UC nid)
+{
+  for( UC i = 0; i < MQ_MAX_PUBLISH_MSG; i++ ) {
+    if( m_items[i].type == msgType && m_items[i].nid == nid ) return i;
+  }
+  return -1;
+}
+
+int PublishQueueClass::FindFree()
+{
+  for( UC i = 0; i < MQ_MAX_PUBLISH_MSG; i++ ) {
+    if( m_items[i].type == PUBQ_SLOT_FREE ) return i;
+  }
+  return -1;
+}
+
+// Oldest message of the lowest priority, which must not be higher than the given one
+int PublishQueueClass::FindVictim(UC priority)
+{
+  int pos = -1;
+  UC lowest = priority;
+  for( UC i = 0; i < MQ_MAX_PUBLISH_MSG; i++ ) {
+    if( m_items[i].type == PUBQ_SLOT_FREE ) continue;
+    UC pri = pubqTopics[m_items[i].type].priority;
+    if( pri > lowest || (pri == lowest && (pos < 0 || m_items[i].seq < m_items[pos].seq)) ) {
+      lowest = pri;
+      pos = i;
+    }
+  }
+  return pos;
+}
+
+// Oldest message of the highest priority whose topic has a token
+int PublishQueueClass::FindNext()
+{
+  int pos = -1;
+  UC highest = PUBQ_PRI_DUMMY;
+  for( UC i = 0; i < MQ_MAX_PUBLISH_MSG; i++ ) {
+    if( m_items[i].type == PUBQ_SLOT_FREE ) continue;
+    if( m_topic[m_items[i].type].tokens == 0 ) continue;
+    UC pri = pubqTopics[m_items[i].type].priority;
+    if( pri < highest || (pri == highest && m_items[i].seq < m_items[pos].seq) ) {
+      highest = pri;
+      pos = i;
+    }
+  }
+  return pos;
+}
@@ -0,0 +1,119 @@
+//  xlxPublishQueue.h - Xlight cloud publish queue with priority and rate shaping
+
+#ifndef xlxPublishQueue_h
+#define xlxPublishQueue_h
+
+#include "xliCommon.h"
+
+// Publish message types (topics)
+#define CLT_ID_LOGMSG           0
+#define CLT_ID_SensorData       1
+#define CLT_ID_DeviceStatus     2
+#define CLT_ID_DeviceConfig     3
+#define CLT_ID_Alarm            4
+#define CLT_ID_ACTION           5
+#define CLT_ID_MAX              6
+
+// Cloud event names. Notes: event name max length is 63 characters.
+#define CLT_NAME_LOGMSG         "xlc-event-log"
+#define CLT_NAME_SensorData     "xlc-data-sensor"
+#define CLT_NAME_DeviceStatus   "xlc-status-device"
+#define CLT_NAME_DeviceConfig   "xlc-config-device"
+#define CLT_NAME_Alarm          "xlc-event-alarm"
+#define CLT_NAME_ACTION         "xlc-event-action"
+
+// Cloud event TTL (in seconds)
+#define CLT_TTL_LOGMSG          1800
+#define CLT_TTL_SensorData      60
+#define CLT_TTL_DeviceStatus    1800
+#define CLT_TTL_DeviceConfig    1800
+#define CLT_TTL_Alarm           3600
+#define CLT_TTL_ACTION          600
+
+// Particle cloud allows 1 publish per second with a burst of 4
+#define PUBQ_CLOUD_RATE_MS      1000
+#define PUBQ_CLOUD_BURST        4
+
+// Maximum length of one message, incl. '\0'
+#define PUBQ_MSG_SIZE           256
+
+// Priority, the smaller the higher
+enum {
+  PUBQ_PRI_ALARM = 0,
+  PUBQ_PRI_STATUS,
+  PUBQ_PRI_CONFIG,
+  PUBQ_PRI_ACTION,
+  PUBQ_PRI_SENSOR,
+  PUBQ_PRI_LOG,
+  PUBQ_PRI_DUMMY
+};
+
+// Token bucket of one topic
+typedef struct
+{
+  UC tokens;                        // Available tokens
+  UC burst;                         // Bucket depth
+  US rate;                          // Milliseconds per token
+  UL lastRefill;                    // millis() of last refill
+} pubq_bucket_t;
+
+// Statistics of one topic
+typedef struct
+{
+  UL added;
+  UL sent;
+  UL replaced;
+  UL dropped;
+  UL failed;
+} pubq_stat_t;
+
+// One pending message
+typedef struct
+{
+  UC type;                          // CLT_ID_*, 0xFF means free slot
+  UC nid;
+  US len;
+  UL seq;                           // Enqueue order, FIFO within the same priority
+  char data[PUBQ_MSG_SIZE];
+} pubq_item_t;
+
+//------------------------------------------------------------------
+// Xlight Publish Queue Class
+//------------------------------------------------------------------
+class PublishQueueClass
+{
+public:
+  PublishQueueClass();
+
+  BOOL AddPublishMsg(UC msgType, const char *msg, US len, UC nid = 0xff, UC bNeedReplace = 0);
+  BOOL ProcessPublishMsg();
+
+  UC GetPending();
+  BOOL IsFull();
+  BOOL IsPending(UC msgType, UC nid);
+  void SetTopicRate(UC msgType, US rate, UC burst);
+  const pubq_stat_t *GetStatistics(UC msgType);
+  void ShowStatistics();
+
+protected:
+  void RefillBucket(pubq_bucket_t *pBucket, UL now);
+  int FindReplace(UC msgType, UC nid);
+  int FindFree();
+  int FindVictim(UC priority);
+  int FindNext();
+
+private:
+  pubq_item_t m_items[MQ_MAX_PUBLISH_MSG];
+  pubq_bucket_t m_global;
+  pubq_bucket_t m_topic[CLT_ID_MAX];
+  pubq_stat_t m_stat[CLT_ID_MAX];
+  UL m_seq;
+  UC m_pending;
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern PublishQueueClass theCloudQue;
+
+#endif /* xlxPublishQueue_h */
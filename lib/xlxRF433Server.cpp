@@ -55,14 +55,61 @@ UC *msgData = (UC *)&(msg.msg);
 
 RF433ServerClass::RF433ServerClass()
 	:	MyTransport433()
-	, CDataQueue(MAX_MESSAGE_LENGTH * MQ_MAX_RF_RCVMSG)
+	, CDataQueue(sizeof(rf_rx_frame_t) * MQ_MAX_RF_RCVMSG)
 	, CFastMessageQ(MQ_MAX_RF_SNDMSG, MAX_MESSAGE_LENGTH)
 {
 	_sentID = 0;
-	_ackWaitTick = 0;
+	_txFrames = 0;
+	_txCpuTicks = 0;
+	_txCpuMax = 0;
+	_txAirTime = 0;
+	m_ackPending = NULL;
+	m_ackWaitStart = 0;
+	m_ackRepeat = 0;
+	m_ackNode = 0;
+	m_ackTimeout = ACK_TIMEOUT;
+	m_ackRTT = 0;
+	memset(m_links, 0x00, sizeof(m_links));
+	m_linkCount = 0;
+	memset(m_fragTx, 0x00, sizeof(m_fragTx));
+	memset(m_fragRx, 0x00, sizeof(m_fragRx));
+	m_fragMsgID = 0;
+	_fragTxMsgs = 0;
+	_fragTxFailed = 0;
+	_fragTxFrames = 0;
+	_fragTxRetrans = 0;
+	_fragRxMsgs = 0;
+	_fragRxTimeout = 0;
+	memset(m_sleepy, 0x00, sizeof(m_sleepy));
+	m_wakeNode = 0;
+	_mailStored = 0;
+	_mailDelivered = 0;
+	_mailReplaced = 0;
+	_mailDropped = 0;
+	_worWakeups = 0;
+	memset(m_survey, 0x00, sizeof(m_survey));
+	m_surveyCount = 0;
+	m_surveyMode = RF_SURVEY_OFF;
+	m_surveyNext = 0;
+	m_surveyTime = 0;
+	m_migState = RF_MIG_IDLE;
+	m_migFrom = 0;
+	m_migTo = 0;
+	m_migRetried = false;
+	m_migStart = 0;
+	m_migLast = 0;
+	m_migRetry = 0;
+	memset(m_migAcked, 0x00, sizeof(m_migAcked));
+	memset(m_migPending, 0x00, sizeof(m_migPending));
+	_migDone = 0;
+	_migCancelled = 0;
+	_migReverted = 0;
 	_times = 0;
 	_succ = 0;
 	_received = 0;
+	_rxUnknown = 0;
+	_rxShort = 0;
+	memset(m_rxUnknown, 0x00, sizeof(m_rxUnknown));
 }
 
 bool RF433ServerClass::ServerBegin(uint8_t channel,uint8_t address)
@@ -92,177 +139,236 @@ bool RF433ServerClass::ProcessMQ()
 {
 	ProcessSendMQ();
 	ProcessReceiveMQ();
+	ExpireFragments();
+	ExpireMail();
+	ProcessMigration();
+	SurveyChannel();
 	return true;
 }
-// TODO
+// Split "v1:v2:..." into integers in place, same as toInt() of each substring
+static UC ParseValues(const char *str, int *values, const UC max)
+{
+	UC count = 0;
+	while( str && *str && count < max ) {
+		values[count++] = (int)strtol(str, NULL, 10);
+		str = strchr(str, ':');
+		if( str ) str++;
+	}
+	return count;
+}
+
+// String entry of console and cloud serial commands, parsed into rf_cmd_t
 bool RF433ServerClass::ProcessSend(const UC _node, const UC _msgID, String &strPayl, MyMessage &my_msg, const UC _replyTo, const UC _sensor)
 {
 	bool sentOK = false;
 	bool bMsgReady = false;
-	uint8_t bytValue;
-	int iValue;
-	float fValue;
+	int lv_values[5];
+	UC lv_count;
 	char strBuffer[64];
-	uint8_t payload[MAX_PAYLOAD];
+	rf_cmd_t lv_cmd;
 	MyMessage lv_msg;
-	int nPos;
 
-	switch (_msgID)
-	{
-	case 0: // Free style
-		iValue = min(strPayl.length(), 63);
-		strncpy(strBuffer, strPayl.c_str(), iValue);
-		strBuffer[iValue] = 0;
+	if( _msgID == RF_CMD_SERIAL ) {
+		// Free style
+		lv_count = min(strPayl.length(), 63);
+		strncpy(strBuffer, strPayl.c_str(), lv_count);
+		strBuffer[lv_count] = 0;
 		// Serail format to MySensors message structure
 		bMsgReady = serialMsgParser.parse(lv_msg, strBuffer);
 		if (bMsgReady) {
 			if( _sensor > 0 ) lv_msg.setSensor(_sensor);
 			SERIAL("Now sending message...");
+			SERIAL("to %d...", lv_msg.getDestination());
+			sentOK = ProcessSend(&lv_msg);
+			my_msg = lv_msg;
+			SERIAL_LN(sentOK ? "OK" : "failed");
 		}
+		return sentOK;
+	}
+
+	memset(&lv_cmd, 0x00, sizeof(lv_cmd));
+	lv_cmd.node = _node;
+	lv_cmd.msgID = _msgID;
+	lv_cmd.subID = _sensor;
+	lv_cmd.replyTo = _replyTo;
+	memset(lv_values, 0x00, sizeof(lv_values));
+	lv_count = ParseValues(strPayl.c_str(), lv_values, 5);
+
+	switch (_msgID)
+	{
+	case RF_CMD_NODE_ID:
+		lv_cmd.newID = (UC)lv_values[0];
+		break;
+
+	case RF_CMD_NODE_CONFIG:
+		if( lv_count < 2 ) return false;
+		lv_cmd.config.ncf = (UC)lv_values[0];
+		lv_cmd.config.value = (US)lv_values[1];
 		break;
 
-	case 1:   // Request new node ID
+	case RF_CMD_SET_POWER:
+		lv_cmd.sw = constrain(lv_values[0], DEVICE_SW_OFF, DEVICE_SW_TOGGLE);
+		break;
+
+	case RF_CMD_SET_BR:
+		lv_cmd.br = constrain(lv_values[0], 0, 100);
+		break;
+
+	case RF_CMD_SET_CCT:
+		lv_cmd.cct = constrain(lv_values[0], CT_MIN_VALUE, CT_MAX_VALUE);
+		break;
+
+	case RF_CMD_SET_STATUS:
+		// br:cct or br:W[:R[:G[:B]]]
+		lv_cmd.status.br = 65;
+		lv_cmd.status.cct = 3000;
+		if( lv_count >= 2 ) {
+			lv_cmd.status.br = (UC)lv_values[0];
+			lv_cmd.status.cct = (US)constrain(lv_values[1], 0, CT_MAX_VALUE);
+			lv_cmd.status.R = (UC)lv_values[2];
+			lv_cmd.status.G = (UC)lv_values[3];
+			lv_cmd.status.B = (UC)lv_values[4];
+		}
+		break;
+
+	case RF_CMD_SCENARIO:
+		lv_cmd.scenario = (UC)lv_values[0];
+		break;
+
+	case RF_CMD_EFFECT:
+		lv_cmd.filter = (UC)lv_values[0];
+		break;
+
+	case RF_CMD_BASE_CONFIG:
+		// nid[:channel]
+		lv_cmd.base.nid = (UC)lv_values[0];
+		lv_cmd.base.channel = (lv_count >= 2 ? (UC)lv_values[1] : CC1101_433_CHANNEL);
+		break;
+	}
+
+	return SendCommand(lv_cmd, &my_msg);
+}
+
+// Typed internal command, no String on the way
+bool RF433ServerClass::SendCommand(const rf_cmd_t &cmd, MyMessage *pMsg)
+{
+	bool sentOK = false;
+	bool bMsgReady = false;
+	const UC _node = cmd.node;
+	const UC _replyTo = cmd.replyTo;
+	const UC _sensor = cmd.subID;
+	uint8_t bytValue;
+	US usValue;
+	uint8_t payload[MAX_PAYLOAD];
+	MyMessage lv_msg;
+
+	switch (cmd.msgID)
+	{
+	case RF_CMD_NODE_ID:   // Request new node ID
 		if( _node == GATEWAY_ADDRESS ) {
 			SERIAL_LN("Controller can not request node ID\n\r");
-		} else {
+		} else if( cmd.newID > 0 ) {
 			// Set specific NodeID to node
-			UC newID = 0;
-			if( strPayl.length() > 0 ) {
-				newID = (UC)strPayl.toInt();
-			}
-			if( newID > 0 ) {
-				lv_msg.build(_replyTo, _node, newID, C_INTERNAL, I_ID_RESPONSE, false, false);
-				//lv_msg.set(getMyNetworkID());
-				//theConfig.lstNodes.clearNodeId(_node);
-				SERIAL("Now sending new id:%d to node:%d...", newID, _node);
+			lv_msg.build(_replyTo, _node, cmd.newID, C_INTERNAL, I_ID_RESPONSE, false, false);
+			//lv_msg.set(getMyNetworkID());
+			//theConfig.lstNodes.clearNodeId(_node);
+			SERIAL("Now sending new id:%d to node:%d...", cmd.newID, _node);
+			bMsgReady = true;
+		} else {
+			// Reboot node
+			ListNode<DevStatusRow_t> *DevStatusRowPtr = theSys.SearchDevStatus(_node);
+			if( DevStatusRowPtr ) {
+				lv_msg.build(_replyTo, _node, _sensor, C_INTERNAL, I_REBOOT, false);
+				lv_msg.set((unsigned int)DevStatusRowPtr->data.token);
 				bMsgReady = true;
-			} else {
-				// Reboot node
-				ListNode<DevStatusRow_t> *DevStatusRowPtr = theSys.SearchDevStatus(_node);
-				if( DevStatusRowPtr ) {
-					lv_msg.build(_replyTo, _node, _sensor, C_INTERNAL, I_REBOOT, false);
-					lv_msg.set((unsigned int)DevStatusRowPtr->data.token);
-					bMsgReady = true;
-				}
 			}
 		}
 		break;
 
-	case 2:   // Node Config
-		{
-			nPos = strPayl.indexOf(':');
-			if (nPos > 0) {
-				bytValue = (uint8_t)(strPayl.substring(0, nPos).toInt());
-				iValue = strPayl.substring(nPos + 1).toInt();
-				lv_msg.build(_replyTo, _node, bytValue, C_INTERNAL, I_CONFIG, true);
-				lv_msg.set((unsigned int)iValue);
-				bMsgReady = true;
-				SERIAL("Now sending node:%d config:%d value:%d...", _node, bytValue, iValue);
-			}
-		}
+	case RF_CMD_NODE_CONFIG:   // Node Config
+		lv_msg.build(_replyTo, _node, cmd.config.ncf, C_INTERNAL, I_CONFIG, true);
+		lv_msg.set((unsigned int)cmd.config.value);
+		bMsgReady = true;
+		SERIAL("Now sending node:%d config:%d value:%d...", _node, cmd.config.ncf, cmd.config.value);
 		break;
 
-	case 3:   // Temperature sensor present with sensor id 1, req no ack
+	case RF_CMD_PRESENT_TEMP:   // Temperature sensor present with sensor id 1, req no ack
 		lv_msg.build(_replyTo, _node, _sensor, C_PRESENTATION, S_TEMP, false);
 		lv_msg.set("");
 		bMsgReady = true;
 		SERIAL("Now sending DHT11 present message...");
 		break;
 
-	case 6:   // Get main lamp(ID:1) power(V_STATUS:2) on/off, ack
+	case RF_CMD_GET_POWER:   // Get main lamp(ID:1) power(V_STATUS:2) on/off, ack
 		lv_msg.build(_replyTo, _node, _sensor, C_REQ, V_STATUS, true);
 		bMsgReady = true;
 		SERIAL("Now sending get V_STATUS message...");
 		break;
 
-	case 7:   // Set main lamp(ID:1) power(V_STATUS:2) on/off, ack
+	case RF_CMD_SET_POWER:   // Set main lamp(ID:1) power(V_STATUS:2) on/off, ack
 		lv_msg.build(_replyTo, _node, _sensor, C_SET, V_STATUS, true);
-		bytValue = constrain(strPayl.toInt(), DEVICE_SW_OFF, DEVICE_SW_TOGGLE);
+		bytValue = constrain(cmd.sw, DEVICE_SW_OFF, DEVICE_SW_TOGGLE);
 		lv_msg.set(bytValue);
 		bMsgReady = true;
 		SERIAL("Now sending set V_STATUS %s message...", (bytValue ? "on" : "off"));
 		break;
 
-	case 8:   // Get main lamp(ID:1) dimmer (V_PERCENTAGE:3), ack
+	case RF_CMD_GET_BR:   // Get main lamp(ID:1) dimmer (V_PERCENTAGE:3), ack
 		lv_msg.build(_replyTo, _node, _sensor, C_REQ, V_PERCENTAGE, true);
 		bMsgReady = true;
 		SERIAL("Now sending get V_PERCENTAGE message...");
 		break;
 
-	case 9:   // Set main lamp(ID:1) dimmer (V_PERCENTAGE:3), ack
+	case RF_CMD_SET_BR:   // Set main lamp(ID:1) dimmer (V_PERCENTAGE:3), ack
 		lv_msg.build(_replyTo, _node, _sensor, C_SET, V_PERCENTAGE, true);
-		bytValue = constrain(strPayl.toInt(), 0, 100);
+		bytValue = constrain(cmd.br, 0, 100);
 		lv_msg.set((uint8_t)OPERATOR_SET, bytValue);
 		bMsgReady = true;
 		SERIAL("Now sending set V_PERCENTAGE:%d message...", bytValue);
 		break;
 
-	case 10:  // Get main lamp(ID:1) color temperature (V_LEVEL), ack
+	case RF_CMD_GET_CCT:  // Get main lamp(ID:1) color temperature (V_LEVEL), ack
 		lv_msg.build(_replyTo, _node, _sensor, C_REQ, V_LEVEL, true);
 		bMsgReady = true;
 		SERIAL("Now sending get CCT V_LEVEL message...");
 		break;
 
-	case 11:  // Set main lamp(ID:1) color temperature (V_LEVEL), ack
+	case RF_CMD_SET_CCT:  // Set main lamp(ID:1) color temperature (V_LEVEL), ack
 		lv_msg.build(_replyTo, _node, _sensor, C_SET, V_LEVEL, true);
-		iValue = constrain(strPayl.toInt(), CT_MIN_VALUE, CT_MAX_VALUE);
-		lv_msg.set((uint8_t)OPERATOR_SET, (unsigned int)iValue);
+		usValue = constrain(cmd.cct, CT_MIN_VALUE, CT_MAX_VALUE);
+		lv_msg.set((uint8_t)OPERATOR_SET, (unsigned int)usValue);
 		bMsgReady = true;
-		SERIAL("Now sending set CCT V_LEVEL %d message...", iValue);
+		SERIAL("Now sending set CCT V_LEVEL %d message...", usValue);
 		break;
 
-	case 12:  // Request lamp status in one
+	case RF_CMD_GET_STATUS:  // Request lamp status in one
 		lv_msg.build(_replyTo, _node, _sensor, C_REQ, V_RGBW, true);
 		lv_msg.set((uint8_t)RING_ID_ALL);		// RING_ID_1 is also workable currently
 		bMsgReady = true;
 		SERIAL("Now sending get dev-status (V_RGBW) message...");
 		break;
 
-	case 13:  // Set main lamp(ID:1) status in one, ack
+	case RF_CMD_SET_STATUS:  // Set main lamp(ID:1) status in one, ack
 		lv_msg.build(_replyTo, _node, _sensor, C_SET, V_RGBW, true);
 		payload[0] = RING_ID_ALL;
 		payload[1] = 1;
-		payload[2] = 65;
-		nPos = strPayl.indexOf(':');
-		if (nPos > 0) {
-			// Extract brightness, cct or WRGB
-			bytValue = (uint8_t)(strPayl.substring(0, nPos).toInt());
-			payload[2] = bytValue;
-			iValue = strPayl.substring(nPos + 1).toInt();
-			if( iValue < 256 ) {
-				// WRGB
-				payload[3] = iValue;	// W
-				payload[4] = 0;	// R
-				payload[5] = 0;	// G
-				payload[6] = 0;	// B
-				for( int cindex = 3; cindex < 7; cindex++ ) {
-					strPayl = strPayl.substring(nPos + 1);
-					nPos = strPayl.indexOf(':');
-					if (nPos <= 0) {
-						bytValue = (uint8_t)(strPayl.toInt());
-						payload[cindex] = bytValue;
-						break;
-					}
-					bytValue = (uint8_t)(strPayl.substring(0, nPos).toInt());
-					payload[cindex] = bytValue;
-				}
-				lv_msg.set((void*)payload, 7);
-				SERIAL("Now sending set BR=%d WRGB=(%d,%d,%d,%d)...",
-						payload[2], payload[3], payload[4], payload[5], payload[6]);
-			} else {
-				// CCT
-				iValue = constrain(iValue, CT_MIN_VALUE, CT_MAX_VALUE);
-				payload[3] = iValue % 256;
-			  payload[4] = iValue / 256;
-				lv_msg.set((void*)payload, 5);
-				SERIAL("Now sending set BR=%d CCT=%d...", bytValue, iValue);
-			}
+		payload[2] = cmd.status.br;
+		if( cmd.status.cct < 256 ) {
+			// WRGB
+			payload[3] = cmd.status.cct;	// W
+			payload[4] = cmd.status.R;
+			payload[5] = cmd.status.G;
+			payload[6] = cmd.status.B;
+			lv_msg.set((void*)payload, 7);
+			SERIAL("Now sending set BR=%d WRGB=(%d,%d,%d,%d)...",
+					payload[2], payload[3], payload[4], payload[5], payload[6]);
 		} else {
-			iValue = 3000;
-			payload[3] = iValue % 256;
-		  payload[4] = iValue / 256;
+			// CCT
+			usValue = constrain(cmd.status.cct, CT_MIN_VALUE, CT_MAX_VALUE);
+			payload[3] = usValue % 256;
+			payload[4] = usValue / 256;
 			lv_msg.set((void*)payload, 5);
-			SERIAL("Now sending set BR=%d CCT=%d...", bytValue, iValue);
+			SERIAL("Now sending set BR=%d CCT=%d...", payload[2], usValue);
 		}
 		bMsgReady = true;
 		break;
@@ -271,41 +377,24 @@ bool RF433ServerClass::ProcessSend(const UC _node, const UC _msgID, String &strP
 	case 16:	// Reserved for query command
 		break;
 
-	case 15:	// Set Device Scenerio
-		bytValue = (UC)(strPayl.toInt());
-		theSys.ChangeLampScenario(_node, bytValue, _replyTo, _sensor);
+	case RF_CMD_SCENARIO:	// Set Device Scenerio
+		theSys.ChangeLampScenario(_node, cmd.scenario, _replyTo, _sensor);
 		break;
 
-	case 17:	// Set special effect
+	case RF_CMD_EFFECT:	// Set special effect
 		lv_msg.build(_replyTo, _node, _sensor, C_SET, V_VAR1, true);
-		bytValue = (UC)(strPayl.toInt());
-		lv_msg.set(bytValue);
+		lv_msg.set(cmd.filter);
 		bMsgReady = true;
-		SERIAL("Now setting special effect %d...", bytValue);
+		SERIAL("Now setting special effect %d...", cmd.filter);
 		break;
-	case 20:
+
+	case RF_CMD_BASE_CONFIG:
 		// Set base config to node
 		lv_msg.build(_replyTo, _node, _sensor, C_INTERNAL, I_CONFIG, true);
-		payload[0] = 101;  //maindev
-		payload[1] = CC1101_433_CHANNEL;
-		payload[2] = 101;
+		payload[0] = cmd.base.nid;
+		payload[1] = cmd.base.channel;
+		payload[2] = cmd.base.nid;
 		payload[3] = 0;
-		nPos = strPayl.indexOf(':');
-		Serial.printlnf("msg=%s,pos=%d...",strPayl.c_str(),nPos);
-		if (nPos > 0) {
-			// Extract brightness, cct or WRGB
-			bytValue = (uint8_t)(strPayl.substring(0, nPos).toInt());
-			payload[0] = bytValue;
-			payload[2] = bytValue;
-			iValue = strPayl.substring(nPos + 1).toInt();
-			payload[1] = iValue;
-		}
-		else
-		{
-			bytValue = (uint8_t)(strPayl.toInt());
-			payload[0] = bytValue;
-			payload[2] = bytValue;
-		}
 		lv_msg.set((void*)payload, 4);
 		SERIAL("Now sending set nodeid=%d channel=%d...", payload[0], payload[1]);
 		bMsgReady = true;
@@ -315,7 +404,7 @@ bool RF433ServerClass::ProcessSend(const UC _node, const UC _msgID, String &strP
 	if (bMsgReady) {
 		SERIAL("to %d...", lv_msg.getDestination());
 		sentOK = ProcessSend(&lv_msg);
-		my_msg = lv_msg;
+		if( pMsg ) *pMsg = lv_msg;
 		SERIAL_LN(sentOK ? "OK" : "failed");
 	}
 
@@ -387,6 +476,12 @@ bool RF433ServerClass::ProcessSend(MyMessage *pMsg)
 {
 	if( !pMsg ) { pMsg = &msg; }
 
+	// Keep it for the next uplink of a sleeping node
+	UC lv_power = GetNodePower(pMsg->getDestination());
+	if( (lv_power & RF_NODE_SLEEPY) && !(lv_power & RF_NODE_WOR) && !IsNodeAwake(pMsg->getDestination()) ) {
+		return StoreMail(*pMsg);
+	}
+
 	// Convent message if necessary
 	// Add message to sending MQ. Right now tag has no actual purpose (just for debug)
 	uint32_t flag = 0;
@@ -406,11 +501,17 @@ bool RF433ServerClass::ProcessSend(MyMessage *pMsg)
 void RF433ServerClass::PeekMessage()
 {
 	if( !isValid() ) return;
+	// End of our own frame, the radio is back to RX
+	if( txDone() ) {
+		_txAirTime += getTxAirTime();
+		return;
+	}
 	//detachInterrupt(GDO2);
 	uint8_t from,to = 0;
 	uint8_t len;
 	MyMessage lv_msg;
 	uint8_t *lv_pData = (uint8_t *)&(lv_msg.msg);
+	rf_rx_frame_t lv_frame;
 	if(available()){
 		  len = receive(lv_pData,&from,&to);
 			if(len > 0)
@@ -427,376 +528,1417 @@ void RF433ServerClass::PeekMessage()
 				LOGD(LOGTAG_MSG, "Received isack:%d,msg-len=%d, from:%d to:%d sender:%d dest:%d cmd:%d type:%d sensor:%d payl-len:%d",
 				lv_msg.isAck(),len, from, to, lv_msg.getSender(), lv_msg.getDestination(), lv_msg.getCommand(),
 				lv_msg.getType(), lv_msg.getSensor(), lv_msg.getLength());
-				if(lv_msg.isAck())
+				// Fragment status is handled by ProcessReceiveMQ
+				if(lv_msg.isAck() && lv_msg.getCommand() != C_STREAM)
 				{
 					unsigned long ackid = lv_msg.getSender();
 					if(_sentID !=0 && ackid == _sentID)
 					{
+						m_ackRTT = millis() - m_ackWaitStart;
 						_sentID = 0;
 					}
 				}
-				Append(lv_pData, len);
+				// Link table is left to the main loop, only latch the values here
+				memset(&lv_frame, 0x00, sizeof(lv_frame));
+				memcpy(lv_frame.data, lv_pData, (len < MAX_MESSAGE_LENGTH ? len : MAX_MESSAGE_LENGTH));
+				lv_frame.from = from;
+				lv_frame.rssi = getLastRSSI();
+				lv_frame.lqi = getLastLQI();
+				Append((UC *)&lv_frame, sizeof(lv_frame));
 			}
 	}
 	//attachInterrupt(GDO2, &RF433ServerClass::PeekMessage, this, FALLING);
 }
 
-// TODO
+//------------------------------------------------------------------
+// Receive dispatch table
+//------------------------------------------------------------------
+typedef struct
+{
+	UC command;
+	UC sensor;												// S_*, or RF_RX_ANY
+	UC type;													// V_* / I_*, or RF_RX_ANY
+	UC minLen;												// Minimum payload length
+	rf_rx_handler_t handler;					// NULL to ignore
+	const char *name;
+} rf_rx_entry_t;
+
+typedef struct
+{
+	UL count;
+	UL cycles;
+} rf_rx_stat_t;
+
+// First match wins, so specific entries go before wildcards
+const rf_rx_entry_t rfRxTable[] = {
+	{C_INTERNAL,			RF_RX_ANY,				I_ID_REQUEST,				0,	NULL,																	"idreq"},
+	{C_INTERNAL,			RF_RX_ANY,				I_CONFIG,						0,	&RF433ServerClass::OnNodeConfig,		"config"},
+	{C_INTERNAL,			RF_RX_ANY,				I_REBOOT,						0,	&RF433ServerClass::OnNodeReboot,		"reboot"},
+
+	{C_PRESENTATION,	S_LIGHT,					RF_RX_ANY,					0,	&RF433ServerClass::OnPresentation,	"present"},
+	{C_PRESENTATION,	S_DIMMER,					RF_RX_ANY,					0,	&RF433ServerClass::OnPresentation,	"present"},
+	{C_PRESENTATION,	S_ZENSENSOR,			RF_RX_ANY,					0,	&RF433ServerClass::OnPresentation,	"present"},
+	{C_PRESENTATION,	S_ZENREMOTE,			RF_RX_ANY,					0,	&RF433ServerClass::OnPresentation,	"present"},
+	{C_PRESENTATION,	S_POWER,					RF_RX_ANY,					0,	&RF433ServerClass::OnPresentation,	"present"},
+	{C_PRESENTATION,	S_HVAC,						RF_RX_ANY,					0,	&RF433ServerClass::OnPresentation,	"present"},
+	{C_PRESENTATION,	S_MOTION,					V_STATUS,						1,	&RF433ServerClass::OnMotion,				"pir"},
+	{C_PRESENTATION,	S_IR,							V_STATUS,						1,	&RF433ServerClass::OnMotion,				"irkey"},
+	{C_PRESENTATION,	S_LIGHT_LEVEL,		V_LIGHT_LEVEL,			1,	&RF433ServerClass::OnBrightness,		"als"},
+	{C_PRESENTATION,	S_SOUND,					V_STATUS,						1,	&RF433ServerClass::OnSound,					"mic"},
+	{C_PRESENTATION,	S_SOUND,					V_LEVEL,						2,	&RF433ServerClass::OnNoise,					"noise"},
+	{C_PRESENTATION,	S_TEMP,						V_LEVEL,						4,	&RF433ServerClass::OnDHT,						"dht"},
+	{C_PRESENTATION,	S_HUM,						V_LEVEL,						4,	&RF433ServerClass::OnDHT,						"dht"},
+	{C_PRESENTATION,	S_TEMP,						V_TEMP,							2,	&RF433ServerClass::OnDHT,						"temp"},
+	{C_PRESENTATION,	S_HUM,						V_HUM,							2,	&RF433ServerClass::OnDHT,						"humi"},
+	{C_PRESENTATION,	S_DUST,						V_LEVEL,						2,	&RF433ServerClass::OnDust,					"dust"},
+	{C_PRESENTATION,	S_AIR_QUALITY,		V_LEVEL,						2,	&RF433ServerClass::OnAirQuality,		"airq"},
+	{C_PRESENTATION,	S_SMOKE,					V_LEVEL,						2,	&RF433ServerClass::OnSmoke,					"smoke"},
+
+	{C_REQ,						RF_RX_ANY,				V_STATUS,						0,	&RF433ServerClass::OnDeviceStatus,	"onoff"},
+	{C_REQ,						RF_RX_ANY,				V_PERCENTAGE,				0,	&RF433ServerClass::OnDeviceStatus,	"bright"},
+	{C_REQ,						RF_RX_ANY,				V_LEVEL,						0,	&RF433ServerClass::OnDeviceStatus,	"cct"},
+	{C_REQ,						RF_RX_ANY,				V_RGBW,							0,	&RF433ServerClass::OnDeviceStatus,	"ring"},
+	{C_REQ,						RF_RX_ANY,				V_DISTANCE,					0,	&RF433ServerClass::OnDeviceStatus,	"top"},
+	{C_REQ,						RF_RX_ANY,				V_VAR1,							0,	&RF433ServerClass::OnDeviceStatus,	"filter"},
+	{C_REQ,						RF_RX_ANY,				V_RELAY_MAP,				0,	&RF433ServerClass::OnDeviceStatus,	"relay"},
+	{C_REQ,						RF_RX_ANY,				V_CURRENT,					0,	&RF433ServerClass::OnACCurrent,			"accur"},
+	{C_REQ,						RF_RX_ANY,				V_KWH,							0,	&RF433ServerClass::OnACQuantity,		"ackwh"},
+	{C_REQ,						RF_RX_ANY,				V_HVAC_FLOW_STATE,	0,	&RF433ServerClass::OnACStatus,			"acstat"},
+
+	{C_SET,						RF_RX_ANY,				RF_RX_ANY,					0,	NULL,																"set"},
+
+	{C_STREAM,				RF_RX_ANY,				RF_RX_ANY,					RF_FRAG_HDR_SIZE,	&RF433ServerClass::OnFragment,	"frag"}
+};
+
+#define RF_RX_TABLE_SIZE		(sizeof(rfRxTable) / sizeof(rf_rx_entry_t))
+
+rf_rx_stat_t rfRxStat[RF_RX_TABLE_SIZE];
+
 // Parse and process message in MQ
 bool RF433ServerClass::ProcessReceiveMQ()
 {
-	bool msgReady;
-	UC len, payl_len;
-	UC replyTo, _sensor, msgType, transTo;
-	bool _bIsAck, _needAck;
-	UC *payload;
-	UC _bValue;
-	US _iValue;
-	char strDisplay[SENSORDATA_JSON_SIZE];
-	String strTemp;
+	UC _cmd;
+	rf_rx_ctx_t ctx;
+	rf_rx_frame_t lv_frame;
 
   while (Length() > 0) {
 
-		msgReady = false;
-	  len = Remove(MAX_MESSAGE_LENGTH, msgData);
-		payl_len = msg.getLength();
-		_sensor = msg.getSensor();
-		msgType = msg.getType();
-		replyTo = msg.getSender();
-		_bIsAck = msg.isAck();
-		_needAck = msg.isReqAck();
-		payload = (uint8_t *)msg.getCustom();
+	  Remove(sizeof(lv_frame), (UC *)&lv_frame);
+		memcpy(msgData, lv_frame.data, MAX_MESSAGE_LENGTH);
+		UpdateLinkQuality(lv_frame.from, lv_frame.rssi, lv_frame.lqi);
+		_cmd = msg.getCommand();
+		ctx.payl_len = msg.getLength();
+		ctx.sensor = msg.getSensor();
+		ctx.type = msg.getType();
+		ctx.replyTo = msg.getSender();
+		ctx.isAck = msg.isAck();
+		ctx.needAck = msg.isReqAck();
+		ctx.payload = (uint8_t *)msg.getCustom();
 
 		LOGD(LOGTAG_MSG, "Will process cmd:%d from:%d type:%d sensor:%d",
-					msg.getCommand(), replyTo, msgType, _sensor);
-		switch( msg.getCommand() )
-	  {
-	    case C_INTERNAL:
-	      if( msgType == I_ID_REQUEST ) {
-				}
-				else if( msgType == I_CONFIG ) {
-				   if( _bIsAck ) {
-						 if( _sensor == NCF_QUERY ) {
-							 theSys.GotNodeConfigAck(replyTo, payload);
-						 }
-					 }
-				 } else if( msgType == I_REBOOT ) {
-					 // TODO Reboot node
-					 transTo = msg.getDestination();
-					 //ListNode<DevStatusRow_t> *DevStatusRowPtr = theSys.SearchDevStatus(transTo);
-					 //if( DevStatusRowPtr ) {
-						 msg.build(replyTo, transTo, _sensor, C_INTERNAL, I_REBOOT, false);
-						 //msg.set((unsigned int)DevStatusRowPtr->data.token);
-						 msgReady = true;
-					 //}
-				 }
-				 /*else if( msgType == I_GET_NONCE ) {
-				 // RF Scanner Probe
-					 if( replyTo == NODEID_RF_SCANNER ) {
-						 if( payload[0] == SCANNER_PROBE ) {
-							 MsgScanner_ProbeAck();
-						 } else if( payload[0] == SCANNER_SETUP_RF ) {
-							 transTo = msg.getDestination();
-							 if(transTo == NODEID_GATEWAY)
-								 Process_SetupRF(payload + 1,payl_len-1);
-						 }
-						 else if( payload[0] == SCANNER_SETUPDEV_RF ) {
-							 uint8_t mac[6] = {0};
-							 //WiFi.macAddress(mac);
-							 theSys.GetMac(mac);
-							 if(isIdentityEqual(payload + 1,mac,sizeof(mac)))
-								 Process_SetupRF(payload + 1 + LEN_NODE_IDENTITY, payl_len - 1 - LEN_NODE_IDENTITY);
-						 }
-					 }
-				 }*/
-				 break;
-			 case C_PRESENTATION:
- 				if( _sensor == S_LIGHT || _sensor == S_DIMMER || _sensor == S_ZENSENSOR || _sensor == S_ZENREMOTE ||\
- 					  _sensor == S_POWER || _sensor == S_HVAC) {
- 					US token;
- 					if( _needAck ) {
- 						// Presentation message: appear of Smart Lamp
- 						// Verify credential, return token if true, and change device status
- 						uint64_t nIdentity = msg.getUInt64();
- 						token = random(65535);
- 						theSys.UpdateNodeList(replyTo,0, msgType, nIdentity,token);
- 						if( token ) {
- 							// return token
- 							// Notes: lampType & S_LIGHT (msgType) are not necessary, use for associated device
- 			        msg.build(getAddress(), replyTo, _sensor, C_PRESENTATION, msgType, false, true);
- 							msg.set((unsigned int)token);
- 							msgReady = true;
- 							// ToDo: send status req to this lamp
- 						}
- 						//theNodeManager.UpdateNode(lv_nNodeID,);
- 						LOGN(LOGTAG_MSG, "Node:%d presence!",replyTo);
- 					}
- 				}
- 				else {
- 					if( _sensor == S_MOTION || _sensor == S_IR ) {
- 						if( msgType == V_STATUS) { // PIR
- 							theSys.UpdateMotion(replyTo, _sensor, msg.getByte());
- 						}
- 					} else if( _sensor == S_LIGHT_LEVEL ) {
- 						if( msgType == V_LIGHT_LEVEL) { // ALS
- 							theSys.UpdateBrightness(replyTo, msg.getByte());
- 						}
- 					} else if( _sensor == S_SOUND ) {
- 						if( msgType == V_STATUS ) { // MIC
- 							theSys.UpdateSound(replyTo, payload[0]);
- 						} else if( msgType == V_LEVEL ) {
- 							_iValue = payload[1] * 256 + payload[0];
- 							theSys.UpdateNoise(replyTo, _iValue);
- 						}
- 					} else if( _sensor == S_TEMP || _sensor == S_HUM ) {
- 						float lv_flt1 = 255, lv_flt2 = 255;
- 						if( msgType == V_LEVEL && payl_len >= 4 ) {
- 							lv_flt1 = payload[0] + payload[1] / 100.0;
- 							lv_flt2 = payload[2] + payload[3] / 100.0;
- 						} else if( _sensor == S_TEMP && msgType == V_TEMP ) {
- 							lv_flt1 = payload[0] + payload[1] / 100.0;
- 						} else if( _sensor == S_HUM && msgType == V_HUM ) {
- 							lv_flt2 = payload[0] + payload[1] / 100.0;
- 						}
- 						theSys.UpdateDHT(replyTo, lv_flt1, lv_flt2);
- 					} else if( _sensor == S_DUST || _sensor == S_AIR_QUALITY || _sensor == S_SMOKE ) {
- 						if( msgType == V_LEVEL ) { // Dust, Gas or Smoke
- 							_iValue = payload[1] * 256 + payload[0];
- 							if( _sensor == S_DUST ) {
- 								theSys.UpdateDust(replyTo, _iValue);
- 							} else if( _sensor == S_AIR_QUALITY ) {
- 								if(payl_len >= 10)
- 								{
- 								  US pm10 = payload[3] * 256 + payload[2];
- 									float tvoc = (payload[5] * 256 + payload[4])/10.0;
- 									float ch2o = (payload[7] * 256 + payload[6])/10.0;
- 									US co2 = payload[9] * 256 + payload[8];
- 									theSys.UpdateAirQuality(replyTo, _iValue,pm10,tvoc,ch2o,co2);
- 								}
- 								else
- 								{
- 									theSys.UpdateGas(replyTo, _iValue);
- 								}
- 							} else if( _sensor == S_SMOKE ) {
- 								theSys.UpdateSmoke(replyTo, _iValue);
- 							}
- 						}
- 					}
- 				}
- 				break;
-			case C_REQ:
-				if( msgType == V_STATUS || msgType == V_PERCENTAGE || msgType == V_LEVEL
-					  || msgType == V_RGBW || msgType == V_DISTANCE || msgType == V_VAR1
-					  || msgType == V_RELAY_MAP ) {
-					transTo = msg.getDestination();
-					BOOL bLampDataChanged = false;
-					if( _bIsAck ) {
-						//SERIAL_LN("REQ ack:%d to: %d 0x%x-0x%x-0x%x-0x%x-0x%x-0x%x-0x%x", msgType, transTo, payload[0],payload[1], payload[2], payload[3], payload[4],payload[5],payload[6]);
-						if( msgType == V_STATUS ) {
-							if(IS_LAMP_NODEID(replyTo))
-							{
-								bLampDataChanged |= theSys.ConfirmLampOnOff(replyTo, _sensor,payload[0]);
-							}
-						}
-						if( msgType == V_PERCENTAGE ) {
-							bLampDataChanged |= theSys.ConfirmLampBrightness(replyTo, _sensor,payload[0], payload[1]);
-						} else if( msgType == V_LEVEL ) {
-							bLampDataChanged |= theSys.ConfirmLampCCT(replyTo,_sensor, (US)msg.getUInt());
-						} else if( msgType == V_RGBW ) {
-							// lamp timing status msg
-							if( payload[0] ) {	// Succeed or not
-								static bool bFirstRGBW = true;		// Make sure the first message will be sent anyway
-								UC _devType = payload[1];	// payload[2] is present status
-								UC _ringID = payload[3];
-								UC filter = payload[payl_len-1];
-								if( IS_SUNNY(_devType) ) {
-									// Sunny
-									US _CCTValue = payload[7] * 256 + payload[6];
-									bLampDataChanged |= theSys.ConfirmLampSunnyStatus(replyTo,_sensor,payload[4], payload[5], _CCTValue, filter,_ringID);
-									bLampDataChanged |= bFirstRGBW;
-									bFirstRGBW = false;
-								} else if( IS_RAINBOW(_devType) || IS_MIRAGE(_devType) ) {
-									// Rainbow or Mirage, set RBGW
-									bLampDataChanged |= theSys.ConfirmLampHue(replyTo,_sensor,payload[6], payload[7], payload[8], payload[9], _ringID);
-									bLampDataChanged |= theSys.ConfirmLampBrightness(replyTo, _sensor, payload[4], payload[5], _ringID);
-									bLampDataChanged |= bFirstRGBW;
-									bFirstRGBW = false;
-								}
-							}
-						} else if( msgType == V_VAR1 ) { // Change special effect ack
-							bLampDataChanged |= theSys.ConfirmLampFilter(replyTo, _sensor, payload[0]);
-						} else if( msgType == V_DISTANCE && payload[0] ) {
-							UC _devType = payload[1];	// payload[2] is present status
-							if( IS_MIRAGE(_devType) ) {
-								bLampDataChanged |= theSys.ConfirmLampTop(replyTo, _sensor, payload, payl_len);
-							}
-						}else if( msgType == V_RELAY_MAP ) {
-							// Publish Relay Status
-							strTemp = String::format("{'nd':%d,'subid':%d,'km':%d}", replyTo, _sensor,payload[0]);
-							theSys.PublishMsg(CLT_ID_DeviceStatus,strTemp.c_str(),strTemp.length(),replyTo,1);
-							//LOGD(LOGTAG_MSG, "Recv nd:%d relay msg:%d",replyTo,payload[0]);
-							theSys.UpdateNodeList(replyTo,_sensor);
-
-						}
-
-						// If data changed, new status must broadcast to all end points
-						if( bLampDataChanged ) {
-							transTo = BROADCAST_ADDRESS;
-						}
-					} /* else { // Request
-						// ToDo: verify token
-					} */
-
-					// ToDo: if lamp is not present, return error
-					if( transTo > 0 ) {
-						// Transfer message
-						msg.build(replyTo, transTo, _sensor, C_REQ, msgType, _needAck, _bIsAck, true);
-						// Keep payload unchanged
-						msgReady = true;
-					}
-				}
-				/////////////////// add by zql for airconditioning//////////////////////////////////////////////////////////////
-				else if(msgType == V_CURRENT)
-				{
-					theSys.UpdateNodeList(replyTo,_sensor);
-					if(payl_len >= 2)
-					{ // electric current change msg
-						uint16_t eCurrent = payload[1]<<8 | payload[0];
-						UC lv_nNodeID = msg.getSender();
-						LOGD(LOGTAG_MSG, "Recv nd:%d current msg:%d",lv_nNodeID,eCurrent);
-						theACManager.UpdateACCurrentByNodeid(lv_nNodeID,eCurrent);
-					}
-				}
-				else if(msgType == V_KWH)
-				{
-					theSys.UpdateNodeList(replyTo,_sensor);
-					if(payl_len >= 9)
-					{
-						uint32_t eQuantity = 0;
-						memcpy(&eQuantity,&payload[0],4);
-						uint16_t eqindex = payload[5]<<8 | payload[4];
-						uint16_t eCurrent = payload[7]<<8 | payload[6];
-						uint8_t bReset = payload[8];
-						UC lv_nNodeID = msg.getSender();
-						LOGD(LOGTAG_MSG, "Recv eq msg,nd:%d,eq:%d,index=%d,current:%d,reset:%d",lv_nNodeID,eQuantity,eqindex,eCurrent,bReset);
-						theACManager.UpdateACByNodeid(lv_nNodeID,eCurrent,eQuantity,eqindex,bReset);
-						if(_needAck)
-						{
-							msg.build(transTo, replyTo, _sensor, C_REQ, msgType, 0, 1, true);
-							msgReady = true;
-						}
-					}
-					else if(payl_len >= 4)
-					{ // electric current change msg
-						uint16_t eQuantity = payload[1]<<8 | payload[0];
-						uint16_t eqindex = payload[3]<<8 | payload[2];
-						uint16_t eCurrent = payload[5]<<8 | payload[4];
-						UC lv_nNodeID = msg.getSender();
-						LOGD(LOGTAG_MSG, "Recv eq msg,nd:%d,eq:%d,index=%d,current:%d",lv_nNodeID,eQuantity,eqindex,eCurrent);
-						theACManager.UpdateACByNodeid(lv_nNodeID,eCurrent,eQuantity,eqindex);
-					}
-				}
-				else if(msgType == V_HVAC_FLOW_STATE)
-				{
-					theSys.UpdateNodeList(replyTo,_sensor);
-					if(payl_len >= 4)
-					{ // electric current change msg
-						uint8_t onoff = payload[0];
-						uint8_t mode = payload[1];
-						uint8_t temp = payload[2];
-						uint8_t fanlevel = payload[3];
-						UC lv_nNodeID = msg.getSender();
-						LOGD(LOGTAG_MSG, "Recv acstatus msg,nd:%d,onoff:%d,mode=%d,temp:%d,fanlevel:%d",onoff,mode,temp,fanlevel);
-						theACManager.UpdateACStatusByNodeid(lv_nNodeID,onoff,mode,temp,fanlevel);
-					}
-				}
-				/////////////////// add by zql for airconditioning end//////////////////////////////////////////////////////////
-				break;
+					_cmd, ctx.replyTo, ctx.type, ctx.sensor);
 
-			case C_SET:
-				break;
-
-	    default:
-	      break;
-	  }
+		// Sleepy node listens for a while after uplink
+		DeliverMail(ctx.replyTo);
+		DispatchMessage(_cmd, ctx);
+		// Any frame counts as keepalive; presentation may have set the power mode
+		if( GetNodePower(ctx.replyTo) & RF_NODE_SLEEPY ) {
+			theSys.m_liveness.Remove(ctx.replyTo);
+		} else {
+			theSys.m_liveness.Refresh(ctx.replyTo);
+		}
   }
   return true;
 }
-// TODO
+
+// Look up handler by (command, sensor, type) and call it
+void RF433ServerClass::DispatchMessage(UC _cmd, rf_rx_ctx_t &ctx)
+{
+	const rf_rx_entry_t *pEntry = NULL;
+	UC i;
+	UL lv_ticks;
+
+	for( i = 0; i < RF_RX_TABLE_SIZE; i++ ) {
+		if( rfRxTable[i].command != _cmd ) continue;
+		if( rfRxTable[i].sensor != RF_RX_ANY && rfRxTable[i].sensor != ctx.sensor ) continue;
+		if( rfRxTable[i].type != RF_RX_ANY && rfRxTable[i].type != ctx.type ) continue;
+		pEntry = rfRxTable + i;
+		break;
+	}
+
+	if( !pEntry ) {
+		AddUnknown(_cmd, ctx.sensor, ctx.type);
+		return;
+	}
+	if( ctx.payl_len < pEntry->minLen ) {
+		_rxShort++;
+		LOGD(LOGTAG_MSG, "Short payload %d for %s from:%d", ctx.payl_len, pEntry->name, ctx.replyTo);
+		return;
+	}
+
+	rfRxStat[i].count++;
+	if( pEntry->handler ) {
+		lv_ticks = System.ticks();
+		(this->*(pEntry->handler))(ctx);
+		rfRxStat[i].cycles += System.ticks() - lv_ticks;
+	}
+}
+
+void RF433ServerClass::AddUnknown(UC _cmd, UC _sensor, UC _type)
+{
+	_rxUnknown++;
+	UC i, lv_least = 0;
+	for( i = 0; i < RF_RX_MAX_UNKNOWN; i++ ) {
+		if( m_rxUnknown[i].count == 0 ) break;
+		if( m_rxUnknown[i].command == _cmd && m_rxUnknown[i].sensor == _sensor && m_rxUnknown[i].type == _type ) {
+			m_rxUnknown[i].count++;
+			return;
+		}
+		if( m_rxUnknown[i].count < m_rxUnknown[lv_least].count ) lv_least = i;
+	}
+	// Replace the least seen one when full
+	if( i >= RF_RX_MAX_UNKNOWN ) i = lv_least;
+	m_rxUnknown[i].command = _cmd;
+	m_rxUnknown[i].sensor = _sensor;
+	m_rxUnknown[i].type = _type;
+	m_rxUnknown[i].count = 1;
+	LOGD(LOGTAG_MSG, "Unknown msg cmd:%d sensor:%d type:%d", _cmd, _sensor, _type);
+}
+
+void RF433ServerClass::ShowDecoderStatistics()
+{
+	UL lv_usTicks = System.ticksPerMicrosecond();
+	if( lv_usTicks == 0 ) lv_usTicks = 1;
+	SERIAL_LN("** RF receive decoder: received %lu, unknown %lu, short %lu **", _received, _rxUnknown, _rxShort);
+	for( UC i = 0; i < RF_RX_TABLE_SIZE; i++ ) {
+		if( rfRxStat[i].count == 0 ) continue;
+		SERIAL_LN("  %d-%d-%d %s: %lu msgs, %lu cycles, avg %lu us", rfRxTable[i].command, rfRxTable[i].sensor, rfRxTable[i].type,
+				rfRxTable[i].name, rfRxStat[i].count, rfRxStat[i].cycles, rfRxStat[i].cycles / rfRxStat[i].count / lv_usTicks);
+	}
+	for( UC i = 0; i < RF_RX_MAX_UNKNOWN; i++ ) {
+		if( m_rxUnknown[i].count == 0 ) break;
+		SERIAL_LN("  unknown %d-%d-%d: %lu msgs", m_rxUnknown[i].command, m_rxUnknown[i].sensor, m_rxUnknown[i].type, m_rxUnknown[i].count);
+	}
+	SERIAL_LN("");
+}
+
+//------------------------------------------------------------------
+// Link quality table
+//------------------------------------------------------------------
+// Linear search is fine for MAX_NODE_PER_CONTROLLER entries; when full,
+// the least recently seen node is replaced
+rf_link_t *RF433ServerClass::SearchLink(UC _nid, BOOL bCreate)
+{
+	UC i, lv_oldest = 0;
+	for( i = 0; i < m_linkCount; i++ ) {
+		if( m_links[i].nid == _nid ) return &m_links[i];
+		if( m_links[i].lastSeen < m_links[lv_oldest].lastSeen ) lv_oldest = i;
+	}
+	if( !bCreate ) return NULL;
+
+	if( m_linkCount < RF_LINK_TABLE_SIZE ) {
+		i = m_linkCount++;
+	} else {
+		i = lv_oldest;
+	}
+	memset(&m_links[i], 0x00, sizeof(rf_link_t));
+	m_links[i].nid = _nid;
+	m_links[i].lastSeen = millis();
+	return &m_links[i];
+}
+
+// Called from ProcessReceiveMQ, with the values PeekMessage (ISR) latched
+void RF433ServerClass::UpdateLinkQuality(UC _nid, int8_t _rssi, UC _lqi)
+{
+	rf_link_t *pLink = SearchLink(_nid, true);
+	if( !pLink ) return;
+	if( pLink->samples == 0 ) {
+		pLink->rssi = _rssi * 16;
+		pLink->lqi = _lqi * 16;
+	} else {
+		pLink->rssi += (_rssi * 16 - pLink->rssi) / RF_LINK_EWMA_WEIGHT;
+		pLink->lqi += ((int)_lqi * 16 - (int)pLink->lqi) / RF_LINK_EWMA_WEIGHT;
+	}
+	if( pLink->samples < 255 ) pLink->samples++;
+	pLink->lastSeen = millis();
+}
+
+void RF433ServerClass::UpdateLinkAck(UC _nid, bool _acked, US _rtt)
+{
+	rf_link_t *pLink = SearchLink(_nid, true);
+	if( !pLink ) return;
+	int lv_sample = (_acked ? 1000 : 0);
+	if( pLink->acks == 0 ) {
+		pLink->ackRate = lv_sample;
+	} else {
+		pLink->ackRate += (lv_sample - (int)pLink->ackRate) / RF_LINK_EWMA_WEIGHT;
+	}
+	if( pLink->acks < 255 ) pLink->acks++;
+	if( _acked && _rtt > 0 ) {
+		if( pLink->rtt == 0 ) {
+			pLink->rtt = _rtt;
+		} else {
+			pLink->rtt += ((int)_rtt - (int)pLink->rtt) / RF_LINK_EWMA_WEIGHT;
+		}
+	}
+}
+
+// Fewer retries on a good link keeps the air free, more on a bad one
+// improves delivery; weak signal adds one more
+UC RF433ServerClass::GetLinkRetries(UC _nid)
+{
+	UC lv_base = theConfig.GetNdMsgRptTimes();
+	rf_link_t *pLink = SearchLink(_nid);
+	if( !pLink || pLink->acks < RF_LINK_MIN_SAMPLES ) return lv_base;
+
+	UC lv_retries = lv_base;
+	if( pLink->ackRate >= RF_LINK_GOOD_ACK ) {
+		lv_retries = (lv_base + 1) / 2;
+	} else if( pLink->ackRate < RF_LINK_BAD_ACK ) {
+		lv_retries = lv_base * 2;
+	}
+	if( pLink->samples > 0 && pLink->rssi < RF_LINK_WEAK_RSSI * 16 ) lv_retries++;
+	if( lv_retries > RF_MAX_RETRIES ) lv_retries = RF_MAX_RETRIES;
+	return lv_retries;
+}
+
+// 1.5 times the average round trip plus margin, ACK_TIMEOUT until measured
+US RF433ServerClass::GetLinkAckTimeout(UC _nid)
+{
+	rf_link_t *pLink = SearchLink(_nid);
+	if( !pLink || pLink->rtt == 0 ) return ACK_TIMEOUT;
+
+	UL lv_timeout = pLink->rtt + pLink->rtt / 2 + 50;
+	if( lv_timeout < RF_MIN_ACK_TIMEOUT ) lv_timeout = RF_MIN_ACK_TIMEOUT;
+	if( lv_timeout > RF_MAX_ACK_TIMEOUT ) lv_timeout = RF_MAX_ACK_TIMEOUT;
+	return lv_timeout;
+}
+
+const rf_link_t *RF433ServerClass::GetLink(UC _nid)
+{
+	return SearchLink(_nid);
+}
+
+UC RF433ServerClass::GetLinkCount()
+{
+	return m_linkCount;
+}
+
+void RF433ServerClass::ShowLinkTable()
+{
+	SERIAL_LN("** RF link table: %d of %d nodes, base retries %d **", m_linkCount, RF_LINK_TABLE_SIZE, theConfig.GetNdMsgRptTimes());
+	for( UC i = 0; i < m_linkCount; i++ ) {
+		SERIAL_LN("  nd:%d rssi:%d lqi:%d ack:%d/1000 (%d) rtt:%dms retry:%d timeout:%dms %lus ago",
+				m_links[i].nid, m_links[i].rssi / 16, m_links[i].lqi / 16, m_links[i].ackRate, m_links[i].acks,
+				m_links[i].rtt, GetLinkRetries(m_links[i].nid), GetLinkAckTimeout(m_links[i].nid),
+				(millis() - m_links[i].lastSeen) / 1000);
+	}
+	SERIAL_LN("");
+}
+
+// One message per node, replacing the previous one of the same node
+UC RF433ServerClass::PublishLinkTable()
+{
+	String strTemp;
+	UC lv_count = 0;
+	for( UC i = 0; i < m_linkCount; i++ ) {
+		strTemp = String::format("{'nd':%d,'rssi':%d,'lqi':%d,'ack':%d,'rtt':%d}",
+				m_links[i].nid, m_links[i].rssi / 16, m_links[i].lqi / 16, m_links[i].ackRate, m_links[i].rtt);
+		if( theCloudQue.AddPublishMsg(CLT_ID_DeviceStatus, strTemp.c_str(), strTemp.length(), m_links[i].nid, 1) ) lv_count++;
+	}
+	return lv_count;
+}
+
+//------------------------------------------------------------------
+// Fragmentation
+//------------------------------------------------------------------
+// A logical message longer than MAX_PAYLOAD goes out as C_STREAM fragments
+// with the type and sensor of the original message. Only the last fragment
+// of a round requests ack, and the peer answers with a bitmap of received
+// fragments. Missing ones are sent again until all are confirmed.
+bool RF433ServerClass::SendFragmented(MyMessage &my_msg, const UC *_data, const UC _len)
+{
+	if( _len <= MAX_PAYLOAD ) {
+		my_msg.set((void *)_data, _len);
+		return ProcessSend(&my_msg);
+	}
+
+	UC lv_node = my_msg.getDestination();
+	if( _len > RF_FRAG_MAX_SIZE || lv_node == BROADCAST_ADDRESS || lv_node == BROADCAST_ADDRESS1 ) {
+		LOGW(LOGTAG_MSG, "Can't fragment msg len:%d to %d", _len, lv_node);
+		return false;
+	}
+
+	rf_frag_buf_t *pBuf = NULL;
+	for( UC i = 0; i < RF_FRAG_MAX_TX; i++ ) {
+		if( m_fragTx[i].state == RF_FRAG_FREE ) {
+			pBuf = m_fragTx + i;
+			break;
+		}
+	}
+	if( !pBuf ) {
+		LOGW(LOGTAG_MSG, "Failed to add fragmented msg to %d", lv_node);
+		return false;
+	}
+
+	pBuf->node = lv_node;
+	pBuf->sender = my_msg.getSender();
+	pBuf->msgID = ++m_fragMsgID;
+	pBuf->count = (_len + RF_FRAG_DATA_SIZE - 1) / RF_FRAG_DATA_SIZE;
+	pBuf->cap = my_msg.msg.header.command_ack_payload;
+	pBuf->type = my_msg.getType();
+	pBuf->sensor = my_msg.getSensor();
+	pBuf->len = _len;
+	pBuf->rounds = 0;
+	pBuf->done = 0;
+	pBuf->pending = BITMASK(pBuf->count) - 1;
+	pBuf->time = millis();
+	memcpy(pBuf->data, _data, _len);
+	pBuf->state = RF_FRAG_SENDING;
+	_times++;
+	LOGD(LOGTAG_MSG, "Add fragmented msg %d len:%d in %d to %d", pBuf->msgID, _len, pBuf->count, lv_node);
+	return true;
+}
+
+// Put the next fragment on air, return true if the radio is taken
+bool RF433ServerClass::ProcessSendFragment()
+{
+	MyMessage lv_msg;
+	UC lv_buf[MAX_PAYLOAD];
+	rf_frag_hdr_t *pHdr = (rf_frag_hdr_t *)lv_buf;
+	rf_frag_buf_t *pBuf;
+	US lv_missing;
+	UC lv_index, lv_offset, lv_size;
+	bool lv_last;
+
+	for( UC i = 0; i < RF_FRAG_MAX_TX; i++ ) {
+		pBuf = m_fragTx + i;
+		if( m_wakeNode && pBuf->node != m_wakeNode ) continue;
+		if( pBuf->state == RF_FRAG_WAITING ) {
+			if( millis() - pBuf->time < GetLinkAckTimeout(pBuf->node) ) continue;
+			detachInterrupt(GDO2);
+			UpdateLinkAck(pBuf->node, false);
+			attachInterrupt(GDO2, &RF433ServerClass::PeekMessage, this, FALLING);
+			if( ++pBuf->rounds > GetLinkRetries(pBuf->node) ) {
+				LOGW(LOGTAG_MSG, "Fragmented msg %d to %d failed, got 0x%x", pBuf->msgID, pBuf->node, pBuf->done);
+				pBuf->state = RF_FRAG_FREE;
+				_fragTxFailed++;
+				continue;
+			}
+			// No status, ask again with the last unconfirmed fragment
+			lv_missing = (BITMASK(pBuf->count) - 1) & ~pBuf->done;
+			lv_index = pBuf->count - 1;
+			while( !BITTEST(lv_missing, lv_index) ) lv_index--;
+			pBuf->pending = BITMASK(lv_index);
+			pBuf->state = RF_FRAG_SENDING;
+		}
+		if( pBuf->state != RF_FRAG_SENDING ) continue;
+		if( NeedWake(pBuf->node) ) return StartWake(pBuf->node);
+
+		// Lowest pending fragment first
+		lv_index = 0;
+		while( !BITTEST(pBuf->pending, lv_index) ) lv_index++;
+		lv_offset = lv_index * RF_FRAG_DATA_SIZE;
+		lv_size = pBuf->len - lv_offset;
+		if( lv_size > RF_FRAG_DATA_SIZE ) lv_size = RF_FRAG_DATA_SIZE;
+		pHdr->msgID = pBuf->msgID;
+		pHdr->index = lv_index;
+		pHdr->count = pBuf->count;
+		pHdr->cap = pBuf->cap;
+		memcpy(lv_buf + RF_FRAG_HDR_SIZE, pBuf->data + lv_offset, lv_size);
+		lv_last = (BITUNSET(pBuf->pending, lv_index) == 0);
+		lv_msg.build(pBuf->sender, pBuf->node, pBuf->sensor, C_STREAM, pBuf->type, lv_last);
+		lv_msg.set((void *)lv_buf, RF_FRAG_HDR_SIZE + lv_size);
+
+		detachInterrupt(GDO2);
+		bool lv_sent = send(pBuf->node, lv_msg);
+		attachInterrupt(GDO2, &RF433ServerClass::PeekMessage, this, FALLING);
+		if( !lv_sent ) return true;
+
+		if( pBuf->node == m_wakeNode ) m_wakeNode = 0;
+		pBuf->pending = BITUNSET(pBuf->pending, lv_index);
+		_txFrames++;
+		_fragTxFrames++;
+		if( pBuf->rounds > 0 ) _fragTxRetrans++;
+		if( lv_last ) {
+			pBuf->state = RF_FRAG_WAITING;
+			pBuf->time = millis();
+		}
+		return true;
+	}
+	return false;
+}
+
+// Reassembly status from the peer
+void RF433ServerClass::OnFragmentStatus(rf_rx_ctx_t &ctx)
+{
+	if( ctx.payl_len < sizeof(rf_frag_status_t) ) {
+		_rxShort++;
+		return;
+	}
+	const rf_frag_status_t *pStatus = (const rf_frag_status_t *)ctx.payload;
+	rf_frag_buf_t *pBuf = NULL;
+	for( UC i = 0; i < RF_FRAG_MAX_TX; i++ ) {
+		if( m_fragTx[i].state != RF_FRAG_FREE && m_fragTx[i].node == ctx.replyTo && m_fragTx[i].msgID == pStatus->hdr.msgID ) {
+			pBuf = m_fragTx + i;
+			break;
+		}
+	}
+	// Late status of a finished message
+	if( !pBuf || pBuf->state != RF_FRAG_WAITING ) return;
+
+	US lv_all = BITMASK(pBuf->count) - 1;
+	pBuf->done |= (pStatus->received & lv_all);
+	detachInterrupt(GDO2);
+	UpdateLinkAck(pBuf->node, true, millis() - pBuf->time);
+	attachInterrupt(GDO2, &RF433ServerClass::PeekMessage, this, FALLING);
+
+	if( pBuf->done == lv_all ) {
+		LOGD(LOGTAG_MSG, "Fragmented msg %d to %d done in %d rounds", pBuf->msgID, pBuf->node, pBuf->rounds + 1);
+		pBuf->state = RF_FRAG_FREE;
+		_fragTxMsgs++;
+		_succ++;
+		return;
+	}
+	if( ++pBuf->rounds > GetLinkRetries(pBuf->node) ) {
+		LOGW(LOGTAG_MSG, "Fragmented msg %d to %d failed, got 0x%x", pBuf->msgID, pBuf->node, pBuf->done);
+		pBuf->state = RF_FRAG_FREE;
+		_fragTxFailed++;
+		return;
+	}
+	// Selective retransmit
+	pBuf->pending = lv_all & ~pBuf->done;
+	pBuf->state = RF_FRAG_SENDING;
+}
+
+void RF433ServerClass::SendFragmentStatus(rf_frag_buf_t *pBuf)
+{
+	MyMessage lv_msg;
+	rf_frag_status_t lv_status;
+	lv_status.hdr.msgID = pBuf->msgID;
+	lv_status.hdr.index = 0;
+	lv_status.hdr.count = pBuf->count;
+	lv_status.hdr.cap = pBuf->cap;
+	lv_status.received = pBuf->done;
+	lv_msg.build(getAddress(), pBuf->node, pBuf->sensor, C_STREAM, pBuf->type, false, true);
+	lv_msg.set((void *)&lv_status, sizeof(lv_status));
+	ProcessSend(&lv_msg);
+}
+
+// Release reassembly buffers without fragments for a while
+void RF433ServerClass::ExpireFragments()
+{
+	for( UC i = 0; i < RF_FRAG_MAX_RX; i++ ) {
+		if( m_fragRx[i].state == RF_FRAG_FREE ) continue;
+		if( millis() - m_fragRx[i].time < RF_FRAG_RX_TIMEOUT ) continue;
+		if( m_fragRx[i].state == RF_FRAG_RECEIVING ) {
+			_fragRxTimeout++;
+			LOGD(LOGTAG_MSG, "Drop fragmented msg %d from %d, got 0x%x", m_fragRx[i].msgID, m_fragRx[i].node, m_fragRx[i].done);
+		}
+		m_fragRx[i].state = RF_FRAG_FREE;
+	}
+}
+
+//------------------------------------------------------------------
+// Sleepy nodes
+//------------------------------------------------------------------
+// A sleepy node only listens shortly after its own uplink, so messages wait
+// in its mailbox instead of being retried. A node running WOR polls the
+// channel and is woken by a preamble longer than its polling interval.
+rf_sleepy_t *RF433ServerClass::SearchSleepy(UC _nid, BOOL bCreate)
+{
+	rf_sleepy_t *pFree = NULL;
+	for( UC i = 0; i < RF_SLEEPY_NODES; i++ ) {
+		if( m_sleepy[i].nid == _nid && _nid > 0 ) return m_sleepy + i;
+		if( !pFree && m_sleepy[i].nid == 0 ) pFree = m_sleepy + i;
+	}
+	if( !bCreate || !pFree ) return NULL;
+
+	memset(pFree, 0x00, sizeof(rf_sleepy_t));
+	pFree->nid = _nid;
+	return pFree;
+}
+
+void RF433ServerClass::SetNodePower(UC _nid, UC _flags, US _wakeTime)
+{
+	rf_sleepy_t *pSleepy = SearchSleepy(_nid, _flags > 0);
+	if( !pSleepy ) {
+		if( _flags > 0 ) LOGW(LOGTAG_MSG, "No slot for sleepy node %d", _nid);
+		return;
+	}
+	if( pSleepy->flags != _flags ) {
+		LOGN(LOGTAG_MSG, "Node:%d power mode %d", _nid, _flags);
+	}
+	pSleepy->flags = _flags;
+	pSleepy->wakeTime = _wakeTime;
+	if( _flags == 0 ) {
+		// Always listening now, send the mail right away
+		DeliverMail(_nid);
+		pSleepy->nid = 0;
+	} else {
+		pSleepy->lastAwake = millis();
+	}
+}
+
+UC RF433ServerClass::GetNodePower(UC _nid)
+{
+	rf_sleepy_t *pSleepy = SearchSleepy(_nid);
+	return(pSleepy ? pSleepy->flags : 0);
+}
+
+bool RF433ServerClass::IsNodeAwake(UC _nid)
+{
+	rf_sleepy_t *pSleepy = SearchSleepy(_nid);
+	if( !pSleepy ) return true;
+	return(millis() - pSleepy->lastAwake < RF_NODE_AWAKE_TIME);
+}
+
+// A newer message of the same kind replaces the old one, otherwise the
+// oldest is dropped on full mailbox
+bool RF433ServerClass::StoreMail(MyMessage &my_msg)
+{
+	rf_sleepy_t *pSleepy = SearchSleepy(my_msg.getDestination());
+	if( !pSleepy ) return false;
+
+	const MyMessage_t *pMail;
+	UC i;
+	for( i = 0; i < pSleepy->count; i++ ) {
+		pMail = (const MyMessage_t *)pSleepy->mail[i];
+		if( mGetCommand((*pMail)) == my_msg.getCommand() && pMail->header.type == my_msg.getType() && pMail->header.sensor == my_msg.getSensor() ) break;
+	}
+	if( i < pSleepy->count ) {
+		_mailReplaced++;
+	} else if( pSleepy->count < RF_MAILBOX_DEPTH ) {
+		i = pSleepy->count++;
+	} else {
+		memmove(pSleepy->mail[0], pSleepy->mail[1], (RF_MAILBOX_DEPTH - 1) * MAX_MESSAGE_LENGTH);
+		memmove(pSleepy->stored, pSleepy->stored + 1, (RF_MAILBOX_DEPTH - 1) * sizeof(UL));
+		i = RF_MAILBOX_DEPTH - 1;
+		_mailDropped++;
+	}
+	memcpy(pSleepy->mail[i], &(my_msg.msg), MAX_MESSAGE_LENGTH);
+	pSleepy->stored[i] = millis();
+	_mailStored++;
+	LOGD(LOGTAG_MSG, "Keep msg %d-%d for sleepy node %d", my_msg.getCommand(), my_msg.getType(), pSleepy->nid);
+	return true;
+}
+
+// Mark the node awake and move its mail to the send MQ
+UC RF433ServerClass::DeliverMail(UC _nid)
+{
+	rf_sleepy_t *pSleepy = SearchSleepy(_nid);
+	if( !pSleepy ) return 0;
+
+	pSleepy->lastAwake = millis();
+	UC lv_count = pSleepy->count;
+	if( lv_count == 0 ) return 0;
+
+	MyMessage lv_msg;
+	pSleepy->count = 0;
+	for( UC i = 0; i < lv_count; i++ ) {
+		memcpy(&(lv_msg.msg), pSleepy->mail[i], MAX_MESSAGE_LENGTH);
+		if( ProcessSend(&lv_msg) ) _mailDelivered++;
+	}
+	LOGD(LOGTAG_MSG, "Deliver %d msgs to sleepy node %d", lv_count, _nid);
+	return lv_count;
+}
+
+void RF433ServerClass::ExpireMail()
+{
+	rf_sleepy_t *pSleepy;
+	UC i;
+	for( UC n = 0; n < RF_SLEEPY_NODES; n++ ) {
+		pSleepy = m_sleepy + n;
+		// Oldest first
+		while( pSleepy->count > 0 && millis() - pSleepy->stored[0] > RF_MAILBOX_EXPIRE ) {
+			for( i = 1; i < pSleepy->count; i++ ) {
+				memcpy(pSleepy->mail[i - 1], pSleepy->mail[i], MAX_MESSAGE_LENGTH);
+				pSleepy->stored[i - 1] = pSleepy->stored[i];
+			}
+			pSleepy->count--;
+			_mailDropped++;
+			LOGD(LOGTAG_MSG, "Mail to sleepy node %d expired", pSleepy->nid);
+		}
+	}
+}
+
+bool RF433ServerClass::NeedWake(UC _nid)
+{
+	return((GetNodePower(_nid) & RF_NODE_WOR) && !IsNodeAwake(_nid));
+}
+
+// Return true if the radio is taken by the preamble
+bool RF433ServerClass::StartWake(UC _nid)
+{
+	rf_sleepy_t *pSleepy = SearchSleepy(_nid);
+	detachInterrupt(GDO2);
+	bool lv_started = txWake(pSleepy ? pSleepy->wakeTime : WOR_WAKE_TIME);
+	attachInterrupt(GDO2, &RF433ServerClass::PeekMessage, this, FALLING);
+	if( lv_started ) {
+		m_wakeNode = _nid;
+		_worWakeups++;
+		LOGD(LOGTAG_MSG, "Wake WOR node %d", _nid);
+	}
+	return lv_started;
+}
+
+void RF433ServerClass::ShowSleepyNodes()
+{
+	SERIAL_LN("** Sleepy nodes: mail stored %lu, delivered %lu, replaced %lu, dropped %lu, WOR wakeups %lu **",
+			_mailStored, _mailDelivered, _mailReplaced, _mailDropped, _worWakeups);
+	for( UC i = 0; i < RF_SLEEPY_NODES; i++ ) {
+		if( m_sleepy[i].nid == 0 ) continue;
+		if( m_sleepy[i].flags & RF_NODE_WOR ) {
+			SERIAL_LN("  nd:%d WOR %ums mail:%d awake %lus ago", m_sleepy[i].nid, m_sleepy[i].wakeTime,
+					m_sleepy[i].count, (millis() - m_sleepy[i].lastAwake) / 1000);
+		} else {
+			SERIAL_LN("  nd:%d sleepy mail:%d awake %lus ago", m_sleepy[i].nid, m_sleepy[i].count,
+					(millis() - m_sleepy[i].lastAwake) / 1000);
+		}
+	}
+	SERIAL_LN("");
+}
+
+//------------------------------------------------------------------
+// Channel survey & migration
+//------------------------------------------------------------------
+void RF433ServerClass::SetSurveyMode(UC _mode)
+{
+	if( _mode > RF_SURVEY_AUTO ) _mode = RF_SURVEY_AUTO;
+	m_surveyMode = _mode;
+}
+
+UC RF433ServerClass::GetSurveyMode()
+{
+	return m_surveyMode;
+}
+
+// Home channel first, then the grid without it
+void RF433ServerClass::ResetSurvey()
+{
+	UC lv_home = getChannel(false);
+	memset(m_survey, 0x00, sizeof(m_survey));
+	m_survey[0].channel = lv_home;
+	m_surveyCount = 1;
+	for( UC lv_ch = 0; lv_ch <= 127 && m_surveyCount < RF_SURVEY_CHANNELS; lv_ch += RF_SURVEY_STEP ) {
+		if( lv_ch == lv_home ) continue;
+		m_survey[m_surveyCount++].channel = lv_ch;
+	}
+	m_surveyNext = 0;
+}
+
+const rf_chan_stat_t *RF433ServerClass::GetChannelStat(UC _index)
+{
+	if( _index >= m_surveyCount ) return NULL;
+	return &m_survey[_index];
+}
+
+// Nothing to send, nothing on air and nothing half done
+bool RF433ServerClass::IsRadioIdle()
+{
+	if( m_ackPending || m_wakeNode || GetMQLength() > 0 ) return false;
+	for( UC i = 0; i < RF_FRAG_MAX_TX; i++ ) {
+		if( m_fragTx[i].state != RF_FRAG_FREE ) return false;
+	}
+	for( UC i = 0; i < RF_FRAG_MAX_RX; i++ ) {
+		if( m_fragRx[i].state == RF_FRAG_RECEIVING ) return false;
+	}
+	if( isTxBusy() ) return false;
+	// GDO2 is asserted from sync word to the end of packet
+	return( digitalRead(GDO2) == LOW );
+}
+
+// One sample per call, so the radio is deaf for at most RX_WAIT_TIMEOUT plus
+// RSSI_SETTLE_TIME, and the calibration back on the home channel
+void RF433ServerClass::SurveyChannel()
+{
+	if( m_surveyMode == RF_SURVEY_OFF || m_migState != RF_MIG_IDLE ) return;
+	if( m_surveyCount == 0 || m_survey[0].channel != getChannel(false) ) ResetSurvey();
+	if( millis() - m_surveyTime < RF_SURVEY_INTERVAL ) return;
+	if( !IsRadioIdle() ) return;
+	m_surveyTime = millis();
+
+	rf_chan_stat_t &lv_stat = m_survey[m_surveyNext];
+	if( ++m_surveyNext >= m_surveyCount ) m_surveyNext = 0;
+	detachInterrupt(GDO2);
+	int8_t lv_rssi = sampleRSSI(lv_stat.channel);
+	attachInterrupt(GDO2, &RF433ServerClass::PeekMessage, this, FALLING);
+	if( lv_rssi == RSSI_SAMPLE_FAILED ) {
+		LOGW(LOGTAG_MSG, "RSSI sample on channel %d failed, no RX", lv_stat.channel);
+		return;
+	}
+
+	SHORT lv_bin = (lv_rssi - RF_NOISE_MIN_DB) / RF_NOISE_BIN_DB;
+	if( lv_bin < 0 ) lv_bin = 0;
+	if( lv_bin >= RF_NOISE_BINS ) lv_bin = RF_NOISE_BINS - 1;
+	if( lv_stat.hist[lv_bin] == 0xFFFF ) {
+		for( UC i = 0; i < RF_NOISE_BINS; i++ ) lv_stat.hist[i] >>= 1;
+	}
+	lv_stat.hist[lv_bin]++;
+	if( lv_stat.samples == 0 ) {
+		lv_stat.avg = lv_rssi * 16;
+		lv_stat.peak = lv_rssi;
+	} else {
+		lv_stat.avg += (lv_rssi * 16 - lv_stat.avg) / RF_LINK_EWMA_WEIGHT;
+		if( lv_rssi > lv_stat.peak ) lv_stat.peak = lv_rssi;
+	}
+	lv_stat.samples++;
+	if( lv_rssi > RF_NOISE_BUSY_DB ) lv_stat.busy++;
+
+	if( m_surveyMode == RF_SURVEY_AUTO && (m_migLast == 0 || millis() - m_migLast > RF_MIG_HOLDOFF) ) {
+		UC lv_best = GetBestChannel();
+		if( lv_best != m_survey[0].channel ) StartMigration(lv_best);
+	}
+}
+
+// A candidate must be no busier than home and quieter by the margin on average
+UC RF433ServerClass::GetBestChannel()
+{
+	rf_chan_stat_t *pBest = &m_survey[0];
+	if( m_surveyCount == 0 || pBest->samples < RF_SURVEY_MIN_SAMPLES ) return getChannel(false);
+
+	UL lv_busy, lv_bestBusy = pBest->busy * 1000 / pBest->samples;
+	for( UC i = 1; i < m_surveyCount; i++ ) {
+		if( m_survey[i].samples < RF_SURVEY_MIN_SAMPLES ) continue;
+		lv_busy = m_survey[i].busy * 1000 / m_survey[i].samples;
+		if( lv_busy > lv_bestBusy ) continue;
+		if( m_survey[i].avg + RF_MIG_MARGIN_DB * 16 > pBest->avg ) continue;
+		pBest = &m_survey[i];
+		lv_bestBusy = lv_busy;
+	}
+	return pBest->channel;
+}
+
+// Two phases on the old channel: prepare, then switch or cancel before the deadline.
+// Nodes keep their channel unless they get no cancel; after the switch every node
+// heard recently must ack again on the new channel, otherwise all move back.
+bool RF433ServerClass::StartMigration(UC _channel)
+{
+	if( m_migState != RF_MIG_IDLE || _channel > 127 || _channel == getChannel(false) ) return false;
+	m_migLast = millis();
+	// A sleeping node would miss it and be left behind
+	for( UC i = 0; i < RF_SLEEPY_NODES; i++ ) {
+		if( m_sleepy[i].nid ) {
+			LOGW(LOGTAG_MSG, "No RF channel migration with sleepy node %d", m_sleepy[i].nid);
+			return false;
+		}
+	}
+
+	m_migFrom = getChannel(false);
+	m_migTo = _channel;
+	m_migRetried = false;
+	m_migStart = m_migLast;
+	memset(m_migAcked, 0x00, sizeof(m_migAcked));
+	memset(m_migPending, 0x00, sizeof(m_migPending));
+	m_migState = RF_MIG_PREPARE;
+	SendChannelConfig(BROADCAST_ADDRESS, m_migTo, RF_MIG_DELAY);
+	LOGN(LOGTAG_MSG, "RF channel migration %d->%d", m_migFrom, m_migTo);
+	return true;
+}
+
+UC RF433ServerClass::GetMigrationState()
+{
+	return m_migState;
+}
+
+void RF433ServerClass::SendChannelConfig(UC _node, UC _channel, UC _delay)
+{
+	MyMessage lv_msg;
+	UC lv_data[2];
+	lv_data[0] = _channel;
+	lv_data[1] = _delay;
+	lv_msg.build(NODEID_GATEWAY, _node, NCF_DEV_SET_RF_CHANNEL, C_INTERNAL, I_CONFIG, true);
+	lv_msg.set(lv_data, sizeof(lv_data));
+	ProcessSend(&lv_msg);
+}
+
+// Return number of nodes heard recently but not acked yet, and ask them again if bRetry.
+// On cancel, only nodes that acked the prepare count, and they are told to stay.
+UC RF433ServerClass::CheckMigrationAcks(bool bRetry)
+{
+	UC lv_missing = 0, lv_nid;
+	UC lv_delay = 0;
+	if( m_migState == RF_MIG_PREPARE ) {
+		lv_delay = RF_MIG_DELAY - (millis() - m_migStart) / 1000;
+	}
+	for( UC i = 0; i < m_linkCount; i++ ) {
+		lv_nid = m_links[i].nid;
+		if( lv_nid == 0 ) continue;
+		if( m_migState == RF_MIG_CANCEL ) {
+			if( !(m_migPending[lv_nid >> 3] & (1 << (lv_nid & 0x07))) ) continue;
+		} else if( millis() - m_links[i].lastSeen > RF_MIG_ACTIVE_TIME ) {
+			continue;
+		}
+		if( m_migAcked[lv_nid >> 3] & (1 << (lv_nid & 0x07)) ) continue;
+		lv_missing++;
+		if( bRetry ) SendChannelConfig(lv_nid, (m_migState == RF_MIG_CANCEL ? m_migFrom : m_migTo), lv_delay);
+	}
+	return lv_missing;
+}
+
+void RF433ServerClass::ProcessMigration()
+{
+	UC lv_missing;
+	UL lv_elapsed = millis() - m_migStart;
+
+	switch( m_migState ) {
+	case RF_MIG_PREPARE:
+		if( !m_migRetried ) {
+			if( lv_elapsed < RF_MIG_ACK_WINDOW ) break;
+			m_migRetried = true;
+			if( CheckMigrationAcks(true) == 0 ) m_migState = RF_MIG_SWITCH;
+		} else if( lv_elapsed >= 2 * RF_MIG_ACK_WINDOW ) {
+			lv_missing = CheckMigrationAcks(false);
+			if( lv_missing > 0 ) {
+				// Cancel before the deadline, nobody moves. Those acked have to confirm it.
+				memcpy(m_migPending, m_migAcked, sizeof(m_migPending));
+				memset(m_migAcked, 0x00, sizeof(m_migAcked));
+				SendChannelConfig(BROADCAST_ADDRESS, m_migFrom, 0);
+				m_migRetry = millis();
+				_migCancelled++;
+				m_migState = RF_MIG_CANCEL;
+				LOGW(LOGTAG_MSG, "RF channel migration cancelled, %d nodes missing", lv_missing);
+			} else {
+				m_migState = RF_MIG_SWITCH;
+			}
+		}
+		break;
+
+	case RF_MIG_SWITCH:
+		if( lv_elapsed < RF_MIG_DELAY * 1000UL || isTxBusy() ) break;
+		detachInterrupt(GDO2);
+		setChannel(m_migTo);
+		attachInterrupt(GDO2, &RF433ServerClass::PeekMessage, this, FALLING);
+		memset(m_migAcked, 0x00, sizeof(m_migAcked));
+		m_migRetried = false;
+		m_migStart = millis();
+		m_migState = RF_MIG_VERIFY;
+		SendChannelConfig(BROADCAST_ADDRESS, m_migTo, 0);
+		break;
+
+	case RF_MIG_VERIFY:
+		if( !m_migRetried ) {
+			if( lv_elapsed < RF_MIG_VERIFY_TIME / 2 ) break;
+			m_migRetried = true;
+			CheckMigrationAcks(true);
+		} else if( lv_elapsed >= RF_MIG_VERIFY_TIME ) {
+			lv_missing = CheckMigrationAcks(false);
+			if( lv_missing == 0 ) {
+				// Radio is already there, only save it
+				theConfig.SetRFChannel(m_migTo);
+				_migDone++;
+				m_migState = RF_MIG_IDLE;
+				LOGN(LOGTAG_MSG, "RF channel migrated to %d", m_migTo);
+			} else {
+				// Whoever followed goes back with us
+				SendChannelConfig(BROADCAST_ADDRESS, m_migFrom, RF_MIG_REVERT_DELAY);
+				_migReverted++;
+				m_migStart = millis();
+				m_migState = RF_MIG_REVERT;
+				LOGW(LOGTAG_MSG, "RF channel migration reverted, %d nodes missing", lv_missing);
+			}
+		}
+		break;
+
+	case RF_MIG_CANCEL:
+		if( lv_elapsed < RF_MIG_DELAY * 1000UL ) {
+			if( millis() - m_migRetry < RF_MIG_CANCEL_RETRY ) break;
+			m_migRetry = millis();
+			if( CheckMigrationAcks(true) == 0 ) {
+				m_migState = RF_MIG_IDLE;
+				LOGN(LOGTAG_MSG, "RF channel migration cancel confirmed");
+			}
+			break;
+		}
+		if( isTxBusy() ) break;
+		lv_missing = CheckMigrationAcks(false);
+		if( lv_missing == 0 ) {
+			m_migState = RF_MIG_IDLE;
+			break;
+		}
+		// Missed the cancel and moved at the deadline, call them back from there
+		detachInterrupt(GDO2);
+		setChannel(m_migTo);
+		attachInterrupt(GDO2, &RF433ServerClass::PeekMessage, this, FALLING);
+		for( UC i = 0; i < sizeof(m_migPending); i++ ) m_migPending[i] &= ~m_migAcked[i];
+		for( UC lv_nid = 1; lv_nid < NODEID_DUMMY; lv_nid++ ) {
+			if( m_migPending[lv_nid >> 3] & (1 << (lv_nid & 0x07)) ) SendChannelConfig(lv_nid, m_migFrom, RF_MIG_REVERT_DELAY);
+		}
+		_migReverted++;
+		m_migStart = millis();
+		m_migState = RF_MIG_REVERT;
+		LOGW(LOGTAG_MSG, "RF channel migration, %d nodes missed the cancel", lv_missing);
+		break;
+
+	case RF_MIG_REVERT:
+		if( lv_elapsed < RF_MIG_REVERT_DELAY * 1000UL || isTxBusy() ) break;
+		detachInterrupt(GDO2);
+		setChannel(m_migFrom);
+		attachInterrupt(GDO2, &RF433ServerClass::PeekMessage, this, FALLING);
+		m_migState = RF_MIG_IDLE;
+		break;
+	}
+}
+
+void RF433ServerClass::ShowChannelSurvey()
+{
+	const char *strMigState[] = {"idle", "prepare", "switch", "verify", "revert", "cancel"};
+	SERIAL_LN("** Channel survey %s, best %d, migration %s %d->%d, done %lu, cancelled %lu, reverted %lu **",
+			m_surveyMode == RF_SURVEY_AUTO ? "auto" : (m_surveyMode == RF_SURVEY_ON ? "on" : "off"),
+			GetBestChannel(), strMigState[m_migState], m_migFrom, m_migTo,
+			_migDone, _migCancelled, _migReverted);
+	SERIAL_LN("  ch    n  avg peak busy  hist from %ddBm by %ddB", RF_NOISE_MIN_DB, RF_NOISE_BIN_DB);
+	for( UC i = 0; i < m_surveyCount; i++ ) {
+		SERIAL("%c%3d %5lu %4d %4d %3lu%%", (i == 0 ? '*' : ' '), m_survey[i].channel, m_survey[i].samples,
+				m_survey[i].avg / 16, m_survey[i].peak,
+				(m_survey[i].samples > 0 ? m_survey[i].busy * 100 / m_survey[i].samples : 0));
+		for( UC j = 0; j < RF_NOISE_BINS; j++ ) {
+			SERIAL(" %u", m_survey[i].hist[j]);
+		}
+		SERIAL_LN("");
+	}
+	SERIAL_LN("");
+}
+
+//------------------------------------------------------------------
+// Receive handlers
+//------------------------------------------------------------------
+bool RF433ServerClass::OnNodeConfig(rf_rx_ctx_t &ctx)
+{
+	if( ctx.isAck && ctx.sensor == NCF_QUERY ) {
+		theSys.GotNodeConfigAck(ctx.replyTo, ctx.payload);
+	} else if( ctx.isAck && ctx.sensor == NCF_DEV_SET_RF_CHANNEL ) {
+		// Channel migration, only acks of the channel being moved to, or staying on if cancelled, count
+		UC lv_channel = (m_migState == RF_MIG_CANCEL ? m_migFrom : m_migTo);
+		if( m_migState != RF_MIG_IDLE && ctx.payl_len > 0 && ctx.payload[0] == lv_channel ) {
+			m_migAcked[ctx.replyTo >> 3] |= (1 << (ctx.replyTo & 0x07));
+		}
+	}
+	return false;
+}
+
+// Reboot request for another node, forwarded with its token as the cloud command does
+bool RF433ServerClass::OnNodeReboot(rf_rx_ctx_t &ctx)
+{
+	UC transTo = msg.getDestination();
+	ListNode<DevStatusRow_t> *DevStatusRowPtr = theSys.SearchDevStatus(transTo);
+	if( transTo == getAddress() || !DevStatusRowPtr ) {
+		LOGW(LOGTAG_MSG, "Reboot of node:%d from:%d dropped, unknown node", transTo, ctx.replyTo);
+		return false;
+	}
+
+	MyMessage lv_msg;
+	lv_msg.build(ctx.replyTo, transTo, ctx.sensor, C_INTERNAL, I_REBOOT, false);
+	lv_msg.set((unsigned int)DevStatusRowPtr->data.token);
+	BOOL rc = ProcessSend(&lv_msg);
+	LOGN(LOGTAG_MSG, "Node:%d reboot requested by node:%d%s", transTo, ctx.replyTo, rc ? "" : ", not queued");
+	return false;
+}
+
+// Presentation message: appear of Smart Lamp
+// Verify credential, return token if true, and change device status
+bool RF433ServerClass::OnPresentation(rf_rx_ctx_t &ctx)
+{
+	// Power mode is opt-in, told by a flags byte after the identity
+	UC lv_flags = (ctx.payl_len > sizeof(uint64_t) ? ctx.payload[sizeof(uint64_t)] : 0);
+	UC lv_period = (lv_flags >> RF_WOR_PERIOD_SHIFT);
+	SetNodePower(ctx.replyTo, lv_flags & RF_NODE_POWER_MASK,
+			(lv_period > 0 ? lv_period * RF_WOR_PERIOD_UNIT + RF_WOR_MARGIN : WOR_WAKE_TIME));
+	// So are the capabilities, in the byte after
+	UC lv_caps = (ctx.payl_len > sizeof(uint64_t) + 1 ? ctx.payload[sizeof(uint64_t) + 1] : 0);
+	theSys.SetPackedScene(ctx.replyTo, lv_caps & RF_NODE_CAP_PACKED_SCENE);
+
+	if( !ctx.needAck ) return false;
+
+	uint64_t nIdentity = msg.getUInt64();
+	US token = random(65535);
+	theSys.UpdateNodeList(ctx.replyTo, 0, ctx.type, nIdentity, token);
+	LOGN(LOGTAG_MSG, "Node:%d presence!", ctx.replyTo);
+	if( token ) {
+		// return token
+		// Notes: lampType & S_LIGHT (msgType) are not necessary, use for associated device
+		msg.build(getAddress(), ctx.replyTo, ctx.sensor, C_PRESENTATION, ctx.type, false, true);
+		msg.set((unsigned int)token);
+		return true;
+	}
+	return false;
+}
+
+bool RF433ServerClass::OnMotion(rf_rx_ctx_t &ctx)
+{
+	theSys.UpdateMotion(ctx.replyTo, ctx.sensor, msg.getByte());
+	return false;
+}
+
+bool RF433ServerClass::OnBrightness(rf_rx_ctx_t &ctx)
+{
+	theSys.UpdateBrightness(ctx.replyTo, msg.getByte());
+	return false;
+}
+
+bool RF433ServerClass::OnSound(rf_rx_ctx_t &ctx)
+{
+	theSys.UpdateSound(ctx.replyTo, ctx.payload[0]);
+	return false;
+}
+
+bool RF433ServerClass::OnNoise(rf_rx_ctx_t &ctx)
+{
+	const rf_pl_level_t *pData = (const rf_pl_level_t *)ctx.payload;
+	theSys.UpdateNoise(ctx.replyTo, pData->value);
+	return false;
+}
+
+// V_LEVEL carries both, V_TEMP or V_HUM carries one of them
+bool RF433ServerClass::OnDHT(rf_rx_ctx_t &ctx)
+{
+	const rf_pl_dht_t *pData = (const rf_pl_dht_t *)ctx.payload;
+	float lv_flt1 = 255, lv_flt2 = 255;
+	if( ctx.type == V_LEVEL ) {
+		lv_flt1 = pData->tempInt + pData->tempDec / 100.0;
+		lv_flt2 = pData->humiInt + pData->humiDec / 100.0;
+	} else if( ctx.type == V_TEMP ) {
+		lv_flt1 = pData->tempInt + pData->tempDec / 100.0;
+	} else {
+		// Humidity is in the first two bytes
+		lv_flt2 = pData->tempInt + pData->tempDec / 100.0;
+	}
+	theSys.UpdateDHT(ctx.replyTo, lv_flt1, lv_flt2);
+	return false;
+}
+
+bool RF433ServerClass::OnDust(rf_rx_ctx_t &ctx)
+{
+	const rf_pl_level_t *pData = (const rf_pl_level_t *)ctx.payload;
+	theSys.UpdateDust(ctx.replyTo, pData->value);
+	return false;
+}
+
+// Full air quality frame, or gas level only
+bool RF433ServerClass::OnAirQuality(rf_rx_ctx_t &ctx)
+{
+	if( ctx.payl_len >= sizeof(rf_pl_airq_t) ) {
+		const rf_pl_airq_t *pData = (const rf_pl_airq_t *)ctx.payload;
+		theSys.UpdateAirQuality(ctx.replyTo, pData->pm25, pData->pm10, pData->tvoc / 10.0, pData->ch2o / 10.0, pData->co2);
+	} else {
+		const rf_pl_level_t *pData = (const rf_pl_level_t *)ctx.payload;
+		theSys.UpdateGas(ctx.replyTo, pData->value);
+	}
+	return false;
+}
+
+bool RF433ServerClass::OnSmoke(rf_rx_ctx_t &ctx)
+{
+	const rf_pl_level_t *pData = (const rf_pl_level_t *)ctx.payload;
+	theSys.UpdateSmoke(ctx.replyTo, pData->value);
+	return false;
+}
+
+// Device status ack (or request) to be confirmed and transferred
+bool RF433ServerClass::OnDeviceStatus(rf_rx_ctx_t &ctx)
+{
+	UC transTo = msg.getDestination();
+	UC *payload = ctx.payload;
+	BOOL bLampDataChanged = false;
+	if( ctx.isAck ) {
+		switch( ctx.type ) {
+		case V_STATUS:
+			if( IS_LAMP_NODEID(ctx.replyTo) ) {
+				bLampDataChanged |= theSys.ConfirmLampOnOff(ctx.replyTo, ctx.sensor, payload[0]);
+			}
+			break;
+		case V_PERCENTAGE:
+			bLampDataChanged |= theSys.ConfirmLampBrightness(ctx.replyTo, ctx.sensor, payload[0], payload[1]);
+			break;
+		case V_LEVEL:
+			bLampDataChanged |= theSys.ConfirmLampCCT(ctx.replyTo, ctx.sensor, (US)msg.getUInt());
+			break;
+		case V_RGBW: {
+			// lamp timing status msg
+			const rf_pl_ring_t *pRing = (const rf_pl_ring_t *)payload;
+			if( pRing->ok ) {	// Succeed or not
+				static bool bFirstRGBW = true;		// Make sure the first message will be sent anyway
+				UC filter = payload[ctx.payl_len-1];
+				if( IS_SUNNY(pRing->devType) ) {
+					// Sunny
+					bLampDataChanged |= theSys.ConfirmLampSunnyStatus(ctx.replyTo, ctx.sensor, pRing->state, pRing->br, pRing->cct, filter, pRing->ringID);
+					bLampDataChanged |= bFirstRGBW;
+					bFirstRGBW = false;
+				} else if( IS_RAINBOW(pRing->devType) || IS_MIRAGE(pRing->devType) ) {
+					// Rainbow or Mirage, set RBGW
+					bLampDataChanged |= theSys.ConfirmLampHue(ctx.replyTo, ctx.sensor, pRing->hue.W, pRing->hue.R, pRing->hue.G, pRing->hue.B, pRing->ringID);
+					bLampDataChanged |= theSys.ConfirmLampBrightness(ctx.replyTo, ctx.sensor, pRing->state, pRing->br, pRing->ringID);
+					bLampDataChanged |= bFirstRGBW;
+					bFirstRGBW = false;
+				}
+			}
+			break;
+		}
+		case V_VAR1:
+			// Change special effect ack
+			bLampDataChanged |= theSys.ConfirmLampFilter(ctx.replyTo, ctx.sensor, payload[0]);
+			break;
+		case V_DISTANCE:
+			// payload[1] is device type, payload[2] is present status
+			if( payload[0] && IS_MIRAGE(payload[1]) ) {
+				bLampDataChanged |= theSys.ConfirmLampTop(ctx.replyTo, ctx.sensor, payload, ctx.payl_len);
+			}
+			break;
+		case V_RELAY_MAP: {
+			// Publish Relay Status
+			String strTemp = String::format("{'nd':%d,'subid':%d,'km':%d}", ctx.replyTo, ctx.sensor, payload[0]);
+			theSys.PublishMsg(CLT_ID_DeviceStatus, strTemp.c_str(), strTemp.length(), ctx.replyTo, 1);
+			theSys.UpdateNodeList(ctx.replyTo, ctx.sensor);
+			break;
+		}
+		}
+
+		// If data changed, new status must broadcast to all end points
+		if( bLampDataChanged ) {
+			transTo = BROADCAST_ADDRESS;
+		}
+	} /* else { // Request
+		// ToDo: verify token
+	} */
+
+	// ToDo: if lamp is not present, return error
+	if( transTo > 0 ) {
+		// Transfer message
+		msg.build(ctx.replyTo, transTo, ctx.sensor, C_REQ, ctx.type, ctx.needAck, ctx.isAck, true);
+		// Keep payload unchanged
+		return true;
+	}
+	return false;
+}
+
+/////////////////// add by zql for airconditioning//////////////////////////////////////////////////////////////
+bool RF433ServerClass::OnACCurrent(rf_rx_ctx_t &ctx)
+{
+	theSys.UpdateNodeList(ctx.replyTo, ctx.sensor);
+	if( ctx.payl_len >= sizeof(rf_pl_level_t) ) {
+		// electric current change msg
+		const rf_pl_level_t *pData = (const rf_pl_level_t *)ctx.payload;
+		LOGD(LOGTAG_MSG, "Recv nd:%d current msg:%d", ctx.replyTo, pData->value);
+		theACManager.UpdateACCurrentByNodeid(ctx.replyTo, pData->value);
+	}
+	return false;
+}
+
+bool RF433ServerClass::OnACQuantity(rf_rx_ctx_t &ctx)
+{
+	theSys.UpdateNodeList(ctx.replyTo, ctx.sensor);
+	if( ctx.payl_len >= sizeof(rf_pl_kwh_t) ) {
+		const rf_pl_kwh_t *pData = (const rf_pl_kwh_t *)ctx.payload;
+		LOGD(LOGTAG_MSG, "Recv eq msg,nd:%d,eq:%d,index=%d,current:%d,reset:%d", ctx.replyTo, pData->quantity, pData->index, pData->current, pData->reset);
+		theACManager.UpdateACByNodeid(ctx.replyTo, pData->current, pData->quantity, pData->index, pData->reset);
+		if( ctx.needAck ) {
+			msg.build(msg.getDestination(), ctx.replyTo, ctx.sensor, C_REQ, ctx.type, 0, 1, true);
+			return true;
+		}
+	} else if( ctx.payl_len >= 4 ) {
+		// Same thresholds as before the table, current may sit past a 4 byte payload
+		const rf_pl_kwh16_t *pData = (const rf_pl_kwh16_t *)ctx.payload;
+		LOGD(LOGTAG_MSG, "Recv eq msg,nd:%d,eq:%d,index=%d,current:%d", ctx.replyTo, pData->quantity, pData->index, pData->current);
+		theACManager.UpdateACByNodeid(ctx.replyTo, pData->current, pData->quantity, pData->index);
+	}
+	return false;
+}
+
+bool RF433ServerClass::OnACStatus(rf_rx_ctx_t &ctx)
+{
+	theSys.UpdateNodeList(ctx.replyTo, ctx.sensor);
+	if( ctx.payl_len >= sizeof(rf_pl_acstatus_t) ) {
+		const rf_pl_acstatus_t *pData = (const rf_pl_acstatus_t *)ctx.payload;
+		LOGD(LOGTAG_MSG, "Recv acstatus msg,nd:%d,onoff:%d,mode=%d,temp:%d,fanlevel:%d", ctx.replyTo, pData->onoff, pData->mode, pData->temp, pData->fanlevel);
+		theACManager.UpdateACStatusByNodeid(ctx.replyTo, pData->onoff, pData->mode, pData->temp, pData->fanlevel);
+	}
+	return false;
+}
+/////////////////// add by zql for airconditioning end//////////////////////////////////////////////////////////
+
+// Fragment of a logical message, or reassembly status of ours
+bool RF433ServerClass::OnFragment(rf_rx_ctx_t &ctx)
+{
+	if( ctx.isAck ) {
+		OnFragmentStatus(ctx);
+		return false;
+	}
+
+	const rf_frag_hdr_t *pHdr = (const rf_frag_hdr_t *)ctx.payload;
+	if( pHdr->count == 0 || pHdr->count > RF_FRAG_MAX_COUNT || pHdr->index >= pHdr->count ) {
+		LOGD(LOGTAG_MSG, "Bad fragment %d of %d from:%d", pHdr->index, pHdr->count, ctx.replyTo);
+		return false;
+	}
+
+	rf_frag_buf_t *pBuf = NULL, *pFree = NULL;
+	for( UC i = 0; i < RF_FRAG_MAX_RX; i++ ) {
+		if( m_fragRx[i].state == RF_FRAG_FREE ) {
+			if( !pFree ) pFree = m_fragRx + i;
+		} else if( m_fragRx[i].node == ctx.replyTo && m_fragRx[i].msgID == pHdr->msgID ) {
+			pBuf = m_fragRx + i;
+			break;
+		}
+	}
+	if( !pBuf ) {
+		if( !pFree ) {
+			LOGW(LOGTAG_MSG, "No reassembly buffer for fragment from:%d", ctx.replyTo);
+			return false;
+		}
+		pBuf = pFree;
+		pBuf->state = RF_FRAG_RECEIVING;
+		pBuf->node = ctx.replyTo;
+		pBuf->msgID = pHdr->msgID;
+		pBuf->count = pHdr->count;
+		pBuf->cap = pHdr->cap;
+		pBuf->type = ctx.type;
+		pBuf->sensor = ctx.sensor;
+		pBuf->len = 0;
+		pBuf->done = 0;
+	}
+	pBuf->time = millis();
+
+	if( pBuf->state == RF_FRAG_RECEIVING && pHdr->count == pBuf->count ) {
+		UC lv_offset = pHdr->index * RF_FRAG_DATA_SIZE;
+		UC lv_size = ctx.payl_len - RF_FRAG_HDR_SIZE;
+		if( lv_size > RF_FRAG_DATA_SIZE ) lv_size = RF_FRAG_DATA_SIZE;
+		memcpy(pBuf->data + lv_offset, ctx.payload + RF_FRAG_HDR_SIZE, lv_size);
+		pBuf->done = BITSET(pBuf->done, pHdr->index);
+		if( pHdr->index == pBuf->count - 1 ) pBuf->len = lv_offset + lv_size;
+
+		if( pBuf->done == BITMASK(pBuf->count) - 1 ) {
+			pBuf->state = RF_FRAG_COMPLETE;
+			_fragRxMsgs++;
+			SendFragmentStatus(pBuf);
+
+			// Deliver as the original message, msg keeps the first MAX_PAYLOAD bytes
+			rf_rx_ctx_t lv_ctx = ctx;
+			msg.set((void *)pBuf->data, pBuf->len > MAX_PAYLOAD ? MAX_PAYLOAD : pBuf->len);
+			msg.msg.header.command_ack_payload = pBuf->cap;
+			lv_ctx.isAck = msg.isAck();
+			lv_ctx.needAck = msg.isReqAck();
+			lv_ctx.payload = pBuf->data;
+			lv_ctx.payl_len = pBuf->len;
+			LOGD(LOGTAG_MSG, "Reassembled msg %d len:%d from:%d", pBuf->msgID, pBuf->len, ctx.replyTo);
+			DispatchMessage(msg.getCommand(), lv_ctx);
+			return false;
+		}
+	}
+
+	// Duplicates of a delivered message get the full bitmap again
+	if( ctx.needAck ) SendFragmentStatus(pBuf);
+	return false;
+}
+
 // Scan sendMQ and send messages, repeat if necessary
+// Hand one frame to the radio per call and return without waiting for
+// the end of TX or the ack
 bool RF433ServerClass::ProcessSendMQ()
 {
 	MyMessage lv_msg;
-	MyMessage resmsg;
-	uint8_t reslen = 0;
 	UC *pData = (UC *)&(lv_msg.msg);
 	CFastMessageNode *pNode = NULL, *pOld;
 	UC _repeat;
 	UC _tag = 0;
 	uint32_t _flag = 0;
 	bool _remove = false;
+	UL lv_ticks;
+	UC lv_dest;
+
+	// Previous frame is still on air
+	if( isTxBusy() ) return true;
+
+	// Long preamble to a WOR node, only its frames may follow
+	if( m_wakeNode ) {
+		if( !isWakeReady() ) return true;
+		rf_sleepy_t *pSleepy = SearchSleepy(m_wakeNode);
+		if( pSleepy ) pSleepy->lastAwake = millis();
+	}
+
+	// Fragments go out between unicast messages, never while one waits for ack
+	if( !m_ackPending && ProcessSendFragment() ) return true;
+
+	// Previous unicast message is waiting for ack
+	if( m_ackPending ) {
+		if( _sentID != 0 && millis() - m_ackWaitStart < m_ackTimeout ) return true;
+		// The link table is also updated by PeekMessage
+		detachInterrupt(GDO2);
+		UpdateLinkAck(m_ackNode, _sentID == 0, m_ackRTT);
+		attachInterrupt(GDO2, &RF433ServerClass::PeekMessage, this, FALLING);
+		// Remove message if succeeded or retried enough times
+		if( _sentID == 0 || m_ackRepeat > GetLinkRetries(m_ackNode) ) {
+			RemoveMessage(m_ackPending);
+		}
+		m_ackPending = NULL;
+		_sentID = 0;
+	}
+
 	if( GetMQLength() > 0 ) {
 		while( pNode = GetMessage(pNode) ) {
 			pOld = pNode;
 			// Next node
 			pNode = pOld->m_pNext;
+			// Destination is in the lowest byte of flag
+			lv_dest = (UC)(pOld->m_iFlag & 0xFF);
+			if( m_wakeNode && lv_dest != m_wakeNode ) continue;
+			if( NeedWake(lv_dest) ) {
+				StartWake(lv_dest);
+				break;
+			}
 			// Get message data
 			if( pOld->ReadMessage(pData, &_repeat, &_tag, &_flag,15) > 0 )
 			{
-				// Send message
+				// Load TX FIFO and strobe, the end of TX is signalled by GDO2
+				_sentID = lv_msg.getDestination();
+				lv_ticks = System.ticks();
 				detachInterrupt(GDO2);
 				_remove = send(lv_msg.getDestination(), lv_msg);
 				attachInterrupt(GDO2, &RF433ServerClass::PeekMessage, this, FALLING);
-	      _sentID = lv_msg.getDestination();
+				lv_ticks = System.ticks() - lv_ticks;
+				if( !_remove ) break;
+				if( lv_dest == m_wakeNode ) m_wakeNode = 0;
+				_txFrames++;
+				_txCpuTicks += lv_ticks;
+				if( lv_ticks > _txCpuMax ) _txCpuMax = lv_ticks;
 				LOGD(LOGTAG_MSG, "RF-send msg %d-%d tag %d to %d tried %d id=%d", lv_msg.getCommand(), lv_msg.getType(), _tag, lv_msg.getDestination(), _repeat,_sentID);
 				if( lv_msg.getDestination() == BROADCAST_ADDRESS || lv_msg.getDestination() == BROADCAST_ADDRESS1)
 				{
           _remove = (_repeat > theConfig.GetBcMsgRptTimes());
 				}
+				else if(lv_msg.getCommand() == C_STREAM && lv_msg.isAck())
+				{
+					// Reassembly status is not acked, the peer asks again
+					_remove = true;
+				}
+				else if(lv_msg.getCommand() == C_INTERNAL && lv_msg.getType() == I_CONFIG)
+				{
+					_remove = (_repeat > GetLinkRetries(lv_msg.getDestination()));
+				}
 				else
 				{
-					if(lv_msg.getCommand() == C_INTERNAL && lv_msg.getType() == I_CONFIG)
-					{
-						_remove = (_repeat > theConfig.GetNdMsgRptTimes());
-					}
-					else
-					{
-						_remove = false;
-						// wait for ack
-						while(_ackWaitTick < ACK_TIMEOUT)
-						{
-							if(_sentID != 0)
-							{// wait for ack
-								_ackWaitTick++;                               //increment ACK wait counter
-								delay(1);
-							}
-							else
-							{
-								_remove = true;
-								break;
-							}
-						}
-						_ackWaitTick = 0;
-						if( !_remove && _repeat > theConfig.GetNdMsgRptTimes() ) 	_remove = true;
-					}
-					/*if(reslen > 0)
-					{
-						LOGD(LOGTAG_MSG, "Receive real-time msg len=%d sender:%d dest:%d cmd:%d type:%d sensor:%d payl-len:%d",
-							 reslen,resmsg.getSender(), resmsg.getDestination(), resmsg.getCommand(),
-							 resmsg.getType(), resmsg.getSensor(), resmsg.getLength());
-						uint8_t *lv_pData = (uint8_t *)&(resmsg.msg);
-						Append(lv_pData, reslen);
-					}
-					if( _repeat > theConfig.GetNdMsgRptTimes() ) 	_remove = true;*/
+					// Check ack in later calls
+					_remove = false;
+					m_ackPending = pOld;
+					m_ackWaitStart = millis();
+					m_ackRepeat = _repeat;
+					m_ackNode = lv_msg.getDestination();
+					m_ackTimeout = GetLinkAckTimeout(m_ackNode);
+					m_ackRTT = 0;
 				}
-				// Remove message if succeeded or retried enough times
 				if( _remove ) {
 					RemoveMessage(pOld);
 				}
+				// The radio is busy until this frame is on air
+				break;
 			}
 		}
 	}
 
+	// Nothing left for the woken node
+	if( m_wakeNode && isWakeReady() ) {
+		cancelWake();
+		m_wakeNode = 0;
+	}
+
 	return true;
 }
 
@@ -814,6 +1956,5 @@ bool RF433ServerClass::SendNodeConfig(UC _node, UC _ncf, UC *_data, const UC _le
 	// Notify Remote Node
 	MyMessage lv_msg;
 	lv_msg.build(NODEID_GATEWAY, _node, _ncf, C_INTERNAL, I_CONFIG, true);
-	lv_msg.set((void*)_data, _len);
-	return ProcessSend(&lv_msg);
+	return SendFragmented(lv_msg, _data, _len);
 }
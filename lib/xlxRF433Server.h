@@ -7,6 +7,325 @@
 #include "MessageQ.h"
 #include "MyTransport433.h"
 
+// Wildcard of sensor or type in receive dispatch table
+#define RF_RX_ANY               0xFF
+
+// Maximum distinct unknown (command, sensor, type) combinations tracked
+#define RF_RX_MAX_UNKNOWN       8
+
+// Internal command ID, same as <msgID> of console command "node[-subID]:msgID[:payload]"
+#define RF_CMD_SERIAL           0           // Free style MySensors serial message, string only
+#define RF_CMD_NODE_ID          1           // Assign node ID, or reboot node if 0
+#define RF_CMD_NODE_CONFIG      2
+#define RF_CMD_PRESENT_TEMP     3
+#define RF_CMD_GET_POWER        6
+#define RF_CMD_SET_POWER        7
+#define RF_CMD_GET_BR           8
+#define RF_CMD_SET_BR           9
+#define RF_CMD_GET_CCT          10
+#define RF_CMD_SET_CCT          11
+#define RF_CMD_GET_STATUS       12
+#define RF_CMD_SET_STATUS       13
+#define RF_CMD_SCENARIO         15
+#define RF_CMD_EFFECT           17
+#define RF_CMD_BASE_CONFIG      20
+
+// Link quality table
+#define RF_LINK_TABLE_SIZE      MAX_NODE_PER_CONTROLLER
+#define RF_LINK_EWMA_WEIGHT     8           // New sample counts 1/8
+#define RF_LINK_MIN_SAMPLES     4           // Ack samples before adapting
+#define RF_LINK_GOOD_ACK        900         // Ack rate (permille) of a good link
+#define RF_LINK_BAD_ACK         500         // Ack rate (permille) of a bad link
+#define RF_LINK_WEAK_RSSI       -90         // dBm
+#define RF_MAX_RETRIES          15
+#define RF_MIN_ACK_TIMEOUT      200         // ms
+#define RF_MAX_ACK_TIMEOUT      1500        // ms
+
+// Airtime estimate of one frame at the configured 2 kbps GFSK
+#define RF_AIR_OVERHEAD         33          // Preamble 24, sync 4, length, 2 addresses and CRC 2
+#define RF_AIR_BYTE_US          4000
+
+// Fragmentation of logical messages longer than MAX_PAYLOAD, sent as C_STREAM
+#define RF_FRAG_HDR_SIZE        4
+#define RF_FRAG_DATA_SIZE       (MAX_PAYLOAD - RF_FRAG_HDR_SIZE)
+#define RF_FRAG_MAX_COUNT       15          // Fit in US bitmap
+#define RF_FRAG_MAX_SIZE        240         // Data area of NodeConfig_t
+#define RF_FRAG_MAX_TX          2           // Outgoing logical messages
+#define RF_FRAG_MAX_RX          2           // Reassembly buffers
+#define RF_FRAG_RX_TIMEOUT      5000        // ms
+
+// Sleepy nodes, only those telling so in the flags byte of presentation.
+// Bits 2..7 of the byte are the WOR polling period in RF_WOR_PERIOD_UNIT,
+// 0 for EVENT0 of wor_enable(). Nothing is received during the preamble,
+// so it is the period plus RF_WOR_MARGIN rather than a fixed worst case.
+#define RF_NODE_SLEEPY          0x01        // Sleeps between uplinks, mail waits for the next one
+#define RF_NODE_WOR             0x02        // Polls with WOR, woken by long preamble
+#define RF_NODE_POWER_MASK      0x03
+#define RF_WOR_PERIOD_SHIFT     2
+#define RF_WOR_PERIOD_UNIT      50          // ms
+#define RF_WOR_MARGIN           60          // ms, covers the RX window and clock drift
+#define RF_SLEEPY_NODES         8
+#define RF_MAILBOX_DEPTH        2
+#define RF_MAILBOX_EXPIRE       600000      // ms
+#define RF_NODE_AWAKE_TIME      1000        // ms a node listens after uplink or wake
+
+// Capabilities, a second byte after the flags byte of presentation.
+// Nodes leaving it out are legacy and get the old frames
+#define RF_NODE_CAP_PACKED_SCENE 0x01       // Parses the packed scene frame of V_RGBW
+
+// Channel survey, one RSSI sample per interval while the radio is idle
+#define RF_SURVEY_CHANNELS      9           // Home channel and a grid of candidates
+#define RF_SURVEY_STEP          16          // Grid step of candidate channels
+#define RF_SURVEY_INTERVAL      1000        // ms between samples
+#define RF_NOISE_BINS           8           // Histogram bins of RF_NOISE_BIN_DB
+#define RF_NOISE_MIN_DB         -110        // Lower edge of the first bin
+#define RF_NOISE_BIN_DB         10
+#define RF_NOISE_BUSY_DB        -90         // Sample above it counts as busy
+#define RF_SURVEY_MIN_SAMPLES   32          // Samples of a channel before comparing
+#define RF_SURVEY_OFF           0
+#define RF_SURVEY_ON            1           // Sample only
+#define RF_SURVEY_AUTO          2           // Sample and migrate to a quieter channel
+
+// Channel migration
+#define RF_MIG_MARGIN_DB        6           // Average noise gain to migrate automatically
+#define RF_MIG_HOLDOFF          3600000     // ms between automatic migrations
+#define RF_MIG_ACTIVE_TIME      600000      // ms, nodes heard within it must follow
+#define RF_MIG_DELAY            10          // Seconds from prepare to switch
+#define RF_MIG_ACK_WINDOW       3000        // ms per round of prepare acks
+#define RF_MIG_VERIFY_TIME      5000        // ms to hear all nodes on the new channel
+#define RF_MIG_REVERT_DELAY     3           // Seconds from move back to switch back
+#define RF_MIG_CANCEL_RETRY     1000        // ms between cancels to nodes not confirmed
+
+// State of channel migration
+#define RF_MIG_IDLE             0
+#define RF_MIG_PREPARE          1           // Collecting acks on the old channel
+#define RF_MIG_SWITCH           2           // All acked, waiting for the deadline
+#define RF_MIG_VERIFY           3           // On the new channel, collecting acks again
+#define RF_MIG_REVERT           4           // Nodes told to move back
+#define RF_MIG_CANCEL           5           // Nodes acked the prepare have to confirm the cancel
+
+// State of fragment buffer
+#define RF_FRAG_FREE            0
+#define RF_FRAG_SENDING         1           // Fragments left in this round
+#define RF_FRAG_WAITING         2           // Waiting for reassembly status
+#define RF_FRAG_RECEIVING       3
+#define RF_FRAG_COMPLETE        4           // Delivered, kept to re-ack duplicates
+
+//------------------------------------------------------------------
+// Typed payload views, little endian as sent by the nodes
+//------------------------------------------------------------------
+// Sensor level, e.g. noise, dust, gas and smoke
+typedef struct
+	__attribute__((packed))
+{
+  US value;
+} rf_pl_level_t;
+
+// Temperature and humidity, integer and hundredths
+typedef struct
+	__attribute__((packed))
+{
+  UC tempInt;
+  UC tempDec;
+  UC humiInt;
+  UC humiDec;
+} rf_pl_dht_t;
+
+// Air quality, TVOC & CH2O in 0.1 unit
+typedef struct
+	__attribute__((packed))
+{
+  US pm25;
+  US pm10;
+  US tvoc;
+  US ch2o;
+  US co2;
+} rf_pl_airq_t;
+
+// Lamp ring status (V_RGBW ack)
+typedef struct
+	__attribute__((packed))
+{
+  UC ok;
+  UC devType;
+  UC present;
+  UC ringID;
+  UC state;
+  UC br;
+  union {
+    US cct;                         // Sunny
+    struct {
+      UC W;
+      UC R;
+      UC G;
+      UC B;
+    } hue;                          // Rainbow or Mirage
+  };
+} rf_pl_ring_t;
+
+// AC electricity quantity (V_KWH), long form
+typedef struct
+	__attribute__((packed))
+{
+  UL quantity;
+  US index;
+  US current;
+  UC reset;
+} rf_pl_kwh_t;
+
+// AC electricity quantity (V_KWH), short form
+typedef struct
+	__attribute__((packed))
+{
+  US quantity;
+  US index;
+  US current;
+} rf_pl_kwh16_t;
+
+// AC status (V_HVAC_FLOW_STATE)
+typedef struct
+	__attribute__((packed))
+{
+  UC onoff;
+  UC mode;
+  UC temp;
+  UC fanlevel;
+} rf_pl_acstatus_t;
+
+// Fragment header, at the start of C_STREAM payload
+typedef struct
+	__attribute__((packed))
+{
+  UC msgID;
+  UC index;                         // Fragment index, 0 in status
+  UC count;                         // Number of fragments
+  UC cap;                           // command_ack_payload of the logical message
+} rf_frag_hdr_t;
+
+// Reassembly status, C_STREAM ack of the last fragment in a round
+typedef struct
+	__attribute__((packed))
+{
+  rf_frag_hdr_t hdr;
+  US received;                      // Bitmap of received fragments
+} rf_frag_status_t;
+
+// Outgoing or reassembling logical message
+typedef struct
+{
+  UC state;                         // RF_FRAG_*
+  UC node;                          // Peer
+  UC sender;                        // Origin of the logical message (tx)
+  UC msgID;
+  UC count;
+  UC cap;
+  UC type;
+  UC sensor;
+  UC len;
+  UC rounds;                        // Status rounds without completion
+  US done;                          // Fragments confirmed (tx) or received (rx)
+  US pending;                       // Fragments to send in this round (tx)
+  UL time;                          // Start of status wait (tx) or last fragment (rx)
+  UC data[RF_FRAG_MAX_SIZE];
+} rf_frag_buf_t;
+
+// Power mode and mailbox of a sleepy node
+typedef struct
+{
+  UC nid;                           // 0 means free slot
+  UC flags;                         // RF_NODE_*
+  UC count;                         // Messages in mailbox
+  US wakeTime;                      // ms of preamble to wake a WOR node
+  UL lastAwake;                     // millis() of last uplink or wake
+  UL stored[RF_MAILBOX_DEPTH];      // millis() when stored
+  UC mail[RF_MAILBOX_DEPTH][MAX_MESSAGE_LENGTH];
+} rf_sleepy_t;
+
+// Noise statistics of a surveyed channel
+typedef struct
+{
+  UC channel;
+  US hist[RF_NOISE_BINS];           // Samples per bin, halved together on overflow
+  UL samples;
+  UL busy;                          // Samples above RF_NOISE_BUSY_DB
+  SHORT avg;                        // EWMA of dBm * 16
+  SHORT peak;                       // dBm
+} rf_chan_stat_t;
+
+// Internal command, typed form of the console command
+typedef struct
+{
+  UC node;
+  UC msgID;                         // RF_CMD_*
+  UC subID;
+  UC replyTo;
+  union {
+    UC newID;                       // RF_CMD_NODE_ID, 0 to reboot
+    UC sw;                          // RF_CMD_SET_POWER
+    UC br;                          // RF_CMD_SET_BR
+    US cct;                         // RF_CMD_SET_CCT
+    UC scenario;                    // RF_CMD_SCENARIO
+    UC filter;                      // RF_CMD_EFFECT
+    struct {
+      UC ncf;
+      US value;
+    } config;                       // RF_CMD_NODE_CONFIG
+    struct {
+      UC br;
+      US cct;                       // CCT, or W if less than 256
+      UC R;
+      UC G;
+      UC B;
+    } status;                       // RF_CMD_SET_STATUS
+    struct {
+      UC nid;
+      UC channel;
+    } base;                         // RF_CMD_BASE_CONFIG
+  };
+} rf_cmd_t;
+
+// Receive queue entry, the ISR latches link quality with the frame
+typedef struct
+{
+  UC data[MAX_MESSAGE_LENGTH];
+  UC from;                          // Last hop, as told by the radio
+  int8_t rssi;
+  UC lqi;
+} rf_rx_frame_t;
+
+// Decoded header of the received message
+typedef struct
+{
+  UC replyTo;
+  UC sensor;
+  UC type;
+  BOOL isAck;
+  BOOL needAck;
+  UC payl_len;
+  UC *payload;
+} rf_rx_ctx_t;
+
+typedef struct
+{
+  UC command;
+  UC sensor;
+  UC type;
+  UL count;
+} rf_rx_unknown_t;
+
+// EWMA of link quality per node
+typedef struct
+{
+  UC nid;
+  UC samples;                       // RSSI/LQI samples, saturated at 255
+  UC acks;                          // Ack samples, saturated at 255
+  SHORT rssi;                       // dBm * 16
+  US lqi;                           // LQI * 16, lower is better
+  US ackRate;                       // Permille
+  US rtt;                           // Ack round trip in ms
+  UL lastSeen;                      // millis()
+} rf_link_t;
+
 // RF433 Server class
 class RF433ServerClass : public MyTransport433, public CDataQueue, public CFastMessageQ
 {
@@ -21,24 +340,160 @@ public:
   bool ProcessSend(String &strMsg, MyMessage &my_msg, const UC _replyTo = 0, const UC _sensor = 0);
   bool ProcessSend(String &strMsg, const UC _replyTo = 0, const UC _sensor = 0); //overloaded
   bool ProcessSend(MyMessage *pMsg = NULL);
+  bool SendCommand(const rf_cmd_t &cmd, MyMessage *pMsg = NULL);
   bool SendNodeConfig(UC _node, UC _ncf, unsigned int _value);
   bool SendNodeConfig(UC _node, UC _ncf, UC *_data, const UC _len);
+  // Send payload of any length up to RF_FRAG_MAX_SIZE with the header of my_msg
+  bool SendFragmented(MyMessage &my_msg, const UC *_data, const UC _len);
+
+  // Sleepy nodes
+  void SetNodePower(UC _nid, UC _flags, US _wakeTime = WOR_WAKE_TIME);
+  UC GetNodePower(UC _nid);
+  bool IsNodeAwake(UC _nid);
+  bool StoreMail(MyMessage &my_msg);
+  UC DeliverMail(UC _nid);
+  void ShowSleepyNodes();
+
+  // Channel survey & migration
+  void SetSurveyMode(UC _mode);
+  UC GetSurveyMode();
+  void ResetSurvey();
+  const rf_chan_stat_t *GetChannelStat(UC _index);
+  UC GetBestChannel();
+  bool StartMigration(UC _channel);
+  UC GetMigrationState();
+  void ShowChannelSurvey();
 
   bool ProcessMQ();
   bool ProcessSendMQ();
   bool ProcessReceiveMQ();
 
   void PeekMessage();
+  void ShowDecoderStatistics();
+
+  // Link quality table
+  void UpdateLinkQuality(UC _nid, int8_t _rssi, UC _lqi);
+  void UpdateLinkAck(UC _nid, bool _acked, US _rtt = 0);
+  UC GetLinkRetries(UC _nid);
+  US GetLinkAckTimeout(UC _nid);
+  const rf_link_t *GetLink(UC _nid);
+  UC GetLinkCount();
+  void ShowLinkTable();
+  UC PublishLinkTable();
 
   unsigned long _times;
   unsigned long _succ;
   unsigned long _received;
 
   unsigned long _sentID;
-  uint16_t _ackWaitTick;
 
+  // Transmit statistics
+  unsigned long _txFrames;          // Frames handed to the radio
+  unsigned long _txCpuTicks;        // CPU cycles spent in handing frames over
+  unsigned long _txCpuMax;          // Maximum CPU cycles of one frame
+  unsigned long _txAirTime;         // On-air time in us, measured by GDO2 interrupt
+
+  // Receive decoder statistics
+  unsigned long _rxUnknown;         // Messages without handler
+  unsigned long _rxShort;           // Payload shorter than the handler requires
+
+  // Fragmentation statistics
+  unsigned long _fragTxMsgs;        // Logical messages delivered
+  unsigned long _fragTxFailed;      // Logical messages given up
+  unsigned long _fragTxFrames;      // Fragments sent, incl. retransmission
+  unsigned long _fragTxRetrans;     // Fragments retransmitted
+  unsigned long _fragRxMsgs;        // Logical messages reassembled
+  unsigned long _fragRxTimeout;     // Reassembly dropped on timeout
+
+  // Sleepy node statistics
+  unsigned long _mailStored;        // Messages kept for sleepy nodes
+  unsigned long _mailDelivered;     // Messages sent after uplink
+  unsigned long _mailReplaced;      // Superseded by a newer message of the same kind
+  unsigned long _mailDropped;       // Dropped on full mailbox or expiry
+  unsigned long _worWakeups;        // Long preambles sent
+
+  // Channel migration statistics
+  unsigned long _migDone;           // Migrations verified
+  unsigned long _migCancelled;      // Nodes missing before the switch
+  unsigned long _migReverted;       // Nodes missing after the switch
+
+  // Receive handlers, referred by the dispatch table
+  // Return true if msg is rebuilt as reply
+  bool OnNodeConfig(rf_rx_ctx_t &ctx);
+  bool OnNodeReboot(rf_rx_ctx_t &ctx);
+  bool OnPresentation(rf_rx_ctx_t &ctx);
+  bool OnMotion(rf_rx_ctx_t &ctx);
+  bool OnBrightness(rf_rx_ctx_t &ctx);
+  bool OnSound(rf_rx_ctx_t &ctx);
+  bool OnNoise(rf_rx_ctx_t &ctx);
+  bool OnDHT(rf_rx_ctx_t &ctx);
+  bool OnDust(rf_rx_ctx_t &ctx);
+  bool OnAirQuality(rf_rx_ctx_t &ctx);
+  bool OnSmoke(rf_rx_ctx_t &ctx);
+  bool OnDeviceStatus(rf_rx_ctx_t &ctx);
+  bool OnACCurrent(rf_rx_ctx_t &ctx);
+  bool OnACQuantity(rf_rx_ctx_t &ctx);
+  bool OnACStatus(rf_rx_ctx_t &ctx);
+  bool OnFragment(rf_rx_ctx_t &ctx);
+
+protected:
+  void AddUnknown(UC _cmd, UC _sensor, UC _type);
+  rf_link_t *SearchLink(UC _nid, BOOL bCreate = false);
+  void DispatchMessage(UC _cmd, rf_rx_ctx_t &ctx);
+  bool ProcessSendFragment();
+  void OnFragmentStatus(rf_rx_ctx_t &ctx);
+  void SendFragmentStatus(rf_frag_buf_t *pBuf);
+  void ExpireFragments();
+  rf_sleepy_t *SearchSleepy(UC _nid, BOOL bCreate = false);
+  bool NeedWake(UC _nid);
+  bool StartWake(UC _nid);
+  void ExpireMail();
+  bool IsRadioIdle();
+  void SurveyChannel();
+  void ProcessMigration();
+  void SendChannelConfig(UC _node, UC _channel, UC _delay);
+  UC CheckMigrationAcks(bool bRetry);
+
+private:
+  rf_rx_unknown_t m_rxUnknown[RF_RX_MAX_UNKNOWN];
+
+  // Unicast message waiting for ack
+  CFastMessageNode *m_ackPending;
+  UL m_ackWaitStart;
+  UC m_ackRepeat;
+  UC m_ackNode;
+  US m_ackTimeout;
+  volatile US m_ackRTT;
+
+  rf_link_t m_links[RF_LINK_TABLE_SIZE];
+  UC m_linkCount;
+
+  rf_frag_buf_t m_fragTx[RF_FRAG_MAX_TX];
+  rf_frag_buf_t m_fragRx[RF_FRAG_MAX_RX];
+  UC m_fragMsgID;
+
+  rf_sleepy_t m_sleepy[RF_SLEEPY_NODES];
+  UC m_wakeNode;                    // WOR node being woken, 0 means none
+
+  rf_chan_stat_t m_survey[RF_SURVEY_CHANNELS];  // [0] is the home channel
+  UC m_surveyCount;
+  UC m_surveyMode;
+  UC m_surveyNext;
+  UL m_surveyTime;
+
+  UC m_migState;                    // RF_MIG_*
+  UC m_migFrom;
+  UC m_migTo;
+  bool m_migRetried;
+  UL m_migStart;                    // millis() of prepare, switch or move back
+  UL m_migLast;                     // millis() of the last attempt
+  UL m_migRetry;                    // millis() of the last cancel
+  UC m_migAcked[32];                // Bitmap of nodes acked in this phase
+  UC m_migPending[32];              // Bitmap of nodes to confirm the cancel
 };
 
+typedef bool (RF433ServerClass::*rf_rx_handler_t)(rf_rx_ctx_t &ctx);
+
 //------------------------------------------------------------------
 // Function & Class Helper
 //------------------------------------------------------------------
@@ -0,0 +1,432 @@
+/**
+ * xlxRollup.cpp - Xlight sensor rollups per minute and hour, kept in MEM_REPORT
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Every reading stored in the sensor store, filtered or not, is folded
+ *    into min/max/sum/count of its current minute and hour, in O(1)
+ * 2. Closed hours are appended as 24-byte records to a ring of sectors in
+ *    MEM_REPORT, programmed by FlushFlash() in SaveConfig(). A sector is a
+ *    whole page of the region, 4094 bytes on the wear levelling device
+ * 3. Records are in time order, so a query finds its first hour by binary
+ *    search and reads on from there
+ * 4. Report message, hours relative to 'h0', the open hour as 'cur':
+ *    {'rp':'DHTt','nd':3,'h0':<start>,'d':[[0,21.5,23,22.14,58],[1,...]],'cur':[21,22,21.5,12],'nx':<start>}
+ *    'nx' is given when more records are left, ask again from there
+ *
+ * ToDo:
+ * 1.
+**/
+
+#include "xlxRollup.h"
+#include "xlxConfig.h"
+#include "xlxLogger.h"
+#include "xlxPublishQueue.h"
+#include "xlxTelemetry.h"
+
+#define RLP_QUERY_CHUNK         12
+
+// the one and only instance of RollupClass
+RollupClass theRollup;
+
+// Integer when integral, otherwise 2 decimals
+static int PrintRollupValue(char *buf, int size, float value)
+{
+  if( value == (long)value ) return snprintf(buf, size, "%ld", (long)value);
+  return snprintf(buf, size, "%.2f", value);
+}
+
+//------------------------------------------------------------------
+// Xlight Sensor Rollup Class
+//------------------------------------------------------------------
+RollupClass::RollupClass()
+{
+  memset(m_series, 0x00, sizeof(m_series));
+  m_ready = false;
+  m_sectors = 0;
+  m_recsPerSector = 0;
+  m_maxRecords = 0;
+  m_head = 0;
+  m_seq = 1;
+  m_records = 0;
+  m_samples = 0;
+  m_hours = 0;
+}
+
+RollupClass::~RollupClass()
+{
+  for( UC col = 0; col < SNS_COL_MAX; col++ ) {
+    for( UC slot = 0; slot < MAX_SENSOR_NODES; slot++ ) {
+      if( m_series[col][slot] ) {
+        delete m_series[col][slot];
+        m_series[col][slot] = NULL;
+      }
+    }
+  }
+}
+
+BOOL RollupClass::Init()
+{
+  FlashRegionClass *pFlash = theConfig.getFlash(FLR_REPORT);
+  if( pFlash ) {
+    m_sectors = (UC)pFlash->pageCount();
+    m_recsPerSector = pFlash->pageSize() / sizeof(rlp_record_t);
+    m_maxRecords = m_sectors * m_recsPerSector;
+  }
+  m_ready = (pFlash != NULL && m_sectors >= 2 && m_recsPerSector > 0);
+  if( !m_ready ) {
+    LOGW(LOGTAG_MSG, "Report region not available");
+    return false;
+  }
+
+  // Sectors whose first record is the newest and the oldest
+  rlp_record_t lv_rec;
+  UL lv_newSeq = 0, lv_oldSeq = RLP_SEQ_FREE;
+  UC lv_new = m_sectors, lv_old = m_sectors;
+  for( UC s = 0; s < m_sectors; s++ ) {
+    if( !ReadRecord(s * m_recsPerSector, lv_rec) || lv_rec.seq == RLP_SEQ_FREE ) continue;
+    if( lv_new == m_sectors || lv_rec.seq > lv_newSeq ) {
+      lv_new = s;
+      lv_newSeq = lv_rec.seq;
+    }
+    if( lv_rec.seq < lv_oldSeq ) {
+      lv_old = s;
+      lv_oldSeq = lv_rec.seq;
+    }
+  }
+  if( lv_new == m_sectors ) {
+    m_head = 0;
+    m_records = 0;
+    m_seq = 1;
+    return true;
+  }
+
+  US lv_start = lv_new * m_recsPerSector;
+  US lv_used = FindFirstFree(lv_start, m_recsPerSector);
+  ReadRecord(lv_start + lv_used - 1, lv_rec);
+  m_seq = lv_rec.seq + 1;
+  m_head = (lv_start + lv_used) % m_maxRecords;
+  m_records = (m_head + m_maxRecords - lv_old * m_recsPerSector) % m_maxRecords;
+  if( m_records == 0 ) m_records = m_maxRecords;
+  return true;
+}
+
+void RollupClass::Update(UC col, UC slot, UC nid, UC sensor, float value)
+{
+  if( col >= SNS_COL_MAX || slot >= MAX_SENSOR_NODES ) return;
+  UL now = Time.now();
+  if( now < RLP_MIN_EPOCH ) return;
+
+  rlp_series_t *pSeries = m_series[col][slot];
+  if( !pSeries ) {
+    pSeries = new rlp_series_t;
+    if( !pSeries ) return;
+    memset(pSeries, 0x00, sizeof(rlp_series_t));
+    m_series[col][slot] = pSeries;
+  }
+  pSeries->nid = nid;
+  pSeries->sensor = (sensor == sensorDUST ? (UC)sensorPM25 : sensor);
+  m_samples++;
+
+  UL lv_start = now - now % RLP_MINUTE;
+  if( pSeries->minute.start != lv_start ) {
+    if( pSeries->minute.count > 0 ) pSeries->lastMinute = pSeries->minute;
+    pSeries->minute.count = 0;
+  }
+  Fold(pSeries->minute, lv_start, value);
+
+  lv_start = now - now % RLP_HOUR;
+  if( pSeries->hour.count > 0 && pSeries->hour.start != lv_start ) CloseHour(pSeries);
+  Fold(pSeries->hour, lv_start, value);
+}
+
+void RollupClass::Remove(UC col, UC slot)
+{
+  if( col >= SNS_COL_MAX || slot >= MAX_SENSOR_NODES ) return;
+  if( !m_series[col][slot] ) return;
+  CloseHour(m_series[col][slot]);
+  delete m_series[col][slot];
+  m_series[col][slot] = NULL;
+}
+
+// Close buckets of sensors that went quiet
+void RollupClass::Process()
+{
+  UL now = Time.now();
+  if( now < RLP_MIN_EPOCH ) return;
+
+  rlp_series_t *pSeries;
+  for( UC col = 0; col < SNS_COL_MAX; col++ ) {
+    for( UC slot = 0; slot < MAX_SENSOR_NODES; slot++ ) {
+      pSeries = m_series[col][slot];
+      if( !pSeries ) continue;
+      if( pSeries->minute.count > 0 && now >= pSeries->minute.start + RLP_MINUTE ) {
+        pSeries->lastMinute = pSeries->minute;
+        pSeries->minute.count = 0;
+      }
+      if( pSeries->hour.count > 0 && now >= pSeries->hour.start + RLP_HOUR ) {
+        CloseHour(pSeries);
+      }
+    }
+  }
+}
+
+UC RollupClass::Query(UC nid, UC sensor, UL from, UL to, rlp_record_t *pRecords, UC nMax, UL *pNext)
+{
+  UC lv_num = 0;
+  if( pNext ) *pNext = 0;
+  if( !m_ready ) return 0;
+
+  rlp_record_t lv_rec;
+  US lv_oldest = (m_head + m_maxRecords - m_records) % m_maxRecords;
+  for( US i = FindFirstHour(from); i < m_records; i++ ) {
+    if( !ReadRecord(lv_oldest + i, lv_rec) ) break;
+    if( lv_rec.start >= to ) break;
+    if( lv_rec.nid != nid || lv_rec.sensor != sensor ) continue;
+    if( lv_num >= nMax ) {
+      if( pNext ) *pNext = lv_rec.start;
+      break;
+    }
+    pRecords[lv_num++] = lv_rec;
+  }
+  return lv_num;
+}
+
+BOOL RollupClass::GetCurrent(UC nid, UC sensor, rlp_series_t &series)
+{
+  for( UC col = 0; col < SNS_COL_MAX; col++ ) {
+    for( UC slot = 0; slot < MAX_SENSOR_NODES; slot++ ) {
+      if( !m_series[col][slot] ) continue;
+      if( m_series[col][slot]->nid != nid || m_series[col][slot]->sensor != sensor ) continue;
+      series = *m_series[col][slot];
+      return true;
+    }
+  }
+  return false;
+}
+
+BOOL RollupClass::PublishReport(UC nid, UC sensor, UL from, UL to)
+{
+  rlp_record_t lv_recs[RLP_QUERY_CHUNK];
+  UL lv_next;
+  UC lv_num = Query(nid, sensor, from, to, lv_recs, RLP_QUERY_CHUNK, &lv_next);
+
+  char buf[PUBQ_MSG_SIZE];
+  char strItem[64];
+  int nPos, nLen;
+  UL lv_h0 = (lv_num > 0 ? lv_recs[0].start : from - from % RLP_HOUR);
+  nPos = snprintf(buf, sizeof(buf), "{'rp':'%s','nd':%d,'h0':%lu,'d':[", GetSensorKey(sensor), nid, lv_h0);
+  for( UC i = 0; i < lv_num; i++ ) {
+    nLen = snprintf(strItem, sizeof(strItem), "%s[%lu,", (i > 0 ? "," : ""), (lv_recs[i].start - lv_h0) / RLP_HOUR);
+    nLen += PrintRollupValue(strItem + nLen, sizeof(strItem) - nLen, lv_recs[i].min);
+    strItem[nLen++] = ',';
+    nLen += PrintRollupValue(strItem + nLen, sizeof(strItem) - nLen, lv_recs[i].max);
+    strItem[nLen++] = ',';
+    nLen += PrintRollupValue(strItem + nLen, sizeof(strItem) - nLen, lv_recs[i].avg);
+    nLen += snprintf(strItem + nLen, sizeof(strItem) - nLen, ",%d]", lv_recs[i].count);
+    // Reserve the open hour, 'nx' and the closing
+    if( nPos + nLen + 64 >= (int)sizeof(buf) ) {
+      lv_next = lv_recs[i].start;
+      break;
+    }
+    strcpy(buf + nPos, strItem);
+    nPos += nLen;
+  }
+  nPos += snprintf(buf + nPos, sizeof(buf) - nPos, "]");
+
+  rlp_series_t lv_series;
+  if( lv_next == 0 && GetCurrent(nid, sensor, lv_series) && lv_series.hour.count > 0
+      && lv_series.hour.start < to ) {
+    nLen = snprintf(strItem, sizeof(strItem), ",'cur':[");
+    nLen += PrintRollupValue(strItem + nLen, sizeof(strItem) - nLen, lv_series.hour.min);
+    strItem[nLen++] = ',';
+    nLen += PrintRollupValue(strItem + nLen, sizeof(strItem) - nLen, lv_series.hour.max);
+    strItem[nLen++] = ',';
+    nLen += PrintRollupValue(strItem + nLen, sizeof(strItem) - nLen, lv_series.hour.sum / lv_series.hour.count);
+    nLen += snprintf(strItem + nLen, sizeof(strItem) - nLen, ",%d]", lv_series.hour.count);
+    if( nPos + nLen + 2 < (int)sizeof(buf) ) {
+      strcpy(buf + nPos, strItem);
+      nPos += nLen;
+    }
+  }
+  if( lv_next > 0 ) {
+    nPos += snprintf(buf + nPos, sizeof(buf) - nPos, ",'nx':%lu", lv_next);
+  }
+  nPos += snprintf(buf + nPos, sizeof(buf) - nPos, "}");
+  return theCloudQue.AddPublishMsg(CLT_ID_SensorData, buf, nPos, nid);
+}
+
+void RollupClass::ShowSeries()
+{
+  SERIAL_LN("** Rollup: %s, %d of %d hours in flash, next seq:%lu **", (m_ready ? "ready" : "not available"),
+      m_records, m_maxRecords, m_seq);
+  SERIAL_LN("  samples:%lu hours written:%lu", m_samples, m_hours);
+  rlp_series_t *pSeries;
+  const rlp_bucket_t *pMinute;
+  for( UC col = 0; col < SNS_COL_MAX; col++ ) {
+    for( UC slot = 0; slot < MAX_SENSOR_NODES; slot++ ) {
+      pSeries = m_series[col][slot];
+      if( !pSeries ) continue;
+      pMinute = (pSeries->minute.count > 0 ? &pSeries->minute : &pSeries->lastMinute);
+      SERIAL("  nd:%3d %-4s", pSeries->nid, GetSensorKey(pSeries->sensor));
+      if( pMinute->count > 0 ) {
+        SERIAL(" minute %.2f/%.2f/%.2f n:%d", pMinute->min, pMinute->max, pMinute->sum / pMinute->count, pMinute->count);
+      }
+      if( pSeries->hour.count > 0 ) {
+        SERIAL(" hour %.2f/%.2f/%.2f n:%d", pSeries->hour.min, pSeries->hour.max,
+            pSeries->hour.sum / pSeries->hour.count, pSeries->hour.count);
+      }
+      SERIAL_LN("");
+    }
+  }
+  SERIAL_LN("");
+}
+
+void RollupClass::ShowReport(UC nid, UC sensor, UC hours)
+{
+  UL now = Time.now();
+  UL lv_from = now - now % RLP_HOUR - (UL)hours * RLP_HOUR;
+  rlp_record_t lv_recs[RLP_QUERY_CHUNK];
+  UC lv_num;
+  US lv_total = 0;
+
+  SERIAL_LN("** Report of node %d %s, last %d hours (min/max/avg n) **", nid, GetSensorKey(sensor), hours);
+  while( lv_from > 0 ) {
+    lv_num = Query(nid, sensor, lv_from, now, lv_recs, RLP_QUERY_CHUNK, &lv_from);
+    for( UC i = 0; i < lv_num; i++ ) {
+      SERIAL_LN("  %s %.2f/%.2f/%.2f n:%d", Time.format(lv_recs[i].start, "%m-%d %H:%M").c_str(),
+          lv_recs[i].min, lv_recs[i].max, lv_recs[i].avg, lv_recs[i].count);
+    }
+    lv_total += lv_num;
+  }
+  SERIAL_LN("  %d hours\n\r", lv_total);
+}
+
+void RollupClass::Clear()
+{
+  FlashRegionClass *pFlash = theConfig.getFlash(FLR_REPORT);
+  if( !m_ready ) return;
+  for( UC s = 0; s < m_sectors; s++ ) {
+    pFlash->erasePage(pFlash->PageOffset(s));
+  }
+  m_head = 0;
+  m_records = 0;
+  m_seq = 1;
+}
+
+//------------------------------------------------------------------
+// Internal functions
+//------------------------------------------------------------------
+void RollupClass::Fold(rlp_bucket_t &bucket, UL start, float value)
+{
+  if( bucket.count == 0 ) {
+    bucket.start = start;
+    bucket.min = bucket.max = bucket.sum = value;
+    bucket.count = 1;
+    return;
+  }
+  if( value < bucket.min ) bucket.min = value;
+  if( value > bucket.max ) bucket.max = value;
+  if( bucket.count < 0xFFFF ) {
+    bucket.sum += value;
+    bucket.count++;
+  }
+}
+
+BOOL RollupClass::CloseHour(rlp_series_t *pSeries)
+{
+  if( pSeries->hour.count == 0 ) return true;
+  rlp_record_t lv_rec;
+  lv_rec.start = pSeries->hour.start;
+  lv_rec.nid = pSeries->nid;
+  lv_rec.sensor = pSeries->sensor;
+  lv_rec.count = pSeries->hour.count;
+  lv_rec.min = pSeries->hour.min;
+  lv_rec.max = pSeries->hour.max;
+  lv_rec.avg = pSeries->hour.sum / pSeries->hour.count;
+  pSeries->hour.count = 0;
+  return Append(lv_rec);
+}
+
+BOOL RollupClass::Append(rlp_record_t &_rec)
+{
+  if( !m_ready ) return false;
+  FlashRegionClass *pFlash = theConfig.getFlash(FLR_REPORT);
+
+  if( m_head % m_recsPerSector == 0 ) {
+    // Entering a sector, its records are the oldest ones
+    if( m_records > m_maxRecords - m_recsPerSector ) m_records = m_maxRecords - m_recsPerSector;
+    if( !pFlash->erasePage(RecordAddress(m_head)) ) return false;
+  }
+
+  _rec.seq = m_seq;
+  if( !pFlash->write<rlp_record_t>(_rec, RecordAddress(m_head)) ) return false;
+
+  m_seq++;
+  m_hours++;
+  m_records++;
+  m_head = (m_head + 1) % m_maxRecords;
+  return true;
+}
+
+// Region address of a ring slot, records do not span sectors
+UL RollupClass::RecordAddress(US pos)
+{
+  FlashRegionClass *pFlash = theConfig.getFlash(FLR_REPORT);
+  pos %= m_maxRecords;
+  return pFlash->PageOffset(pos / m_recsPerSector) + (UL)(pos % m_recsPerSector) * sizeof(rlp_record_t);
+}
+
+BOOL RollupClass::ReadRecord(US pos, rlp_record_t &_rec)
+{
+  FlashRegionClass *pFlash = theConfig.getFlash(FLR_REPORT);
+  return pFlash->read<rlp_record_t>(_rec, RecordAddress(pos));
+}
+
+// Offset of the first free record from 'from', count if none
+US RollupClass::FindFirstFree(US from, US count)
+{
+  rlp_record_t lv_rec;
+  US lo = 0, hi = count, mid;
+  while( lo < hi ) {
+    mid = lo + (hi - lo) / 2;
+    if( !ReadRecord(from + mid, lv_rec) || lv_rec.seq == RLP_SEQ_FREE ) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+// Index, counted from the oldest record, of the first hour at or after start
+US RollupClass::FindFirstHour(UL start)
+{
+  rlp_record_t lv_rec;
+  US lv_oldest = (m_head + m_maxRecords - m_records) % m_maxRecords;
+  US lo = 0, hi = m_records, mid;
+  while( lo < hi ) {
+    mid = lo + (hi - lo) / 2;
+    if( !ReadRecord(lv_oldest + mid, lv_rec) || lv_rec.start >= start ) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
@@ -0,0 +1,112 @@
+//  xlxRollup.h - Xlight sensor rollups per minute and hour, kept in MEM_REPORT
+
+#ifndef xlxRollup_h
+#define xlxRollup_h
+
+#include "xliCommon.h"
+#include "xliMemoryMap.h"
+#include "xlxSensorStore.h"
+
+#define RLP_MINUTE              60
+#define RLP_HOUR                3600
+// Samples before the clock is synced are not rolled up (2016-01-01)
+#define RLP_MIN_EPOCH           1451606400UL
+
+// Ring of erase sectors in MEM_REPORT, one sector per page of the flash
+// region, sized from the device after Init()
+#define RLP_SEQ_FREE            0xFFFFFFFF
+
+// Hours per query when not specified
+#define RLP_QUERY_HOURS         24
+
+typedef struct
+{
+  UL start;                         // Bucket start, 0 if empty
+  float min;
+  float max;
+  float sum;
+  US count;
+} rlp_bucket_t;
+
+typedef struct
+{
+  UC nid;
+  UC sensor;                        // sensors_t
+  rlp_bucket_t minute;              // Current minute
+  rlp_bucket_t lastMinute;          // Last closed minute
+  rlp_bucket_t hour;                // Current hour, goes to flash when closed
+} rlp_series_t;
+
+// Closed hour in flash
+typedef struct
+{
+  UL seq;                           // RLP_SEQ_FREE if the slot was never written
+  UL start;                         // Hour start, Time.now()
+  UC nid;
+  UC sensor;
+  US count;
+  float min;
+  float max;
+  float avg;
+} rlp_record_t;
+
+//------------------------------------------------------------------
+// Xlight Sensor Rollup Class
+// Series are indexed like the sensor store, [column][node slot], and are
+// created on the first sample. Update() is O(1): it folds the sample into
+// the current minute and hour, closing them when the sample falls into a
+// new one. Process() closes the buckets of sensors that went quiet.
+//------------------------------------------------------------------
+class RollupClass
+{
+public:
+  RollupClass();
+  ~RollupClass();
+
+  // Find the ring head after reboot
+  BOOL Init();
+  void Update(UC col, UC slot, UC nid, UC sensor, float value);
+  // Close the hour of a node slot being reused
+  void Remove(UC col, UC slot);
+  // Call it once per minute
+  void Process();
+
+  // Closed hours of (nid, sensor) in [from, to), up to nMax, oldest first.
+  // Return the number found, *pNext gets the start of the next record.
+  UC Query(UC nid, UC sensor, UL from, UL to, rlp_record_t *pRecords, UC nMax, UL *pNext = NULL);
+  BOOL GetCurrent(UC nid, UC sensor, rlp_series_t &series);
+  // Publish the query result as one compact message
+  BOOL PublishReport(UC nid, UC sensor, UL from, UL to);
+  void ShowSeries();
+  void ShowReport(UC nid, UC sensor, UC hours);
+  void Clear();
+
+  UL m_samples;
+  UL m_hours;                       // Hours written to flash
+  UL m_seq;                         // Sequence of the next record
+  US m_records;                     // Records in flash
+
+protected:
+  void Fold(rlp_bucket_t &bucket, UL start, float value);
+  BOOL CloseHour(rlp_series_t *pSeries);
+  BOOL Append(rlp_record_t &_rec);
+  UL RecordAddress(US pos);
+  BOOL ReadRecord(US pos, rlp_record_t &_rec);
+  US FindFirstFree(US from, US count);
+  US FindFirstHour(UL start);
+
+private:
+  BOOL m_ready;
+  UC m_sectors;
+  US m_recsPerSector;
+  US m_maxRecords;
+  US m_head;                        // Next slot to write
+  rlp_series_t *m_series[SNS_COL_MAX][MAX_SENSOR_NODES];
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern RollupClass theRollup;
+
+#endif /* xlxRollup_h */
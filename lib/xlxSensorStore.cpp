@@ -0,0 +1,321 @@
+/**
+ * xlxSensorStore.cpp - Xlight per-node sensor data store
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Keep last value, timestamp and moving average per (node, sensor)
+ * 2. O(1) lookup: nid -> slot table and sensor -> column table
+ * 3. Node 0 is the controller itself
+ * 4. When all slots are taken, the least recently updated node is replaced
+ * 5. Readings are always stored, but only report a change when they pass
+ *    the per-column filter in config (deadband, hysteresis, min interval)
+ * 6. Every stored reading is also folded into the minute and hour rollups
+ *
+ * ToDo:
+ * 1.
+**/
+
+#include "xlxSensorStore.h"
+#include "xlxConfig.h"
+#include "xlxRollup.h"
+
+// sensors_t -> column
+const UC snsColumnOfSensor[] = {
+  SNS_COL_TEMP,       // sensorDHT
+  SNS_COL_ALS,        // sensorALS
+  SNS_COL_NOISE,      // sensorMIC
+  SNS_INVALID,        // sensorVIBRATION
+  SNS_COL_PIR,        // sensorPIR
+  SNS_COL_SMOKE,      // sensorSMOKE
+  SNS_COL_GAS,        // sensorGAS
+  SNS_COL_PM25,       // sensorDUST
+  SNS_INVALID,        // sensorLEAK
+  SNS_INVALID,        // sensorBEAT
+  SNS_INVALID,
+  SNS_INVALID,
+  SNS_INVALID,
+  SNS_INVALID,
+  SNS_INVALID,
+  SNS_COL_IRKEY,      // sensorIRKey
+  SNS_COL_HUMI,       // sensorDHT_h
+  SNS_COL_SOUND,      // sensorMIC_b
+  SNS_COL_PM25,       // sensorPM25
+  SNS_COL_PM10,       // sensorPM10
+  SNS_COL_TVOC,       // sensorTVOC
+  SNS_COL_CH2O,       // sensorCH2O
+  SNS_COL_CO2         // sensorCO2
+};
+
+char strColumnNames[][5] = {"DHTt", "DHTh", "ALS", "NOS", "MIC", "PIR", "IRK", "SMK", "GAS", "PM25", "PM10", "TVOC", "CH2O", "CO2"};
+
+//------------------------------------------------------------------
+// Xlight Sensor Store Class
+//------------------------------------------------------------------
+SensorStoreClass::SensorStoreClass()
+{
+  memset(m_slotOfNode, SNS_INVALID, sizeof(m_slotOfNode));
+  memset(m_nodeOfSlot, SNS_INVALID, sizeof(m_nodeOfSlot));
+  memset(m_value, 0x00, sizeof(m_value));
+  memset(m_time, 0x00, sizeof(m_time));
+  memset(m_avg, 0x00, sizeof(m_avg));
+  memset(m_fired, 0x00, sizeof(m_fired));
+  memset(m_firedTime, 0x00, sizeof(m_firedTime));
+  memset(m_firedDir, 0x00, sizeof(m_firedDir));
+  m_nodes = 0;
+  ResetFilterStatistics();
+}
+
+SensorStoreClass::~SensorStoreClass()
+{
+  for( UC col = 0; col < SNS_COL_MAX; col++ ) {
+    for( UC slot = 0; slot < MAX_SENSOR_NODES; slot++ ) {
+      if( m_avg[col][slot] ) {
+        delete m_avg[col][slot];
+        m_avg[col][slot] = NULL;
+      }
+    }
+  }
+}
+
+BOOL SensorStoreClass::Update(UC nid, UC sensor, float value)
+{
+  UC col = GetColumn(sensor);
+  if( col == SNS_INVALID ) return true;
+  UC slot = GetSlot(nid, true);
+  if( slot == SNS_INVALID ) return true;
+
+  m_value[col][slot] = value;
+  m_time[col][slot] = Time.now();
+  if( m_time[col][slot] == 0 ) m_time[col][slot] = 1;
+
+  if( !m_avg[col][slot] ) {
+    m_avg[col][slot] = new CMoveAverage(SNS_AVG_SIZE);
+  }
+  if( m_avg[col][slot] ) m_avg[col][slot]->AddData(value);
+  theRollup.Update(col, slot, nid, sensor, value);
+
+  return Filter(col, slot, value);
+}
+
+BOOL SensorStoreClass::GetValue(UC nid, UC sensor, float &value)
+{
+  UC col = GetColumn(sensor);
+  UC slot = GetSlot(nid);
+  if( col == SNS_INVALID || slot == SNS_INVALID ) return false;
+  if( m_time[col][slot] == 0 ) return false;
+  value = m_value[col][slot];
+  return true;
+}
+
+// Fall back to the last value until the average is ready
+BOOL SensorStoreClass::GetAverage(UC nid, UC sensor, float &value)
+{
+  UC col = GetColumn(sensor);
+  UC slot = GetSlot(nid);
+  if( col == SNS_INVALID || slot == SNS_INVALID ) return false;
+  if( m_time[col][slot] == 0 ) return false;
+  if( m_avg[col][slot] && m_avg[col][slot]->IsDataReady() ) {
+    value = m_avg[col][slot]->GetValue();
+  } else {
+    value = m_value[col][slot];
+  }
+  return true;
+}
+
+UL SensorStoreClass::GetTimestamp(UC nid, UC sensor)
+{
+  UC col = GetColumn(sensor);
+  UC slot = GetSlot(nid);
+  if( col == SNS_INVALID || slot == SNS_INVALID ) return 0;
+  return m_time[col][slot];
+}
+
+BOOL SensorStoreClass::GetLatest(UC sensor, float &value, UC *nid)
+{
+  UC col = GetColumn(sensor);
+  if( col == SNS_INVALID ) return false;
+
+  UC latest = SNS_INVALID;
+  for( UC slot = 0; slot < MAX_SENSOR_NODES; slot++ ) {
+    if( m_time[col][slot] == 0 ) continue;
+    if( latest == SNS_INVALID || m_time[col][slot] > m_time[col][latest] ) latest = slot;
+  }
+  if( latest == SNS_INVALID ) return false;
+
+  value = m_value[col][latest];
+  if( nid ) *nid = m_nodeOfSlot[latest];
+  return true;
+}
+
+void SensorStoreClass::RemoveNode(UC nid)
+{
+  UC slot = GetSlot(nid);
+  if( slot == SNS_INVALID ) return;
+
+  for( UC col = 0; col < SNS_COL_MAX; col++ ) {
+    m_time[col][slot] = 0;
+    m_value[col][slot] = 0;
+    m_firedTime[col][slot] = 0;
+    m_firedDir[col][slot] = 0;
+    theRollup.Remove(col, slot);
+    if( m_avg[col][slot] ) {
+      delete m_avg[col][slot];
+      m_avg[col][slot] = NULL;
+    }
+  }
+  m_slotOfNode[nid] = SNS_INVALID;
+  m_nodeOfSlot[slot] = SNS_INVALID;
+  m_nodes--;
+}
+
+UC SensorStoreClass::GetNodeCount()
+{
+  return m_nodes;
+}
+
+void SensorStoreClass::ShowTable()
+{
+  SERIAL_LN("** Sensor Store: %d of %d nodes **", m_nodes, MAX_SENSOR_NODES);
+  float avg;
+  for( UC slot = 0; slot < MAX_SENSOR_NODES; slot++ ) {
+    if( m_nodeOfSlot[slot] == SNS_INVALID ) continue;
+    SERIAL("  nd:%d", m_nodeOfSlot[slot]);
+    for( UC col = 0; col < SNS_COL_MAX; col++ ) {
+      if( m_time[col][slot] == 0 ) continue;
+      avg = (m_avg[col][slot] && m_avg[col][slot]->IsDataReady() ? m_avg[col][slot]->GetValue() : m_value[col][slot]);
+      SERIAL(" %s=%.2f(avg %.2f, %lus ago)", strColumnNames[col], m_value[col][slot], avg, Time.now() - m_time[col][slot]);
+    }
+    SERIAL_LN("");
+  }
+  SERIAL_LN("");
+  ShowFilterStatistics();
+}
+
+void SensorStoreClass::ShowFilterStatistics()
+{
+  const SensorFilter_t *pFilter;
+  SERIAL_LN("** Sensor Filter: deadband/hysteresis in 0.01 unit **");
+  for( UC col = 0; col < SNS_COL_MAX; col++ ) {
+    pFilter = theConfig.GetSensorFilter(col);
+    if( !pFilter ) continue;
+    SERIAL_LN("  %d-%s db:%d hy:%d iv:%ds passed:%lu sup(db:%lu hy:%lu iv:%lu)", col, strColumnNames[col],
+        pFilter->deadband, pFilter->hysteresis, pFilter->minInterval,
+        m_passed[col], m_supDeadband[col], m_supHysteresis[col], m_supInterval[col]);
+  }
+  SERIAL_LN("");
+}
+
+void SensorStoreClass::ResetFilterStatistics()
+{
+  memset(m_passed, 0x00, sizeof(m_passed));
+  memset(m_supDeadband, 0x00, sizeof(m_supDeadband));
+  memset(m_supHysteresis, 0x00, sizeof(m_supHysteresis));
+  memset(m_supInterval, 0x00, sizeof(m_supInterval));
+}
+
+//------------------------------------------------------------------
+// Internal functions
+//------------------------------------------------------------------
+UC SensorStoreClass::GetColumn(UC sensor)
+{
+  if( sensor >= sizeof(snsColumnOfSensor) ) return SNS_INVALID;
+  return snsColumnOfSensor[sensor];
+}
+
+UC SensorStoreClass::GetSlot(UC nid, BOOL bCreate)
+{
+  UC slot = m_slotOfNode[nid];
+  if( slot != SNS_INVALID || !bCreate ) return slot;
+
+  // Find a free slot
+  for( slot = 0; slot < MAX_SENSOR_NODES; slot++ ) {
+    if( m_nodeOfSlot[slot] == SNS_INVALID ) break;
+  }
+
+  if( slot >= MAX_SENSOR_NODES ) {
+    // Replace the least recently updated node
+    UL lv_oldest = 0xFFFFFFFF, lv_recent;
+    UC victim = 0;
+    for( UC i = 0; i < MAX_SENSOR_NODES; i++ ) {
+      lv_recent = 0;
+      for( UC col = 0; col < SNS_COL_MAX; col++ ) {
+        if( m_time[col][i] > lv_recent ) lv_recent = m_time[col][i];
+      }
+      if( lv_recent < lv_oldest ) {
+        lv_oldest = lv_recent;
+        victim = i;
+      }
+    }
+    RemoveNode(m_nodeOfSlot[victim]);
+    slot = victim;
+  }
+
+  m_slotOfNode[nid] = slot;
+  m_nodeOfSlot[slot] = nid;
+  m_nodes++;
+  return slot;
+}
+
+// The first reading always passes; afterwards the change from the last passed
+// value must exceed the deadband, plus the hysteresis if it reverses direction.
+// A suppressed reading is compared again on the next sample, so a steady new
+// level still passes once the interval is over.
+BOOL SensorStoreClass::Filter(UC col, UC slot, float value)
+{
+  UL now = m_time[col][slot];
+  if( m_firedTime[col][slot] == 0 ) {
+    m_fired[col][slot] = value;
+    m_firedTime[col][slot] = now;
+    m_firedDir[col][slot] = 0;
+    m_passed[col]++;
+    return true;
+  }
+
+  float delta = value - m_fired[col][slot];
+  if( delta == 0 ) {
+    m_supDeadband[col]++;
+    return false;
+  }
+
+  const SensorFilter_t *pFilter = theConfig.GetSensorFilter(col);
+  char dir = (delta > 0 ? 1 : -1);
+  float change = (delta > 0 ? delta : -delta);
+  if( pFilter ) {
+    float deadband = pFilter->deadband / 100.0;
+    if( change < deadband ) {
+      m_supDeadband[col]++;
+      return false;
+    }
+    if( m_firedDir[col][slot] != 0 && m_firedDir[col][slot] != dir ) {
+      if( change < deadband + pFilter->hysteresis / 100.0 ) {
+        m_supHysteresis[col]++;
+        return false;
+      }
+    }
+    if( now - m_firedTime[col][slot] < pFilter->minInterval ) {
+      m_supInterval[col]++;
+      return false;
+    }
+  }
+
+  m_fired[col][slot] = value;
+  m_firedTime[col][slot] = now;
+  m_firedDir[col][slot] = dir;
+  m_passed[col]++;
+  return true;
+}
@@ -0,0 +1,85 @@
+//  xlxSensorStore.h - Xlight per-node sensor data store
+
+#ifndef xlxSensorStore_h
+#define xlxSensorStore_h
+
+#include "xliCommon.h"
+#include "MoveAverage.h"
+
+// Moving average window of each (node, sensor)
+#define SNS_AVG_SIZE            5
+
+// Slot of unknown node or unsupported sensor
+#define SNS_INVALID             0xFF
+
+// Column (sensor) index in the store
+enum {
+  SNS_COL_TEMP = 0,                 // sensorDHT
+  SNS_COL_HUMI,                     // sensorDHT_h
+  SNS_COL_ALS,                      // sensorALS
+  SNS_COL_NOISE,                    // sensorMIC
+  SNS_COL_SOUND,                    // sensorMIC_b
+  SNS_COL_PIR,                      // sensorPIR
+  SNS_COL_IRKEY,                    // sensorIRKey
+  SNS_COL_SMOKE,                    // sensorSMOKE
+  SNS_COL_GAS,                      // sensorGAS
+  SNS_COL_PM25,                     // sensorPM25 & sensorDUST
+  SNS_COL_PM10,                     // sensorPM10
+  SNS_COL_TVOC,                     // sensorTVOC
+  SNS_COL_CH2O,                     // sensorCH2O
+  SNS_COL_CO2,                      // sensorCO2
+  SNS_COL_MAX
+};
+
+//------------------------------------------------------------------
+// Xlight Sensor Store Class
+// Struct-of-arrays, indexed by [column][node slot]
+//------------------------------------------------------------------
+class SensorStoreClass
+{
+public:
+  SensorStoreClass();
+  ~SensorStoreClass();
+
+  // Store the value, return true if it passes the sensor filter
+  BOOL Update(UC nid, UC sensor, float value);
+
+  BOOL GetValue(UC nid, UC sensor, float &value);
+  BOOL GetAverage(UC nid, UC sensor, float &value);
+  UL GetTimestamp(UC nid, UC sensor);
+  // The most recent reading of the sensor from any node
+  BOOL GetLatest(UC sensor, float &value, UC *nid = NULL);
+
+  void RemoveNode(UC nid);
+  UC GetNodeCount();
+  void ShowTable();
+  void ShowFilterStatistics();
+  void ResetFilterStatistics();
+
+protected:
+  UC GetColumn(UC sensor);
+  UC GetSlot(UC nid, BOOL bCreate = false);
+  BOOL Filter(UC col, UC slot, float value);
+
+private:
+  UC m_slotOfNode[256];             // nid -> slot
+  UC m_nodeOfSlot[MAX_SENSOR_NODES];
+  UC m_nodes;
+
+  float m_value[SNS_COL_MAX][MAX_SENSOR_NODES];
+  UL m_time[SNS_COL_MAX][MAX_SENSOR_NODES];     // Time.now(), 0 means no data
+  CMoveAverage *m_avg[SNS_COL_MAX][MAX_SENSOR_NODES];  // Created on first sample
+
+  // Filter state: value, time and direction of the last passed event
+  float m_fired[SNS_COL_MAX][MAX_SENSOR_NODES];
+  UL m_firedTime[SNS_COL_MAX][MAX_SENSOR_NODES];  // 0 means no event yet
+  char m_firedDir[SNS_COL_MAX][MAX_SENSOR_NODES]; // 1: up, -1: down, 0: unknown
+
+  // Filter statistics per column
+  UL m_passed[SNS_COL_MAX];
+  UL m_supDeadband[SNS_COL_MAX];
+  UL m_supHysteresis[SNS_COL_MAX];
+  UL m_supInterval[SNS_COL_MAX];
+};
+
+#endif /* xlxSensorStore_h */
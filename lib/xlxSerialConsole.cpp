@@ -47,7 +47,14 @@
 #include "xlxConfig.h"
 #include "xlxLogger.h"
 #include "xlxPanel.h"
+#include "xlxPublishQueue.h"
 #include "xlxRF433Server.h"
+#include "xlxTelemetry.h"
+#include "xlxStatusFeed.h"
+#include "xlxOfflineStore.h"
+#include "xlxRollup.h"
+#include "xlxTableTxn.h"
+#include "xlxAlarmGraph.h"
 
 //------------------------------------------------------------------
 // the one and only instance of SerialConsoleClass
@@ -176,8 +183,9 @@ bool SerialConsoleClass::showThisHelp(String &strTopic)
     SERIAL_LN("--- Command: check <object> ---");
     SERIAL_LN("To check component status, where <object> could be:");
     SERIAL_LN("   ble:   check BLE module availability");
-    SERIAL_LN("   flash: check flash space");
+    SERIAL_LN("   flash: check flash space and region cache statistics");
     SERIAL_LN("   rf:    check RF availability");
+    SERIAL_LN("   scene: check packed scene encoding and its airtime");
     SERIAL_LN("   wifi:  check Wi-Fi module status");
     SERIAL_LN("   wlan:  check internet status");
     SERIAL_LN("e.g. check rf\n\r");
@@ -192,10 +200,25 @@ bool SerialConsoleClass::showThisHelp(String &strTopic)
     SERIAL_LN("   node:    show node summary");
     SERIAL_LN("   button:  show button (knob) status");
     SERIAL_LN("   nlist:   show NodeID list");
+    SERIAL_LN("   pubq:    show cloud publish queue statistics");
+    SERIAL_LN("   tlm:     show sensor telemetry statistics");
     SERIAL_LN("   rf:      print RF details");
+    SERIAL_LN("   link:    show RF link quality of nodes");
+    SERIAL_LN("   chan:    show RF channel survey and migration");
+    SERIAL_LN("   rxdec:   show RF receive decoder statistics");
+    SERIAL_LN("   sensor:  show sensor data of all nodes");
+    SERIAL_LN("   shadow:  show desired and reported state of lamps");
+    SERIAL_LN("   feed:    show device status feed statistics");
+    SERIAL_LN("   alive:   show keepalive deadlines of nodes");
+    SERIAL_LN("   offline: show offline data store and back-fill");
+    SERIAL_LN("   rollup:  show current minute and hour of sensors");
+    SERIAL_LN("   report <nid> <sensor> [hours]: show hourly min/max/avg, e.g. show report 0 DHTt 24");
+    SERIAL_LN("   sleepy:  show sleepy nodes and their mailbox");
     SERIAL_LN("   time:    show current time and time zone");
     SERIAL_LN("   var:     show system variables");
-    SERIAL_LN("   table:   show working memory tables");
+    SERIAL_LN("   table [r|a|s|h]: show rule, schedule, scenario or device status table, all if omitted");
+    SERIAL_LN("   txn:     show bulk table upload transaction");
+    SERIAL_LN("   alarm [n]: show alarms with their rules and the next n firings");
     SERIAL_LN("   device:  show functional devices");
     SERIAL_LN("   remote:  show remotes");
     SERIAL_LN("   asrsnt:  show ASR command scenario table");
@@ -253,7 +276,7 @@ bool SerialConsoleClass::showThisHelp(String &strTopic)
         //CloudOutput("set flag csc|cdts|fnid|hwsw");
       } else if (wal_strnicmp(sObj, "var", 3) == 0) {
         SERIAL_LN("--- Command: set var <var name> <value> ---");
-        SERIAL_LN("<var name>: senmap, devst, bmrt, nmrt, rfch, rfpl, rfdr");
+        SERIAL_LN("<var name>: senmap, devst, bmrt, nmrt, rfch, rfmig, rfsv, rfpl, rfdr, tlmw, tlmpk");
         SERIAL_LN("e.g. set var senmap 23");
         SERIAL_LN("     , set Sensor Bitmap to 0x17");
         SERIAL_LN("e.g. set var devst 5");
@@ -264,10 +287,18 @@ bool SerialConsoleClass::showThisHelp(String &strTopic)
         SERIAL_LN("     , set Node Msg Repeat Times");
         SERIAL_LN("e.g. set var rfch [0..127]");
         SERIAL_LN("     , set RF Channel");
+        SERIAL_LN("e.g. set var rfmig [0..127]");
+        SERIAL_LN("     , move all nodes to RF Channel, fall back if any fails to follow");
+        SERIAL_LN("e.g. set var rfsv [0..2]");
+        SERIAL_LN("     , set RF channel survey to off(0), on(1) or auto migration(2)");
         SERIAL_LN("e.g. set var rfpl [0..3]");
         SERIAL_LN("     , set RF Power Level to min(0), low(1), high(2) or max(3)");
         SERIAL_LN("e.g. set var rfdr [0..2]");
         SERIAL_LN("     , set RF Datarate to 1MBPS(0), 2MBPS(1) or 250KBPS(2)");
+        SERIAL_LN("e.g. set var tlmw [0..255]");
+        SERIAL_LN("     , set sensor telemetry window in seconds, 0 to publish every reading");
+        SERIAL_LN("e.g. set var tlmpk [0|1]");
+        SERIAL_LN("     , set telemetry frame to JSON(0) or packed base64(1)");
         //CloudOutput("set var senmap|devst|rfch|rfpl|rfdr");
       } else if (wal_strnicmp(sObj, "spkr", 4) == 0) {
         SERIAL_LN("--- Command: set spkr [0|1] ---");
@@ -325,6 +356,8 @@ bool SerialConsoleClass::showThisHelp(String &strTopic)
       SERIAL_LN("     , to set keymap item");
       SERIAL_LN("e.g. set extbtn <button operation action keymap>");
       SERIAL_LN("     , to define extbtn action");
+      SERIAL_LN("e.g. set snsflt <column deadband hysteresis interval>");
+      SERIAL_LN("     , to set sensor filter, deadband and hysteresis in 0.01 unit, use 'show sensor' for column");
       SERIAL_LN("e.g. set debug [log:level]");
       SERIAL_LN("     , where log is [serial|flash|syslog|cloud|all");
       SERIAL_LN("     and level is [none|alter|critical|error|warn|notice|info|debug]\n\r");
@@ -347,6 +380,8 @@ bool SerialConsoleClass::showThisHelp(String &strTopic)
     SERIAL_LN("e.g. sys sync time");
     SERIAL_LN("e.g. sys clear nodeid 1");
     SERIAL_LN("e.g. sys clear credentials");
+    SERIAL_LN("e.g. sys clear offline");
+    SERIAL_LN("e.g. sys clear report");
     SERIAL_LN("e.g. sys reset\n\r");
     //CloudOutput("sys base|private|reset|safe|setup|dfu|update|serial|sync|clear");
   } else {
@@ -384,6 +419,18 @@ bool SerialConsoleClass::doHelp(const char *cmd)
   return showThisHelp(strTopic);
 }
 
+// Field by field, bit fields may leave padding
+// The wire carries CCT % 256 only (the W channel)
+static BOOL IsSameScene(const Hue_t *_first, const Hue_t *_second)
+{
+  for( UC idx = 0; idx < MAX_RING_NUM; idx++ ) {
+    if( _first[idx].State != _second[idx].State || _first[idx].BR != _second[idx].BR ||
+        (_first[idx].CCT % 256) != (_second[idx].CCT % 256) || _first[idx].R != _second[idx].R ||
+        _first[idx].G != _second[idx].G || _first[idx].B != _second[idx].B ) return false;
+  }
+  return true;
+}
+
 // check - Check commands
 bool SerialConsoleClass::doCheck(const char *cmd)
 {
@@ -401,7 +448,54 @@ bool SerialConsoleClass::doCheck(const char *cmd)
         SERIAL_LN("  Sent %lu out of %lu, Succ-rate %.2f%%",
             theRadio._succ, theRadio._times, succ_r);
       }
+      if( theRadio._txFrames > 0 ) {
+        UL lv_usTicks = System.ticksPerMicrosecond();
+        if( lv_usTicks == 0 ) lv_usTicks = 1;
+        SERIAL_LN("  TX %lu frames, CPU avg %lu us (max %lu us), on-air avg %lu ms",
+            theRadio._txFrames, theRadio._txCpuTicks / theRadio._txFrames / lv_usTicks,
+            theRadio._txCpuMax / lv_usTicks, theRadio._txAirTime / theRadio._txFrames / 1000);
+      }
+      if( theRadio._fragTxFrames > 0 || theRadio._fragRxMsgs > 0 ) {
+        SERIAL_LN("  Fragmented TX %lu msgs (%lu failed), %lu frames (%lu resent), RX %lu msgs (%lu timeout)",
+            theRadio._fragTxMsgs, theRadio._fragTxFailed, theRadio._fragTxFrames, theRadio._fragTxRetrans,
+            theRadio._fragRxMsgs, theRadio._fragRxTimeout);
+      }
       CloudOutput("c_rf:%d, succ_r:%.2f", theRadio.isValid(), succ_r);
+    } else if (wal_strnicmp(sTopic, "scene", 5) == 0) {
+      // Round trip of a full and a delta change, against one legacy frame per ring
+      Hue_t lv_known[MAX_RING_NUM], lv_target[MAX_RING_NUM], lv_rings[MAX_RING_NUM];
+      UC lv_payl[SCN_MAX_PACKED_LEN];
+      UC lv_full, lv_delta;
+      BOOL lv_ok;
+      memset(lv_known, 0x00, sizeof(lv_known));
+      memset(lv_target, 0x00, sizeof(lv_target));
+      for( UC idx = 0; idx < MAX_RING_NUM; idx++ ) {
+        lv_known[idx].State = DEVICE_SW_ON;
+        lv_known[idx].BR = 50;
+        lv_target[idx].State = DEVICE_SW_ON;
+        lv_target[idx].BR = 80 + idx;
+        lv_target[idx].CCT = 10 * idx;
+        lv_target[idx].R = 255 - idx;
+        lv_target[idx].G = 64 * idx;
+        lv_target[idx].B = 32 + idx;
+      }
+      memcpy(lv_rings, lv_known, sizeof(lv_rings));
+      lv_full = theSys.CreateScenePayload(lv_payl, lv_target);
+      lv_ok = (theSys.ParseScenePayload(lv_payl, lv_full, lv_rings) == lv_full &&
+          IsSameScene(lv_rings, lv_target));
+      lv_target[1].State = DEVICE_SW_OFF;
+      lv_target[2].G = 0;
+      memcpy(lv_known, lv_rings, sizeof(lv_known));
+      lv_delta = theSys.CreateScenePayload(lv_payl, lv_target, lv_known);
+      lv_ok = lv_ok && (theSys.ParseScenePayload(lv_payl, lv_delta, lv_rings) == lv_delta &&
+          IsSameScene(lv_rings, lv_target));
+      UL lv_legacy = MAX_RING_NUM * (RF_AIR_OVERHEAD + HEADER_SIZE + 7) * RF_AIR_BYTE_US / 1000;
+      SERIAL_LN("**Packed scene round trip %s", lv_ok ? "OK" : "failed!");
+      SERIAL_LN("  %d frames of 7 bytes: %lu ms, packed %d bytes: %lu ms, delta %d bytes: %lu ms",
+          MAX_RING_NUM, lv_legacy,
+          lv_full, (UL)(RF_AIR_OVERHEAD + HEADER_SIZE + lv_full) * RF_AIR_BYTE_US / 1000,
+          lv_delta, (UL)(RF_AIR_OVERHEAD + HEADER_SIZE + lv_delta) * RF_AIR_BYTE_US / 1000);
+      CloudOutput("c_scene:%d-%d-%d", lv_ok, lv_full, lv_delta);
     } else if (wal_strnicmp(sTopic, "wifi", 4) == 0) {
       if( !theConfig.GetDisableWiFi() ) {
         SERIAL("**Wi-Fi module is %s, ", (WiFi.ready() ? "ready" : "not ready!"));
@@ -426,7 +520,14 @@ bool SerialConsoleClass::doCheck(const char *cmd)
       //CloudOutput("c_wlan:1");
     } else if (wal_strnicmp(sTopic, "flash", 5) == 0) {
       SERIAL_LN("** Free memory: %lu bytes, total EEPROM space: %lu bytes\n\r", System.freeMemory(), EEPROM.length());
-      CloudOutput("c_flash:%lu-%lu", System.freeMemory(), EEPROM.length());
+      theConfig.ShowFlashStatistics();
+      UL lv_programs = 0, lv_erases = 0;
+      for( UC i = 0; i < FLR_DUMMY; i++ ) {
+        if( !theConfig.getFlash(i) ) continue;
+        lv_programs += theConfig.getFlash(i)->m_programs;
+        lv_erases += theConfig.getFlash(i)->m_erases;
+      }
+      CloudOutput("c_flash:%lu-%lu-%lu-%lu", System.freeMemory(), EEPROM.length(), lv_programs, lv_erases);
     } else {
       retVal = false;
     }
@@ -485,6 +586,85 @@ bool SerialConsoleClass::doShow(const char *cmd)
       theConfig.showKeyMap();
   } else if (wal_strnicmp(sTopic, "extbtn", 6) == 0) {
       theConfig.showButtonActions();
+  } else if (wal_strnicmp(sTopic, "pubq", 4) == 0) {
+      theCloudQue.ShowStatistics();
+      const pubq_stat_t *pStat;
+      UL lv_sent = 0, lv_replaced = 0, lv_dropped = 0;
+      for( UC i = 0; i < CLT_ID_MAX; i++ ) {
+        pStat = theCloudQue.GetStatistics(i);
+        lv_sent += pStat->sent;
+        lv_replaced += pStat->replaced;
+        lv_dropped += pStat->dropped;
+      }
+      CloudOutput("s_pubq:%d-%lu-%lu-%lu", theCloudQue.GetPending(), lv_sent, lv_replaced, lv_dropped);
+  } else if (wal_strnicmp(sTopic, "link", 4) == 0) {
+      theRadio.ShowLinkTable();
+      if( isInCloudCommand ) {
+        CloudOutput("s_link:%d-%d", theRadio.GetLinkCount(), theRadio.PublishLinkTable());
+      }
+  } else if (wal_strnicmp(sTopic, "chan", 4) == 0) {
+      theRadio.ShowChannelSurvey();
+      CloudOutput("s_chan:%d-%d-%d-%lu-%lu-%lu", theRadio.getChannel(false), theRadio.GetBestChannel(),
+          theRadio.GetMigrationState(), theRadio._migDone, theRadio._migCancelled, theRadio._migReverted);
+  } else if (wal_strnicmp(sTopic, "rxdec", 5) == 0) {
+      theRadio.ShowDecoderStatistics();
+      CloudOutput("s_rxdec:%lu-%lu-%lu", theRadio._received, theRadio._rxUnknown, theRadio._rxShort);
+  } else if (wal_strnicmp(sTopic, "sleepy", 6) == 0) {
+      theRadio.ShowSleepyNodes();
+      CloudOutput("s_sleepy:%lu-%lu-%lu-%lu", theRadio._mailStored, theRadio._mailDelivered, theRadio._mailDropped, theRadio._worWakeups);
+  } else if (wal_strnicmp(sTopic, "nlist", 5) == 0) {
+      theConfig.lstNodes.showList(isInCloudCommand);
+      CloudOutput("s_nlist:%d", theConfig.lstNodes.count());
+  } else if (wal_strnicmp(sTopic, "table", 5) == 0) {
+      char *sParam1 = next();     // Get table
+      const char lv_tables[] = {CLS_RULE, CLS_SCHEDULE, CLS_SCENARIO, CLS_LIGHT_STATUS};
+      UC lv_frames = 0;
+      for( UC i = 0; i < sizeof(lv_tables); i++ ) {
+        if( sParam1 && tolower(sParam1[0]) != lv_tables[i] ) continue;
+        lv_frames += theSys.print_table(lv_tables[i], (isInCloudCommand ? JSW_SINK_CLOUD : JSW_SINK_SERIAL));
+      }
+      CloudOutput("s_table:%d", lv_frames);
+  } else if (wal_strnicmp(sTopic, "sensor", 6) == 0) {
+      theSys.m_sensors.ShowTable();
+      CloudOutput("s_sensor:%d", theSys.m_sensors.GetNodeCount());
+  } else if (wal_strnicmp(sTopic, "shadow", 6) == 0) {
+      theSys.m_shadow.ShowTable();
+      CloudOutput("s_shadow:%lx-%lx", theSys.m_shadow.GetSyncBitmap(), theSys.m_shadow.GetPendingBitmap());
+  } else if (wal_strnicmp(sTopic, "alive", 5) == 0) {
+      theSys.m_liveness.ShowWheel();
+      CloudOutput("s_alive:%d-%lu-%lu", theSys.m_liveness.GetCount(), theSys.m_liveness.m_refreshes, theSys.m_liveness.m_expired);
+  } else if (wal_strnicmp(sTopic, "rollup", 6) == 0) {
+      theRollup.ShowSeries();
+      CloudOutput("s_rollup:%d-%lu-%lu", theRollup.m_records, theRollup.m_samples, theRollup.m_hours);
+  } else if (wal_strnicmp(sTopic, "report", 6) == 0) {
+      char *sParam1 = next();     // Get node_id
+      char *sParam2 = next();     // Get sensor key
+      char *sParam3 = next();     // Get hours
+      UC lv_sensor = (sParam2 ? GetSensorByKey(sParam2) : 0xFF);
+      if( sParam1 && lv_sensor != 0xFF ) {
+        UC lv_hours = (sParam3 ? (UC)atoi(sParam3) : RLP_QUERY_HOURS);
+        theRollup.ShowReport((UC)atoi(sParam1), lv_sensor, lv_hours);
+        CloudOutput("s_report:%d-%s-%d", atoi(sParam1), GetSensorKey(lv_sensor), lv_hours);
+      } else {
+        retVal = false;
+      }
+  } else if (wal_strnicmp(sTopic, "offline", 7) == 0) {
+      theOfflineStore.ShowStatus();
+      CloudOutput("s_offline:%d-%lu-%lu", theOfflineStore.m_pending, theOfflineStore.m_uploaded, theOfflineStore.m_dropped);
+  } else if (wal_strnicmp(sTopic, "txn", 3) == 0) {
+      theTableTxn.ShowStatus();
+      CloudOutput("s_txn:%d-%lu-%lu", theTableTxn.GetRows(), theTableTxn.m_commits, theTableTxn.m_failures);
+  } else if (wal_strnicmp(sTopic, "alarm", 5) == 0) {
+      char *sParam1 = next();     // Get number of firings
+      theAlarmGraph.ShowGraph();
+      theAlarmGraph.ShowNext(sParam1 ? (UC)atoi(sParam1) : AGR_SHOW_FIRINGS);
+      CloudOutput("s_alarm:%d-%lu-%lu", theAlarmGraph.GetTriggerCount(), theAlarmGraph.m_firings, theAlarmGraph.m_rebuilds);
+  } else if (wal_strnicmp(sTopic, "feed", 4) == 0) {
+      theStatusFeed.ShowStatistics();
+      CloudOutput("s_feed:%lu-%lu-%lu-%lu", theStatusFeed.m_seq, theStatusFeed.m_deltas, theStatusFeed.m_snapshots, theStatusFeed.m_bytes);
+  } else if (wal_strnicmp(sTopic, "tlm", 3) == 0) {
+      theTelemetry.ShowStatistics();
+      CloudOutput("s_tlm:%d-%lu-%lu-%lu", theConfig.GetTelemetryWindow(), theTelemetry.m_readings, theTelemetry.m_frames, theTelemetry.m_bytes);
   }  else if (wal_strnicmp(sTopic, "time", 4) == 0) {
       time_t time = Time.now();
       SERIAL_LN("Now is %s, %s\n\r", Time.format(time, TIME_FORMAT_ISO8601_FULL).c_str(), theSys.m_tzString.c_str());
@@ -726,6 +906,30 @@ bool SerialConsoleClass::doSet(const char *cmd)
             SERIAL_LN("RF Channel: %d    \n\r", theRadio.getChannel(false));
             CloudOutput("v_rfch:%d", theRadio.getChannel(false));
             retVal = true;
+          } else if (wal_strnicmp(sParam1, "rfmig", 5) == 0) {
+            if( !theRadio.StartMigration((UC)atoi(sParam2)) ) {
+              SERIAL_LN("Failed to migrate RF Channel: %s\n\r", sParam2);
+              CloudOutput("Failed to migrate RF channel %s", sParam2);
+            } else {
+              SERIAL_LN("RF Channel migration: %d->%s\n\r", theRadio.getChannel(false), sParam2);
+              CloudOutput("v_rfmig:%s", sParam2);
+            }
+            retVal = true;
+          } else if (wal_strnicmp(sParam1, "rfsv", 4) == 0) {
+            theConfig.SetRFSurvey((UC)atoi(sParam2));
+            SERIAL_LN("RF channel survey: %d\n\r", theRadio.GetSurveyMode());
+            CloudOutput("v_rfsv:%d", theRadio.GetSurveyMode());
+            retVal = true;
+          } else if (wal_strnicmp(sParam1, "tlmw", 4) == 0) {
+            theConfig.SetTelemetryWindow((UC)atoi(sParam2));
+            SERIAL_LN("Telemetry window: %d\n\r", theConfig.GetTelemetryWindow());
+            CloudOutput("v_tlmw:%d", theConfig.GetTelemetryWindow());
+            retVal = true;
+          } else if (wal_strnicmp(sParam1, "tlmpk", 5) == 0) {
+            theConfig.SetTelemetryPacked(atoi(sParam2) > 0);
+            SERIAL_LN("Telemetry frame: %s\n\r", theConfig.IsTelemetryPacked() ? "packed" : "JSON");
+            CloudOutput("v_tlmpk:%d", theConfig.IsTelemetryPacked());
+            retVal = true;
           }else if (wal_strnicmp(sParam1, "rfaddr", 4) == 0) {
             theConfig.SetRFAddr((UC)atoi(sParam2));
             SERIAL_LN("RF Addr: %d      \n\r", theRadio.getAddress());
@@ -776,6 +980,28 @@ bool SerialConsoleClass::doSet(const char *cmd)
         SERIAL_LN("Require a valid nodeID\n\r");
         retVal = true;
       }
+    } else if (wal_strnicmp(sTopic, "snsflt", 6) == 0) {
+      // Sensor filter
+      sParam1 = next();     // Get column
+      sParam2 = next();     // Get deadband
+      sParam3 = next();     // Get hysteresis
+      sParam4 = next();     // Get interval
+      if( sParam1 && sParam2 && sParam3 && sParam4 ) {
+        UC _col = (UC)atoi(sParam1);
+        theConfig.SetSensorFilter(_col, (US)atoi(sParam2), (US)atoi(sParam3), (UC)atoi(sParam4));
+        const SensorFilter_t *pFilter = theConfig.GetSensorFilter(_col);
+        if( pFilter ) {
+          SERIAL_LN("Sensor filter %d: deadband %d, hysteresis %d, interval %ds\n\r", _col,
+              pFilter->deadband, pFilter->hysteresis, pFilter->minInterval);
+          CloudOutput("snsflt:%d,%d,%d,%d", _col, pFilter->deadband, pFilter->hysteresis, pFilter->minInterval);
+        } else {
+          SERIAL_LN("Invalid sensor column: %d\n\r", _col);
+        }
+        retVal = true;
+      } else {
+        SERIAL_LN("Require column, deadband, hysteresis and interval, use '? set' for detail\n\r");
+        retVal = true;
+      }
     } else if (wal_strnicmp(sTopic, "subid", 5) == 0) {
       // Sub device id
       sParam1 = next();
@@ -996,8 +1222,19 @@ bool SerialConsoleClass::doSysSub(const char *cmd)
             if( !theConfig.lstNodes.clearNodeId((UC)atoi(sParam1)) ) {
               SERIAL_LN("Failed to clear NodeID:%s\n\r", sParam1);
               CloudOutput("Failed to clear NodeID:%s", sParam1);
+            } else {
+              theSys.m_shadow.Remove((UC)atoi(sParam1));
+              theStatusFeed.Remove((UC)atoi(sParam1));
             }
           }
+        } else if( wal_stricmp(sParam1, "report") == 0 ) {
+          theRollup.Clear();
+          SERIAL_LN("Sensor reports cleared\n\r");
+          CloudOutput("Sensor reports cleared");
+        } else if( wal_stricmp(sParam1, "offline") == 0 ) {
+          theOfflineStore.Clear();
+          SERIAL_LN("Offline data cleared\n\r");
+          CloudOutput("Offline data cleared");
         } else if( wal_stricmp(sParam1, "credentials") == 0 ) {
           WiFi.clearCredentials();
           SERIAL_LN("WiFi credentials cleared\n\r");
@@ -0,0 +1,306 @@
+/**
+ * xlxStatusFeed.cpp - Xlight device status change feed
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Keep per lamp the state last sent to the cloud (baseline)
+ * 2. Delta: only the fields that differ from the baseline, e.g.
+ *    {'nd':12,'sid':0,'sq':35,'BR':60}
+ *    rings that differ from each other go as 'ringN':[State,BR,CCT,R,G,B]
+ * 3. While the previous delta of a node is still in the publish queue,
+ *    further changes are merged into the next delta. The baseline only
+ *    moves when the queue has sent the delta
+ * 4. Snapshot: all lamps every STF_SNAPSHOT_INTERVAL and after the cloud
+ *    reconnects, {'sq':36,'snap':1,'d':[[nd,up,filter,State,BR,CCT,R,G,B],..]}
+ *    with 6 more values per ring when the rings differ
+ * 5. 'sq' increases by one per delta or snapshot frame, so the cloud can
+ *    tell a lost message and wait for the next snapshot
+ *
+ * ToDo:
+ * 1.
+**/
+
+#include "xlxStatusFeed.h"
+#include "xlxPublishQueue.h"
+#include "xlSmartController.h"
+
+#define STF_SNAP_DONE           0xFF
+
+// the one and only instance of StatusFeedClass
+StatusFeedClass theStatusFeed;
+
+// Fields that differ between two rings
+static UC CompareRing(const Hue_t &_first, const Hue_t &_second)
+{
+  UC lv_fld = 0;
+  if( _first.State != _second.State ) lv_fld |= STF_FLD_STATE;
+  if( _first.BR != _second.BR ) lv_fld |= STF_FLD_BR;
+  if( _first.CCT != _second.CCT ) lv_fld |= STF_FLD_CCT;
+  if( _first.R != _second.R || _first.G != _second.G || _first.B != _second.B ) lv_fld |= STF_FLD_RGB;
+  return lv_fld;
+}
+
+static BOOL IsUniformRings(const Hue_t *_rings)
+{
+  for( UC idx = 1; idx < MAX_RING_NUM; idx++ ) {
+    if( CompareRing(_rings[0], _rings[idx]) ) return false;
+  }
+  return true;
+}
+
+//------------------------------------------------------------------
+// Xlight Status Feed Class
+//------------------------------------------------------------------
+StatusFeedClass::StatusFeedClass()
+{
+  memset(m_nodes, 0x00, sizeof(m_nodes));
+  m_dirty = 0;
+  m_nextDelta = 0;
+  m_snapPos = STF_SNAP_DONE;
+  m_lastSnapshot = 0;
+  m_connected = false;
+  m_seq = 0;
+  m_changes = 0;
+  m_deltas = 0;
+  m_snapshots = 0;
+  m_bytes = 0;
+}
+
+BOOL StatusFeedClass::Changed(UC nid, UC sid)
+{
+  int pos = Search(nid, true);
+  if( pos < 0 ) return false;
+
+  m_changes++;
+  m_nodes[pos].sid = sid;
+  if( !m_nodes[pos].dirty ) {
+    m_nodes[pos].dirty = 1;
+    m_dirty++;
+  }
+  return true;
+}
+
+void StatusFeedClass::Remove(UC nid)
+{
+  int pos = Search(nid);
+  if( pos < 0 ) return;
+  if( m_nodes[pos].dirty ) m_dirty--;
+  memset(&m_nodes[pos], 0x00, sizeof(stf_node_t));
+}
+
+void StatusFeedClass::RequestSnapshot()
+{
+  m_snapPos = 0;
+  m_lastSnapshot = millis();
+}
+
+// Call it in SelfCheck, publish at most one message per call
+void StatusFeedClass::Process()
+{
+  // Keep changes until the cloud is back, then start with a snapshot
+  if( theConfig.GetDisableWiFi() || !Particle.connected() ) {
+    m_connected = false;
+    return;
+  }
+  if( !m_connected ) {
+    m_connected = true;
+    RequestSnapshot();
+  }
+  if( millis() - m_lastSnapshot >= (UL)STF_SNAPSHOT_INTERVAL * 1000 ) {
+    RequestSnapshot();
+  }
+
+  CheckInflight();
+  if( m_snapPos != STF_SNAP_DONE ) {
+    PublishSnapshot();
+    return;
+  }
+  if( m_dirty == 0 ) return;
+
+  UC pos;
+  for( UC i = 0; i < MAX_DEVICE_PER_CONTROLLER; i++ ) {
+    pos = (m_nextDelta + i) % MAX_DEVICE_PER_CONTROLLER;
+    if( !m_nodes[pos].dirty ) continue;
+    // Previous delta not sent yet, merge into the next one
+    if( theCloudQue.IsPending(CLT_ID_DeviceStatus, m_nodes[pos].nid) ) continue;
+    m_nextDelta = pos + 1;
+    PublishDelta(m_nodes[pos]);
+    break;
+  }
+}
+
+void StatusFeedClass::ShowStatistics()
+{
+  SERIAL_LN("** Status Feed: seq %lu, %d of %d nodes changed **", m_seq, m_dirty, MAX_DEVICE_PER_CONTROLLER);
+  SERIAL_LN("  changes: %lu, deltas: %lu, snapshots: %lu, bytes: %lu, next snapshot in %lus\n\r",
+      m_changes, m_deltas, m_snapshots, m_bytes,
+      (STF_SNAPSHOT_INTERVAL * 1000 - (millis() - m_lastSnapshot)) / 1000);
+}
+
+//------------------------------------------------------------------
+// Internal functions
+//------------------------------------------------------------------
+int StatusFeedClass::Search(UC nid, BOOL bCreate)
+{
+  int lv_free = -1;
+  for( int pos = 0; pos < MAX_DEVICE_PER_CONTROLLER; pos++ ) {
+    if( m_nodes[pos].nid == nid ) return pos;
+    if( m_nodes[pos].nid == 0 && lv_free < 0 ) lv_free = pos;
+  }
+  if( !bCreate || lv_free < 0 || nid == 0 ) return -1;
+
+  memset(&m_nodes[lv_free], 0x00, sizeof(stf_node_t));
+  m_nodes[lv_free].nid = nid;
+  return lv_free;
+}
+
+// Deltas that left the publish queue become the baseline
+void StatusFeedClass::CheckInflight()
+{
+  for( UC pos = 0; pos < MAX_DEVICE_PER_CONTROLLER; pos++ ) {
+    if( !m_nodes[pos].inflight ) continue;
+    if( theCloudQue.IsPending(CLT_ID_DeviceStatus, m_nodes[pos].nid) ) continue;
+    memcpy(m_nodes[pos].ring, m_nodes[pos].sent, sizeof(m_nodes[pos].ring));
+    m_nodes[pos].filter = m_nodes[pos].sentFilter;
+    m_nodes[pos].published = 1;
+    m_nodes[pos].inflight = 0;
+  }
+}
+
+BOOL StatusFeedClass::PublishDelta(stf_node_t &_node)
+{
+  ListNode<DevStatusRow_t> *pDev = theSys.SearchDevStatus(_node.nid);
+  if( !pDev ) {
+    Remove(_node.nid);
+    return false;
+  }
+
+  const Hue_t *pRings = pDev->data.ring;
+  UC lv_fld[MAX_RING_NUM];
+  UC lv_any = 0;
+  for( UC idx = 0; idx < MAX_RING_NUM; idx++ ) {
+    lv_fld[idx] = (_node.published ? CompareRing(_node.ring[idx], pRings[idx]) :
+        STF_FLD_STATE | STF_FLD_BR | STF_FLD_CCT | STF_FLD_RGB);
+    lv_any |= lv_fld[idx];
+  }
+  BOOL bFilter = (!_node.published || _node.filter != pDev->data.filter);
+  if( !lv_any && !bFilter ) {
+    // Changed back before it was sent
+    _node.dirty = 0;
+    m_dirty--;
+    return false;
+  }
+
+  char buf[PUBQ_MSG_SIZE];
+  int nPos = snprintf(buf, sizeof(buf), "{'nd':%d,'sid':%d,'sq':%lu", _node.nid, _node.sid, m_seq + 1);
+  if( IsUniformRings(pRings) ) {
+    if( lv_any & STF_FLD_STATE ) nPos += snprintf(buf + nPos, sizeof(buf) - nPos, ",'State':%d", pRings[0].State);
+    if( lv_any & STF_FLD_BR ) nPos += snprintf(buf + nPos, sizeof(buf) - nPos, ",'BR':%d", pRings[0].BR);
+    if( lv_any & STF_FLD_CCT ) nPos += snprintf(buf + nPos, sizeof(buf) - nPos, ",'%s':%d",
+        (pRings[0].CCT < 256 ? "W" : "CCT"), pRings[0].CCT);
+    if( lv_any & STF_FLD_RGB ) nPos += snprintf(buf + nPos, sizeof(buf) - nPos, ",'R':%d,'G':%d,'B':%d",
+        pRings[0].R, pRings[0].G, pRings[0].B);
+  } else {
+    for( UC idx = 0; idx < MAX_RING_NUM; idx++ ) {
+      if( !lv_fld[idx] ) continue;
+      nPos += snprintf(buf + nPos, sizeof(buf) - nPos, ",'ring%d':[%d,%d,%d,%d,%d,%d]", idx + 1,
+          pRings[idx].State, pRings[idx].BR, pRings[idx].CCT, pRings[idx].R, pRings[idx].G, pRings[idx].B);
+    }
+  }
+  if( bFilter ) nPos += snprintf(buf + nPos, sizeof(buf) - nPos, ",'filter':%d", pDev->data.filter);
+  nPos += snprintf(buf + nPos, sizeof(buf) - nPos, "}");
+
+  if( !theCloudQue.AddPublishMsg(CLT_ID_DeviceStatus, buf, nPos, _node.nid) ) return false;
+
+  memcpy(_node.sent, pRings, sizeof(_node.sent));
+  _node.sentFilter = pDev->data.filter;
+  _node.inflight = 1;
+  _node.dirty = 0;
+  m_dirty--;
+  m_seq++;
+  m_deltas++;
+  m_bytes += nPos;
+  return true;
+}
+
+// One frame per call, as many lamps as fit, from DevStatus row m_snapPos
+BOOL StatusFeedClass::PublishSnapshot()
+{
+  char buf[PUBQ_MSG_SIZE];
+  char strItem[96];
+  int nPos, nLen;
+  UC row = 0, count = 0, lv_nextPos = STF_SNAP_DONE;
+  ListNode<DevStatusRow_t> *lv_devs[MAX_DEVICE_PER_CONTROLLER];
+
+  nPos = snprintf(buf, sizeof(buf), "{'sq':%lu,'snap':1,'d':[", m_seq + 1);
+  ListNode<DevStatusRow_t> *pDev = theSys.DevStatus_table.getRoot();
+  while( pDev != NULL && count < MAX_DEVICE_PER_CONTROLLER ) {
+    if( row++ < m_snapPos || pDev->data.node_id == 0 ) {
+      pDev = pDev->next;
+      continue;
+    }
+    const Hue_t *pRings = pDev->data.ring;
+    nLen = snprintf(strItem, sizeof(strItem), "%s[%d,%d,%d", (count > 0 ? "," : ""),
+        pDev->data.node_id, pDev->data.present, pDev->data.filter);
+    for( UC idx = 0; idx < MAX_RING_NUM; idx++ ) {
+      if( idx > 0 && IsUniformRings(pRings) ) break;
+      nLen += snprintf(strItem + nLen, sizeof(strItem) - nLen, ",%d,%d,%d,%d,%d,%d",
+          pRings[idx].State, pRings[idx].BR, pRings[idx].CCT, pRings[idx].R, pRings[idx].G, pRings[idx].B);
+    }
+    nLen += snprintf(strItem + nLen, sizeof(strItem) - nLen, "]");
+    // Reserve "]}", the rest goes in the next frame
+    if( nPos + nLen + 2 >= (int)sizeof(buf) ) {
+      lv_nextPos = row - 1;
+      break;
+    }
+    strcpy(buf + nPos, strItem);
+    nPos += nLen;
+    lv_devs[count++] = pDev;
+    pDev = pDev->next;
+  }
+  if( count == 0 ) {
+    m_snapPos = STF_SNAP_DONE;
+    return false;
+  }
+
+  buf[nPos++] = ']';
+  buf[nPos++] = '}';
+  buf[nPos] = '\0';
+  if( !theCloudQue.AddPublishMsg(CLT_ID_DeviceStatus, buf, nPos) ) return false;
+  m_snapPos = lv_nextPos;
+  m_seq++;
+  m_snapshots++;
+  m_bytes += nPos;
+
+  // The snapshot is the new baseline
+  int pos;
+  for( UC i = 0; i < count; i++ ) {
+    pos = Search(lv_devs[i]->data.node_id, true);
+    if( pos < 0 ) continue;
+    memcpy(m_nodes[pos].ring, lv_devs[i]->data.ring, sizeof(m_nodes[pos].ring));
+    m_nodes[pos].filter = lv_devs[i]->data.filter;
+    m_nodes[pos].published = 1;
+    // Older than the snapshot
+    m_nodes[pos].inflight = 0;
+    if( m_nodes[pos].dirty ) {
+      m_nodes[pos].dirty = 0;
+      m_dirty--;
+    }
+  }
+  return true;
+}
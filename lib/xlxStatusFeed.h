@@ -0,0 +1,73 @@
+//  xlxStatusFeed.h - Xlight device status change feed
+
+#ifndef xlxStatusFeed_h
+#define xlxStatusFeed_h
+
+#include "xliCommon.h"
+#include "xlxConfig.h"
+
+// Compact full snapshot of all lamps, in seconds
+#define STF_SNAPSHOT_INTERVAL   600
+
+// Changed fields of one ring
+#define STF_FLD_STATE           0x01
+#define STF_FLD_BR              0x02
+#define STF_FLD_CCT             0x04
+#define STF_FLD_RGB             0x08
+
+typedef struct
+{
+  UC nid;                           // 0 means free slot
+  UC sid;                           // Sub ID of the latest change
+  UC filter;
+  UC published            :1;       // Baseline is valid
+  UC dirty                :1;       // Changed since the last publish
+  UC inflight             :1;       // Delta in the publish queue
+  UC reserved             :5;
+  UC sentFilter;
+  Hue_t ring[MAX_RING_NUM];         // Baseline: what the cloud was sent
+  Hue_t sent[MAX_RING_NUM];         // Delta in the queue, baseline once sent
+} stf_node_t;
+
+//------------------------------------------------------------------
+// Xlight Status Feed Class
+//------------------------------------------------------------------
+class StatusFeedClass
+{
+public:
+  StatusFeedClass();
+
+  // Call it when DevStatus row of the lamp was changed
+  BOOL Changed(UC nid, UC sid = 0);
+  void Remove(UC nid);
+  void RequestSnapshot();
+  void Process();
+  void ShowStatistics();
+
+  UL m_seq;                         // Sequence of the last delta or snapshot
+  UL m_changes;                     // Changed() calls
+  UL m_deltas;                      // Delta messages
+  UL m_snapshots;                   // Snapshot frames
+  UL m_bytes;                       // Bytes of deltas and snapshots
+
+protected:
+  int Search(UC nid, BOOL bCreate = false);
+  void CheckInflight();
+  BOOL PublishDelta(stf_node_t &_node);
+  BOOL PublishSnapshot();
+
+private:
+  stf_node_t m_nodes[MAX_DEVICE_PER_CONTROLLER];
+  UC m_dirty;
+  UC m_nextDelta;                   // Round robin start of delta search
+  UC m_snapPos;                     // Next DevStatus row of snapshot, 0xFF if none
+  UL m_lastSnapshot;
+  BOOL m_connected;
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern StatusFeedClass theStatusFeed;
+
+#endif /* xlxStatusFeed_h */
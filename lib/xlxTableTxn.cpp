@@ -0,0 +1,367 @@
+/**
+ * xlxTableTxn.cpp - Xlight bulk upload of rule, schedule and scenario tables
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Protocol, as config messages:
+ *    {'tx':1,'n':12}                 begin, 'n' is optional
+ *    {'rows':3,'data':[{..},{..}]}   rows as before, staged
+ *    {'tx':2}                        commit, {'tx':0} to abort
+ *    Begin and commit are answered with {'tx':x,'rc':y,'rows':z}
+ * 2. Schedule and scenario chains hold MAX_TABLE_SIZE rows, only rows
+ *    saved and executed can make room. Commit() checks the space before
+ *    it changes anything, so a batch failing validation changes nothing.
+ *    A row the tables still refuse is not rolled back with the others,
+ *    they are kept and saved, and the reply lists what failed:
+ *    {'tx':2,'rc':7,'rows':12,'applied':10,'failed':['s3','r5']}
+ * 3. Alarms are rebuilt once: new rules of the batch run through
+ *    ReadNewRules(), theAlarmGraph has moved the others while applying,
+ *    then one SaveConfig() writes each table and programs the flash cache
+ *
+ * ToDo:
+ * 1.
+**/
+
+#include "xlxTableTxn.h"
+#include "xlSmartController.h"
+#include "xlxLogger.h"
+
+//------------------------------------------------------------------
+// the one and only instance of TableTxnClass
+//------------------------------------------------------------------
+TableTxnClass theTableTxn;
+
+//------------------------------------------------------------------
+// Xlight Table Transaction Class
+//------------------------------------------------------------------
+TableTxnClass::TableTxnClass()
+{
+  m_open = false;
+  m_overflow = false;
+  m_expected = 0;
+  m_rows = 0;
+  m_tick = 0;
+  m_failed = 0;
+  m_done = 0;
+  m_commits = 0;
+  m_failures = 0;
+  m_applied = 0;
+}
+
+BOOL TableTxnClass::Begin(UC expected)
+{
+  if( m_open ) {
+    LOGW(LOGTAG_MSG, "Table transaction restarted, %d rows dropped", m_rows);
+    m_failures++;
+  }
+  m_open = true;
+  m_overflow = false;
+  m_expected = expected;
+  m_rows = 0;
+  m_failed = 0;
+  m_done = 0;
+  m_tick = millis();
+  LOGI(LOGTAG_MSG, "Table transaction begins, %d rows expected", expected);
+  return true;
+}
+
+BOOL TableTxnClass::IsOpen()
+{
+  if( m_open && millis() - m_tick > TXN_TIMEOUT ) {
+    LOGW(LOGTAG_MSG, "Table transaction timeout, %d rows dropped", m_rows);
+    m_failures++;
+    m_open = false;
+    m_rows = 0;
+  }
+  return m_open;
+}
+
+BOOL TableTxnClass::Stage(const RuleRow_t &row)
+{
+  txn_row_t *pRow = NewRow(CLS_RULE);
+  if( !pRow ) return false;
+  pRow->rule = row;
+  return true;
+}
+
+BOOL TableTxnClass::Stage(const ScheduleRow_t &row)
+{
+  txn_row_t *pRow = NewRow(CLS_SCHEDULE);
+  if( !pRow ) return false;
+  pRow->schedule = row;
+  return true;
+}
+
+BOOL TableTxnClass::Stage(const ScenarioRow_t &row)
+{
+  txn_row_t *pRow = NewRow(CLS_SCENARIO);
+  if( !pRow ) return false;
+  pRow->scenario = row;
+  return true;
+}
+
+UC TableTxnClass::Commit()
+{
+  if( !IsOpen() ) return TXN_RC_NOT_OPEN;
+  m_open = false;
+  m_failed = 0;
+  m_done = 0;
+
+  UC rc = Validate();
+  if( rc == TXN_RC_OK ) {
+    if( !Apply() ) rc = TXN_RC_APPLY;
+    // What did apply stays, it is saved with the rest
+    for( UC i = 0; i < m_rows; i++ ) {
+      if( !(m_failed & (1UL << i)) ) m_done++;
+    }
+    Rebuild();
+  }
+
+  if( rc == TXN_RC_OK ) {
+    m_commits++;
+    m_applied += m_done;
+    LOGI(LOGTAG_MSG, "Table transaction committed, %d rows", m_rows);
+  } else {
+    m_failures++;
+    m_applied += m_done;
+    LOGE(LOGTAG_MSG, "Table transaction failed rc=%d, %d rows, %d applied", rc, m_rows, m_done);
+  }
+  return rc;
+}
+
+// UIDs of the rows Apply() refused, as a JSON list body: 's3','r5'.
+// Whole items only, the list is cut short if buf is too small
+US TableTxnClass::PrintFailed(char *buf, US size)
+{
+  char strItem[8];
+  int nPos = 0, nLen;
+  UC lv_uid;
+  buf[0] = '\0';
+  for( UC i = 0; i < m_rows; i++ ) {
+    if( !(m_failed & (1UL << i)) ) continue;
+    lv_uid = (m_row[i].cls == CLS_RULE ? m_row[i].rule.uid :
+        (m_row[i].cls == CLS_SCHEDULE ? m_row[i].schedule.uid : m_row[i].scenario.uid));
+    nLen = snprintf(strItem, sizeof(strItem), "%s'%c%d'", (nPos > 0 ? "," : ""), m_row[i].cls, lv_uid);
+    if( nPos + nLen >= size ) break;
+    strcpy(buf + nPos, strItem);
+    nPos += nLen;
+  }
+  return nPos;
+}
+
+void TableTxnClass::Abort()
+{
+  if( m_open ) {
+    LOGN(LOGTAG_MSG, "Table transaction aborted, %d rows dropped", m_rows);
+    m_failures++;
+  }
+  m_open = false;
+  m_rows = 0;
+}
+
+void TableTxnClass::ShowStatus()
+{
+  SERIAL_LN("** Table transaction **");
+  if( IsOpen() ) {
+    UC lv_num[3] = {0, 0, 0};
+    for( UC i = 0; i < m_rows; i++ ) {
+      lv_num[m_row[i].cls == CLS_RULE ? 0 : (m_row[i].cls == CLS_SCHEDULE ? 1 : 2)]++;
+    }
+    SERIAL_LN("  open %lus, %d of %d rows: %d rules, %d schedules, %d scenarios%s",
+        (millis() - m_tick) / 1000, m_rows, m_expected, lv_num[0], lv_num[1], lv_num[2],
+        (m_overflow ? ", overflow" : ""));
+  } else {
+    SERIAL_LN("  closed");
+  }
+  SERIAL_LN("  commits %lu, failures %lu, rows applied %lu\n\r", m_commits, m_failures, m_applied);
+}
+
+//------------------------------------------------------------------
+// Internal functions
+//------------------------------------------------------------------
+txn_row_t *TableTxnClass::NewRow(char cls)
+{
+  m_tick = millis();
+  if( m_rows >= TXN_MAX_ROWS ) {
+    m_overflow = true;
+    return NULL;
+  }
+  m_row[m_rows].cls = cls;
+  return(m_row + m_rows++);
+}
+
+txn_row_t *TableTxnClass::FindRow(char cls, UC uid)
+{
+  for( UC i = 0; i < m_rows; i++ ) {
+    if( m_row[i].cls != cls ) continue;
+    if( (cls == CLS_RULE && m_row[i].rule.uid == uid)
+        || (cls == CLS_SCHEDULE && m_row[i].schedule.uid == uid)
+        || (cls == CLS_SCENARIO && m_row[i].scenario.uid == uid) ) {
+      return(m_row + i);
+    }
+  }
+  return NULL;
+}
+
+// Rows of the class that need a new node in the working memory chain
+UC TableTxnClass::CountNewRows(char cls)
+{
+  UC lv_num = 0;
+  for( UC i = 0; i < m_rows; i++ ) {
+    if( m_row[i].cls != cls ) continue;
+    if( cls == CLS_SCHEDULE && theSys.Schedule_table.search(m_row[i].schedule.uid) == NULL ) lv_num++;
+    if( cls == CLS_SCENARIO && theSys.Scenario_table.search(m_row[i].scenario.uid) == NULL ) lv_num++;
+  }
+  return lv_num;
+}
+
+UC TableTxnClass::Validate()
+{
+  if( m_overflow ) return TXN_RC_FULL;
+  if( m_expected > 0 && m_rows != m_expected ) return TXN_RC_COUNT;
+
+  // Each row
+  UC i, lv_uid;
+  US lv_max;
+  OP_FLAG lv_op;
+  for( i = 0; i < m_rows; i++ ) {
+    if( m_row[i].cls == CLS_RULE ) {
+      lv_uid = m_row[i].rule.uid;
+      lv_op = m_row[i].rule.op_flag;
+      lv_max = MAX_RT_ROWS;
+    } else if( m_row[i].cls == CLS_SCHEDULE ) {
+      lv_uid = m_row[i].schedule.uid;
+      lv_op = m_row[i].schedule.op_flag;
+      lv_max = MAX_SCT_ROWS;
+    } else {
+      lv_uid = m_row[i].scenario.uid;
+      lv_op = m_row[i].scenario.op_flag;
+      lv_max = MAX_SNT_ROWS;
+    }
+    if( lv_uid >= lv_max || lv_op == GET || FindRow(m_row[i].cls, lv_uid) != m_row + i ) {
+      LOGE(LOGTAG_MSG, "Table transaction: bad row UID:%c%d", m_row[i].cls, lv_uid);
+      return TXN_RC_ROW;
+    }
+  }
+
+  // References of rules, to rows of the batch or rows already there
+  txn_row_t *pRef;
+  for( i = 0; i < m_rows; i++ ) {
+    if( m_row[i].cls != CLS_RULE || m_row[i].rule.op_flag == DELETE ) continue;
+    lv_uid = m_row[i].rule.SCT_uid;
+    if( lv_uid < 255 ) {
+      pRef = FindRow(CLS_SCHEDULE, lv_uid);
+      if( pRef ? pRef->schedule.op_flag == DELETE : theSys.SearchSchedule(lv_uid) == NULL ) {
+        LOGE(LOGTAG_MSG, "Table transaction: UID:%c%d refers to missing UID:%c%d", CLS_RULE, m_row[i].rule.uid, CLS_SCHEDULE, lv_uid);
+        return TXN_RC_REF;
+      }
+    }
+    lv_uid = m_row[i].rule.SNT_uid;
+    if( lv_uid < 255 ) {
+      pRef = FindRow(CLS_SCENARIO, lv_uid);
+      if( pRef ? pRef->scenario.op_flag == DELETE : theSys.SearchScenario(lv_uid) == NULL ) {
+        LOGE(LOGTAG_MSG, "Table transaction: UID:%c%d refers to missing UID:%c%d", CLS_RULE, m_row[i].rule.uid, CLS_SCENARIO, lv_uid);
+        return TXN_RC_REF;
+      }
+    }
+  }
+
+  // Rules already there and not in the batch must not lose what they refer to
+  ListNode<RuleRow_t> *pRule = theSys.Rule_table.getRoot();
+  while( pRule ) {
+    if( pRule->data.op_flag != DELETE && FindRow(CLS_RULE, pRule->data.uid) == NULL ) {
+      pRef = FindRow(CLS_SCHEDULE, pRule->data.SCT_uid);
+      if( pRef && pRef->schedule.op_flag == DELETE ) {
+        LOGE(LOGTAG_MSG, "Table transaction: UID:%c%d still refers to UID:%c%d", CLS_RULE, pRule->data.uid, CLS_SCHEDULE, pRule->data.SCT_uid);
+        return TXN_RC_REF;
+      }
+      pRef = FindRow(CLS_SCENARIO, pRule->data.SNT_uid);
+      if( pRef && pRef->scenario.op_flag == DELETE ) {
+        LOGE(LOGTAG_MSG, "Table transaction: UID:%c%d still refers to UID:%c%d", CLS_RULE, pRule->data.uid, CLS_SCENARIO, pRule->data.SNT_uid);
+        return TXN_RC_REF;
+      }
+    }
+    pRule = pRule->next;
+  }
+
+  // Room in the working memory chains, only saved and executed rows can be evicted
+  UC lv_free = MAX_TABLE_SIZE - theSys.Schedule_table.size();
+  ListNode<ScheduleRow_t> *pSchedule = theSys.Schedule_table.getRoot();
+  while( pSchedule ) {
+    if( pSchedule->data.flash_flag == SAVED && pSchedule->data.run_flag == EXECUTED ) lv_free++;
+    pSchedule = pSchedule->next;
+  }
+  if( CountNewRows(CLS_SCHEDULE) > lv_free ) return TXN_RC_SPACE;
+
+  lv_free = MAX_TABLE_SIZE - theSys.Scenario_table.size();
+  ListNode<ScenarioRow_t> *pScenario = theSys.Scenario_table.getRoot();
+  while( pScenario ) {
+    if( pScenario->data.flash_flag == SAVED && pScenario->data.run_flag == EXECUTED ) lv_free++;
+    pScenario = pScenario->next;
+  }
+  if( CountNewRows(CLS_SCENARIO) > lv_free ) return TXN_RC_SPACE;
+
+  return TXN_RC_OK;
+}
+
+// Schedules and scenarios first, then the rules
+BOOL TableTxnClass::Apply()
+{
+  UC i;
+  for( i = 0; i < m_rows; i++ ) {
+    if( m_row[i].cls == CLS_SCHEDULE ) {
+      if( !theSys.Change_Schedule(m_row[i].schedule) ) m_failed |= (1UL << i);
+    } else if( m_row[i].cls == CLS_SCENARIO ) {
+      if( !theSys.Change_Scenario(m_row[i].scenario) ) m_failed |= (1UL << i);
+    }
+  }
+  for( i = 0; i < m_rows; i++ ) {
+    if( m_row[i].cls == CLS_RULE ) {
+      if( !theSys.Change_Rule(m_row[i].rule) ) m_failed |= (1UL << i);
+    }
+  }
+  return(m_failed == 0);
+}
+
+void TableTxnClass::Rebuild()
+{
+  // New rules go through Action_Rule(), rules already on an alarm were
+  // moved by Change_Schedule() and Change_Rule()
+  theSys.ReadNewRules(true);
+
+  // Rows no rule took over are done as well, so they are saved now
+  for( UC i = 0; i < m_rows; i++ ) {
+    if( m_row[i].cls == CLS_SCHEDULE ) {
+      ListNode<ScheduleRow_t> *pSchedule = theSys.Schedule_table.search(m_row[i].schedule.uid);
+      if( pSchedule && pSchedule->data.run_flag == UNEXECUTED ) {
+        if( pSchedule->data.op_flag == DELETE ) pSchedule->data.alarm_id = dtINVALID_ALARM_ID;
+        pSchedule->data.run_flag = EXECUTED;
+        theConfig.SetSCTChanged(true);
+      }
+    } else if( m_row[i].cls == CLS_SCENARIO ) {
+      ListNode<ScenarioRow_t> *pScenario = theSys.Scenario_table.search(m_row[i].scenario.uid);
+      if( pScenario && pScenario->data.run_flag == UNEXECUTED ) {
+        pScenario->data.run_flag = EXECUTED;
+        theConfig.SetSNTChanged(true);
+      }
+    }
+  }
+
+  // One write per table
+  theConfig.SaveConfig();
+}
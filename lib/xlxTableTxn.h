@@ -0,0 +1,94 @@
+//  xlxTableTxn.h - Xlight bulk upload of rule, schedule and scenario tables
+
+#ifndef xlxTableTxn_h
+#define xlxTableTxn_h
+
+#include "xliCommon.h"
+#include "xlxConfig.h"
+
+// Value of 'tx' in a config message
+#define TXN_ABORT               0
+#define TXN_BEGIN               1
+#define TXN_COMMIT              2
+
+// Result of Commit()
+#define TXN_RC_OK               0
+#define TXN_RC_NOT_OPEN         1
+#define TXN_RC_FULL             2           // More rows than TXN_MAX_ROWS
+#define TXN_RC_COUNT            3           // Rows staged differ from 'n' of begin
+#define TXN_RC_ROW              4           // Bad uid, op or duplicate row
+#define TXN_RC_REF              5           // Rule refers to a missing or deleted schedule or scenario
+#define TXN_RC_SPACE            6           // Working memory chain can't take the rows
+#define TXN_RC_APPLY            7
+
+#define TXN_MAX_ROWS            32
+// An open transaction is dropped after this long without a row
+#define TXN_TIMEOUT             60000
+
+typedef struct
+{
+  char cls;                         // CLS_RULE, CLS_SCHEDULE or CLS_SCENARIO
+  union {
+    RuleRow_t rule;
+    ScheduleRow_t schedule;
+    ScenarioRow_t scenario;
+  };
+} txn_row_t;
+
+//------------------------------------------------------------------
+// Xlight Table Transaction Class
+// Between begin and commit, rows of the three tables are only staged.
+// Commit() validates them together and applies them in one pass,
+// schedules and scenarios before the rules that refer to them, then
+// rebuilds the alarms of the rules involved and saves each table once.
+// A batch that fails validation changes nothing. Rows are not rolled
+// back if one fails to apply, the others are kept and saved, and
+// GetApplied() / PrintFailed() tell the client which rows made it.
+//------------------------------------------------------------------
+class TableTxnClass
+{
+public:
+  TableTxnClass();
+
+  // expected: number of rows to come, 0 if not known
+  BOOL Begin(UC expected = 0);
+  BOOL IsOpen();
+  BOOL Stage(const RuleRow_t &row);
+  BOOL Stage(const ScheduleRow_t &row);
+  BOOL Stage(const ScenarioRow_t &row);
+  UC Commit();
+  void Abort();
+  UC GetRows() { return m_rows; }
+  UC GetApplied() { return m_done; }
+  US PrintFailed(char *buf, US size);
+  void ShowStatus();
+
+  UL m_commits;
+  UL m_failures;
+  UL m_applied;                     // Rows applied by all commits
+
+protected:
+  txn_row_t *NewRow(char cls);
+  UC Validate();
+  txn_row_t *FindRow(char cls, UC uid);
+  UC CountNewRows(char cls);
+  BOOL Apply();
+  void Rebuild();
+
+private:
+  BOOL m_open;
+  BOOL m_overflow;
+  UC m_expected;
+  UC m_rows;
+  UL m_tick;                        // Last activity
+  UL m_failed;                      // Bit per row Apply() could not apply, TXN_MAX_ROWS fit
+  UC m_done;                        // Rows applied by the last commit
+  txn_row_t m_row[TXN_MAX_ROWS];
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern TableTxnClass theTableTxn;
+
+#endif /* xlxTableTxn_h */
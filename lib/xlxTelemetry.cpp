@@ -0,0 +1,298 @@
+/**
+ * xlxTelemetry.cpp - Xlight sensor telemetry aggregator
+ *
+ * Created by Baoshi Sun <bs.sun@datatellit.com>
+ * Copyright (C) 2015-2016 DTIT
+ * Full contributor list:
+ *
+ * Documentation:
+ * Support Forum:
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ *******************************
+ *
+ * REVISION HISTORY
+ * Version 1.0 - Created by Baoshi Sun <bs.sun@datatellit.com>
+ *
+ * DESCRIPTION
+ * 1. Keep the latest value per (node, sensor) within a window
+ * 2. Emit one frame per window instead of one publish per reading
+ * 3. JSON frame: {'ts':<time>,'tlm':[{'nd':12,'DHTt':23.50,'DHTh':45.00},{'nd':13,'ALS':40}]}
+ * 4. Packed frame: {'tlmb':'<base64>'}, binary layout (little endian):
+ *    ver(1) count(1) ts(4), then count * [nid(1) sensor(1) value(2)]
+ *    value is signed, scaled by GetSensorScale(), e.g. 23.5 degree is 235,
+ *    and clamped to -32768..32767, e.g. TVOC above 327.67 reads 32767
+ *
+ * ToDo:
+ * 1.
+**/
+
+#include "xlxTelemetry.h"
+#include "xlxConfig.h"
+#include "xlxPublishQueue.h"
+
+// the one and only instance of TelemetryClass
+TelemetryClass theTelemetry;
+
+//------------------------------------------------------------------
+// Sensor helpers
+//------------------------------------------------------------------
+// JSON key of sensor, same as the single reading messages
+const char *GetSensorKey(UC sensor)
+{
+  switch( sensor ) {
+  case sensorDHT:     return "DHTt";
+  case sensorDHT_h:   return "DHTh";
+  case sensorALS:     return "ALS";
+  case sensorMIC:     return "NOS";
+  case sensorMIC_b:   return "MIC";
+  case sensorPIR:     return "PIR";
+  case sensorIRKey:   return "IRK";
+  case sensorSMOKE:   return "SMK";
+  case sensorGAS:     return "GAS";
+  case sensorDUST:
+  case sensorPM25:    return "PM25";
+  case sensorPM10:    return "PM10";
+  case sensorTVOC:    return "TVOC";
+  case sensorCH2O:    return "CH2O";
+  case sensorCO2:     return "CO2";
+  }
+  return "UNK";
+}
+
+// Sensor of JSON key, 0xFF if unknown. sensorPM25 wins over sensorDUST.
+UC GetSensorByKey(const char *key)
+{
+  for( int sensor = sensorCO2; sensor >= sensorDHT; sensor-- ) {
+    if( wal_stricmp(GetSensorKey(sensor), key) == 0 ) return (UC)sensor;
+  }
+  return 0xFF;
+}
+
+// Multiplier from float value to packed integer
+UC GetSensorScale(UC sensor)
+{
+  switch( sensor ) {
+  case sensorDHT:
+  case sensorDHT_h:   return 10;
+  case sensorTVOC:
+  case sensorCH2O:    return 100;
+  }
+  return 1;
+}
+
+//------------------------------------------------------------------
+// Xlight Telemetry Class
+//------------------------------------------------------------------
+TelemetryClass::TelemetryClass()
+{
+  memset(m_items, 0x00, sizeof(m_items));
+  m_count = 0;
+  m_dirty = 0;
+  m_lastFlush = 0;
+  m_readings = 0;
+  m_frames = 0;
+  m_bytes = 0;
+  m_overflow = 0;
+}
+
+BOOL TelemetryClass::IsEnabled()
+{
+  return(theConfig.GetTelemetryWindow() > 0);
+}
+
+// Keep the latest reading
+BOOL TelemetryClass::Update(UC nid, UC sensor, float value)
+{
+  int pos = Search(nid, sensor, true);
+  if( pos < 0 ) {
+    // Table is full of pending readings, send them now
+    m_overflow++;
+    Flush();
+    pos = Search(nid, sensor, true);
+    if( pos < 0 ) return false;
+  }
+
+  if( !m_items[pos].dirty ) {
+    m_items[pos].dirty = 1;
+    m_dirty++;
+  }
+  m_items[pos].value = value;
+  m_readings++;
+  return true;
+}
+
+// Call it in SelfCheck
+void TelemetryClass::Process()
+{
+  if( m_dirty == 0 ) return;
+
+  UL window = theConfig.GetTelemetryWindow();
+  if( millis() - m_lastFlush >= window * 1000 ) {
+    Flush();
+  }
+}
+
+// Emit all pending readings, return the number of frames
+UC TelemetryClass::Flush()
+{
+  m_lastFlush = millis();
+  if( m_dirty == 0 ) return 0;
+  // Keep the latest values until the cloud is back
+  if( theConfig.GetDisableWiFi() || !Particle.connected() ) return 0;
+
+  char buf[PUBQ_MSG_SIZE];
+  UC start = 0;
+  UC frames = 0;
+  UC len, lv_dirty;
+  BOOL bPacked = theConfig.IsTelemetryPacked();
+  while( m_dirty > 0 && start < m_count ) {
+    lv_dirty = m_dirty;
+    if( bPacked ) {
+      len = BuildPackedFrame(buf, sizeof(buf), start);
+    } else {
+      len = BuildJSONFrame(buf, sizeof(buf), start);
+    }
+    if( lv_dirty == m_dirty ) break;
+    theCloudQue.AddPublishMsg(CLT_ID_SensorData, buf, len);
+    m_bytes += len;
+    frames++;
+  }
+  m_frames += frames;
+  return frames;
+}
+
+void TelemetryClass::ShowStatistics()
+{
+  SERIAL_LN("** Telemetry: window %ds, %s frame **", theConfig.GetTelemetryWindow(),
+      theConfig.IsTelemetryPacked() ? "packed" : "JSON");
+  SERIAL_LN("  items: %d of %d, pending: %d", m_count, TLM_MAX_ITEMS, m_dirty);
+  SERIAL_LN("  readings: %lu, frames: %lu, bytes: %lu, overflow: %lu\n\r",
+      m_readings, m_frames, m_bytes, m_overflow);
+}
+
+//------------------------------------------------------------------
+// Internal functions
+//------------------------------------------------------------------
+// Items are sorted by (nid, sensor), so readings of one node are adjacent
+int TelemetryClass::Search(UC nid, UC sensor, BOOL bInsert)
+{
+  US key = nid * 256 + sensor;
+  US _key;
+  int pos;
+  for( pos = 0; pos < m_count; pos++ ) {
+    _key = m_items[pos].nid * 256 + m_items[pos].sensor;
+    if( _key == key ) return pos;
+    if( _key > key ) break;
+  }
+  if( !bInsert ) return -1;
+
+  if( m_count >= TLM_MAX_ITEMS ) {
+    // Reuse a slot whose value was already sent
+    int victim;
+    for( victim = 0; victim < m_count; victim++ ) {
+      if( !m_items[victim].dirty ) break;
+    }
+    if( victim >= m_count ) return -1;
+    for( int i = victim; i < m_count - 1; i++ ) {
+      m_items[i] = m_items[i+1];
+    }
+    m_count--;
+    if( victim < pos ) pos--;
+  }
+
+  for( int i = m_count; i > pos; i-- ) {
+    m_items[i] = m_items[i-1];
+  }
+  m_items[pos].nid = nid;
+  m_items[pos].sensor = sensor;
+  m_items[pos].dirty = 0;
+  m_items[pos].value = 0;
+  m_count++;
+  return pos;
+}
+
+UC TelemetryClass::BuildJSONFrame(char *buf, US size, UC &start)
+{
+  char strItem[48];
+  int nPos, nLen;
+  int lastNode = -1;
+  UC i;
+
+  nPos = snprintf(buf, size, "{'ts':%lu,'tlm':[", Time.now());
+  for( i = start; i < m_count; i++ ) {
+    if( !m_items[i].dirty ) continue;
+
+    // Open an object per node
+    if( m_items[i].nid != lastNode ) {
+      nLen = snprintf(strItem, sizeof(strItem), "%s{'nd':%d,", (lastNode < 0 ? "" : "},"), m_items[i].nid);
+    } else {
+      nLen = snprintf(strItem, sizeof(strItem), ",");
+    }
+    if( GetSensorScale(m_items[i].sensor) > 1 ) {
+      nLen += snprintf(strItem + nLen, sizeof(strItem) - nLen, "'%s':%.2f", GetSensorKey(m_items[i].sensor), m_items[i].value);
+    } else {
+      nLen += snprintf(strItem + nLen, sizeof(strItem) - nLen, "'%s':%d", GetSensorKey(m_items[i].sensor), (int)m_items[i].value);
+    }
+    // Reserve "}]}"
+    if( nPos + nLen + 3 >= size ) break;
+    strcpy(buf + nPos, strItem);
+    nPos += nLen;
+    lastNode = m_items[i].nid;
+    m_items[i].dirty = 0;
+    m_dirty--;
+  }
+  start = i;
+
+  if( lastNode >= 0 ) buf[nPos++] = '}';
+  buf[nPos++] = ']';
+  buf[nPos++] = '}';
+  buf[nPos] = '\0';
+  return nPos;
+}
+
+UC TelemetryClass::BuildPackedFrame(char *buf, US size, UC &start)
+{
+  UC data[TLM_PACKED_MAX_SIZE];
+  UC count = 0;
+  UC nPos = TLM_PACKED_HEAD_SIZE;
+  UL ts = Time.now();
+  float lv_scaled;
+  SHORT value;
+  UC i;
+
+  for( i = start; i < m_count; i++ ) {
+    if( !m_items[i].dirty ) continue;
+    if( nPos + TLM_PACKED_ITEM_SIZE > TLM_PACKED_MAX_SIZE ) break;
+    // Out of range would wrap around in the cast
+    lv_scaled = m_items[i].value * GetSensorScale(m_items[i].sensor);
+    if( lv_scaled > 32767 ) lv_scaled = 32767;
+    else if( lv_scaled < -32768 ) lv_scaled = -32768;
+    value = (SHORT)lv_scaled;
+    data[nPos++] = m_items[i].nid;
+    data[nPos++] = m_items[i].sensor;
+    data[nPos++] = value & 0xFF;
+    data[nPos++] = (value >> 8) & 0xFF;
+    m_items[i].dirty = 0;
+    m_dirty--;
+    count++;
+  }
+  start = i;
+
+  data[0] = TLM_PACKED_VERSION;
+  data[1] = count;
+  data[2] = ts & 0xFF;
+  data[3] = (ts >> 8) & 0xFF;
+  data[4] = (ts >> 16) & 0xFF;
+  data[5] = (ts >> 24) & 0xFF;
+
+  int nLen = snprintf(buf, size, "{'tlmb':'");
+  nLen += Base64Encode(buf + nLen, data, nPos);
+  buf[nLen++] = '\'';
+  buf[nLen++] = '}';
+  buf[nLen] = '\0';
+  return nLen;
+}
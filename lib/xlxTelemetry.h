@@ -0,0 +1,66 @@
+//  xlxTelemetry.h - Xlight sensor telemetry aggregator
+
+#ifndef xlxTelemetry_h
+#define xlxTelemetry_h
+
+#include "xliCommon.h"
+
+// Maximum (node, sensor) pairs kept in one window
+#define TLM_MAX_ITEMS           32
+
+// Packed frame format version
+#define TLM_PACKED_VERSION      1
+
+// Packed frame: header + 4 bytes per reading, must fit one publish after base64
+#define TLM_PACKED_HEAD_SIZE    6
+#define TLM_PACKED_ITEM_SIZE    4
+#define TLM_PACKED_MAX_SIZE     180
+
+typedef struct
+{
+  UC nid;
+  UC sensor;                        // sensors_t
+  UC dirty                :1;       // Changed since the last frame
+  UC reserved             :7;
+  float value;
+} tlm_item_t;
+
+//------------------------------------------------------------------
+// Xlight Telemetry Class
+//------------------------------------------------------------------
+class TelemetryClass
+{
+public:
+  TelemetryClass();
+
+  BOOL IsEnabled();
+  BOOL Update(UC nid, UC sensor, float value);
+  void Process();
+  UC Flush();
+  void ShowStatistics();
+
+  UL m_readings;                    // Readings fed into the aggregator
+  UL m_frames;                      // Frames emitted
+  UL m_bytes;                       // Bytes of emitted frames
+  UL m_overflow;                    // Early flushes due to full table
+
+protected:
+  int Search(UC nid, UC sensor, BOOL bInsert = false);
+  UC BuildJSONFrame(char *buf, US size, UC &start);
+  UC BuildPackedFrame(char *buf, US size, UC &start);
+
+private:
+  tlm_item_t m_items[TLM_MAX_ITEMS];
+  UC m_count;
+  UC m_dirty;
+  UL m_lastFlush;
+};
+
+//------------------------------------------------------------------
+// Function & Class Helper
+//------------------------------------------------------------------
+extern TelemetryClass theTelemetry;
+const char *GetSensorKey(UC sensor);
+UC GetSensorByKey(const char *key);
+
+#endif /* xlxTelemetry_h */
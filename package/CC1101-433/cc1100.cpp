@@ -35,7 +35,7 @@ static uint8_t cc1100_GFSK_2_kb[] = {
                     0xF8,  // MDMCFG0       Modem Configuration
                     0x15,  // @DEVIATN       Modem Deviation Setting
                     0x07,  // MCSM2         Main Radio Control State Machine Configuration
-                    0x0C,  // MCSM1         Main Radio Control State Machine Configuration
+                    0x0F,  // MCSM1         Main Radio Control State Machine Configuration, RXOFF/TXOFF -> RX
                     0x18,  // MCSM0         Main Radio Control State Machine Configuration
                     0x16,  // @FOCCFG        Frequency Offset Compensation Configuration
                     0x6C,  // @BSCFG         Bit Synchronization Configuration
@@ -126,6 +126,10 @@ uint8_t CC1100::begin()
     pinMode(GDO2, INPUT);
 
     set_debug_level(set_debug_level());   //set debug level of CC1101 outputs
+    tx_pending = FALSE;                   //no frame on air
+    tx_air_us = 0;
+    tx_waking = FALSE;
+    tx_wake_ms = WOR_WAKE_TIME;
 
     if(debug_level > 0){
         Serial.println(F("Init CC1100..."));
@@ -271,20 +275,25 @@ uint8_t CC1100::transmit(void)
 //---------------------------[receive mode]-------------------------------------
 uint8_t CC1100::receive(void)
 {
-    uint8_t marcstate;
-
     sidle();                              //sets to idle first.
     spi_write_strobe(SRX);                //writes receive strobe (receive mode)
 
-    marcstate = 0xFF;                     //set unknown/dummy state value
+    //no need to wait for RX (0x0D), calibration is done by the radio
+    return TRUE;
+}
+//-------------------------------[end]------------------------------------------
+
+//-----------[wait for RX (0x0D) after receive(), bounded in time]---------------
+uint8_t CC1100::wait_rx(uint16_t timeout_us)
+{
+    uint16_t waited = 0;
 
-    while(marcstate != 0x0D)              //0x0D = RX
+    while((spi_read_register(MARCSTATE) & 0x1F) != 0x0D)    //calibrating after SRX
     {
-        marcstate = (spi_read_register(MARCSTATE) & 0x1F); //read out state of cc1100 to be sure in RX
-        //uart_puthex_byte(marcstate);
+        if(waited >= timeout_us) return FALSE;
+        delayMicroseconds(RX_WAIT_STEP);
+        waited += RX_WAIT_STEP;
     }
-    Serial.println("set to rx");
-    delayMicroseconds(100);
     return TRUE;
 }
 //-------------------------------[end]------------------------------------------
@@ -410,10 +419,110 @@ uint8_t CC1100::sent_packet(uint8_t my_addr, uint8_t rx_addr, uint8_t *txbuffer,
         return FALSE;
     }
 
-    tx_payload_burst(my_addr, rx_addr, txbuffer, pktlen);   //loads the data in cc1100 buffer
-    transmit();                                             //sents data over air
-    receive();                                              //receive mode
-    return TRUE;                                               //sent failed. too many retries
+    return tx_start(my_addr, rx_addr, txbuffer, pktlen);    //radio returns to RX itself (MCSM1)
+}
+//-------------------------------[end]------------------------------------------
+
+//------------------[start transmit without waiting]----------------------------
+uint8_t CC1100::tx_start(uint8_t my_addr, uint8_t rx_addr, uint8_t *txbuffer,
+                         uint8_t pktlen)
+{
+    if(pktlen > (FIFOBUFFER - 1))                               //FIFO overflow check
+    {
+        return FALSE;
+    }
+    if(tx_pending && tx_check() == FALSE)                       //previous frame still on air
+    {
+        return FALSE;
+    }
+
+    if(!tx_waking && spi_read_register(TXBYTES) != 0)           //leftover or underflow
+    {
+        sidle();
+        spi_write_strobe(SFTX);                                 //flush TX FIFO in IDLE
+    }
+
+    tx_waking = FALSE;                                          //sync word follows the preamble
+    tx_payload_burst(my_addr, rx_addr, txbuffer, pktlen);       //loads the data in cc1100 buffer
+    tx_start_us = micros();
+    tx_pending = TRUE;
+    spi_write_strobe(STX);                                      //RX or IDLE -> TX
+    return TRUE;
+}
+//-------------------------------[end]------------------------------------------
+
+//------------------[end of packet, call it in GDO2 ISR]------------------------
+uint8_t CC1100::tx_done(void)
+{
+    if(!tx_pending) return FALSE;                               //end of RX packet
+
+    tx_air_us = micros() - tx_start_us;
+    tx_pending = FALSE;
+    return TRUE;
+}
+//-------------------------------[end]------------------------------------------
+
+//------------------[recover if GDO2 edge is missed]----------------------------
+uint8_t CC1100::tx_check(void)
+{
+    uint8_t marcstate;
+
+    if(!tx_pending) return TRUE;
+    if(micros() - tx_start_us < TX_TIMEOUT * 1000UL) return FALSE;
+
+    marcstate = (spi_read_register(MARCSTATE) & 0x1F);
+    if(marcstate != 0x0D)                                       //not back to RX
+    {
+        sidle();
+        spi_write_strobe(SFTX);                                 //flush TX FIFO
+        spi_write_strobe(SRX);
+    }
+    tx_air_us = micros() - tx_start_us;
+    tx_pending = FALSE;
+    return TRUE;
+}
+//-------------------------------[end]------------------------------------------
+
+//---------------[long preamble to wake a node running WOR]---------------------
+// With an empty TX FIFO the modulator keeps sending preamble, until tx_start()
+// loads the packet. Wait for tx_wake_ready() before that. The radio can't
+// receive meanwhile, so wake_ms should be just over the node's EVENT0.
+uint8_t CC1100::tx_wake(unsigned int wake_ms)
+{
+    if(tx_pending && tx_check() == FALSE)                       //previous frame still on air
+    {
+        return FALSE;
+    }
+
+    if(spi_read_register(TXBYTES) != 0)
+    {
+        sidle();
+        spi_write_strobe(SFTX);
+    }
+
+    tx_wake_us = micros();
+    tx_wake_ms = wake_ms;
+    tx_waking = TRUE;
+    spi_write_strobe(STX);                                      //RX or IDLE -> TX, preamble only
+    return TRUE;
+}
+//-------------------------------[end]------------------------------------------
+
+//------------------[preamble covers one WOR EVENT0 period]---------------------
+uint8_t CC1100::tx_wake_ready(void)
+{
+    if(!tx_waking) return TRUE;
+    return (micros() - tx_wake_us >= tx_wake_ms * 1000UL);
+}
+//-------------------------------[end]------------------------------------------
+
+//------------------[stop the preamble, back to RX]-----------------------------
+void CC1100::tx_wake_cancel(void)
+{
+    if(!tx_waking) return;
+    tx_waking = FALSE;
+    sidle();
+    spi_write_strobe(SRX);
 }
 //-------------------------------[end]------------------------------------------
 
@@ -425,9 +534,7 @@ void CC1100::sent_acknolage(uint8_t my_addr, uint8_t tx_addr)
 
     tx_buffer[3] = 'A'; tx_buffer[4] = 'c'; tx_buffer[5] = 'k'; //fill buffer with ACK Payload
 
-    tx_payload_burst(my_addr, tx_addr, tx_buffer, pktlen);      //load payload to CC1100
-    transmit();                                                 //sent package over the air
-    receive();                                                  //set CC1100 in receive mode
+    tx_start(my_addr, tx_addr, tx_buffer, pktlen);              //sent package, back to RX by MCSM1
 
     if(debug_level > 0){                                        //debut output
         Serial.println(F("Ack_sent!"));
@@ -437,7 +544,11 @@ void CC1100::sent_acknolage(uint8_t my_addr, uint8_t tx_addr)
 //----------------------[check if Packet is received]---------------------------
 uint8_t CC1100::packet_available()
 {
+#ifdef CC1101_SIM
+  if(sim->get_gdo2())
+#else
   if(digitalRead(GDO2) == TRUE)
+#endif
   { // rx not finished
     return 0;
   }
@@ -608,7 +719,8 @@ void CC1100::set_channel(uint8_t channel)
 uint8_t CC1100::get_channel()
 {
     uint8_t channel;
-    channel = spi_read_register(CHANNR);   //stores the new channel # in the CC1100
+    channel = spi_read_register(CHANNR);   //reads the channel # from the CC1100
+    return channel;
 }
 //-------------------------------[end]------------------------------------------
 
@@ -848,6 +960,13 @@ int8_t CC1100::rssi_convert(uint8_t Rssi_hex)
 }
 //-------------------------------[end]------------------------------------------
 
+//----------[current RSSI in dBm, valid RSSI_SETTLE_TIME after SRX]-------------
+int8_t CC1100::get_rssi(void)
+{
+    return rssi_convert(spi_read_register(RSSI_VALUE));
+}
+//-------------------------------[end]------------------------------------------
+
 //----------------------------[lqi convert]-------------------------------------
 uint8_t CC1100::lqi_convert(uint8_t lqi)
 {
@@ -900,6 +1019,9 @@ uint8_t CC1100::get_temp(uint8_t *ptemp_Arr)
 //|==================== SPI Initialisation for CC1100 =========================|
 void CC1100::spi_begin(void)
 {
+#ifdef CC1101_SIM
+    return;
+#endif
     pinMode(SS_PIN, OUTPUT);
 
     //|--- Aktivieren des SPI Master Interfaces, fosc = fclk / x --------|
@@ -931,6 +1053,9 @@ void CC1100::spi_begin(void)
 //|==================== SPI Initialisation for CC1100 =========================|
 void CC1100::spi_end(void)
 {
+#ifdef CC1101_SIM
+    return;
+#endif
     pinMode(SS_PIN, INPUT);
 
    /*SPCR = ((0<<SPE) |                   // SPI Enable
@@ -957,6 +1082,10 @@ uint8_t CC1100::spi_putc(uint8_t data)
 //|==================== schreibe strobe command  ==============================|
 void CC1100::spi_write_strobe(uint8_t spi_instr)
 {
+#ifdef CC1101_SIM
+    sim->spi_access(spi_instr, NULL, 0);
+    return;
+#endif
     digitalWrite(SS_PIN, LOW);          // CS low
     //while(digitalRead(MOSI_PIN) == 0);  // Wait until MOSI_PIN becomes LOW
     spi_putc(spi_instr);
@@ -978,6 +1107,10 @@ uint8_t CC1100::spi_read_status(uint8_t spi_instr)
 //|========================== Ein Register lesen ==============================|
 uint8_t CC1100::spi_read_register(uint8_t spi_instr)
 {
+#ifdef CC1101_SIM
+    sim->spi_access(spi_instr | READ_SINGLE_BYTE, &spi_instr, 1);
+    return spi_instr;
+#endif
     digitalWrite(SS_PIN, LOW);          // CS low
     //while(digitalRead(MOSI_PIN) == 0);  // Wait until MOSI_PIN becomes LOW
     spi_putc(spi_instr | READ_SINGLE_BYTE);
@@ -989,6 +1122,10 @@ uint8_t CC1100::spi_read_register(uint8_t spi_instr)
 //|========== Mehrere hintereinanderliegende Register auf einmal lesen ========|
 void CC1100::spi_read_burst(uint8_t spi_instr, uint8_t *pArr, uint8_t length)
 {
+#ifdef CC1101_SIM
+    sim->spi_access(spi_instr | READ_BURST, pArr, length);
+    return;
+#endif
     digitalWrite(SS_PIN, LOW);          // CS low
     //while(digitalRead(MOSI_PIN) == 0);  //Wait until MOSI_PIN becomes LOW
     spi_putc(spi_instr | READ_BURST);
@@ -1003,6 +1140,10 @@ void CC1100::spi_read_burst(uint8_t spi_instr, uint8_t *pArr, uint8_t length)
 //|======================= Ein Register schreiben =============================|
 void CC1100::spi_write_register(uint8_t spi_instr, uint8_t value)
 {
+#ifdef CC1101_SIM
+    sim->spi_access(spi_instr | WRITE_SINGLE_BYTE, &value, 1);
+    return;
+#endif
     digitalWrite(SS_PIN, LOW);          // CS low
     //while(digitalRead(MOSI_PIN) == 0);  //Wait until MOSI_PIN becomes LOW
     spi_putc(spi_instr | WRITE_SINGLE_BYTE);
@@ -1012,6 +1153,10 @@ void CC1100::spi_write_register(uint8_t spi_instr, uint8_t value)
 //|======= Mehrere hintereinanderliegende Register auf einmal schreiben =======|
 void CC1100::spi_write_burst(uint8_t spi_instr, uint8_t *pArr, uint8_t length)
 {
+#ifdef CC1101_SIM
+    sim->spi_access(spi_instr | WRITE_BURST, pArr, length);
+    return;
+#endif
     digitalWrite(SS_PIN, LOW);          // CS low
     //while(digitalRead(MOSI_PIN) == 0);  //Wait until MOSI_PIN becomes LOW
     spi_putc(spi_instr | WRITE_BURST);
@@ -1025,6 +1170,15 @@ void CC1100::spi_write_burst(uint8_t spi_instr, uint8_t *pArr, uint8_t length)
 }
 //|=================================== END ====================================|
 
+#ifdef CC1101_SIM
+//---------------[use simulated chip, call it before begin()]-------------------
+void CC1100::attach_sim(CC1101Sim *radio)
+{
+    sim = radio;
+}
+//-------------------------------[end]------------------------------------------
+#endif
+
 void CC1100::setSyncWord( uint16_t Sync )
 {
     spi_write_register( SYNC1, 0xFF & ( Sync >> 8 ) );
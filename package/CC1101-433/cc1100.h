@@ -1,6 +1,12 @@
 #ifndef cc1100_H
 #define cc1100_H
 
+//#define CC1101_SIM                    //host build: register level simulator instead of SPI
+
+#ifdef CC1101_SIM
+#include "cc1101sim.h"
+#endif
+
 //|=====================[ setting EEPROM addresses]=============================
 #define EEPROM_ADDRESS_CC1100_FREQUENCY 0x1F4  //ISM band
 #define EEPROM_ADDRESS_CC1100_MODE      0x1F5  //modulation mode
@@ -19,6 +25,12 @@
 #define RSSI_OFFSET_868MHZ        0x4E  //dec = 74
 #define TX_RETRIES_MAX            0x05  //tx_retries_max
 #define ACK_TIMEOUT                600  //ACK timeout in ms
+#define TX_TIMEOUT                 500  //max on-air time of one packet in ms
+#define WOR_WAKE_TIME             1950  //default preamble in ms, EVENT0 of wor_enable() plus margin
+#define RSSI_SETTLE_TIME           500  //us in RX before the RSSI register is valid
+#define RX_WAIT_TIMEOUT           1000  //us, IDLE to RX with FS autocal takes ~720us
+#define RX_WAIT_STEP                20  //us between MARCSTATE polls
+#define RSSI_SAMPLE_FAILED        -128  //dBm, RX not reached, no sample
 #define CC1100_COMPARE_REGISTER   0x00  //register compare 0=no compare 1=compare
 #define BROADCAST_ADDRESS         0x00  //broadcast address
 #define BROADCAST_ADDRESS1        0xFF  //broadcast address
@@ -119,6 +131,7 @@
 #define FREQEST        0xF2   // Frequency offset estimate
 #define LQI            0xF3   // Demodulator estimate for link quality
 //#define RSSI           0xF4   // Received signal strength indication
+#define RSSI_VALUE     0xF4   // RSSI, renamed to keep clear of WiFi.RSSI()
 #define MARCSTATE      0xF5   // Control state machine state
 #define WORTIME1       0xF6   // High byte of WOR timer
 #define WORTIME0       0xF7   // Low byte of WOR timer
@@ -141,6 +154,18 @@ class CC1100
     public:
         uint8_t debug_level;
 
+        volatile uint8_t tx_pending;        //frame in TX FIFO or on air
+        volatile unsigned long tx_start_us;
+        volatile unsigned long tx_air_us;   //on-air time of the last frame
+        uint8_t tx_waking;                  //sending preamble to wake a WOR node
+        unsigned long tx_wake_us;
+        unsigned int tx_wake_ms;            //preamble length of the current wake
+
+#ifdef CC1101_SIM
+        CC1101Sim *sim;                     //simulated chip behind the SPI functions
+        void attach_sim(CC1101Sim *radio);
+#endif
+
         uint8_t set_debug_level(uint8_t set_debug_level);
         uint8_t get_debug_level(void);
 
@@ -165,6 +190,7 @@ class CC1100
         uint8_t sidle(void);
         uint8_t transmit(void);
         uint8_t receive(void);
+        uint8_t wait_rx(uint16_t timeout_us = RX_WAIT_TIMEOUT);
 
         void show_register_settings(void);
         void show_main_settings(void);
@@ -182,11 +208,18 @@ class CC1100
         void tx_fifo_erase(uint8_t *txbuffer);
 
         uint8_t sent_packet(uint8_t my_addr, uint8_t rx_addr, uint8_t *txbuffer, uint8_t pktlen);
+        uint8_t tx_start(uint8_t my_addr, uint8_t rx_addr, uint8_t *txbuffer, uint8_t pktlen);
+        uint8_t tx_done(void);
+        uint8_t tx_check(void);
+        uint8_t tx_wake(unsigned int wake_ms = WOR_WAKE_TIME);
+        uint8_t tx_wake_ready(void);
+        void tx_wake_cancel(void);
         void sent_acknolage(uint8_t my_addr, uint8_t tx_addr);
 
         uint8_t check_acknolage(uint8_t *rxbuffer, uint8_t pktlen, uint8_t sender, uint8_t my_addr);
 
         int8_t rssi_convert(uint8_t Rssi);
+        int8_t get_rssi(void);
         uint8_t check_crc(uint8_t lqi);
         uint8_t lqi_convert(uint8_t lqi);
         uint8_t get_temp(uint8_t *ptemp_Arr);
@@ -0,0 +1,565 @@
+/*------------------------------------------------------------------------------
+'                     CC1101 register level simulator
+'                     -------------------------------
+'
+'  Host side model of the CC1101 behind the SPI seam of CC1100:
+'  - config registers, PATABLE, command strobes and status registers
+'  - 64 byte TX/RX FIFOs, MARCSTATE, TXBYTES/RXBYTES with under/overflow
+'  - variable packet length, address check, appended RSSI and LQI/CRC_OK
+'  - MCSM1 RXOFF/TXOFF modes and GDO2 (IOCFG2 = 0x06) end of packet edge
+'  - several radios on one virtual ether with loss, latency and collisions
+'
+'  Only built when CC1101_SIM is defined.
+'-----------------------------------------------------------------------------*/
+#ifdef CC1101_SIM
+
+#include <string.h>
+#include "cc1101sim.h"
+
+/*---------------------------[register addresses]-----------------------------*/
+#define SIM_IOCFG2      0x00
+#define SIM_PKTLEN      0x06
+#define SIM_PKTCTRL1    0x07
+#define SIM_PKTCTRL0    0x08
+#define SIM_ADDR        0x09
+#define SIM_CHANNR      0x0A
+#define SIM_MDMCFG4     0x10
+#define SIM_MDMCFG3     0x11
+#define SIM_MDMCFG2     0x12
+#define SIM_MDMCFG1     0x13
+#define SIM_MCSM1       0x17
+#define SIM_MCSM0       0x18
+#define SIM_PATABLE     0x3E
+#define SIM_FIFO        0x3F
+
+#define SIM_CRYSTAL_FREQUENCY   26000000ULL
+#define SIM_RSSI_OFFSET         0x4E    //same as RSSI_OFFSET_868MHZ of the driver
+
+static const uint8_t sim_preamble_bytes[] = {2, 3, 4, 6, 8, 12, 16, 24};
+
+//|============================= CC1101Sim ====================================|
+CC1101Sim::CC1101Sim(CC1101Ether &the_ether)
+{
+    ether = &the_ether;
+    gdo2_callback = NULL;
+    gdo2_context = NULL;
+    memset(&stat, 0, sizeof(stat));
+    reset();
+    id = ether->attach(this);
+}
+
+//--------------------------[power on reset values]-----------------------------
+void CC1101Sim::reset(void)
+{
+    memset(reg, 0, sizeof(reg));
+    reg[SIM_IOCFG2]   = 0x29;
+    reg[0x02]         = 0x3F;           //IOCFG0
+    reg[SIM_PKTLEN]   = 0xFF;
+    reg[SIM_PKTCTRL1] = 0x04;
+    reg[SIM_PKTCTRL0] = 0x45;
+    reg[SIM_MDMCFG4]  = 0x8C;
+    reg[SIM_MDMCFG3]  = 0x22;
+    reg[SIM_MDMCFG2]  = 0x02;
+    reg[SIM_MDMCFG1]  = 0x22;
+    reg[SIM_MCSM1]    = 0x30;
+    reg[SIM_MCSM0]    = 0x04;
+    memset(patable, 0, sizeof(patable));
+    state = SIM_STATE_IDLE;
+    rx_ready_us = 0;
+    tx_len = 0;
+    tx_preamble = 0;
+    rx_head = 0;
+    rx_len = 0;
+    gdo2_busy = 0;
+}
+//-------------------------------[end]------------------------------------------
+
+//----------------[one SPI transaction, returns chip status]--------------------
+uint8_t CC1101Sim::spi_access(uint8_t header, uint8_t *pArr, uint8_t length)
+{
+    uint8_t read  = header & 0x80;
+    uint8_t burst = header & 0x40;
+    uint8_t addr  = header & 0x3F;
+
+    stat.spi_access++;
+    update_state();
+
+    if(addr >= 0x30 && addr <= 0x3D)
+    {
+        if(!burst)                                  //command strobe
+        {
+            strobe(addr);
+        }
+        else if(read && pArr && length > 0)         //status register
+        {
+            pArr[0] = read_status(addr);
+        }
+        return chip_status();
+    }
+
+    for(uint8_t i = 0; i < length; i++)
+    {
+        if(addr == SIM_PATABLE)
+        {
+            if(read) pArr[i] = patable[i & 0x07];
+            else patable[i & 0x07] = pArr[i];
+        }
+        else if(addr == SIM_FIFO)
+        {
+            if(read)
+            {
+                pArr[i] = 0;
+                if(rx_len > 0)
+                {
+                    pArr[i] = rx_fifo[rx_head++];
+                    if(--rx_len == 0) rx_head = 0;
+                }
+            }
+            else if(tx_len < SIM_FIFO_SIZE)
+            {
+                tx_fifo[tx_len++] = pArr[i];
+                if(tx_preamble && tx_len >= tx_packet_length())
+                {
+                    tx_preamble = 0;            //sync word and packet follow the preamble
+                    start_tx();
+                }
+            }
+        }
+        else
+        {
+            if(read) pArr[i] = reg[addr];
+            else reg[addr] = pArr[i];
+            if(burst && ++addr >= SIM_REG_COUNT) break;
+        }
+    }
+    return chip_status();
+}
+//-------------------------------[end]------------------------------------------
+
+//-------------------[RX once the calibration time is over]---------------------
+void CC1101Sim::update_state(void)
+{
+    if(state == SIM_STATE_STARTCAL && ether->now() >= rx_ready_us) state = SIM_STATE_RX;
+}
+//-------------------------------[end]------------------------------------------
+
+//---------------------------[command strobes]----------------------------------
+void CC1101Sim::strobe(uint8_t cmd)
+{
+    switch(cmd)
+    {
+        case 0x30:                                  //SRES
+            reset();
+            break;
+        case 0x34:                                  //SRX, deaf while the synthesizer settles
+            if(state == SIM_STATE_IDLE || state == SIM_STATE_SLEEP)
+            {
+                state = SIM_STATE_STARTCAL;
+                rx_ready_us = ether->now() +
+                    (((reg[SIM_MCSM0] >> 4) & 0x03) == 0x01 ? SIM_RX_CAL_US : SIM_RX_NOCAL_US);
+            }
+            break;
+        case 0x38:                                  //SWOR, always listening here
+            if(state == SIM_STATE_IDLE || state == SIM_STATE_SLEEP) state = SIM_STATE_RX;
+            break;
+        case 0x35:                                  //STX, also ends STARTCAL (TX settling not modelled)
+            if(state == SIM_STATE_IDLE || state == SIM_STATE_RX || state == SIM_STATE_STARTCAL)
+            {
+                if(tx_len == 0)                     //preamble until TXFIFO is loaded
+                {
+                    state = SIM_STATE_TX;
+                    tx_preamble = 1;
+                    stat.tx_preamble++;
+                }
+                else start_tx();
+            }
+            break;
+        case 0x36:                                  //SIDLE
+            if(tx_preamble)
+            {
+                tx_preamble = 0;
+                state = SIM_STATE_IDLE;
+            }
+            else if(state != SIM_STATE_TX) state = SIM_STATE_IDLE;
+            break;
+        case 0x39:                                  //SPWD
+            if(state == SIM_STATE_IDLE) state = SIM_STATE_SLEEP;
+            break;
+        case 0x3A:                                  //SFRX
+            if(state == SIM_STATE_IDLE || state == SIM_STATE_RXFIFO_OVERFLOW)
+            {
+                rx_head = 0;
+                rx_len = 0;
+                state = SIM_STATE_IDLE;
+            }
+            break;
+        case 0x3B:                                  //SFTX
+            if(state == SIM_STATE_IDLE || state == SIM_STATE_TXFIFO_UNDERFLOW)
+            {
+                tx_len = 0;
+                state = SIM_STATE_IDLE;
+            }
+            break;
+        default:                                    //SFSTXON, SXOFF, SCAL, SAFC, SWORRST, SNOP
+            break;
+    }
+}
+//-------------------------------[end]------------------------------------------
+
+//---------------------------[status registers]---------------------------------
+uint8_t CC1101Sim::read_status(uint8_t addr)
+{
+    switch(addr)
+    {
+        case 0x30: return 0x00;                     //PARTNUM
+        case 0x31: return 0x14;                     //VERSION
+        case 0x34:                                  //RSSI
+            if(state != SIM_STATE_RX) return 0x80;
+            return (uint8_t)((ether->get_rssi(this) + SIM_RSSI_OFFSET) * 2);
+        case 0x35: return state;                    //MARCSTATE
+        case 0x38: return (get_gdo2() ? 0x04 : 0x00);   //PKTSTATUS
+        case 0x3A: return tx_len | (state == SIM_STATE_TXFIFO_UNDERFLOW ? 0x80 : 0x00);   //TXBYTES
+        case 0x3B: return rx_len | (state == SIM_STATE_RXFIFO_OVERFLOW ? 0x80 : 0x00);    //RXBYTES
+    }
+    return 0x00;
+}
+//-------------------------------[end]------------------------------------------
+
+uint8_t CC1101Sim::chip_status(void)
+{
+    uint8_t st = 0;
+    switch(state)
+    {
+        case SIM_STATE_RX:                st = 1; break;
+        case SIM_STATE_STARTCAL:          st = 4; break;
+        case SIM_STATE_TX:                st = 2; break;
+        case SIM_STATE_RXFIFO_OVERFLOW:   st = 6; break;
+        case SIM_STATE_TXFIFO_UNDERFLOW:  st = 7; break;
+    }
+    return (st << 4) | ((SIM_FIFO_SIZE - 1 - tx_len) & 0x0F);
+}
+
+//-----------------[variable length packet from TXFIFO on air]------------------
+void CC1101Sim::start_tx(void)
+{
+    uint8_t length = tx_packet_length();
+
+    if(tx_len == 0 || tx_len < length || length > SIM_FIFO_SIZE)
+    {
+        state = SIM_STATE_TXFIFO_UNDERFLOW;
+        return;
+    }
+
+    state = SIM_STATE_TX;
+    gdo2_busy++;
+    stat.tx_packets++;
+    if(!ether->transmit(this, tx_fifo, length, get_airtime_us(length)))
+    {
+        end_of_packet(reg[SIM_MCSM1] & 0x03);       //ether is full, packet is lost
+    }
+
+    tx_len -= length;
+    memmove(tx_fifo, tx_fifo + length, tx_len);
+}
+//-------------------------------[end]------------------------------------------
+
+//-----------------[bytes of the next packet in TXFIFO]-------------------------
+uint8_t CC1101Sim::tx_packet_length(void)
+{
+    if((reg[SIM_PKTCTRL0] & 0x03) == 0x01) return tx_fifo[0] + 1;  //length byte + payload
+    return reg[SIM_PKTLEN];
+}
+//-------------------------------[end]------------------------------------------
+
+//------------------[GDO2 falling edge and MCSM1 off mode]----------------------
+void CC1101Sim::end_of_packet(uint8_t next_state_bits)
+{
+    if(gdo2_busy > 0) gdo2_busy--;
+    if(state == SIM_STATE_TX || state == SIM_STATE_RX)
+    {
+        state = (next_state_bits == 0x03 ? SIM_STATE_RX : SIM_STATE_IDLE);
+    }
+    if(gdo2_busy == 0 && gdo2_callback) gdo2_callback(gdo2_context);
+}
+//-------------------------------[end]------------------------------------------
+
+//---------------[put a received packet in RXFIFO, TRUE if kept]----------------
+uint8_t CC1101Sim::accept_packet(const uint8_t *packet, uint8_t length,
+                                 int8_t rssi_dbm, uint8_t lqi, uint8_t crc_ok)
+{
+    uint8_t adr_chk = reg[SIM_PKTCTRL1] & 0x03;
+    uint8_t append = (reg[SIM_PKTCTRL1] & 0x04) ? 2 : 0;
+    uint8_t dest = (length > 1 ? packet[1] : 0);
+
+    if(adr_chk && dest != reg[SIM_ADDR] &&
+       !(adr_chk >= 2 && dest == 0x00) && !(adr_chk == 3 && dest == 0xFF))
+    {
+        stat.rx_filtered++;
+        return 0;
+    }
+    if(!crc_ok)
+    {
+        stat.rx_crc_error++;
+        if(reg[SIM_PKTCTRL1] & 0x08) return 0;     //CRC_AUTOFLUSH
+    }
+    if(rx_len + length + append > SIM_FIFO_SIZE)
+    {
+        stat.rx_overflow++;
+        state = SIM_STATE_RXFIFO_OVERFLOW;
+        return 0;
+    }
+
+    if(rx_head + rx_len + length + append > SIM_FIFO_SIZE)
+    {
+        memmove(rx_fifo, rx_fifo + rx_head, rx_len);
+        rx_head = 0;
+    }
+    memcpy(rx_fifo + rx_head + rx_len, packet, length);
+    rx_len += length;
+    if(append)
+    {
+        rx_fifo[rx_head + rx_len++] = (uint8_t)((rssi_dbm + SIM_RSSI_OFFSET) * 2);
+        rx_fifo[rx_head + rx_len++] = (lqi & 0x7F) | (crc_ok ? 0x80 : 0x00);
+    }
+    stat.rx_packets++;
+    return 1;
+}
+//-------------------------------[end]------------------------------------------
+
+//--------[preamble + sync + length + payload + CRC at the set data rate]-------
+uint32_t CC1101Sim::get_airtime_us(uint8_t length)
+{
+    uint8_t drate_e = reg[SIM_MDMCFG4] & 0x0F;
+    uint8_t drate_m = reg[SIM_MDMCFG3];
+    uint64_t rate_x28 = (uint64_t)(256 + drate_m) * ((uint64_t)1 << drate_e) * SIM_CRYSTAL_FREQUENCY;
+    uint32_t bytes = length;
+
+    bytes += sim_preamble_bytes[(reg[SIM_MDMCFG1] >> 4) & 0x07];
+    bytes += ((reg[SIM_MDMCFG2] & 0x03) == 0x03 ? 4 : 2);
+    if(reg[SIM_PKTCTRL0] & 0x04) bytes += 2;
+
+    if(rate_x28 == 0) return 0;
+    //bits * 10^6 / (rate_x28 / 2^28)
+    return (uint32_t)(((uint64_t)bytes * 8 * 1000000ULL << 28) / rate_x28);
+}
+//-------------------------------[end]------------------------------------------
+
+uint8_t CC1101Sim::get_gdo2(void)
+{
+    return (gdo2_busy > 0 ? 1 : 0);
+}
+
+void CC1101Sim::set_gdo2_callback(sim_gdo_callback_t callback, void *context)
+{
+    gdo2_callback = callback;
+    gdo2_context = context;
+}
+
+uint8_t CC1101Sim::get_id(void)
+{
+    return id;
+}
+
+const sim_radio_stat_t *CC1101Sim::get_stat(void)
+{
+    return &stat;
+}
+
+//|============================ CC1101Ether ===================================|
+CC1101Ether::CC1101Ether(uint32_t seed)
+{
+    radio_count = 0;
+    loss = 0;
+    latency = 0;
+    clock_us = 0;
+    rand_state = (seed ? seed : 1);
+    memset(air, 0, sizeof(air));
+    for(uint8_t i = 0; i < SIM_MAX_RADIOS; i++)
+    {
+        for(uint8_t j = 0; j < SIM_MAX_RADIOS; j++)
+        {
+            link_rssi[i][j] = SIM_DEFAULT_RSSI;
+            link_lqi[i][j] = SIM_DEFAULT_LQI;
+        }
+    }
+    memset(noise, SIM_DEFAULT_NOISE, sizeof(noise));
+}
+
+uint8_t CC1101Ether::attach(CC1101Sim *radio)
+{
+    if(radio_count >= SIM_MAX_RADIOS) return SIM_MAX_RADIOS;
+    radios[radio_count] = radio;
+    return radio_count++;
+}
+
+void CC1101Ether::set_loss(uint16_t permille)
+{
+    loss = permille;
+}
+
+void CC1101Ether::set_latency(uint32_t latency_us)
+{
+    latency = latency_us;
+}
+
+void CC1101Ether::set_link(uint8_t from, uint8_t to, int8_t rssi_dbm, uint8_t lqi)
+{
+    if(from >= SIM_MAX_RADIOS || to >= SIM_MAX_RADIOS) return;
+    link_rssi[from][to] = rssi_dbm;
+    link_lqi[from][to] = lqi;
+}
+
+void CC1101Ether::set_noise(uint8_t channel, int8_t noise_dbm)
+{
+    noise[channel] = noise_dbm;
+}
+
+uint64_t CC1101Ether::now(void)
+{
+    return clock_us;
+}
+
+uint8_t CC1101Ether::packets_on_air(void)
+{
+    uint8_t count = 0;
+    for(uint8_t i = 0; i < SIM_MAX_AIR_PACKETS; i++)
+    {
+        if(air[i].used) count++;
+    }
+    return count;
+}
+
+//--------------[start of a packet, returns FALSE if ether is full]-------------
+uint8_t CC1101Ether::transmit(CC1101Sim *sender, const uint8_t *data,
+                              uint8_t length, uint32_t airtime_us)
+{
+    uint8_t slot, i;
+    uint8_t channel = sender->reg[SIM_CHANNR];
+
+    for(slot = 0; slot < SIM_MAX_AIR_PACKETS; slot++)
+    {
+        if(!air[slot].used) break;
+    }
+    if(slot >= SIM_MAX_AIR_PACKETS) return 0;
+
+    sim_air_packet_t &packet = air[slot];
+    packet.used = 1;
+    packet.sender = sender->id;
+    packet.channel = channel;
+    packet.collided = 0;
+    packet.length = length;
+    memcpy(packet.data, data, length);
+    packet.end_us = clock_us + airtime_us;
+
+    // Overlapping packets on the same channel destroy each other
+    for(i = 0; i < SIM_MAX_AIR_PACKETS; i++)
+    {
+        if(i != slot && air[i].used && air[i].channel == channel && air[i].end_us > clock_us)
+        {
+            air[i].collided = 1;
+            packet.collided = 1;
+        }
+    }
+
+    // Radios listening now will see the sync word
+    packet.receivers = 0;
+    for(i = 0; i < radio_count; i++)
+    {
+        radios[i]->update_state();
+        if(radios[i] != sender && radios[i]->state == SIM_STATE_RX &&
+           radios[i]->reg[SIM_CHANNR] == channel)
+        {
+            packet.receivers |= (1 << i);
+            radios[i]->gdo2_busy++;
+        }
+    }
+    return 1;
+}
+//-------------------------------[end]------------------------------------------
+
+//-----------------------[end of packet at all radios]--------------------------
+void CC1101Ether::deliver(sim_air_packet_t &packet)
+{
+    CC1101Sim *sender = radios[packet.sender];
+
+    packet.used = 0;
+    sender->end_of_packet(sender->reg[SIM_MCSM1] & 0x03);
+
+    for(uint8_t i = 0; i < radio_count; i++)
+    {
+        if(!(packet.receivers & (1 << i))) continue;
+        CC1101Sim *radio = radios[i];
+        if(radio->state == SIM_STATE_RX && radio->reg[SIM_CHANNR] == packet.channel)
+        {
+            if(loss > 0 && next_rand() % 1000 < loss)
+            {
+                radio->stat.rx_lost++;
+                if(radio->gdo2_busy > 0) radio->gdo2_busy--;
+                continue;
+            }
+            radio->accept_packet(packet.data, packet.length,
+                                 link_rssi[packet.sender][i], link_lqi[packet.sender][i],
+                                 !packet.collided);
+            if(radio->state == SIM_STATE_RX)
+            {
+                radio->end_of_packet((radio->reg[SIM_MCSM1] >> 2) & 0x03);
+                continue;
+            }
+        }
+        // Left RX during the packet or overflowed, only the edge remains
+        if(radio->gdo2_busy > 0) radio->gdo2_busy--;
+        if(radio->gdo2_busy == 0 && radio->gdo2_callback) radio->gdo2_callback(radio->gdo2_context);
+    }
+}
+//-------------------------------[end]------------------------------------------
+
+//-------[strongest of the noise floor and packets on the radio's channel]------
+int8_t CC1101Ether::get_rssi(CC1101Sim *radio)
+{
+    uint8_t channel = radio->reg[SIM_CHANNR];
+    int8_t rssi = noise[channel];
+
+    for(uint8_t i = 0; i < SIM_MAX_AIR_PACKETS; i++)
+    {
+        if(!air[i].used || air[i].channel != channel || air[i].end_us <= clock_us) continue;
+        if(radios[air[i].sender] == radio) continue;
+        if(radio->id < SIM_MAX_RADIOS && link_rssi[air[i].sender][radio->id] > rssi)
+        {
+            rssi = link_rssi[air[i].sender][radio->id];
+        }
+    }
+    return rssi;
+}
+//-------------------------------[end]------------------------------------------
+
+//-----------[advance clock, deliver packets in order of their end]-------------
+void CC1101Ether::run(uint32_t duration_us)
+{
+    uint64_t target = clock_us + duration_us;
+    uint8_t next;
+
+    while(1)
+    {
+        next = SIM_MAX_AIR_PACKETS;
+        for(uint8_t i = 0; i < SIM_MAX_AIR_PACKETS; i++)
+        {
+            if(!air[i].used) continue;
+            if(next == SIM_MAX_AIR_PACKETS || air[i].end_us < air[next].end_us) next = i;
+        }
+        if(next == SIM_MAX_AIR_PACKETS || air[next].end_us + latency > target) break;
+        if(air[next].end_us + latency > clock_us) clock_us = air[next].end_us + latency;
+        deliver(air[next]);
+    }
+    clock_us = target;
+}
+//-------------------------------[end]------------------------------------------
+
+//------------------[deterministic LCG, same seed same run]---------------------
+uint32_t CC1101Ether::next_rand(void)
+{
+    rand_state = rand_state * 1103515245UL + 12345UL;
+    return (rand_state >> 16) & 0x7FFF;
+}
+//-------------------------------[end]------------------------------------------
+
+#endif // CC1101_SIM
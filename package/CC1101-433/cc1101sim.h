@@ -0,0 +1,148 @@
+#ifndef cc1101sim_H
+#define cc1101sim_H
+
+//|===================[ CC1101 register level simulator ]======================|
+// Replaces the SPI bus when CC1101_SIM is defined (host build), so the driver
+// can run against several virtual radios on Linux, see tools/rfsim/rfbench.cpp.
+// All radios share one CC1101Ether, which owns the virtual clock in us.
+
+#include <stdint.h>
+
+#define SIM_MAX_RADIOS            8     //radios on one ether
+#define SIM_MAX_AIR_PACKETS       16    //packets on air at the same time
+#define SIM_FIFO_SIZE             64    //same as FIFOBUFFER
+#define SIM_REG_COUNT             0x2F  //config registers
+#define SIM_DEFAULT_RSSI          -60   //dBm of links without SetLink()
+#define SIM_DEFAULT_LQI           20    //lower is better
+#define SIM_DEFAULT_NOISE         -105  //dBm noise floor of channels without set_noise()
+#define SIM_RX_CAL_US             721   //IDLE to RX with MCSM0.FS_AUTOCAL = 01
+#define SIM_RX_NOCAL_US           75    //IDLE to RX without calibration
+
+/*----------------------[MARCSTATE values used here]--------------------------*/
+#define SIM_STATE_IDLE            0x01
+#define SIM_STATE_STARTCAL        0x08  //IDLE to RX, until rx_ready_us
+#define SIM_STATE_RX              0x0D
+#define SIM_STATE_RXFIFO_OVERFLOW 0x11
+#define SIM_STATE_TX              0x13
+#define SIM_STATE_TXFIFO_UNDERFLOW 0x16
+#define SIM_STATE_SLEEP           0x00
+
+class CC1101Ether;
+
+typedef void (*sim_gdo_callback_t)(void *context);
+
+typedef struct
+{
+    uint32_t tx_packets;                //packets sent
+    uint32_t rx_packets;                //packets put in RXFIFO
+    uint32_t rx_crc_error;              //collided packets
+    uint32_t rx_lost;                   //dropped by configured loss
+    uint32_t rx_filtered;               //address check failed
+    uint32_t rx_overflow;               //RXFIFO overflow
+    uint32_t tx_preamble;               //transmissions started with an empty TXFIFO
+    uint32_t spi_access;                //SPI transactions
+} sim_radio_stat_t;
+
+class CC1101Sim
+{
+    friend class CC1101Ether;
+
+    public:
+        CC1101Sim(CC1101Ether &the_ether);
+
+        // SPI seam: header byte as sent by the driver, then data bytes
+        uint8_t spi_access(uint8_t header, uint8_t *pArr, uint8_t length);
+
+        // GDO2 level with IOCFG2 = 0x06, and callback on falling edge
+        uint8_t get_gdo2(void);
+        void set_gdo2_callback(sim_gdo_callback_t callback, void *context);
+
+        uint8_t get_id(void);
+        const sim_radio_stat_t *get_stat(void);
+
+    private:
+        CC1101Ether *ether;
+        uint8_t id;
+        uint8_t reg[SIM_REG_COUNT];
+        uint8_t patable[8];
+        uint8_t state;
+        uint64_t rx_ready_us;               //end of STARTCAL
+
+        uint8_t tx_fifo[SIM_FIFO_SIZE];
+        uint8_t tx_len;
+        uint8_t tx_preamble;                //STX with empty TXFIFO, preamble until loaded
+        uint8_t rx_fifo[SIM_FIFO_SIZE];
+        uint8_t rx_head;
+        uint8_t rx_len;
+
+        uint8_t gdo2_busy;                  //packets being sent or received
+        sim_gdo_callback_t gdo2_callback;
+        void *gdo2_context;
+        sim_radio_stat_t stat;
+
+        void reset(void);
+        void update_state(void);
+        void strobe(uint8_t cmd);
+        uint8_t read_status(uint8_t addr);
+        uint8_t chip_status(void);
+        void start_tx(void);
+        uint8_t tx_packet_length(void);
+        void end_of_packet(uint8_t next_state_bits);
+        uint8_t accept_packet(const uint8_t *packet, uint8_t length, int8_t rssi_dbm, uint8_t lqi, uint8_t crc_ok);
+        uint32_t get_airtime_us(uint8_t length);
+};
+
+typedef struct
+{
+    uint8_t used;
+    uint8_t sender;
+    uint8_t channel;
+    uint8_t collided;
+    uint8_t length;
+    uint8_t data[SIM_FIFO_SIZE];
+    uint8_t receivers;                  //bitmap of radios in RX at start
+    uint64_t end_us;
+} sim_air_packet_t;
+
+class CC1101Ether
+{
+    public:
+        CC1101Ether(uint32_t seed = 1);
+
+        uint8_t attach(CC1101Sim *radio);
+
+        // Packet loss in per mille, and extra delay of every end of packet
+        void set_loss(uint16_t permille);
+        void set_latency(uint32_t latency_us);
+        void set_link(uint8_t from, uint8_t to, int8_t rssi_dbm, uint8_t lqi);
+        // Noise floor of a channel, as seen by the RSSI status register
+        void set_noise(uint8_t channel, int8_t noise_dbm);
+
+        // Advance the virtual clock and deliver finished packets
+        void run(uint32_t duration_us);
+        uint64_t now(void);
+
+        uint8_t packets_on_air(void);
+
+    private:
+        friend class CC1101Sim;
+
+        CC1101Sim *radios[SIM_MAX_RADIOS];
+        uint8_t radio_count;
+        sim_air_packet_t air[SIM_MAX_AIR_PACKETS];
+        int8_t link_rssi[SIM_MAX_RADIOS][SIM_MAX_RADIOS];
+        uint8_t link_lqi[SIM_MAX_RADIOS][SIM_MAX_RADIOS];
+        int8_t noise[256];
+        uint16_t loss;
+        uint32_t latency;
+        uint32_t rand_state;
+        uint64_t clock_us;
+
+        uint8_t transmit(CC1101Sim *sender, const uint8_t *data, uint8_t length, uint32_t airtime_us);
+        void deliver(sim_air_packet_t &packet);
+        int8_t get_rssi(CC1101Sim *radio);
+        uint32_t next_rand(void);
+};
+//=======================[CC1101 simulator end]=================================
+
+#endif // cc1101sim_H
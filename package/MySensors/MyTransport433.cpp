@@ -24,6 +24,8 @@ MyTransport433::MyTransport433(uint8_t address,uint8_t channel)
 	_address(address),_channel(channel)
 {
 	_bValid = false;
+	_lastRSSI = 0;
+	_lastLQI = 0;
 }
 
 bool MyTransport433::init() {
@@ -106,6 +108,8 @@ uint8_t MyTransport433::receive(void* data,uint8_t *from,uint8_t *to) {
 	 {
 		   *to = rx_addr;
 			 *from = sender;
+			 _lastRSSI = rssi_dbm;
+			 _lastLQI = lqi;
 			 datalen = pktlen - 3;
 			 memcpy(data,(uint8_t *) Rx_fifo + 3,datalen);
 	 }
@@ -117,6 +121,69 @@ void MyTransport433::powerDown() {
 	cc1101433.powerdown();
 }
 
+bool MyTransport433::isTxBusy() {
+	// Also recovers from a missed interrupt
+	return(cc1101433.tx_check() == FALSE);
+}
+
+// Call it in GDO2 ISR, return true if it is the end of our own frame
+bool MyTransport433::txDone() {
+	return(cc1101433.tx_done() == TRUE);
+}
+
+unsigned long MyTransport433::getTxAirTime() {
+	return cc1101433.tx_air_us;
+}
+
+bool MyTransport433::txWake(unsigned int wake_ms) {
+	return(cc1101433.tx_wake(wake_ms) == TRUE);
+}
+
+bool MyTransport433::isWakeReady() {
+	return(cc1101433.tx_wake_ready() == TRUE);
+}
+
+void MyTransport433::cancelWake() {
+	cc1101433.tx_wake_cancel();
+}
+
+int8_t MyTransport433::getLastRSSI() {
+	return _lastRSSI;
+}
+
+uint8_t MyTransport433::getLastLQI() {
+	return _lastLQI;
+}
+
+int8_t MyTransport433::getRSSI() {
+	return cc1101433.get_rssi();
+}
+
+int8_t MyTransport433::sampleRSSI(uint8_t channel) {
+	int8_t rssi_dbm;
+	if( channel == _channel ) return getRSSI();
+
+	cc1101433.sidle();
+	cc1101433.set_channel(channel);
+	cc1101433.receive();
+	// The register holds nothing of the new channel until RX after calibration
+	rssi_dbm = RSSI_SAMPLE_FAILED;
+	if( cc1101433.wait_rx() ) {
+		delayMicroseconds(RSSI_SETTLE_TIME);
+		rssi_dbm = cc1101433.get_rssi();
+	}
+	cc1101433.sidle();
+	cc1101433.set_channel(_channel);
+	cc1101433.receive();
+	return rssi_dbm;
+}
+
+#ifdef CC1101_SIM
+void MyTransport433::attachSim(CC1101Sim *radio) {
+	cc1101433.attach_sim(radio);
+}
+#endif
+
 uint8_t MyTransport433::getChannel(bool read)
 {
 	if( read ) {
@@ -129,6 +196,9 @@ void MyTransport433::setChannel(uint8_t channel)
 {
 	if( _channel != channel )	{
 		_channel = channel;
+		// Recalibrate on the way back to RX
+		cc1101433.sidle();
 		cc1101433.set_channel(channel);
+		cc1101433.receive();
 	}
 }
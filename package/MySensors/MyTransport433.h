@@ -41,6 +41,31 @@ public:
 	uint8_t receive(void* data,uint8_t *from,uint8_t *to);
 	void powerDown();
 
+	// Non-blocking TX, completion is signalled by GDO2 falling edge
+	bool isTxBusy();
+	bool txDone();
+	unsigned long getTxAirTime();
+
+	// Long preamble before the next send() to wake a node running WOR
+	bool txWake(unsigned int wake_ms);
+	bool isWakeReady();
+	void cancelWake();
+
+	// Link quality of the last received packet
+	int8_t getLastRSSI();
+	uint8_t getLastLQI();
+
+	// Current RSSI of our channel, or of another one for a channel survey.
+	// Sampling another channel waits for RX after calibration, then for
+	// RSSI_SETTLE_TIME, then comes back. RSSI_SAMPLE_FAILED if RX never came
+	int8_t getRSSI();
+	int8_t sampleRSSI(uint8_t channel);
+
+#ifdef CC1101_SIM
+	// Host build: drive the simulated chip, route its GDO2 callback to the ISR
+	void attachSim(CC1101Sim *radio);
+#endif
+
 	uint8_t getChannel(bool read = true);
 	void setChannel(uint8_t channel);
 
@@ -53,6 +78,8 @@ private:
 	uint8_t _address;
 	uint8_t _channel;
   bool _bValid;
+	int8_t _lastRSSI;
+	uint8_t _lastLQI;
 };
 
 #endif
@@ -1,6 +1,7 @@
 //  LedLevelBar.h - Ordered List lib with consecutive memory allocation
 /// Suitable for small array which requires fast search with infrequent insert or delete operations
 /// Can access all data chunk at once
+/// The buffer of maxl items is allocated once in constructor, add() and assign() never reallocate
 
 #ifndef OrderedList_h
 #define OrderedList_h
@@ -23,6 +24,7 @@ protected:
 public:
   T *_pItems;
 
+  // initlen is kept for compatibility, capacity is always maxl
 	OrderdList(uint8_t maxl = 64, bool desc = false, uint8_t initlen = 8);
 	virtual ~OrderdList();
 
@@ -33,7 +35,7 @@ public:
 	virtual uint8_t count();
 
   // Compare two items, return 0 if equal, 1 if the first item is larger, -1 if the second item is larger
-  virtual int compare(T _first, T _second) = 0;
+  virtual int compare(const T &_first, const T &_second) = 0;
 
   // Retrieve item, return the position and data entry
   virtual int get(T*);
@@ -45,6 +47,10 @@ public:
   /// return the inserted postion if succeeds, otherwise return -1
 	virtual int add(T*);
 
+  // Replace all items with nCount items, sorted and without duplicates (the last one wins)
+  /// return the number of items kept
+  virtual uint8_t assign(const T*, uint8_t nCount);
+
   // Remove item
 	virtual bool remove(T*);
 
@@ -59,30 +65,29 @@ OrderdList<T>::OrderdList(uint8_t maxl, bool desc, uint8_t initlen)
 {
   _count = 0;
   _size = 0;
-  _pItems = NULL;
-
-  if( initlen > 0 ) {
-    _pItems = newList(initlen);
-    if( _pItems ) _size = initlen;
-  }
+  _pItems = newList(_maxlen);
+  if( _pItems ) _size = _maxlen;
 }
 
-// Clear items and free Memory
+// Free Memory
 template<typename T>
 OrderdList<T>::~OrderdList()
 {
-  removeAll();
+  if(_pItems) {
+    delete []_pItems;
+    _pItems = NULL;
+  }
+  _count = 0;
+  _size = 0;
 }
 
-// Remove all items
+// Remove all items, keep the buffer
 template<typename T>
 void OrderdList<T>::removeAll() {
   if(_pItems) {
-    delete []_pItems;
-    _pItems = NULL;
+    memset(_pItems, 0x00, sizeof(T) * _size);
   }
   _count = 0;
-  _size = 0;
 }
 
 // Allocate new list
@@ -185,22 +190,7 @@ int OrderdList<T>::add(T *_pT) {
 
   // Add new at 'pos'
   uint8_t _newCount = _count + 1;
-  if( _newCount > _maxlen ) return -1;
-  if( _newCount > _size ) {
-    // Resize of array
-    T *pList = newList(_newCount);
-    if( pList ) {
-      // Copy Data
-      memcpy(pList, _pItems, sizeof(T) * _count);
-      // Delete old list
-      removeAll();
-      // Set new list
-      _pItems = pList;
-      _size = _newCount;
-    } else {
-      return -1;
-    }
-  }
+  if( _newCount > _size ) return -1;
   // Move data
   for( int i = _newCount - 1; i > pos; i-- ) {
     _pItems[i] = _pItems[i-1];
@@ -211,6 +201,35 @@ int OrderdList<T>::add(T *_pT) {
 	return pos;
 }
 
+// Replace all items
+template<typename T>
+uint8_t OrderdList<T>::assign(const T *_pT, uint8_t nCount) {
+  removeAll();
+  if( !_pT || !_pItems ) return 0;
+  if( nCount > _size ) nCount = _size;
+
+  // Insertion sort, linear when the input is already in order (e.g. saved list)
+  int nResult = 1, j;
+  for( uint8_t i = 0; i < nCount; i++ ) {
+    j = _count - 1;
+    while( j >= 0 ) {
+      nResult = compare(_pT[i], _pItems[j]);
+      if( nResult == 0 || (nResult > 0) != _desc ) break;
+      j--;
+    }
+    if( j >= 0 && nResult == 0 ) {
+      _pItems[j] = _pT[i];
+      continue;
+    }
+    for( int k = _count; k > j + 1; k-- ) {
+      _pItems[k] = _pItems[k-1];
+    }
+    _pItems[j + 1] = _pT[i];
+    _count++;
+  }
+  return _count;
+}
+
 // Remove item
 template<typename T>
 bool OrderdList<T>::remove(T *_pT) {
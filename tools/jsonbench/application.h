@@ -0,0 +1,18 @@
+//  application.h - Host shim of the Particle API for the JSON benchmark
+//
+//  xliCommon.h only needs the C library, time_t and the Arduino types here.
+
+#ifndef jsonbench_application_h
+#define jsonbench_application_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#endif // jsonbench_application_h
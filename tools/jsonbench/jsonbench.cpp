@@ -0,0 +1,333 @@
+//  jsonbench.cpp - Cloud command parsing, ArduinoJson DOM against JsonReaderClass
+//
+//  Every line of corpus.txt is a cloud command or a config row. The DOM path
+//  is the one before JsonReaderClass: parseObject() on a copy in a
+//  StaticJsonBuffer, then a lookup per key of the command. The reader path
+//  is the one of ExeJSONCommand and ParseCmdRow: one table with the keys of
+//  every command, filled in one pass. Both fold the values they read into a
+//  checksum, which has to match line by line. Stack is measured by painting.
+//
+//  Host only, not part of the firmware. Build (one command) and run from the
+//  repo root:
+//    g++ -O2 -Itools/jsonbench -I. -Iinc -Ilib -Ipackage/JSON tools/jsonbench/jsonbench.cpp
+//        lib/xlxJsonReader.cpp package/JSON/*.cpp -o jsonbench
+//    ./jsonbench tools/jsonbench/corpus.txt
+
+#include "ArduinoJson.h"
+#include "xlxJsonReader.h"
+
+#define BENCH_ROUNDS              100000
+#define BENCH_MAX_LINES           64
+#define BENCH_LINE_SIZE           (COMMAND_JSON_SIZE * 3)
+#define BENCH_STACK_PAINT         4096
+
+typedef struct
+{
+  const char *key;
+  UC type;
+  US size;
+} bench_key_t;
+
+typedef struct
+{
+  long id;                          // cmd, or first char of the uid
+  const bench_key_t *keys;
+  UC nKeys;
+} bench_group_t;
+
+#define BENCH_GROUP(id, keys)     {id, keys, sizeof(keys) / sizeof(keys[0])}
+
+//------------------------------------------------------------------
+// Keys as declared in ExeJSONCommand
+//------------------------------------------------------------------
+static const bench_key_t cmdHead[] = {
+  {"cmd", JSR_INT, 1}, {"sid", JSR_INT, 1}, {"nd", JSR_INT, 1}
+};
+static const bench_key_t cmdSerial[] = {{"data", JSR_STR, COMMAND_JSON_SIZE * 3}};
+static const bench_key_t cmdPower[] = {{"state", JSR_INT, 1}, {"tp", JSR_BYTES, 32}, {"hw", JSR_INT, 1}};
+static const bench_key_t cmdColor[] = {{"ring", JSR_BYTES, 7}};
+static const bench_key_t cmdValue[] = {{"value", JSR_INT, 1}};
+static const bench_key_t cmdScenario[] = {{"SNT_id", JSR_INT, 1}};
+static const bench_key_t cmdQuery[] = {{"reset", JSR_INT, 1}, {"Ring", JSR_INT, 1}};
+static const bench_key_t cmdEffect[] = {{"filter", JSR_INT, 1}};
+static const bench_key_t cmdExt[] = {
+  {"msg", JSR_INT, 1}, {"ack", JSR_INT, 1}, {"tag", JSR_INT, 1},
+  {"pl", JSR_STR, COMMAND_JSON_SIZE * 2}, {"tp", JSR_BYTES, 32}, {"dt", JSR_BYTES, 20}
+};
+static const bench_key_t cmdReport[] = {
+  {"sr", JSR_INT, 1}, {"from", JSR_INT, 1}, {"to", JSR_INT, 1}, {"hr", JSR_INT, 1}
+};
+static const bench_group_t cmdGroups[] = {
+  BENCH_GROUP(0, cmdSerial), BENCH_GROUP(1, cmdPower), BENCH_GROUP(2, cmdColor),
+  BENCH_GROUP(3, cmdValue), BENCH_GROUP(4, cmdScenario), BENCH_GROUP(5, cmdValue),
+  BENCH_GROUP(6, cmdQuery), BENCH_GROUP(7, cmdEffect), BENCH_GROUP(8, cmdExt),
+  BENCH_GROUP(9, cmdReport)
+};
+
+//------------------------------------------------------------------
+// Keys as declared in ParseCmdRow
+//------------------------------------------------------------------
+static const bench_key_t rowHead[] = {
+  {"op", JSR_INT, 1}, {"fl", JSR_INT, 1}, {"run", JSR_INT, 1}, {"uid", JSR_STR, 8}
+};
+static const bench_key_t rowRule[] = {
+  {"node_uid", JSR_INT, 1}, {"SCT_uid", JSR_INT, 1}, {"SNT_uid", JSR_INT, 1}, {"notif_uid", JSR_INT, 1},
+  {"tmr_int", JSR_INT, 1}, {"tmr_span", JSR_INT, 1}, {"cond0", JSR_INTS, 7}, {"cond1", JSR_INTS, 7}
+};
+static const bench_key_t rowSchedule[] = {
+  {"isRepeat", JSR_INT, 1}, {"weekdays", JSR_INT, 1}, {"hour", JSR_INT, 1}, {"min", JSR_INT, 1}
+};
+static const bench_key_t rowScenario[] = {
+  {"sw", JSR_INT, 1}, {"filter", JSR_INT, 1},
+  {"ring0", JSR_INTS, 6}, {"ring1", JSR_INTS, 6}, {"ring2", JSR_INTS, 6}, {"ring3", JSR_INTS, 6}
+};
+static const bench_key_t rowConfig[] = {
+  {"csc", JSR_INT, 1}, {"loopkc", JSR_INT, 1}, {"kcto", JSR_INT, 1}, {"hwsobj", JSR_INT, 1},
+  {"hwsw", JSR_INT, 1}, {"km", JSR_INT, 1}, {"nd", JSR_INT, 1}, {"sid", JSR_INT, 1}, {"btn", JSR_INT, 1},
+  {"act", JSR_INT, 1}, {"new_id", JSR_INT, 1}, {"ncf", JSR_INT, 1}, {"value", JSR_INTS, 3}
+};
+static const bench_group_t rowGroups[] = {
+  BENCH_GROUP('r', rowRule), BENCH_GROUP('s', rowSchedule),
+  BENCH_GROUP('a', rowScenario), BENCH_GROUP('c', rowConfig)
+};
+
+static char lines[BENCH_MAX_LINES][BENCH_LINE_SIZE];
+static UC nLines = 0;
+static volatile long sink;
+
+static BOOL IsRow(const char *json)
+{
+  return(strstr(json, "'uid'") != NULL || strstr(json, "\"uid\"") != NULL);
+}
+
+static const bench_group_t *FindGroup(const bench_group_t *groups, UC nGroups, long id)
+{
+  for( UC i = 0; i < nGroups; i++ ) {
+    if( groups[i].id == id ) return &groups[i];
+  }
+  return NULL;
+}
+
+//------------------------------------------------------------------
+// DOM path
+//------------------------------------------------------------------
+static long DomValue(JsonObject &obj, const bench_key_t &key)
+{
+  if( !obj.containsKey(key.key) ) return 0;
+  if( key.type == JSR_STR ) {
+    const char *str = obj[key.key];
+    return(str ? (long)strlen(str) * 256 + str[0] : 0);
+  }
+  if( key.type == JSR_INT ) return obj[key.key].as<long>();
+
+  JsonArray &arr = obj[key.key].asArray();
+  if( !arr.success() ) {
+    long item = obj[key.key].as<long>();
+    return 1000 + (key.type == JSR_BYTES ? (UC)item : item);
+  }
+  long sum = 0;
+  US count = (arr.size() < key.size ? arr.size() : key.size);
+  for( US i = 0; i < count; i++ ) {
+    long item = arr[i].as<long>();
+    sum += (key.type == JSR_BYTES ? (UC)item : item);
+  }
+  return sum + count * 1000;
+}
+
+template <size_t N> static long DomParseIn(const char *json)
+{
+  char buf[BENCH_LINE_SIZE];
+  long sum = 0;
+  strcpy(buf, json);
+  StaticJsonBuffer<N> jBuf;
+  JsonObject &obj = jBuf.parseObject(buf);
+  if( !obj.success() ) return -1;
+
+  const bench_group_t *group;
+  if( IsRow(json) ) {
+    for( UC i = 0; i < sizeof(rowHead) / sizeof(rowHead[0]); i++ ) sum += DomValue(obj, rowHead[i]);
+    const char *uid = obj["uid"];
+    group = FindGroup(rowGroups, sizeof(rowGroups) / sizeof(rowGroups[0]), uid ? uid[0] : 0);
+  } else {
+    for( UC i = 0; i < sizeof(cmdHead) / sizeof(cmdHead[0]); i++ ) sum += DomValue(obj, cmdHead[i]);
+    group = FindGroup(cmdGroups, sizeof(cmdGroups) / sizeof(cmdGroups[0]), obj["cmd"].as<long>());
+  }
+  if( group ) {
+    for( UC i = 0; i < group->nKeys; i++ ) sum += DomValue(obj, group->keys[i]);
+  }
+  return sum;
+}
+
+// As ProcessJSONString() did: longer commands came in fragments, joined into a 3 times larger buffer
+__attribute__((noinline)) static long DomParse(const char *json)
+{
+  if( strlen(json) < COMMAND_JSON_SIZE ) return DomParseIn<COMMAND_JSON_SIZE * 8>(json);
+  return DomParseIn<COMMAND_JSON_SIZE * 3 * 8>(json);
+}
+
+//------------------------------------------------------------------
+// Reader path: one table for the head and every group
+//------------------------------------------------------------------
+#define BENCH_MAX_FIELDS          36                  // Sized to the tables, as the firmware
+#define BENCH_POOL_SIZE           576
+
+typedef struct
+{
+  const bench_key_t *keys[BENCH_MAX_FIELDS];
+  US offset[BENCH_MAX_FIELDS];      // Of the value in the pool
+  UC nFields;
+  US poolSize;
+} bench_table_t;
+
+static bench_table_t cmdTable, rowTable;
+
+static void AddKeys(bench_table_t &table, const bench_key_t *keys, UC nKeys)
+{
+  for( UC i = 0; i < nKeys; i++ ) {
+    UC j;
+    for( j = 0; j < table.nFields; j++ ) {
+      if( strcmp(table.keys[j]->key, keys[i].key) == 0 ) break;
+    }
+    if( j < table.nFields ) continue;
+    US size = keys[i].size;
+    if( keys[i].type == JSR_INT || keys[i].type == JSR_INTS ) size *= sizeof(long);
+    table.keys[table.nFields] = &keys[i];
+    table.offset[table.nFields++] = table.poolSize;
+    table.poolSize += (size + sizeof(long) - 1) / sizeof(long) * sizeof(long);
+  }
+}
+
+static void BuildTable(bench_table_t &table, const bench_key_t *head, UC nHead,
+    const bench_group_t *groups, UC nGroups)
+{
+  memset(&table, 0x00, sizeof(table));
+  AddKeys(table, head, nHead);
+  for( UC i = 0; i < nGroups; i++ ) AddKeys(table, groups[i].keys, groups[i].nKeys);
+}
+
+static long ReaderValue(const jsr_field_t &field)
+{
+  if( !field.found ) return 0;
+  if( field.type == JSR_STR ) return (long)field.count * 256 + ((const char *)field.pValue)[0];
+  if( field.type == JSR_INT ) return *(const long *)field.pValue;
+  long sum = 0;
+  for( US i = 0; i < field.count; i++ ) {
+    sum += (field.type == JSR_BYTES ? ((const UC *)field.pValue)[i] : ((const long *)field.pValue)[i]);
+  }
+  return sum + field.count * 1000;
+}
+
+static long ReaderGroupSum(const bench_table_t &table, const jsr_field_t *pFields, const bench_key_t *keys, UC nKeys)
+{
+  long sum = 0;
+  for( UC i = 0; i < nKeys; i++ ) {
+    for( UC j = 0; j < table.nFields; j++ ) {
+      if( strcmp(table.keys[j]->key, keys[i].key) == 0 ) {
+        sum += ReaderValue(pFields[j]);
+        break;
+      }
+    }
+  }
+  return sum;
+}
+
+__attribute__((noinline)) static long ReaderParse(const char *json)
+{
+  // As the firmware: values and fields on the stack, filled in one pass
+  long pool[BENCH_POOL_SIZE / sizeof(long)];
+  jsr_field_t lv_fields[BENCH_MAX_FIELDS];
+  const bench_table_t &table = (IsRow(json) ? rowTable : cmdTable);
+  long sum = 0;
+  for( UC i = 0; i < table.nFields; i++ ) {
+    jsr_field_t field = JSR_FIELD(table.keys[i]->key, table.keys[i]->type, table.keys[i]->size,
+        (char *)pool + table.offset[i]);
+    lv_fields[i] = field;
+  }
+  if( !JsonReaderClass::Parse(json, lv_fields, table.nFields) ) return -1;
+
+  const bench_group_t *group;
+  if( &table == &rowTable ) {
+    sum = ReaderGroupSum(table, lv_fields, rowHead, sizeof(rowHead) / sizeof(rowHead[0]));
+    group = FindGroup(rowGroups, sizeof(rowGroups) / sizeof(rowGroups[0]),
+        lv_fields[3].found ? ((const char *)lv_fields[3].pValue)[0] : 0);
+  } else {
+    sum = ReaderGroupSum(table, lv_fields, cmdHead, sizeof(cmdHead) / sizeof(cmdHead[0]));
+    group = FindGroup(cmdGroups, sizeof(cmdGroups) / sizeof(cmdGroups[0]),
+        lv_fields[0].found ? *(const long *)lv_fields[0].pValue : -1);
+  }
+  if( group ) sum += ReaderGroupSum(table, lv_fields, group->keys, group->nKeys);
+  return sum;
+}
+
+//------------------------------------------------------------------
+// Stack use of one call, by painting
+//------------------------------------------------------------------
+static uintptr_t g_paint;
+
+__attribute__((noinline)) static void Paint(void)
+{
+  volatile UC area[BENCH_STACK_PAINT];
+  for( US i = 0; i < BENCH_STACK_PAINT; i++ ) area[i] = 0xA5;
+  g_paint = (uintptr_t)area;
+}
+
+// The frame of parse() and its callees reuses the painted area
+static size_t StackUsed(long (*parse)(const char *), const char *json)
+{
+  Paint();
+  sink = parse(json);
+  const volatile UC *area = (const volatile UC *)g_paint;
+  size_t i = 0;
+  while( i < BENCH_STACK_PAINT && area[i] == 0xA5 ) i++;
+  return BENCH_STACK_PAINT - i;
+}
+
+static double TimeParse(long (*parse)(const char *))
+{
+  clock_t start = clock();
+  for( long r = 0; r < BENCH_ROUNDS; r++ ) {
+    for( UC i = 0; i < nLines; i++ ) sink += parse(lines[i]);
+  }
+  return (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / BENCH_ROUNDS / nLines;
+}
+
+int main(int argc, char *argv[])
+{
+  FILE *fp = fopen(argc > 1 ? argv[1] : "tools/jsonbench/corpus.txt", "r");
+  if( !fp ) {
+    printf("Usage: jsonbench corpus.txt\n");
+    return 1;
+  }
+  while( nLines < BENCH_MAX_LINES && fgets(lines[nLines], BENCH_LINE_SIZE, fp) ) {
+    lines[nLines][strcspn(lines[nLines], "\r\n")] = '\0';
+    if( lines[nLines][0] == '{' ) nLines++;
+  }
+  fclose(fp);
+
+  BuildTable(cmdTable, cmdHead, sizeof(cmdHead) / sizeof(cmdHead[0]), cmdGroups, sizeof(cmdGroups) / sizeof(cmdGroups[0]));
+  BuildTable(rowTable, rowHead, sizeof(rowHead) / sizeof(rowHead[0]), rowGroups, sizeof(rowGroups) / sizeof(rowGroups[0]));
+
+  UC mismatch = 0;
+  size_t domStack = 0, readerStack = 0;
+  for( UC i = 0; i < nLines; i++ ) {
+    long dom = DomParse(lines[i]), reader = ReaderParse(lines[i]);
+    if( dom != reader ) {
+      printf("mismatch: %s: %ld %ld\n", lines[i], dom, reader);
+      mismatch++;
+    }
+    size_t used = StackUsed(DomParse, lines[i]);
+    if( used > domStack ) domStack = used;
+    used = StackUsed(ReaderParse, lines[i]);
+    if( used > readerStack ) readerStack = used;
+  }
+
+  if( cmdTable.poolSize > BENCH_POOL_SIZE || rowTable.poolSize > BENCH_POOL_SIZE ) {
+    printf("BENCH_POOL_SIZE too small\n");
+    return 1;
+  }
+  printf("%d lines, tables of %d and %d keys (%d and %d bytes of values), %d mismatches\n",
+      nLines, cmdTable.nFields, rowTable.nFields, cmdTable.poolSize, rowTable.poolSize, mismatch);
+  printf("per line: DOM %.0f ns, reader %.0f ns\n", TimeParse(DomParse), TimeParse(ReaderParse));
+  printf("stack: DOM %zu bytes, reader %zu bytes\n", domStack, readerStack);
+  return(mismatch > 0 ? 1 : 0);
+}
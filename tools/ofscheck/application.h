@@ -0,0 +1,75 @@
+//  application.h - Host shim of the Particle API for the flash ring check
+//
+//  Just enough of the firmware environment to build the flash region, the
+//  offline store and the report rollup on Linux. Time is virtual, the check
+//  moves millis() and Time.now() itself.
+
+#ifndef ofscheck_application_h
+#define ofscheck_application_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// FatFs types, flashee-eeprom.h pulls in FlashIO.h. integer.h is skipped,
+// its LONG is not int32_t on a 64-bit host
+#define _FF_INTEGER
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned short WCHAR;
+typedef unsigned int UINT;
+typedef unsigned long DWORD;
+
+extern unsigned long hostMillis;
+extern long hostNow;
+extern bool hostConnected;
+extern bool hostVerbose;
+
+inline unsigned long millis(void) { return hostMillis; }
+
+struct HostSerial
+{
+  void printf(const char *fmt, ...) {
+    if( !hostVerbose ) return;
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+  }
+  void printlnf(const char *fmt, ...) {
+    if( !hostVerbose ) return;
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    putchar('\n');
+  }
+};
+extern HostSerial Serial;
+
+struct HostParticle
+{
+  bool connected() { return hostConnected; }
+};
+extern HostParticle Particle;
+
+struct HostString
+{
+  const char *c_str() const { return ""; }
+};
+
+struct HostTime
+{
+  long now() { return hostNow; }
+  HostString format(long t, const char *fmt) { return HostString(); }
+};
+extern HostTime Time;
+
+#endif // ofscheck_application_h
@@ -0,0 +1,292 @@
+//  ofscheck.cpp - Offline store and report rollup on the wear levelling flash
+//
+//  Builds the flash stack of ConfigClass (Flashee LogicalPageMapper with
+//  4094-byte logical pages under PageSpanFlashDevice) on a fake 1MB chip,
+//  puts the regions of xliMemoryMap.h on it and runs OfflineStoreClass:
+//  records written while offline, found again after a reboot, back-filled
+//  in order once the cloud is back, and the ring wrapping around. Then
+//  RollupClass: closed hours found again after a reboot and queried in
+//  order, before and after the ring wraps. The neighbour regions are
+//  filled with a pattern that must survive.
+//
+//  Host only, not part of the firmware. Build (one command) and run from the
+//  repo root:
+//    g++ -O2 -Wno-format -Itools/ofscheck -I. -Iinc -Ilib -Ipackage/SparkFlasheeEeprom
+//        -Ipackage/MoveAverage tools/ofscheck/ofscheck.cpp -o ofscheck
+//    ./ofscheck [-v]
+
+// Logger, config and telemetry are replaced below, the real ones pull in
+// the whole controller
+#define xlxLogger_h
+#define xlxConfig_h
+#define xlxTelemetry_h
+
+#include <new>
+#include "application.h"
+#include "xliCommon.h"
+#include "xliMemoryMap.h"
+#include "flashee-eeprom.h"
+#include "xlxFlashRegion.h"
+#include "xlxPublishQueue.h"
+
+#define LOGTAG_MSG                "MSG"
+#define LOGE(tag, fmt, ...)       SERIAL_LN(fmt, ##__VA_ARGS__)
+#define LOGW(tag, fmt, ...)       SERIAL_LN(fmt, ##__VA_ARGS__)
+#define LOGN(tag, fmt, ...)       SERIAL_LN(fmt, ##__VA_ARGS__)
+#define LOGI(tag, fmt, ...)       SERIAL_LN(fmt, ##__VA_ARGS__)
+#define LOGD(tag, fmt, ...)
+
+class ConfigClass
+{
+public:
+  FlashRegionClass *m_flash[FLR_DUMMY];
+  BOOL GetDisableWiFi() { return false; }
+  FlashRegionClass* getFlash(UC _region) { return(_region < FLR_DUMMY ? m_flash[_region] : NULL); }
+};
+ConfigClass theConfig;
+
+const char *GetSensorKey(UC sensor)
+{
+  static char strKey[8];
+  snprintf(strKey, sizeof(strKey), "s%d", sensor);
+  return strKey;
+}
+
+#include "xlxFlashRegion.cpp"
+#include "xlxOfflineStore.cpp"
+#include "xlxRollup.cpp"
+
+using namespace Flashee;
+
+// flashee-eeprom.cpp brings the FAT layer along, this is all it adds here
+FlashDevice::~FlashDevice() { }
+
+#define CHECK_PATTERN             0x5A
+#define CHECK_MAX_LOOPS           10000
+
+unsigned long hostMillis = 0;
+long hostNow = 1500000000;
+bool hostConnected = false;
+bool hostVerbose = false;
+HostSerial Serial;
+HostParticle Particle;
+HostTime Time;
+
+//------------------------------------------------------------------
+// Publish queue: every message is sent at once, back-fill is checked here
+//------------------------------------------------------------------
+PublishQueueClass theCloudQue;
+static UL chkNextSeq;               // Expected 'sq' of the next batch
+static UL chkBackfilled;
+static UL chkBadBatches;
+
+PublishQueueClass::PublishQueueClass() {}
+
+UC PublishQueueClass::GetPending()
+{
+  return 0;
+}
+
+BOOL PublishQueueClass::AddPublishMsg(UC msgType, const char *msg, US len, UC nid, UC bNeedReplace)
+{
+  if( hostVerbose ) printf("  pub %s\n", msg);
+  const char *pSeq = strstr(msg, "'sq':");
+  if( msgType != CLT_ID_SensorData || !pSeq ) return false;
+  UL lv_seq = strtoul(pSeq + 5, NULL, 10);
+  UL lv_items = 0;
+  for( const char *p = strstr(msg, "'d':[") + 5; *p; p++ ) {
+    if( *p == '[' ) lv_items++;
+  }
+  // Records of one batch are consecutive, batches follow each other
+  if( lv_seq != chkNextSeq ) chkBadBatches++;
+  chkNextSeq = lv_seq + lv_items;
+  chkBackfilled += lv_items;
+  return true;
+}
+
+//------------------------------------------------------------------
+// Check
+//------------------------------------------------------------------
+static FakeFlashDevice *chkRaw;
+static FlashDevice *chkDevice;
+static int chkFailures = 0;
+
+static void Expect(bool ok, const char *what, long got, long want)
+{
+  printf("%-44s %s (%ld, expected %ld)\n", what, (ok ? "ok" : "FAILED"), got, want);
+  if( !ok ) chkFailures++;
+}
+
+static void NewRegion(UC region, flash_addr_t base, flash_addr_t len, const char *name)
+{
+  if( theConfig.m_flash[region] ) {
+    theConfig.m_flash[region]->Flush();
+    delete theConfig.m_flash[region];
+  }
+  theConfig.m_flash[region] = new FlashRegionClass(*chkDevice, base, len, 1, name);
+}
+
+// Reboot: the cache is flushed by SaveConfig() before, RAM is lost
+static void Reboot()
+{
+  NewRegion(FLR_OFFLINE_DATA, MEM_OFFLINE_DATA_OFFSET, MEM_OFFLINE_DATA_LEN, "offline");
+  NewRegion(FLR_REPORT, MEM_REPORT_OFFSET, MEM_REPORT_LEN, "report");
+  theOfflineStore = OfflineStoreClass();
+  theOfflineStore.Init();
+  theRollup.~RollupClass();
+  new(&theRollup) RollupClass();
+  theRollup.Init();
+}
+
+static void FillPattern(flash_addr_t address, flash_addr_t len)
+{
+  UC lv_buf[256];
+  memset(lv_buf, CHECK_PATTERN, sizeof(lv_buf));
+  for( flash_addr_t ofs = 0; ofs < len; ofs += sizeof(lv_buf) ) {
+    chkDevice->writeErasePage(lv_buf, address + ofs, sizeof(lv_buf));
+  }
+}
+
+static UL CountPattern(flash_addr_t address, flash_addr_t len)
+{
+  UC lv_buf[256];
+  UL lv_bad = 0;
+  for( flash_addr_t ofs = 0; ofs < len; ofs += sizeof(lv_buf) ) {
+    chkDevice->read(lv_buf, address + ofs, sizeof(lv_buf));
+    for( UC i = 0; i < 255; i++ ) if( lv_buf[i] != CHECK_PATTERN ) lv_bad++;
+    if( lv_buf[255] != CHECK_PATTERN ) lv_bad++;
+  }
+  return lv_bad;
+}
+
+static void AddOffline(UL count)
+{
+  hostConnected = false;
+  for( UL i = 0; i < count; i++ ) {
+    hostNow++;
+    theOfflineStore.AddSensor(1 + i % 8, 3, (float)(i % 100));
+  }
+}
+
+// One sample every 20 minutes of node 3, then the last hour is closed
+static void AddHours(UL hours)
+{
+  for( UL i = 0; i < hours * 3; i++ ) {
+    theRollup.Update(0, 0, 3, sensorDHT, (float)(i % 30));
+    hostNow += 1200;
+  }
+  hostNow += RLP_HOUR;
+  theRollup.Process();
+}
+
+// Closed hours of node 3 in [from, now), must be in time order
+static UL QueryHours(UL from, UL *pDisorder)
+{
+  rlp_record_t lv_recs[RLP_QUERY_CHUNK];
+  UL lv_total = 0, lv_last = 0;
+  UC lv_num;
+  *pDisorder = 0;
+  while( from > 0 ) {
+    lv_num = theRollup.Query(3, sensorDHT, from, hostNow, lv_recs, RLP_QUERY_CHUNK, &from);
+    for( UC i = 0; i < lv_num; i++ ) {
+      if( lv_recs[i].start <= lv_last ) (*pDisorder)++;
+      lv_last = lv_recs[i].start;
+    }
+    lv_total += lv_num;
+  }
+  return lv_total;
+}
+
+static void Backfill()
+{
+  hostConnected = true;
+  chkNextSeq = theOfflineStore.m_seq - theOfflineStore.m_pending;
+  for( UL n = 0; n < CHECK_MAX_LOOPS && theOfflineStore.m_pending > 0; n++ ) {
+    hostMillis += 1000;
+    theOfflineStore.Process();
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  hostVerbose = (argc > 1 && strcmp(argv[1], "-v") == 0);
+
+  // Same stack as Devices::createWearLevelErase(): 256 pages, 2 free
+  chkRaw = new FakeFlashDevice(256, 4096);
+  chkRaw->eraseAll();
+  chkDevice = new PageSpanFlashDevice(*new LogicalPageMapper<>(*chkRaw, 254));
+  printf("device page size %u, offline region 0x%x-0x%x\n", (unsigned)chkDevice->pageSize(),
+      (unsigned)MEM_OFFLINE_DATA_OFFSET, (unsigned)(MEM_OFFLINE_DATA_OFFSET + MEM_OFFLINE_DATA_LEN));
+  FillPattern(MEM_MAC_LIST_OFFSET, MEM_MAC_LIST_LEN);
+  FillPattern(MEM_REPORT_OFFSET, MEM_REPORT_LEN);
+  FillPattern(MEM_MISC_OFFSET, MEM_NODECONFIG_LEN);
+
+  Reboot();
+  const OfflineStoreClass &st = theOfflineStore;
+  Expect(st.m_pending == 0, "empty store after format", st.m_pending, 0);
+  theOfflineStore.Clear();
+
+  // Three sectors and a bit while offline, then reboot
+  AddOffline(800);
+  Expect(st.m_stored == 800, "records stored offline", st.m_stored, 800);
+  Reboot();
+  Expect(st.m_pending == 800, "pending after reboot", st.m_pending, 800);
+  Expect(st.m_seq == 801, "next seq after reboot", st.m_seq, 801);
+
+  Backfill();
+  Expect(chkBackfilled == 800, "records back-filled", chkBackfilled, 800);
+  Expect(chkBadBatches == 0, "batches out of order", chkBadBatches, 0);
+  Reboot();
+  Expect(st.m_pending == 0, "pending after back-fill and reboot", st.m_pending, 0);
+  Expect(st.m_seq == 801, "next seq after back-fill and reboot", st.m_seq, 801);
+
+  // More than the ring holds: the oldest sectors are dropped
+  chkBackfilled = 0;
+  AddOffline(9000);
+  US lv_pending = st.m_pending;
+  Expect(st.m_dropped > 0 && lv_pending + st.m_dropped == 9000, "ring wrap keeps or drops each record",
+      lv_pending + st.m_dropped, 9000);
+  Reboot();
+  Expect(st.m_pending == lv_pending, "pending after wrap and reboot", st.m_pending, lv_pending);
+  Backfill();
+  Expect(chkBackfilled == lv_pending, "records back-filled after wrap", chkBackfilled, lv_pending);
+  Expect(chkBadBatches == 0, "batches out of order", chkBadBatches, 0);
+
+  Reboot();
+  theOfflineStore.Clear();
+  Expect(CountPattern(MEM_MAC_LIST_OFFSET, MEM_MAC_LIST_LEN) == 0, "mac list region intact",
+      CountPattern(MEM_MAC_LIST_OFFSET, MEM_MAC_LIST_LEN), 0);
+  Expect(CountPattern(MEM_REPORT_OFFSET, MEM_REPORT_LEN) == 0, "report region intact",
+      CountPattern(MEM_REPORT_OFFSET, MEM_REPORT_LEN), 0);
+
+  // Report rollup, one record per closed hour
+  const RollupClass &rl = theRollup;
+  theRollup.Clear();
+  hostNow -= hostNow % RLP_HOUR;
+  UL lv_from = hostNow, lv_disorder;
+  AddHours(500);
+  Expect(rl.m_hours == 500, "hours closed", rl.m_hours, 500);
+  Reboot();
+  Expect(rl.m_records == 500, "hours after reboot", rl.m_records, 500);
+  Expect(rl.m_seq == 501, "next seq after reboot", rl.m_seq, 501);
+  Expect(QueryHours(lv_from, &lv_disorder) == 500, "hours queried", QueryHours(lv_from, &lv_disorder), 500);
+  Expect(lv_disorder == 0, "hours out of order", lv_disorder, 0);
+
+  // More than the ring holds: the oldest sector goes
+  AddHours(3000);
+  US lv_records = rl.m_records;
+  Reboot();
+  Expect(rl.m_records == lv_records && lv_records < 3500, "hours after wrap and reboot", rl.m_records, lv_records);
+  Expect(QueryHours(lv_from, &lv_disorder) == lv_records, "hours queried after wrap",
+      QueryHours(lv_from, &lv_disorder), lv_records);
+  Expect(lv_disorder == 0, "hours out of order", lv_disorder, 0);
+
+  Reboot();
+  Expect(CountPattern(MEM_MAC_LIST_OFFSET, MEM_MAC_LIST_LEN) == 0, "mac list region intact",
+      CountPattern(MEM_MAC_LIST_OFFSET, MEM_MAC_LIST_LEN), 0);
+  Expect(CountPattern(MEM_MISC_OFFSET, MEM_NODECONFIG_LEN) == 0, "misc region intact",
+      CountPattern(MEM_MISC_OFFSET, MEM_NODECONFIG_LEN), 0);
+
+  printf("%s\n", (chkFailures ? "FAILED" : "PASSED"));
+  return(chkFailures ? 1 : 0);
+}
@@ -0,0 +1,75 @@
+//  application.h - Host shim of the Particle API for the radio benchmark
+//
+//  Just enough of the firmware environment to build the CC1100 driver on
+//  Linux with CC1101_SIM. Time is virtual: delay() and
+//  micros() advance and read the clock of the simulated ether.
+
+#ifndef rfsim_application_h
+#define rfsim_application_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef TRUE
+#define TRUE              1
+#endif
+#ifndef FALSE
+#define FALSE             0
+#endif
+
+#define HIGH              1
+#define LOW               0
+#define INPUT             0
+#define OUTPUT            1
+#define A1                11
+#define A2                12
+
+#define F(x)              (x)
+
+typedef uint8_t byte;
+
+template <class T, class U> inline T min(T a, U b) { return (a < (T)b ? a : (T)b); }
+
+// Virtual time, see rfbench.cpp
+unsigned long micros(void);
+unsigned long millis(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+inline void pinMode(uint16_t, uint8_t) {}
+inline void digitalWrite(uint16_t, uint8_t) {}
+inline int32_t digitalRead(uint16_t) { return LOW; }
+inline int32_t analogRead(uint16_t) { return 0; }
+
+inline char *itoa(int value, char *str, int) { sprintf(str, "%d", value); return str; }
+
+// Driver debug output is dropped
+class HostSerial
+{
+public:
+  template <class T> void print(T) {}
+  template <class T> void print(T, int) {}
+  void println(void) {}
+  template <class T> void println(T) {}
+  template <class T> void println(T, int) {}
+  template <class T> void write(T) {}
+  void printf(const char *, ...) {}
+  void printlnf(const char *, ...) {}
+};
+extern HostSerial Serial;
+
+// The SPI bus is replaced by CC1101Sim
+class HostSPI
+{
+public:
+  void begin(void) {}
+  void end(void) {}
+  uint8_t transfer(uint8_t) { return 0; }
+};
+extern HostSPI SPI;
+
+#endif // rfsim_application_h
@@ -0,0 +1,403 @@
+//  rfbench.cpp - Multi-node benchmark of the 433MHz link on the CC1101 simulator
+//
+//  One gateway and up to 7 nodes share a CC1101Ether, every radio runs the real
+//  CC1100 driver. BenchTransport frames packets the way MyTransport433 does
+//  (MyMessage.h doesn't build on a 64-bit host, its set() overloads collide).
+//  Each node sends fixed size frames to the gateway and waits for the echo,
+//  retrying on timeout. The gateway answers every frame and queues its echos
+//  while its own TX is busy. Loss, node count and seeds are fixed, so every run
+//  gives the same numbers.
+//
+//  "crc err" counts the collided frames seen by all radios, nodes overhear
+//  each other since the gateway address is also a broadcast address.
+//
+//  The survey part times one channel survey hop of MyTransport433::sampleRSSI()
+//  on a quiet home channel and a noisy candidate, with and without waiting for
+//  RX after the FS calibration. "away" runs from leaving home RX to being back
+//  in RX on the home channel.
+//
+//  Host only, not part of the firmware. Build (one command) and run from the
+//  repo root:
+//    g++ -O2 -DCC1101_SIM -Itools/rfsim -Ipackage/CC1101-433 tools/rfsim/rfbench.cpp
+//        package/CC1101-433/cc1100.cpp package/CC1101-433/cc1101sim.cpp -o rfbench
+//    ./rfbench
+
+#include <time.h>
+#include "application.h"
+#include "cc1100.h"
+
+#define GATEWAY_ADDRESS           0
+#define MAX_MESSAGE_LENGTH        27                  // as MyMessage.h
+#define BENCH_FRAME_LEN           MAX_MESSAGE_LENGTH  // available() wants full frames
+#define BENCH_FRAMES_PER_NODE     100
+#define BENCH_TX_RETRIES          TX_RETRIES_MAX
+#define BENCH_ACK_TIMEOUT         ACK_TIMEOUT         // ms from the end of TX, the server's default
+#define BENCH_GAP_MIN             200                 // ms between frames of a node
+#define BENCH_GAP_SPAN            2000
+#define BENCH_BACKOFF_SPAN        500                 // ms, random before a retry
+#define BENCH_STEP_US             200                 // resolution of the main loop
+#define BENCH_ACK_QUEUE           8
+#define BENCH_RF_CHANNEL          100                 // CC1101_433_CHANNEL
+#define BENCH_SURVEY_CHANNEL      116                 // Home plus RF_SURVEY_STEP
+#define BENCH_SURVEY_NOISE        -80                 // dBm on the candidate channel
+
+HostSerial Serial;
+HostSPI SPI;
+
+static CC1101Ether *g_ether = NULL;
+
+unsigned long micros(void)
+{
+  return (unsigned long)g_ether->now();
+}
+
+unsigned long millis(void)
+{
+  return (unsigned long)(g_ether->now() / 1000);
+}
+
+void delay(unsigned long ms)
+{
+  g_ether->run(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  g_ether->run(us);
+}
+
+// Same framing, RX filter and TX completion as MyTransport433
+class BenchTransport
+{
+public:
+  BenchTransport(uint8_t address) : _address(address) {}
+
+  void attachSim(CC1101Sim *radio) { cc1101433.attach_sim(radio); }
+
+  bool init(uint8_t channel) {
+    if( !cc1101433.begin() ) return false;
+    cc1101433.set_channel(channel);
+    cc1101433.set_myaddr(_address);
+    cc1101433.receive();
+    return true;
+  }
+
+  bool send(uint8_t to, const void *data, uint8_t len) {
+    uint8_t sndmsg[FIFOBUFFER];
+    memset(sndmsg, 0x00, FIFOBUFFER);
+    memcpy(sndmsg + 3, data, len);
+    return(cc1101433.sent_packet(_address, to, sndmsg, len + 3) == TRUE);
+  }
+
+  bool available() {
+    return(cc1101433.packet_available() >= MAX_MESSAGE_LENGTH + 5);
+  }
+
+  uint8_t receive(void *data, uint8_t *from, uint8_t *to) {
+    uint8_t Rx_fifo[FIFOBUFFER];
+    uint8_t pktlen, lqi, rx_addr, sender;
+    int8_t rssi_dbm;
+    if( cc1101433.get_payload(Rx_fifo, pktlen, rx_addr, sender, rssi_dbm, lqi) != TRUE ) return 0;
+    *to = rx_addr;
+    *from = sender;
+    memcpy(data, Rx_fifo + 3, pktlen - 3);
+    return pktlen - 3;
+  }
+
+  bool isTxBusy() { return(cc1101433.tx_check() == FALSE); }
+  bool txDone() { return(cc1101433.tx_done() == TRUE); }
+
+  // As MyTransport433::sampleRSSI(), bWaitRx false is the sequence before
+  // it polled MARCSTATE
+  int8_t sampleRSSI(uint8_t channel, uint8_t home, bool bWaitRx) {
+    int8_t rssi_dbm = RSSI_SAMPLE_FAILED;
+    cc1101433.sidle();
+    cc1101433.set_channel(channel);
+    cc1101433.receive();
+    if( !bWaitRx || cc1101433.wait_rx() ) {
+      delayMicroseconds(RSSI_SETTLE_TIME);
+      rssi_dbm = cc1101433.get_rssi();
+    }
+    cc1101433.sidle();
+    cc1101433.set_channel(home);
+    cc1101433.receive();
+    return rssi_dbm;
+  }
+
+  bool waitRx() { return(cc1101433.wait_rx() == TRUE); }
+
+private:
+  CC1100 cc1101433;
+  uint8_t _address;
+};
+
+static uint32_t g_seed = 1;
+static uint32_t BenchRand(uint32_t span)
+{
+  g_seed = g_seed * 1103515245UL + 12345UL;
+  return (g_seed >> 8) % span;
+}
+
+enum {
+  NODE_IDLE,
+  NODE_TX,
+  NODE_WAIT_ACK
+};
+
+typedef struct
+{
+  BenchTransport *radio;
+  uint8_t address;
+  uint8_t state;
+  uint16_t seq;
+  uint16_t retries;
+  unsigned long nextAt;
+  unsigned long deadline;
+  unsigned long firstTx;
+  // Results
+  uint32_t txFrames;
+  uint32_t delivered;
+  uint32_t failed;
+  uint64_t latency;
+} bench_node_t;
+
+typedef struct
+{
+  BenchTransport *radio;
+  uint8_t ackTo[BENCH_ACK_QUEUE];
+  uint16_t ackSeq[BENCH_ACK_QUEUE];
+  uint8_t ackCount;
+  uint16_t lastSeq[SIM_MAX_RADIOS];
+  // Results
+  uint32_t rxFrames;
+  uint32_t duplicates;
+  uint32_t ackDropped;
+} bench_gateway_t;
+
+typedef struct
+{
+  uint32_t frames;
+  uint32_t delivered;
+  uint32_t failed;
+  uint32_t txFrames;
+  uint32_t duplicates;
+  uint32_t collided;
+  uint32_t lost;
+  uint32_t ackDropped;
+  double elapsed_s;
+  double latency_ms;
+  double host_ms;
+} bench_result_t;
+
+// End of packet edge of GDO2, as the firmware ISR does
+static void OnGDO2(void *context)
+{
+  ((BenchTransport *)context)->txDone();
+}
+
+static void GatewayLoop(bench_gateway_t &gw)
+{
+  uint8_t data[FIFOBUFFER];
+  uint8_t from, to;
+
+  while( gw.radio->available() ) {
+    if( gw.radio->receive(data, &from, &to) < 3 || from >= SIM_MAX_RADIOS ) continue;
+    uint16_t seq = data[0] | (data[1] << 8);
+    if( seq == gw.lastSeq[from] ) {
+      gw.duplicates++;        // Our echo was lost, answer again
+    } else {
+      gw.lastSeq[from] = seq;
+      gw.rxFrames++;
+    }
+    if( gw.ackCount < BENCH_ACK_QUEUE ) {
+      gw.ackTo[gw.ackCount] = from;
+      gw.ackSeq[gw.ackCount] = seq;
+      gw.ackCount++;
+    } else {
+      gw.ackDropped++;
+    }
+  }
+
+  if( gw.ackCount > 0 && !gw.radio->isTxBusy() ) {
+    memset(data, 0x00, sizeof(data));
+    data[0] = gw.ackSeq[0] & 0xFF;
+    data[1] = gw.ackSeq[0] >> 8;
+    if( gw.radio->send(gw.ackTo[0], data, BENCH_FRAME_LEN) ) {
+      gw.ackCount--;
+      memmove(gw.ackTo, gw.ackTo + 1, gw.ackCount);
+      memmove(gw.ackSeq, gw.ackSeq + 1, gw.ackCount * sizeof(uint16_t));
+    }
+  }
+}
+
+static void NodeLoop(bench_node_t &node)
+{
+  uint8_t data[FIFOBUFFER];
+  uint8_t from, to;
+  unsigned long now = millis();
+
+  switch( node.state ) {
+  case NODE_IDLE:
+    if( node.seq > BENCH_FRAMES_PER_NODE || now < node.nextAt ) break;
+    memset(data, 0x00, sizeof(data));
+    data[0] = node.seq & 0xFF;
+    data[1] = node.seq >> 8;
+    data[2] = node.address;
+    if( node.radio->isTxBusy() || !node.radio->send(GATEWAY_ADDRESS, data, BENCH_FRAME_LEN) ) break;
+    if( node.retries == 0 ) node.firstTx = now;
+    node.txFrames++;
+    node.state = NODE_TX;
+    break;
+
+  case NODE_TX:
+    if( node.radio->isTxBusy() ) break;
+    node.deadline = now + BENCH_ACK_TIMEOUT;
+    node.state = NODE_WAIT_ACK;
+    break;
+
+  case NODE_WAIT_ACK:
+    // Frames of the other nodes to the gateway are broadcast as well
+    while( node.radio->available() ) {
+      if( node.radio->receive(data, &from, &to) < 3 ) continue;
+      if( from != GATEWAY_ADDRESS || to != node.address ) continue;
+      if( (data[0] | (data[1] << 8)) != node.seq ) continue;
+      node.delivered++;
+      node.latency += now - node.firstTx;
+      node.seq++;
+      node.retries = 0;
+      node.nextAt = now + BENCH_GAP_MIN + BenchRand(BENCH_GAP_SPAN);
+      node.state = NODE_IDLE;
+      return;
+    }
+    if( now < node.deadline ) break;
+    if( node.retries++ < BENCH_TX_RETRIES ) {
+      node.nextAt = now + BenchRand(BENCH_BACKOFF_SPAN);
+    } else {
+      node.failed++;
+      node.seq++;
+      node.retries = 0;
+      node.nextAt = now + BENCH_GAP_MIN + BenchRand(BENCH_GAP_SPAN);
+    }
+    node.state = NODE_IDLE;
+    break;
+  }
+}
+
+static bench_result_t RunScenario(uint8_t nodes, uint16_t loss)
+{
+  bench_result_t result;
+  CC1101Ether ether(1000 + nodes * 31 + loss);
+  CC1101Sim *chips[SIM_MAX_RADIOS];
+  BenchTransport *radios[SIM_MAX_RADIOS];
+  bench_gateway_t gw;
+  bench_node_t node[SIM_MAX_RADIOS];
+  clock_t host_start = clock();
+
+  g_ether = &ether;
+  g_seed = nodes * 7 + loss;
+  ether.set_loss(loss);
+  memset(&result, 0x00, sizeof(result));
+  memset(&gw, 0x00, sizeof(gw));
+  memset(node, 0x00, sizeof(node));
+
+  // Radio 0 is the gateway, the others take their index as address
+  for( uint8_t i = 0; i <= nodes; i++ ) {
+    chips[i] = new CC1101Sim(ether);
+    radios[i] = new BenchTransport(i);
+    radios[i]->attachSim(chips[i]);
+    chips[i]->set_gdo2_callback(OnGDO2, radios[i]);
+    radios[i]->init(BENCH_RF_CHANNEL);
+  }
+  gw.radio = radios[0];
+  for( uint8_t i = 0; i < SIM_MAX_RADIOS; i++ ) gw.lastSeq[i] = 0xFFFF;
+  for( uint8_t i = 1; i <= nodes; i++ ) {
+    node[i].radio = radios[i];
+    node[i].address = i;
+    node[i].seq = 1;
+    node[i].nextAt = millis() + BenchRand(BENCH_GAP_SPAN);
+  }
+
+  bool bDone = false;
+  while( !bDone ) {
+    ether.run(BENCH_STEP_US);
+    GatewayLoop(gw);
+    bDone = (gw.ackCount == 0);
+    for( uint8_t i = 1; i <= nodes; i++ ) {
+      NodeLoop(node[i]);
+      if( node[i].seq <= BENCH_FRAMES_PER_NODE ) bDone = false;
+    }
+  }
+
+  result.frames = nodes * BENCH_FRAMES_PER_NODE;
+  result.duplicates = gw.duplicates;
+  result.ackDropped = gw.ackDropped;
+  for( uint8_t i = 1; i <= nodes; i++ ) {
+    result.delivered += node[i].delivered;
+    result.failed += node[i].failed;
+    result.txFrames += node[i].txFrames;
+    result.latency_ms += node[i].latency;
+  }
+  if( result.delivered > 0 ) result.latency_ms /= result.delivered;
+  for( uint8_t i = 0; i <= nodes; i++ ) {
+    result.collided += chips[i]->get_stat()->rx_crc_error;
+    result.lost += chips[i]->get_stat()->rx_lost;
+    delete radios[i];
+    delete chips[i];
+  }
+  result.elapsed_s = ether.now() / 1000000.0;
+  result.host_ms = (clock() - host_start) * 1000.0 / CLOCKS_PER_SEC;
+  g_ether = NULL;
+  return result;
+}
+
+// One survey hop on an otherwise silent ether
+static void RunSurvey(bool bWaitRx)
+{
+  CC1101Ether ether(1);
+  CC1101Sim chip(ether);
+  BenchTransport radio(GATEWAY_ADDRESS);
+
+  g_ether = &ether;
+  radio.attachSim(&chip);
+  radio.init(BENCH_RF_CHANNEL);
+  ether.set_noise(BENCH_SURVEY_CHANNEL, BENCH_SURVEY_NOISE);
+  radio.waitRx();
+
+  unsigned long start = micros();
+  int8_t rssi = radio.sampleRSSI(BENCH_SURVEY_CHANNEL, BENCH_RF_CHANNEL, bWaitRx);
+  unsigned long sampled = micros();
+  bool bBack = radio.waitRx();
+  unsigned long back = micros();
+  printf("%-12s %5d dBm %5d dBm %8.2fms %8.2fms%s\n", bWaitRx ? "wait RX" : "no wait",
+      rssi, BENCH_SURVEY_NOISE, (sampled - start) / 1000.0, (back - start) / 1000.0,
+      bBack ? "" : "  (RX not reached)");
+  g_ether = NULL;
+}
+
+int main(void)
+{
+  const uint8_t nodeCounts[] = {1, 3, 7};
+  const uint16_t losses[] = {0, 20, 100};
+
+  printf("%d frames of %d bytes per node, %d retries, echo timeout %d ms\n",
+      BENCH_FRAMES_PER_NODE, BENCH_FRAME_LEN, BENCH_TX_RETRIES, BENCH_ACK_TIMEOUT);
+  printf("nodes loss   delivered  failed  tx/frame  dup  crc err  lost  ackdrop  latency  frames/s  host\n");
+  for( uint8_t n = 0; n < sizeof(nodeCounts); n++ ) {
+    for( uint8_t l = 0; l < sizeof(losses) / sizeof(losses[0]); l++ ) {
+      bench_result_t r = RunScenario(nodeCounts[n], losses[l]);
+      printf("%5d %4.1f%% %5lu/%-5lu %7lu %9.2f %4lu %9lu %5lu %8lu %6.1fms %9.1f %4.0fms\n",
+          nodeCounts[n], losses[l] / 10.0,
+          (unsigned long)r.delivered, (unsigned long)r.frames, (unsigned long)r.failed,
+          r.delivered ? (double)r.txFrames / r.delivered : 0.0,
+          (unsigned long)r.duplicates, (unsigned long)r.collided, (unsigned long)r.lost,
+          (unsigned long)r.ackDropped, r.latency_ms,
+          r.elapsed_s > 0 ? r.delivered / r.elapsed_s : 0.0, r.host_ms);
+    }
+  }
+
+  printf("\nsurvey hop, RSSI settle %d us, RX wait up to %d us\n", RSSI_SETTLE_TIME, RX_WAIT_TIMEOUT);
+  printf("sequence      sampled  expected   sample     away\n");
+  RunSurvey(false);
+  RunSurvey(true);
+  return 0;
+}
@@ -36,6 +36,12 @@
 #include "TimeAlarms.h"
 #include "xlxAirCondManager.h"
 #include "xlxPublishQueue.h"
+#include "xlxTelemetry.h"
+#include "xlxStatusFeed.h"
+#include "xlxOfflineStore.h"
+#include "xlxRollup.h"
+#include "xlxTableTxn.h"
+#include "xlxAlarmGraph.h"
 
 //------------------------------------------------------------------
 // Global Data Structures & Variables
@@ -66,27 +72,6 @@ SmartControllerClass theSys;
 #endif
 #endif
 
-//------------------------------------------------------------------
-// Alarm Triggered Actions
-//------------------------------------------------------------------
-void AlarmTimerTriggered(uint32_t tag)
-{
-	if( tag == 255 ) return;
-	uint8_t rule_uid = (uint8_t)tag;
-	SERIAL_LN("Rule %u Alarm Triggered", rule_uid);
-
-	//search Rule table for matching UID
-	ListNode<RuleRow_t> *RuleRowptr = theSys.Rule_table.search(rule_uid);
-	if (RuleRowptr == NULL)
-	{
-		LOGE(LOGTAG_MSG, "Error, could not locate Rule Row corresponding to triggered Alarm ID");
-		return;
-	}
-
-	// Execute the rule with init-flag
-	theSys.Execute_Rule(RuleRowptr, true);
-}
-
 //------------------------------------------------------------------
 // Smart Controller Class
 //------------------------------------------------------------------
@@ -99,6 +84,8 @@ SmartControllerClass::SmartControllerClass()
 	m_tickLoopKeyCode = 0;
 	m_relaykeyflag = 0x00;
 	memset(m_mac,0,sizeof(m_mac));
+	memset(m_hueConfirmed,0,sizeof(m_hueConfirmed));
+	m_packedScene = 0;
 	memset(m_action,0,sizeof(m_action));
 	m_actionchanged = 0;
 }
@@ -125,6 +112,10 @@ void SmartControllerClass::Init()
 	// Initialize Logger
 	theLog.Init(m_SysID);
 	theLog.InitFlash(MEM_OFFLINE_DATA_OFFSET, MEM_OFFLINE_DATA_LEN);
+	// Sensor history kept while the cloud is unreachable
+	theOfflineStore.Init();
+	// Hourly sensor reports
+	theRollup.Init();
 
 	LOGN(LOGTAG_MSG, "SmartController is starting...SysID=%s", m_SysID.c_str());
 }
@@ -134,6 +125,7 @@ void SmartControllerClass::Init()
 void SmartControllerClass::InitRadio()
 {
   m_isRF = theRadio.ServerBegin(theConfig.GetRFChannel(),theConfig.GetRFAddr());
+  theRadio.SetSurveyMode(theConfig.GetRFSurvey());
   if (m_isRF)
   {
     LOGN(LOGTAG_MSG, "RF is working.");
@@ -273,6 +265,12 @@ BOOL SmartControllerClass::Start()
 	// Acts on the Rules rules newly loaded from flash
 	ReadNewRules(true);
 
+	// Known nodes have to show up within a keepalive period, remotes excepted
+	for( UC i = 0; i < theConfig.lstNodes.count(); i++ ) {
+		UC lv_nid = theConfig.lstNodes._pItems[i].nid;
+		if( !(theRadio.GetNodePower(lv_nid) & RF_NODE_SLEEPY) ) m_liveness.Refresh(lv_nid);
+	}
+
 	return true;
 }
 
@@ -423,6 +421,8 @@ BOOL SmartControllerClass::SelfCheck(US ms)
 	static UC tickAcitveCheck = 0;
 	static UC tickWiFiOff = 0;
 	static US tickACCheck = 0;
+	static US tickShadow = 0;
+	static US tickLiveness = 0;
 
   ProcessPublishMsg();
 	PublishBtnAction();
@@ -434,16 +434,22 @@ BOOL SmartControllerClass::SelfCheck(US ms)
 		theACManager.ProcessCheck();
 	}
 
+	// Resend lost lamp commands, once per second
+	if (++tickShadow > 1000 / ms) {
+		tickShadow = 0;
+		ReconcileShadow();
+	}
+
 	// Save config if it was changed
 	if (++tickSaveConfig > 30000 / ms) {	// once per 30 seconds
 		tickSaveConfig = 0;
 		theConfig.SaveConfig();
 	}
-  // TODO
-	// Scan device list and check keepalive timeout
-	/*if( tickSaveConfig % (2000 / ms) == 0 ) { // every 2 second
+	// Expire nodes that missed the keepalive, once per second
+	if (++tickLiveness > 1000 / ms) {
+		tickLiveness = 0;
 		CheckDevTimeout();
-	}*/
+	}
 
 	// Publish relay key status if changed
 	if( !theConfig.GetDisableWiFi() ) {
@@ -455,6 +461,8 @@ BOOL SmartControllerClass::SelfCheck(US ms)
 		// Check RF module
 		++tickAcitveCheck;
 		tickCheckRadio = 0;
+		// Close minute and hour buckets of quiet sensors
+		theRollup.Process();
     //TODO rf check
     /*if( !IsRFGood() || !theRadio.CheckConfig() ) {
       if( CheckRF() ) {
@@ -663,13 +671,13 @@ int SmartControllerClass::DeviceSwitch(UC sw, UC hwsw, UC dev, const UC subID,UC
 	if( nKey == 0 )
 	{
 		//m_senddelay = 2; //delay 1s
-		rc = DevSoftSwitch(sw, dev, subID,arrDevType,devTypeNum);
+		rc = DevSoftSwitch(sw, dev, subID);
 	}
 
 	return rc;
 }
 
-int SmartControllerClass::DevSoftSwitch(UC sw, UC dev, const UC subID,UC *arrDevType,UC devTypeNum)
+int SmartControllerClass::DevSoftSwitch(UC sw, UC dev, const UC subID)
 {
 	// Turn on hardswitch before turning softswitch on
 	if( sw > 0 ) {
@@ -682,17 +690,12 @@ int SmartControllerClass::DevSoftSwitch(UC sw, UC dev, const UC subID,UC *arrDev
 	//ToDo: if dev = 0, go through list of devices
 	// ToDo:
 	//SetStatus();
-	String strCmd = String::format("%d:7:%d", dev, sw);
-	if(arrDevType != NULL && devTypeNum>0)
-	{
-		strCmd += ":0:0";   // add delay op time unit and time
-		for( UC i = 0; i < devTypeNum; i++ )
-		{
-			strCmd += ":";
-			strCmd += String(*(arrDevType+i));
-		}
-	}
-	return theRadio.ProcessSend(strCmd, 0, subID);
+	rf_cmd_t lv_cmd = {};
+	lv_cmd.node = dev;
+	lv_cmd.msgID = RF_CMD_SET_POWER;
+	lv_cmd.subID = subID;
+	lv_cmd.sw = sw;
+	return SendLampCommand(lv_cmd);
 }
 
 int SmartControllerClass::DevHardSwitch(UC key, UC sw)
@@ -967,6 +970,9 @@ void SmartControllerClass::FastProcess()
 
 void SmartControllerClass::ProcessPublishMsg()
 {
+  theTelemetry.Process();
+  theStatusFeed.Process();
+  theOfflineStore.Process();
   theCloudQue.ProcessPublishMsg();
 }
 
@@ -977,29 +983,31 @@ void SmartControllerClass::ProcessPublishMsg()
 int SmartControllerClass::CldSetTimeZone(String tzStr)
 {
 	// Parse JSON string
-	StaticJsonBuffer<COMMAND_JSON_SIZE * 8> lv_jBuf;
-	JsonObject& root = lv_jBuf.parseObject(const_cast<char*>(tzStr.c_str()));
-	if (!root.success())
+	long lv_id = 0, lv_offset = 0, lv_dst = 0;
+	jsr_field_t lv_fields[] = {
+		JSR_FIELD("id", JSR_INT, 1, &lv_id),
+		JSR_FIELD("offset", JSR_INT, 1, &lv_offset),
+		JSR_FIELD("dst", JSR_INT, 1, &lv_dst)
+	};
+	if (!JsonReaderClass::Parse(tzStr.c_str(), lv_fields, 3))
 		return -1;
-	if (root.size() != 3)  // Expected 3 KVPs
-		return -1;
-	if(!root.containsKey("id")) return 1;
-	if(!root.containsKey("offset")) return 2;
-	if(!root.containsKey("dst")) return 3;
+	if(!lv_fields[0].found) return 1;
+	if(!lv_fields[1].found) return 2;
+	if(!lv_fields[2].found) return 3;
 
 	// Set timezone id
-	if (!theConfig.SetTimeZoneID((US)root["id"].as<int>()))
+	if (!theConfig.SetTimeZoneID((US)lv_id))
 		return 1;
 
 	// Set timezone offset
-	if (!theConfig.SetTimeZoneOffset((SHORT)root["offset"].as<int>()))
+	if (!theConfig.SetTimeZoneOffset((SHORT)lv_offset))
 		return 2;
 
 	// Set timezone dst
-	if (!theConfig.SetDaylightSaving((UC)root["dst"].as<int>()))
+	if (!theConfig.SetDaylightSaving((UC)lv_dst))
 		return 3;
 
-	LOGI(LOGTAG_EVENT, "setTimeZone to %d;%d;%d", root["id"].as<int>(), root["offset"].as<int>(), root["dst"].as<int>());
+	LOGI(LOGTAG_EVENT, "setTimeZone to %d;%d;%d", (int)lv_id, (int)lv_offset, (int)lv_dst);
 	return 0;
 }
 
@@ -1129,63 +1137,83 @@ int SmartControllerClass::ExeJSONCommand(String jsonCmd)
 		return 1;
 	}
 
-	int sub_id = 0;
-	if( (*m_jpCldCmd).containsKey("sid") ) sub_id = (*m_jpCldCmd)["sid"].as<int>();
+	// One table for the keys of every command, read in one pass
+	enum { JC_CMD, JC_SID, JC_ND, JC_DATA, JC_STATE, JC_TP, JC_HW, JC_RING, JC_VALUE, JC_SNT, JC_RESET, JC_RINGID,
+		JC_FILTER, JC_MSG, JC_ACK, JC_TAG, JC_PL, JC_DT, JC_SR, JC_FROM, JC_TO, JC_HR, JC_NUM };
+	long lv_cmd = 0, lv_sid = 0, lv_nd = 0;
+	long state = 0, hw = 2, value = 0, SNT_uid = 0, reset = 0, ring_id = RING_ID_ALL, filter_id = 0;
+	long msg_id = 0, ack_flag = 0, tag = 0, sensor = 0, from = 0, to = 0, hours = RLP_QUERY_HOURS;
+	char strData[COMMAND_JSON_SIZE * 3];
+	char payl[COMMAND_JSON_SIZE * 2];
+	UC devTypeArr[32];
+	UC ring[7];
+	UC payl_buf[MAX_PAYLOAD];
+	memset(devTypeArr,0x00,sizeof(devTypeArr));
+	jsr_field_t lv_fields[] = {
+		JSR_FIELD("cmd", JSR_INT, 1, &lv_cmd),
+		JSR_FIELD("sid", JSR_INT, 1, &lv_sid),
+		JSR_FIELD("nd", JSR_INT, 1, &lv_nd),
+		JSR_FIELD("data", JSR_STR, sizeof(strData), strData),
+		JSR_FIELD("state", JSR_INT, 1, &state),
+		JSR_FIELD("tp", JSR_BYTES, sizeof(devTypeArr), devTypeArr),
+		JSR_FIELD("hw", JSR_INT, 1, &hw),
+		JSR_FIELD("ring", JSR_BYTES, sizeof(ring), ring),
+		JSR_FIELD("value", JSR_INT, 1, &value),
+		JSR_FIELD("SNT_id", JSR_INT, 1, &SNT_uid),
+		JSR_FIELD("reset", JSR_INT, 1, &reset),
+		JSR_FIELD("Ring", JSR_INT, 1, &ring_id),
+		JSR_FIELD("filter", JSR_INT, 1, &filter_id),
+		JSR_FIELD("msg", JSR_INT, 1, &msg_id),
+		JSR_FIELD("ack", JSR_INT, 1, &ack_flag),
+		JSR_FIELD("tag", JSR_INT, 1, &tag),
+		JSR_FIELD("pl", JSR_STR, sizeof(payl), payl),
+		JSR_FIELD("dt", JSR_BYTES, sizeof(payl_buf), payl_buf),
+		JSR_FIELD("sr", JSR_INT, 1, &sensor),
+		JSR_FIELD("from", JSR_INT, 1, &from),
+		JSR_FIELD("to", JSR_INT, 1, &to),
+		JSR_FIELD("hr", JSR_INT, 1, &hours)
+	};
+	if( !JsonReaderClass::Parse(m_pCldCmd, lv_fields, JC_NUM) ) {
+		LOGE(LOGTAG_MSG, "Error parsing json cmd: %s", m_pCldCmd);
+		return 0;
+	}
+	const int sub_id = (int)lv_sid;
+	const int node_id = (int)lv_nd;
+	const BOOL hasNode = lv_fields[JC_ND].found;
 
 	rc = 0;
-	if ((*m_jpCldCmd).containsKey("cmd"))
+	if (lv_fields[JC_CMD].found)
   {
-		const COMMAND _cmd = (COMMAND)(*m_jpCldCmd)["cmd"].as<int>();
+		const COMMAND _cmd = (COMMAND)lv_cmd;
 		//COMMAND 0: Use Serial Interface
 		if( _cmd == CMD_SERIAL) {
 			// Execute serial port command, and reflect results on cloud variable
-			if ((*m_jpCldCmd).containsKey("data")) {
+			if (lv_fields[JC_DATA].found) {
 				if( !theConfig.IsCloudSerialEnabled() ) {
 					LOGN(LOGTAG_MSG, "Cloud serial command is not allowed. Check system config.");
 					return 0;
 				}
-				const char* strData = (*m_jpCldCmd)["data"];
 				theConsole.ExecuteCloudCommand(strData);
 				return 1;
 			}
 		}
 		//COMMAND 1: Toggle light switch
 		else if (_cmd == CMD_POWER) {
-			if ((*m_jpCldCmd).containsKey("nd") && (*m_jpCldCmd).containsKey("state")) {
-				const int node_id = (*m_jpCldCmd)["nd"].as<int>();
-				const int state = (*m_jpCldCmd)["state"].as<int>();
-				UC devTypeArr[32];
-				memset(devTypeArr,0x00,sizeof(devTypeArr));
-				UC devTypeNum = 0;
-				if( (*m_jpCldCmd).containsKey("tp") ) {
-					devTypeNum = (*m_jpCldCmd)["tp"].size();
-					for( UC i = 0; i < devTypeNum; i++ )
-					{
-						devTypeArr[i] = (*m_jpCldCmd)["tp"][i].as<uint8_t>();
-					}
-				}
-				const UC _hwsw = (UC)((*m_jpCldCmd).containsKey("hw") ? (*m_jpCldCmd)["hw"].as<int>() : 2);
-				return DeviceSwitch(state, _hwsw, node_id, sub_id,devTypeArr,devTypeNum);
+			if (hasNode && lv_fields[JC_STATE].found) {
+				const UC devTypeNum = (UC)lv_fields[JC_TP].count;
+				return DeviceSwitch((int)state, (UC)hw, node_id, sub_id,devTypeArr,devTypeNum);
 			}
 		}
 		//COMMAND 2: Change light color
 		else if (_cmd == CMD_COLOR) {
-			if ((*m_jpCldCmd).containsKey("nd") && (*m_jpCldCmd).containsKey("ring")) {
-				if( (*m_jpCldCmd)["ring"].size() > 6 ) {
-					const int node_id = (*m_jpCldCmd)["nd"].as<int>();
-					const uint8_t ring = (*m_jpCldCmd)["ring"][0].as<uint8_t>();
-					const uint8_t State = (*m_jpCldCmd)["ring"][1].as<uint8_t>();
-					const uint8_t BR = (*m_jpCldCmd)["ring"][2].as<uint8_t>();
-					const uint8_t W = (*m_jpCldCmd)["ring"][3].as<uint8_t>();
-					const uint8_t R = (*m_jpCldCmd)["ring"][4].as<uint8_t>();
-					const uint8_t G = (*m_jpCldCmd)["ring"][5].as<uint8_t>();
-					const uint8_t B = (*m_jpCldCmd)["ring"][6].as<uint8_t>();
-
+			if (hasNode && lv_fields[JC_RING].found) {
+				if( lv_fields[JC_RING].count > 6 ) {
 					MyMessage tmpMsg;
 					UC payl_buf[MAX_PAYLOAD];
 					UC payl_len;
 
-					payl_len = CreateColorPayload(payl_buf, ring, State, BR, W, R, G, B);
+					// ring, State, BR, W, R, G, B
+					payl_len = CreateColorPayload(payl_buf, ring[0], ring[1], ring[2], ring[3], ring[4], ring[5], ring[6]);
 					tmpMsg.build(theRadio.getAddress(), node_id, sub_id, C_SET, V_RGBW, true);
 					tmpMsg.set((void *)payl_buf, payl_len);
 					return theRadio.ProcessSend(&tmpMsg);
@@ -1195,127 +1223,95 @@ int SmartControllerClass::ExeJSONCommand(String jsonCmd)
 		//COMMAND 3: Change brightness
 		//COMMAND 5: Change CCT
 		else if (_cmd == CMD_BRIGHTNESS || _cmd == CMD_CCT) {
-			if ((*m_jpCldCmd).containsKey("nd") && (*m_jpCldCmd).containsKey("value")) {
-				const int node_id = (*m_jpCldCmd)["nd"].as<int>();
-				const int value = (*m_jpCldCmd)["value"].as<int>();
-
+			if (hasNode && lv_fields[JC_VALUE].found) {
 				//char buf[64];
 				//sprintf(buf, "%d;%d;%d;%d;%d;%d", node_id, S_DIMMER, C_SET, 1, V_DIMMER, value);
 				//String strCmd(buf);
 				//ExecuteLightCommand(strCmd);
 				// Use shortcut instead
-				String strCmd = String::format("%d:%d:%d", node_id, (_cmd == CMD_BRIGHTNESS ? 9 : 11), value);
-				UC devTypeArr[32];
-				memset(devTypeArr,0x00,sizeof(devTypeArr));
-				UC devTypeNum = 0;
-				if( (*m_jpCldCmd).containsKey("tp") ) {
-					devTypeNum = (*m_jpCldCmd)["tp"].size();
-					for( UC i = 0; i < devTypeNum; i++ )
-					{
-						devTypeArr[i] = (*m_jpCldCmd)["tp"][i].as<uint8_t>();
-					}
-				}
-				if(devTypeArr != NULL && devTypeNum>0)
-				{
-					for( UC i = 0; i < devTypeNum; i++ )
-					{
-						strCmd += ":";
-						strCmd += String(*(devTypeArr+i));
-					}
+				rf_cmd_t lv_cmd = {};
+				lv_cmd.node = (UC)node_id;
+				lv_cmd.msgID = RF_CMD_SET_BR;
+				lv_cmd.subID = (UC)sub_id;
+				if( _cmd == CMD_BRIGHTNESS ) {
+					lv_cmd.br = constrain(value, 0, 100);
+				} else {
+					lv_cmd.msgID = RF_CMD_SET_CCT;
+					lv_cmd.cct = constrain(value, CT_MIN_VALUE, CT_MAX_VALUE);
 				}
-				return theRadio.ProcessSend(strCmd, 0, sub_id);
+				return SendLampCommand(lv_cmd);
 			}
 		}
 		//COMMAND 4: Change color with scenario input
 		else if (_cmd == CMD_SCENARIO) {
-			if ((*m_jpCldCmd).containsKey("nd") && (*m_jpCldCmd).containsKey("SNT_id")) {
-				const int node_id = (*m_jpCldCmd)["nd"].as<int>();
-				const int SNT_uid = (*m_jpCldCmd)["SNT_id"].as<int>();
+			if (hasNode && lv_fields[JC_SNT].found) {
 				return ChangeLampScenario((UC)node_id, (UC)SNT_uid, sub_id);
 			}
 		}
 		//COMMAND 6: Query Device Status
 		else if (_cmd == CMD_QUERY) {
-			if ((*m_jpCldCmd).containsKey("nd")) {
-				const int node_id = (*m_jpCldCmd)["nd"].as<int>();
-				if( (*m_jpCldCmd).containsKey("reset") ) {
-					if( (*m_jpCldCmd)["reset"].as<int>() == 1 ) {
+			if (hasNode) {
+				if( lv_fields[JC_RESET].found ) {
+					if( reset == 1 ) {
 						return RebootNode((uint8_t)node_id);
 					}
 				} else {
-					UC ring_id = RING_ID_ALL;
-					if( (*m_jpCldCmd).containsKey("Ring") ) {
-						ring_id = (UC)(*m_jpCldCmd)["Ring"].as<int>();
-						if( ring_id > MAX_RING_NUM ) ring_id = RING_ID_ALL;
-					}
-					return QueryDeviceStatus((UC)node_id, ring_id);
+					UC lv_ring = (UC)ring_id;
+					if( lv_ring > MAX_RING_NUM ) lv_ring = RING_ID_ALL;
+					return QueryDeviceStatus((UC)node_id, lv_ring);
 				}
 			}
 		}
 		//COMMAND 7: Special effect
 		else if (_cmd == CMD_EFFECT) {
-			if ((*m_jpCldCmd).containsKey("nd")) {
-				const int node_id = (*m_jpCldCmd)["nd"].as<int>();
-				const int filter_id = ((*m_jpCldCmd).containsKey("filter") ? (*m_jpCldCmd)["filter"].as<int>() : 0);
-				String strCmd = String::format("%d:17:%d", node_id, filter_id);
-				UC devTypeArr[32];
-				memset(devTypeArr,0x00,sizeof(devTypeArr));
-				UC devTypeNum = 0;
-				if( (*m_jpCldCmd).containsKey("tp") ) {
-					devTypeNum = (*m_jpCldCmd)["tp"].size();
-					for( UC i = 0; i < devTypeNum; i++ )
-					{
-						devTypeArr[i] = (*m_jpCldCmd)["tp"][i].as<uint8_t>();
-					}
-				}
-				if(devTypeArr != NULL && devTypeNum>0)
-				{
-					for( UC i = 0; i < devTypeNum; i++ )
-					{
-						strCmd += ":";
-						strCmd += String(*(devTypeArr+i));
-					}
-				}
-				return theRadio.ProcessSend(strCmd, 0, sub_id);
+			if (hasNode) {
+				rf_cmd_t lv_cmd = {};
+				lv_cmd.node = (UC)node_id;
+				lv_cmd.msgID = RF_CMD_EFFECT;
+				lv_cmd.subID = (UC)sub_id;
+				lv_cmd.filter = (UC)filter_id;
+				return theRadio.SendCommand(lv_cmd);
 			}
 		}
 		//COMMAND 8: Extended funcions of special node, e.g. Key Simulator (nd=129)
 		else if (_cmd == CMD_EXT) {
-			if ((*m_jpCldCmd).containsKey("nd") && (*m_jpCldCmd).containsKey("msg")) {
-				const int node_id = (*m_jpCldCmd)["nd"].as<int>();
-				const int msg_id = (*m_jpCldCmd)["msg"].as<int>();
-				const int ack_flag = ((*m_jpCldCmd).containsKey("ack") ? (*m_jpCldCmd)["ack"].as<int>() : 0);
-				const int tag = ((*m_jpCldCmd).containsKey("tag") ? (*m_jpCldCmd)["tag"].as<int>() : 0);
+			if (hasNode && lv_fields[JC_MSG].found) {
 				String strCmd;
-				if( (*m_jpCldCmd).containsKey("pl") ) {
-					String payl = (*m_jpCldCmd)["pl"].asString();
+				if( lv_fields[JC_PL].found ) {
 					// nd;Remote-node-id(Orig=0);Msg;Ack;Type;Payload\n
-					strCmd = String::format("%d;0;%d;%d;%d;%s", node_id, msg_id, ack_flag, tag, payl.c_str());
-					if( (*m_jpCldCmd).containsKey("tp") ) {
-						UC devTypeNum = (*m_jpCldCmd)["tp"].size();
-						for( UC i = 0; i < devTypeNum; i++ )
-						{
-							strCmd += ";";
-							strCmd += String((*m_jpCldCmd)["tp"][i].as<uint8_t>());
-						}
+					strCmd = String::format("%d;0;%d;%d;%d;%s", node_id, (int)msg_id, (int)ack_flag, (int)tag, payl);
+					for( UC i = 0; i < lv_fields[JC_TP].count; i++ )
+					{
+						strCmd += ";";
+						strCmd += String(devTypeArr[i]);
 					}
 					return theRadio.ProcessSend(strCmd, 0, sub_id);
-				} else if( (*m_jpCldCmd).containsKey("dt") ) {
+				} else if( lv_fields[JC_DT].found ) {
 					MyMessage tmpMsg;
-					UC payl_buf[MAX_PAYLOAD];
-					UC payl_len = min(MAX_PAYLOAD, (*m_jpCldCmd)["dt"].size());
-					for( UC i = 0; i < payl_len; i++ ) {
-						payl_buf[i] = (*m_jpCldCmd)["dt"][i].as<uint8_t>();
-					}
+					UC payl_len = (UC)lv_fields[JC_DT].count;
 					tmpMsg.build(theRadio.getAddress(), node_id, sub_id, msg_id, tag, (ack_flag == 1), (ack_flag == 2));
 					tmpMsg.set((void *)payl_buf, payl_len);
 					return theRadio.ProcessSend(&tmpMsg);
 				} else {
-					strCmd = String::format("%d;0;%d;%d;%d", node_id, msg_id, ack_flag, tag);
+					strCmd = String::format("%d;0;%d;%d;%d", node_id, (int)msg_id, (int)ack_flag, (int)tag);
 					return theRadio.ProcessSend(strCmd, 0, sub_id);
 				}
 			}
 		}
+		//COMMAND 9: Hourly sensor report, e.g. {'cmd':9,'nd':3,'sr':0,'hr':24} or with 'from' and 'to'
+		else if (_cmd == CMD_REPORT) {
+			if (hasNode && lv_fields[JC_SR].found) {
+				UL now = Time.now();
+				UL lv_to = (lv_fields[JC_TO].found ? (UL)to : now + 1);
+				UL lv_from;
+				if( lv_fields[JC_FROM].found ) {
+					lv_from = (UL)from;
+				} else {
+					lv_from = now - now % RLP_HOUR - (UL)hours * RLP_HOUR;
+				}
+				return theRollup.PublishReport((UC)node_id, (UC)sensor, lv_from, lv_to);
+			}
+		}
 	}
 
 	if( rc == 0 ) {
@@ -1346,30 +1342,67 @@ int SmartControllerClass::ExeJSONConfig(String jsonData) //future actions
 		return 1;
 	}
 
-  if (!(*m_jpCldCmd).containsKey("rows"))
+  jsr_span_t lv_data = {NULL, 0};
+  long lv_rows = 0, lv_tx = 0, lv_expected = 0;
+  jsr_field_t lv_fields[] = {
+    JSR_FIELD("rows", JSR_INT, 1, &lv_rows),
+    JSR_FIELD("data", JSR_SPAN, 1, &lv_data),
+    JSR_FIELD("tx", JSR_INT, 1, &lv_tx),
+    JSR_FIELD("n", JSR_INT, 1, &lv_expected)
+  };
+  if( !JsonReaderClass::Parse(m_pCldCmd, lv_fields, 4) ) {
+		LOGE(LOGTAG_MSG, "Error parsing json config message: %s", m_pCldCmd);
+		return 0;
+  }
+
+  // Bulk table upload: begin, rows are staged, commit or abort
+  if( lv_fields[2].found ) {
+		UC lv_rc = TXN_RC_OK;
+		if( lv_tx == TXN_BEGIN ) {
+			theTableTxn.Begin((UC)lv_expected);
+		} else if( lv_tx == TXN_COMMIT ) {
+			lv_rc = theTableTxn.Commit();
+		} else {
+			theTableTxn.Abort();
+		}
+		String strTemp = String::format("{'tx':%d,'rc':%d,'rows':%d", (int)lv_tx, lv_rc, theTableTxn.GetRows());
+		if( lv_rc == TXN_RC_APPLY ) {
+			// Not rolled back, tell what is in the tables now
+			char strFailed[PUBQ_MSG_SIZE / 2];
+			theTableTxn.PrintFailed(strFailed, sizeof(strFailed));
+			strTemp += String::format(",'applied':%d,'failed':[%s]", theTableTxn.GetApplied(), strFailed);
+		}
+		strTemp += "}";
+		PublishMsg(CLT_ID_DeviceConfig, strTemp.c_str(), strTemp.length());
+		return(lv_rc == TXN_RC_OK ? 1 : 0);
+  }
+
+  if (!lv_fields[0].found)
   {
     numRows = 1;
     bRowsKey = false;
   }
   else
   {
-    numRows = (*m_jpCldCmd)["rows"].as<int>();
+    numRows = (int)lv_rows;
   }
 
   int successCount = 0;
+  jsr_span_t lv_row;
   for (int j = 0; j < numRows; j++)
   {
 	  if (!bRowsKey)
 	  {
-		  if (ParseCmdRow(*m_jpCldCmd))
+		  lv_row.start = m_pCldCmd;
+		  lv_row.len = strlen(m_pCldCmd);
+		  if (ParseCmdRow(lv_row))
 		  {
 			  successCount++;
 		  }
 	  }
 	  else
 	  {
-		  JsonObject& data = (*m_jpCldCmd)["data"][j];
-		  if (ParseCmdRow(data))
+		  if (JsonReaderClass::GetElement(lv_data, j, lv_row) && ParseCmdRow(lv_row))
 		  {
 			  successCount++;
 		  }
@@ -1379,16 +1412,80 @@ int SmartControllerClass::ExeJSONConfig(String jsonData) //future actions
   return successCount;
 }
 
-bool SmartControllerClass::ParseCmdRow(JsonObject& data)
+bool SmartControllerClass::ParseCmdRow(const jsr_span_t &data)
 {
 	bool isSuccess = true;
-	OP_FLAG op_flag = (OP_FLAG)data["op"].as<int>();
-	FLASH_FLAG flash_flag = (FLASH_FLAG)data["fl"].as<int>();
-	RUN_FLAG run_flag = (RUN_FLAG)data["run"].as<int>();
+	// One table for the keys of every row class, read in one pass
+	enum { CR_OP, CR_FL, CR_RUN, CR_UID,
+		CR_NODE, CR_SCT, CR_SNT, CR_NOTIF, CR_TMR_INT, CR_TMR_SPAN, CR_COND0, CR_COND1,
+		CR_REPEAT, CR_WEEKDAYS, CR_HOUR, CR_MIN,
+		CR_SW, CR_FILTER, CR_RING0, CR_RING1, CR_RING2, CR_RING3,
+		CR_CSC, CR_LOOPKC, CR_KCTO, CR_HWSOBJ, CR_HWSW, CR_KM, CR_ND, CR_SID, CR_BTN, CR_ACT, CR_NEWID, CR_NCF, CR_VALUE,
+		CR_NUM };
+	long lv_op = 0, lv_fl = 0, lv_run = 0;
+	char uidWhole[8] = "";
+	// Rule
+	long node_uid = 0, SCT_uid = 255, SNT_uid = 255, notif_uid = 255, tmr_int = 0, tmr_span = 0;
+	long cond[MAX_CONDITION_PER_RULE][7];
+	// Schedule
+	long isRepeat = 0, weekdays = 0, hour = 0, minute = 0;
+	// Scenario
+	long sw = 0, filter = 0;
+	long ring[4][6];
+	// Configuration, CR_CSC to CR_NCF
+	long cfg[CR_VALUE - CR_CSC];
+	long value[NCF_LEN_DATA_FN_HUE];
+	memset(ring, 0x00, sizeof(ring));
+	memset(cfg, 0x00, sizeof(cfg));
+	memset(value, 0x00, sizeof(value));
+	jsr_field_t lv_fields[] = {
+		JSR_FIELD("op", JSR_INT, 1, &lv_op),
+		JSR_FIELD("fl", JSR_INT, 1, &lv_fl),
+		JSR_FIELD("run", JSR_INT, 1, &lv_run),
+		JSR_FIELD("uid", JSR_STR, sizeof(uidWhole), uidWhole),
+		JSR_FIELD("node_uid", JSR_INT, 1, &node_uid),
+		JSR_FIELD("SCT_uid", JSR_INT, 1, &SCT_uid),
+		JSR_FIELD("SNT_uid", JSR_INT, 1, &SNT_uid),
+		JSR_FIELD("notif_uid", JSR_INT, 1, &notif_uid),
+		JSR_FIELD("tmr_int", JSR_INT, 1, &tmr_int),
+		JSR_FIELD("tmr_span", JSR_INT, 1, &tmr_span),
+		JSR_FIELD("cond0", JSR_INTS, 7, cond[0]),
+		JSR_FIELD("cond1", JSR_INTS, 7, cond[1]),
+		JSR_FIELD("isRepeat", JSR_INT, 1, &isRepeat),
+		JSR_FIELD("weekdays", JSR_INT, 1, &weekdays),
+		JSR_FIELD("hour", JSR_INT, 1, &hour),
+		JSR_FIELD("min", JSR_INT, 1, &minute),
+		JSR_FIELD("sw", JSR_INT, 1, &sw),
+		JSR_FIELD("filter", JSR_INT, 1, &filter),
+		JSR_FIELD("ring0", JSR_INTS, 6, ring[0]),
+		JSR_FIELD("ring1", JSR_INTS, 6, ring[1]),
+		JSR_FIELD("ring2", JSR_INTS, 6, ring[2]),
+		JSR_FIELD("ring3", JSR_INTS, 6, ring[3]),
+		JSR_FIELD("csc", JSR_INT, 1, cfg + CR_CSC - CR_CSC),
+		JSR_FIELD("loopkc", JSR_INT, 1, cfg + CR_LOOPKC - CR_CSC),
+		JSR_FIELD("kcto", JSR_INT, 1, cfg + CR_KCTO - CR_CSC),
+		JSR_FIELD("hwsobj", JSR_INT, 1, cfg + CR_HWSOBJ - CR_CSC),
+		JSR_FIELD("hwsw", JSR_INT, 1, cfg + CR_HWSW - CR_CSC),
+		JSR_FIELD("km", JSR_INT, 1, cfg + CR_KM - CR_CSC),
+		JSR_FIELD("nd", JSR_INT, 1, cfg + CR_ND - CR_CSC),
+		JSR_FIELD("sid", JSR_INT, 1, cfg + CR_SID - CR_CSC),
+		JSR_FIELD("btn", JSR_INT, 1, cfg + CR_BTN - CR_CSC),
+		JSR_FIELD("act", JSR_INT, 1, cfg + CR_ACT - CR_CSC),
+		JSR_FIELD("new_id", JSR_INT, 1, cfg + CR_NEWID - CR_CSC),
+		JSR_FIELD("ncf", JSR_INT, 1, cfg + CR_NCF - CR_CSC),
+		JSR_FIELD("value", JSR_INTS, NCF_LEN_DATA_FN_HUE, value)
+	};
+	if( !JsonReaderClass::Parse(data, lv_fields, CR_NUM) ) {
+		LOGE(LOGTAG_MSG, "Error parsing row");
+		return 0;
+	}
+	OP_FLAG op_flag = (OP_FLAG)lv_op;
+	FLASH_FLAG flash_flag = (FLASH_FLAG)lv_fl;
+	RUN_FLAG run_flag = (RUN_FLAG)lv_run;
 
 	if (op_flag < GET || op_flag > DELETE)
 	{
-		LOGE(LOGTAG_MSG, "UID:%s Invalid HTTP command: %d", data["uid"], op_flag);
+		LOGE(LOGTAG_MSG, "UID:%s Invalid HTTP command: %d", uidWhole, op_flag);
 		return 0;
 	}
 
@@ -1396,23 +1493,26 @@ bool SmartControllerClass::ParseCmdRow(JsonObject& data)
 	{
 		if (flash_flag != UNSAVED)
 		{
-			LOGE(LOGTAG_MSG, "UID:%s Invalid FLASH_FLAG", data["uid"]);
+			LOGE(LOGTAG_MSG, "UID:%s Invalid FLASH_FLAG", uidWhole);
 			return 0;
 		}
 
 		if (run_flag != UNEXECUTED)
 		{
-			LOGE(LOGTAG_MSG, "UID:%s Invalid RUN_FLAG", data["uid"]);
+			LOGE(LOGTAG_MSG, "UID:%s Invalid RUN_FLAG", uidWhole);
 			return 0;
 		}
 	}
 
 	//grab first part of uid and store it in uidKey, and convert rest of uid string into int uidNum:
-	const char* uidWhole = data["uid"];
 	char uidKey = tolower(uidWhole[0]);
 	uint8_t uidNum = atoi(&uidWhole[1]);
 	UC _cond;
-	String sTemp;
+
+	// Read back working memory tables, uid 0 for all rows
+	if( op_flag == GET && (uidKey == CLS_RULE || uidKey == CLS_SCHEDULE || uidKey == CLS_SCENARIO) ) {
+		return(print_table(uidKey, JSW_SINK_CLOUD, uidNum) > 0 ? 1 : 0);
+	}
 
 	switch(uidKey)
 	{
@@ -1423,40 +1523,34 @@ bool SmartControllerClass::ParseCmdRow(JsonObject& data)
 			row.flash_flag = flash_flag;
 			row.run_flag = run_flag;
 			row.uid = uidNum;
-			row.node_id = data["node_uid"];
-			if( data.containsKey("SCT_uid") )
-				row.SCT_uid = data["SCT_uid"];
-			else row.SCT_uid = 255;
-			if( data.containsKey("SNT_uid") )
-				row.SNT_uid = data["SNT_uid"];
-			else row.SNT_uid = 255;
-			if( data.containsKey("notif_uid") )
-				row.notif_uid = data["notif_uid"];
-			else row.notif_uid = 255;
-			if( data.containsKey("tmr_int") )
-				row.tmr_int = data["tmr_int"];
-			else row.tmr_int = 0;
-			if( data.containsKey("tmr_span") )
-				row.tmr_span = data["tmr_span"];
-			else row.tmr_span = 0;
+			row.node_id = node_uid;
+			row.SCT_uid = SCT_uid;
+			row.SNT_uid = SNT_uid;
+			row.notif_uid = notif_uid;
+			row.tmr_int = tmr_int;
+			row.tmr_span = tmr_span;
 			row.tmr_started = 0;
 
 			// Get conditions
 			for( _cond = 0; _cond < MAX_CONDITION_PER_RULE; _cond++ ) {
-				sTemp = String::format("cond%d", _cond);
-				if( data.containsKey(sTemp) ) {
-					row.actCond[_cond].enabled = data[sTemp][0];
-					row.actCond[_cond].sr_scope = data[sTemp][1];
-					row.actCond[_cond].symbol = data[sTemp][2];
-					row.actCond[_cond].connector = data[sTemp][3];
-					row.actCond[_cond].sr_id = data[sTemp][4];
-					row.actCond[_cond].sr_value1 = data[sTemp][5];
-					row.actCond[_cond].sr_value2 = data[sTemp][6];
+				if( lv_fields[CR_COND0 + _cond].found ) {
+					// Missing items read as 0, like before
+					for( UC i = lv_fields[CR_COND0 + _cond].count; i < 7; i++ ) cond[_cond][i] = 0;
+					row.actCond[_cond].enabled = cond[_cond][0];
+					row.actCond[_cond].sr_scope = cond[_cond][1];
+					row.actCond[_cond].symbol = cond[_cond][2];
+					row.actCond[_cond].connector = cond[_cond][3];
+					row.actCond[_cond].sr_id = cond[_cond][4];
+					row.actCond[_cond].sr_value1 = cond[_cond][5];
+					row.actCond[_cond].sr_value2 = cond[_cond][6];
 				} else {
 					row.actCond[_cond].enabled = false;
 				}
 			}
 
+			// Staged until the transaction commits
+			if( theTableTxn.IsOpen() ) return theTableTxn.Stage(row);
+
 			isSuccess = Change_Rule(row);
 			if (!isSuccess)
 			{
@@ -1478,17 +1572,17 @@ bool SmartControllerClass::ParseCmdRow(JsonObject& data)
 			row.run_flag = run_flag;
 			row.uid = uidNum;
 
-			if (data["isRepeat"] == 1)
+			if (isRepeat == 1)
 			{
-				if (data["weekdays"] > 7)		// [0..7]
+				if (weekdays > 7)		// [0..7]
 				{
 					LOGE(LOGTAG_MSG, "UID:%s Invalid 'weekdays' must between 0 and 7", uidWhole);
 					return 0;
 				}
 			}
-			else if (data["isRepeat"] == 0)
+			else if (isRepeat == 0)
 			{
-				if (data["weekdays"] < 1 || data["weekdays"] > 7)		// [1..7]
+				if (weekdays < 1 || weekdays > 7)		// [1..7]
 				{
 					LOGE(LOGTAG_MSG, "UID:%s Invalid 'weekdays' must between 1 and 7", uidWhole);
 					return 0;
@@ -1500,24 +1594,27 @@ bool SmartControllerClass::ParseCmdRow(JsonObject& data)
 				return 0;
 			}
 
-			if (data["hour"] < 0 || data["hour"] > 23)
+			if (hour < 0 || hour > 23)
 			{
 				LOGE(LOGTAG_MSG, "UID:%s Invalid 'hour' must between 0 and 23", uidWhole);
 				return 0;
 			}
 
-			if (data["min"] < 0 || data["min"] > 59)
+			if (minute < 0 || minute > 59)
 			{
 				LOGE(LOGTAG_MSG, "UID:%s Invalid 'min' must between 0 and 59", uidWhole);
 				return 0;
 			}
 
-			row.weekdays = data["weekdays"];
-			row.isRepeat = data["isRepeat"];
-			row.hour = data["hour"];
-			row.minute = data["min"];
+			row.weekdays = weekdays;
+			row.isRepeat = isRepeat;
+			row.hour = hour;
+			row.minute = minute;
 			row.alarm_id = dtINVALID_ALARM_ID;
 
+			// Staged until the transaction commits
+			if( theTableTxn.IsOpen() ) return theTableTxn.Stage(row);
+
 			isSuccess = Change_Schedule(row);
 			if (!isSuccess)
 			{
@@ -1540,27 +1637,30 @@ bool SmartControllerClass::ParseCmdRow(JsonObject& data)
 			row.uid = uidNum;
 
 			// Power Switch
-			if( data.containsKey("sw") ) {
-				row.sw = data["sw"];
+			if( lv_fields[CR_SW].found ) {
+				row.sw = sw;
 			} else {
 				row.sw = DEVICE_SW_DUMMY;
 				// Copy JSON array to Hue
-				if( data.containsKey("ring0") ) {
-					Array2Hue(data["ring0"], row.ring[0]);
-					Array2Hue(data["ring0"], row.ring[1]);
-					Array2Hue(data["ring0"], row.ring[2]);
+				if( lv_fields[CR_RING0].found ) {
+					Array2Hue(ring[0], row.ring[0]);
+					Array2Hue(ring[0], row.ring[1]);
+					Array2Hue(ring[0], row.ring[2]);
 				} else {
-					if( data.containsKey("ring1") )
-						Array2Hue(data["ring0"], row.ring[0]);
-					if( data.containsKey("ring2") )
-						Array2Hue(data["ring2"], row.ring[1]);
-					if( data.containsKey("ring3") )
-						Array2Hue(data["ring3"], row.ring[2]);
+					if( lv_fields[CR_RING1].found )
+						Array2Hue(ring[1], row.ring[0]);
+					if( lv_fields[CR_RING2].found )
+						Array2Hue(ring[2], row.ring[1]);
+					if( lv_fields[CR_RING3].found )
+						Array2Hue(ring[3], row.ring[2]);
 				}
 			}
 
-			if( data.containsKey("filter") )
-				row.filter = data["filter"];
+			if( lv_fields[CR_FILTER].found )
+				row.filter = filter;
+
+			// Staged until the transaction commits
+			if( theTableTxn.IsOpen() ) return theTableTxn.Stage(row);
 
 			isSuccess = Change_Scenario(row);
 			if (!isSuccess)
@@ -1588,38 +1688,41 @@ bool SmartControllerClass::ParseCmdRow(JsonObject& data)
 		case CLS_CONFIGURATION:		// Sys Config
 		{
 			if( op_flag == PUT ) {
-				if( data.containsKey("csc") ) {
+				if( lv_fields[CR_CSC].found ) {
 					// Change CSC
-					theConfig.SetCloudSerialEnabled(data["csc"] > 0);
-				} else if( data.containsKey("loopkc") ) {
-					theSys.SetLoopKeyCode((UC)data["loopkc"].as<int>());
-				} else if( data.containsKey("kcto") ) {
-					theConfig.SetTimeLoopKC((UC)data["kcto"].as<int>());
-				} else if( data.containsKey("hwsobj") ) {
-					theConfig.SetRelayKeyObj((UC)data["hwsobj"].as<int>());
-				} else if( data.containsKey("hwsw") ) {
-					theConfig.SetHardwareSwitch(data["hwsw"] > 0);
-				} else if( data.containsKey("km") && data.containsKey("nd") ) {
-					theConfig.SetKeyMapItem((UC)data["km"], (UC)data["nd"], (UC)(data.containsKey("sid") ? data["sid"].as<int>() : 0));
-				} else if( data.containsKey("btn") && data.containsKey("op") && data.containsKey("act") && data.containsKey("km")) {
-					theConfig.SetExtBtnAction((UC)data["btn"], (UC)data["op"], (UC)data["act"], (UC)data["km"]);
-				} else if( data.containsKey("nd") ) {
-					UC node_id = (UC)data["nd"];
-					if( data.containsKey("new_id") ) {
-						UC new_id = (UC)data["new_id"];
-						String strCmd = String::format("%d:1:%d", node_id, new_id);
-						theRadio.ProcessSend(strCmd);
+					theConfig.SetCloudSerialEnabled(cfg[CR_CSC - CR_CSC] > 0);
+				} else if( lv_fields[CR_LOOPKC].found ) {
+					theSys.SetLoopKeyCode((UC)cfg[CR_LOOPKC - CR_CSC]);
+				} else if( lv_fields[CR_KCTO].found ) {
+					theConfig.SetTimeLoopKC((UC)cfg[CR_KCTO - CR_CSC]);
+				} else if( lv_fields[CR_HWSOBJ].found ) {
+					theConfig.SetRelayKeyObj((UC)cfg[CR_HWSOBJ - CR_CSC]);
+				} else if( lv_fields[CR_HWSW].found ) {
+					theConfig.SetHardwareSwitch(cfg[CR_HWSW - CR_CSC] > 0);
+				} else if( lv_fields[CR_KM].found && lv_fields[CR_ND].found ) {
+					theConfig.SetKeyMapItem((UC)cfg[CR_KM - CR_CSC], (UC)cfg[CR_ND - CR_CSC], (UC)cfg[CR_SID - CR_CSC]);
+				} else if( lv_fields[CR_BTN].found && lv_fields[CR_OP].found && lv_fields[CR_ACT].found && lv_fields[CR_KM].found) {
+					theConfig.SetExtBtnAction((UC)cfg[CR_BTN - CR_CSC], (UC)lv_op, (UC)cfg[CR_ACT - CR_CSC], (UC)cfg[CR_KM - CR_CSC]);
+				} else if( lv_fields[CR_ND].found ) {
+					UC node_id = (UC)cfg[CR_ND - CR_CSC];
+					if( lv_fields[CR_NEWID].found ) {
+						UC new_id = (UC)cfg[CR_NEWID - CR_CSC];
+						rf_cmd_t lv_cmd = {};
+						lv_cmd.node = node_id;
+						lv_cmd.msgID = RF_CMD_NODE_ID;
+						lv_cmd.newID = new_id;
+						theRadio.SendCommand(lv_cmd);
 						LOGN(LOGTAG_MSG, "Change nodeid:%d to %d", node_id, new_id);
-					} else if( data.containsKey("ncf") && data.containsKey("value") ) {
-						UC _config = (UC)data["ncf"];
+					} else if( lv_fields[CR_NCF].found && lv_fields[CR_VALUE].found ) {
+						UC _config = (UC)cfg[CR_NCF - CR_CSC];
 						if( _config == NCF_DATA_FN_HUE  ) {
 							UC lv_data[NCF_LEN_DATA_FN_HUE];
 							for( _cond = 0; _cond < NCF_LEN_DATA_FN_HUE; _cond++ ) {
-								lv_data[_cond] = data["value"][_cond];
+								lv_data[_cond] = (UC)value[_cond];
 							}
 							theRadio.SendNodeConfig(node_id, _config, lv_data, NCF_LEN_DATA_FN_HUE);
 						} else {
-							US _value = (US)data["value"];
+							US _value = (US)value[0];
 							if( _config == NCF_DEV_ASSOCIATE ) {
 								theConfig.SetRemoteNodeDevice(node_id, _value);
 							} else {
@@ -1709,6 +1812,8 @@ bool SmartControllerClass::Change_Rule(RuleRow_t row)
 			break;
 	}
 	theConfig.SetRTChanged(true);
+	// Move the alarm of the rule if it has one
+	theAlarmGraph.OnRuleChanged(row);
 	return true;
 }
 
@@ -1818,6 +1923,8 @@ bool SmartControllerClass::Change_Schedule(ScheduleRow_t row)
 			break;
 	}
 	theConfig.SetSCTChanged(true);
+	// Rebuild only the alarms of the rules on this schedule
+	theAlarmGraph.OnScheduleChanged(row);
 	return true;
 }
 
@@ -2049,7 +2156,48 @@ bool SmartControllerClass::ExecuteLightCommand(String mySerialStr)
 }
 */
 
-// Execute Rule, called by Action_Rule(), AlarmTimerTriggered() and OnSensorDataChanged()
+// Check one rule condition against the sensor store snapshot
+bool SmartControllerClass::Check_SensorData(UC _thisNd, UC _scope, UC _sr, UC _nd, UC _symbol, US _val1, US _val2)
+{
+	float lv_value;
+	BOOL bFound = false;
+	switch( _scope ) {
+	case SR_SCOPE_CONTROLLER:
+		bFound = m_sensors.GetValue(0, _sr, lv_value);
+		break;
+	case SR_SCOPE_NODE:
+		bFound = m_sensors.GetValue(_thisNd, _sr, lv_value);
+		break;
+	default:
+		// Any node: prefer the node just reported, otherwise the latest reading
+		bFound = m_sensors.GetValue(_nd, _sr, lv_value);
+		if( !bFound ) bFound = m_sensors.GetLatest(_sr, lv_value);
+		break;
+	}
+	if( !bFound ) return false;
+
+	switch( _symbol ) {
+	case SR_SYM_EQ:
+		return(lv_value == _val1);
+	case SR_SYM_NE:
+		return(lv_value != _val1);
+	case SR_SYM_GT:
+		return(lv_value > _val1);
+	case SR_SYM_GE:
+		return(lv_value >= _val1);
+	case SR_SYM_LT:
+		return(lv_value < _val1);
+	case SR_SYM_LE:
+		return(lv_value <= _val1);
+	case SR_SYM_BW:
+		return(lv_value >= _val1 && lv_value <= _val2);
+	case SR_SYM_NB:
+		return(lv_value < _val1 || lv_value > _val2);
+	}
+	return false;
+}
+
+// Execute Rule, called by Action_Rule(), theAlarmGraph and OnSensorDataChanged()
 bool SmartControllerClass::Execute_Rule(ListNode<RuleRow_t> *rulePtr, bool _init, const UC _sr, const UC _nd)
 {
 	// Whether execute
@@ -2098,8 +2246,8 @@ bool SmartControllerClass::Execute_Rule(ListNode<RuleRow_t> *rulePtr, bool _init
 
 		//if( _sr < 255 && _sr != rulePtr->data.actCond[_cond].sr_id ) continue;
 
-		/*bTest = Check_SensorData(rulePtr->data.node_id, rulePtr->data.actCond[_cond].sr_scope, rulePtr->data.actCond[_cond].sr_id, _nd,
-				rulePtr->data.actCond[_cond].symbol, rulePtr->data.actCond[_cond].sr_value1, rulePtr->data.actCond[_cond].sr_value2);*/
+		bTest = Check_SensorData(rulePtr->data.node_id, rulePtr->data.actCond[_cond].sr_scope, rulePtr->data.actCond[_cond].sr_id, _nd,
+				rulePtr->data.actCond[_cond].symbol, rulePtr->data.actCond[_cond].sr_value1, rulePtr->data.actCond[_cond].sr_value2);
 
 		if( _connector != COND_SYM_NOT ) {
 			if( _connector == COND_SYM_OR ) {
@@ -2163,6 +2311,12 @@ void SmartControllerClass::ReadNewRules(bool force)
 // Scan rule list and check conditions in accordance with changed sensor
 void SmartControllerClass::OnSensorDataChanged(const UC _sr, const UC _nd)
 {
+	// Keep the history for back-fill
+	float lv_value;
+	if( theOfflineStore.IsOffline() && m_sensors.GetValue(_nd, _sr, lv_value) ) {
+		theOfflineStore.AddSensor(_nd, _sr, lv_value);
+	}
+
 	ListNode<RuleRow_t> *ruleRowPtr = Rule_table.getRoot();
 	while (ruleRowPtr != NULL)
 	{
@@ -2172,70 +2326,6 @@ void SmartControllerClass::OnSensorDataChanged(const UC _sr, const UC _nd)
 	} //end of loop
 }
 
-bool SmartControllerClass::CreateAlarm(ListNode<ScheduleRow_t>* scheduleRow, uint32_t tag)
-{
-	//Use weekday, isRepeat, hour, min information to create appropriate alarm
-	//The created alarm obj must have a field for rule_id so it has a reference to what created it
-
-	//If isRepeat is 1 AND:
-		//if weekdays value is between 1 and 7, the alarm is to be repeated weekly on the specified weekday
-		//if weekdays value is 0, alarm is to be repeated daily
-	//if isRepeat is 0:
-		//alarm is to to be triggered on specified weekday; weekday cannot be 0.
-
-	AlarmId alarm_id;
-	if (scheduleRow->data.isRepeat == 1)
-	{
-		if (scheduleRow->data.weekdays > 0 && scheduleRow->data.weekdays <= 7) {
-			//repeat weekly on given weekday
-			alarm_id = Alarm.alarmRepeat((timeDayOfWeek_t)(int)scheduleRow->data.weekdays, (int)scheduleRow->data.hour, (int)scheduleRow->data.minute, 0, AlarmTimerTriggered);
-			Alarm.setAlarmTag(alarm_id, tag);
-		}
-		else if (scheduleRow->data.weekdays == 0)
-		{
-			//weekdays == 0 refers to daily repeat
-			time_t tmValue = AlarmHMS((int)scheduleRow->data.hour, (int)scheduleRow->data.minute, 0);
-			alarm_id = Alarm.alarmRepeat(tmValue, AlarmTimerTriggered);
-			Alarm.setAlarmTag(alarm_id, tag);
-		}
-		else
-		{
-			LOGN(LOGTAG_MSG, "Cannot create Alarm via UID:%c%d. Incorrect weekday value.", CLS_RULE, tag);
-			return false;
-		}
-	}
-	else if (scheduleRow->data.isRepeat == 0) {
-		alarm_id = Alarm.alarmOnce((timeDayOfWeek_t)(int)scheduleRow->data.weekdays, (int)scheduleRow->data.hour, (int)scheduleRow->data.minute, 0, AlarmTimerTriggered);
-		Alarm.setAlarmTag(alarm_id, tag);
-	}
-	else {
-		LOGN(LOGTAG_MSG, "Cannot create Alarm via UID:%c%d. Incorrect isRepeat value.", CLS_RULE, tag);
-		return false;
-	}
-	//Update that schedule row's alarm_id field with the newly created alarm's alarm_id
-	scheduleRow->data.alarm_id = alarm_id;
-	LOGI(LOGTAG_MSG, "Alarm %u created via UID:%c%d", alarm_id, CLS_RULE, tag);
-	LOGD(LOGTAG_MSG, "Alarm %u creation info:", alarm_id);
-	LOGD(LOGTAG_MSG, "-----weekday %d", (int)scheduleRow->data.weekdays);
-	LOGD(LOGTAG_MSG, "-----hour %d", (int)scheduleRow->data.hour);
-	LOGD(LOGTAG_MSG, "-----min %d", (int)scheduleRow->data.minute);
-
-	return true;
-}
-
-bool SmartControllerClass::DestoryAlarm(AlarmId alarmID, UC SCT_uid)
-{
-	if(!Alarm.isAllocated(alarmID))
-		return false;
-
-	Alarm.disable(alarmID);
-	Alarm.free(alarmID);
-	LOGN(LOGTAG_MSG, "Destory alarm via UID:%c%d", CLS_SCHEDULE, SCT_uid);
-
-	return true;
-	//Note: Remember to always follow up this function call with setting the AlarmID to dtINVALID_ALARM_ID
-}
-
 bool SmartControllerClass::Action_Rule(ListNode<RuleRow_t> *rulePtr)
 {
 	if(!rulePtr)
@@ -2271,49 +2361,13 @@ bool SmartControllerClass::Action_Schedule(OP_FLAG parentFlag, UC uid, UC rule_u
 	ListNode<ScheduleRow_t> *scheduleRow = SearchSchedule(uid);
 	if (scheduleRow) //found schedule row in chain or Flash
 	{
-		if (scheduleRow->data.run_flag == UNEXECUTED)
-		{
-			switch(scheduleRow->data.op_flag)
-			{
-			case POST:
-			case PUT:
-				if(parentFlag == POST || parentFlag == PUT)
-				{
-					// Recreate Alarm
-					DestoryAlarm(scheduleRow->data.alarm_id, uid);
-					scheduleRow->data.alarm_id = dtINVALID_ALARM_ID;
-					CreateAlarm(scheduleRow, rule_uid);
-				}
-				break;
-
-			case DELETE:
-				// Delete Alarm
-				LOGI(LOGTAG_MSG, "Found to be deleted object UID:%c%d", CLS_SCHEDULE, uid);
-				DestoryAlarm(scheduleRow->data.alarm_id, uid);
-				scheduleRow->data.alarm_id = dtINVALID_ALARM_ID;
-				break;
-
-			case GET:			// ToDo:...
-					break;
-			}
-		}
-		else	// EXECUTED, double check
-		{
-			if(parentFlag != DELETE && parentFlag != GET && scheduleRow->data.op_flag != DELETE)
-			{
-				// The alarm is supposed to exist, otherwise create it
-				if (!Alarm.isAllocated(scheduleRow->data.alarm_id))
-				{
-					CreateAlarm(scheduleRow, rule_uid);
-				}
-			}
-		}
-
-		// Parent Flag Special Check
-		if( parentFlag == DELETE ) {
-			// Destory Alarm if exists
-			DestoryAlarm(scheduleRow->data.alarm_id, uid);
-			scheduleRow->data.alarm_id = dtINVALID_ALARM_ID;
+		if( parentFlag == DELETE || scheduleRow->data.op_flag == DELETE ) {
+			// The rule leaves the alarm, which is freed with its last rule
+			LOGI(LOGTAG_MSG, "UID:%c%d leaves UID:%c%d", CLS_RULE, rule_uid, CLS_SCHEDULE, uid);
+			theAlarmGraph.Detach(rule_uid);
+		} else if( parentFlag != GET ) {
+			// Share the alarm of the same trigger, or create one
+			scheduleRow->data.alarm_id = theAlarmGraph.Attach(rule_uid, scheduleRow->data);
 		}
 
 		// Set flag anyway
@@ -2383,7 +2437,7 @@ ListNode<ScenarioRow_t>* SmartControllerClass::SearchScenario(UC uid)
 		if (uid < MAX_SNT_ROWS)
 		{
 			//find it
-			theConfig.MemReadScenarioRow(row, MEM_SCENARIOS_OFFSET + uid*SNT_ROW_SIZE);
+			theConfig.MemReadScenarioRow(row, uid*SNT_ROW_SIZE);
 
 			//flags should be 111
 			if (row.uid == uid && row.op_flag == (OP_FLAG)1
@@ -2449,38 +2503,33 @@ ListNode<DevStatusRow_t> *SmartControllerClass::FindDevice(UC _nodeID)
 	return DevStatusRowPtr;
 }
 
+// Nodes that missed the keepalive go offline, published in one message
 void SmartControllerClass::CheckDevTimeout()
 {
-	bool bHasTimeout = false;
-	StaticJsonBuffer<256> jsonBuffer;
-
-	JsonObject& root = jsonBuffer.createObject();
-	root["up"] = 0;
+	UC lv_nids[MAX_NODE_PER_CONTROLLER];
+	UC lv_num = m_liveness.Tick(lv_nids, MAX_NODE_PER_CONTROLLER);
+	if( lv_num == 0 ) return;
 
-	JsonArray& arrnd = root.createNestedArray("nd");
-
-	for(uint8_t i = 0;i<theConfig.lstNodes.count();i++)
-  {
-		NodeIdRow_t lv_Node = theConfig.lstNodes._pItems[i];
-		if( Time.now() - lv_Node.recentActive > RTE_TM_KEEP_ALIVE ) {
-			bHasTimeout = true;
-			arrnd.add(lv_Node.nid);
-			if(IS_LAMP_NODEID(lv_Node.nid))
-			{
-				ListNode<DevStatusRow_t> *DevStatusRowPtr = SearchDevStatus(lv_Node.nid);
-				if(DevStatusRowPtr != NULL)
-          ConfirmLampPresent(DevStatusRowPtr, false);
-			}
+	char msg[PUBQ_MSG_SIZE];
+	int nPos = snprintf(msg, sizeof(msg), "{'up':0,'nd':[");
+	UC lv_count = 0;
+	NodeIdRow_t lv_Node;
+	for( UC i = 0; i < lv_num; i++ ) {
+		// Cleared meanwhile, or sleeps between uplinks
+		lv_Node.nid = lv_nids[i];
+		if( theConfig.lstNodes.get(&lv_Node) < 0 ) continue;
+		if( theRadio.GetNodePower(lv_Node.nid) & RF_NODE_SLEEPY ) continue;
+		if( IS_LAMP_NODEID(lv_Node.nid) ) {
+			ListNode<DevStatusRow_t> *DevStatusRowPtr = SearchDevStatus(lv_Node.nid);
+			if( DevStatusRowPtr ) ConfirmLampPresent(DevStatusRowPtr, false);
 		}
+		nPos += snprintf(msg + nPos, sizeof(msg) - nPos, "%s%d", (lv_count++ > 0 ? "," : ""), lv_Node.nid);
+		if( theOfflineStore.IsOffline() ) theOfflineStore.AddPresence(lv_Node.nid, false);
 	}
-	if(bHasTimeout)
-	{
-		char msg[256];
-		memset(msg,0x00,sizeof(msg));
-		root.printTo(msg,256);
-		String strTemp = msg;
-		PublishMsg(CLT_ID_DeviceStatus,strTemp.c_str(),strTemp.length());
-	}
+	if( lv_count == 0 ) return;
+	nPos += snprintf(msg + nPos, sizeof(msg) - nPos, "]}");
+	LOGN(LOGTAG_EVENT, "%d nodes went offline", lv_count);
+	PublishMsg(CLT_ID_DeviceStatus, msg, nPos);
 }
 
 UC SmartControllerClass::GetDevOnOff(UC _nodeID)
@@ -2571,6 +2620,27 @@ ListNode<DevStatusRow_t>* SmartControllerClass::UpdateNodeList(UC _nodeID, UC _s
 	theConfig.lstNodes.add(&lv_Node);
 	theConfig.SetNIDChanged(true);
 
+	// Same identity under another nid: the node was re-paired
+	UC lv_oldNid = (_identity != 0 ? theConfig.lstNodes.findIdentity(_identity, _nodeID) : 0);
+	if( lv_oldNid != 0 ) {
+		LOGN(LOGTAG_EVENT, "Node:%d re-paired as node:%d", lv_oldNid, _nodeID);
+		NodeIdRow_t lv_Old;
+		lv_Old.nid = lv_oldNid;
+		if( theConfig.lstNodes.get(&lv_Old) >= 0 && lv_Node.device == 0 && lv_Old.device != 0 ) {
+			lv_Node.device = lv_Old.device;
+			theConfig.lstNodes.update(&lv_Node);
+		}
+		// Remotes follow the lamp to its new nid
+		UC lv_nids[MAX_NODE_PER_CONTROLLER];
+		UC lv_num = theConfig.lstNodes.findDevice(lv_oldNid, lv_nids, MAX_NODE_PER_CONTROLLER);
+		for( UC i = 0; i < lv_num; i++ ) {
+			theConfig.SetRemoteNodeDevice(lv_nids[i], _nodeID);
+		}
+		theConfig.lstNodes.clearNodeId(lv_oldNid);
+		m_shadow.Remove(lv_oldNid);
+		theStatusFeed.Remove(lv_oldNid);
+	}
+
   if(IS_REMOTE_NODEID(_nodeID)){
 		// TODO Remote
 		theConfig.m_stMainRemote.node_id = _nodeID;
@@ -2636,8 +2706,12 @@ BOOL SmartControllerClass::ChangeLampBrightness(UC _nodeID, UC _percentage, cons
 	BOOL rc = false;
 	//ListNode<DevStatusRow_t> *DevStatusRowPtr = SearchDevStatus(_nodeID);
 	//if (!DevStatusRowPtr) {
-		String strCmd = String::format("%d:9:%d", _nodeID, _percentage);
-		rc = theRadio.ProcessSend(strCmd, 0, subID);
+		rf_cmd_t lv_cmd = {};
+		lv_cmd.node = _nodeID;
+		lv_cmd.msgID = RF_CMD_SET_BR;
+		lv_cmd.subID = subID;
+		lv_cmd.br = _percentage;
+		rc = SendLampCommand(lv_cmd);
 	//}
 	return rc;
 }
@@ -2645,15 +2719,24 @@ BOOL SmartControllerClass::ChangeLampBrightness(UC _nodeID, UC _percentage, cons
 BOOL SmartControllerClass::ChangeLampCCT(UC _nodeID, US _cct, const UC subID)
 {
 	BOOL rc = false;
-	String strCmd = String::format("%d:11:%d", _nodeID, _cct);
-	rc = theRadio.ProcessSend(strCmd, 0, subID);
+	rf_cmd_t lv_cmd = {};
+	lv_cmd.node = _nodeID;
+	lv_cmd.msgID = RF_CMD_SET_CCT;
+	lv_cmd.subID = subID;
+	lv_cmd.cct = _cct;
+	rc = SendLampCommand(lv_cmd);
 	return rc;
 }
 
 BOOL SmartControllerClass::ChangeBR_CCT(UC _nodeID, UC _br, US _cct, const UC subID)
 {
-	String strCmd = String::format("%d:13:%d:%d", _nodeID, _br, _cct);
-	return theRadio.ProcessSend(strCmd, 0, subID);
+	rf_cmd_t lv_cmd = {};
+	lv_cmd.node = _nodeID;
+	lv_cmd.msgID = RF_CMD_SET_STATUS;
+	lv_cmd.subID = subID;
+	lv_cmd.status.br = _br;
+	lv_cmd.status.cct = _cct;
+	return SendLampCommand(lv_cmd);
 }
 
 BOOL SmartControllerClass::ChangeLampScenario(UC _nodeID, UC _scenarioID, UC _replyTo, const UC _sensor)
@@ -2672,43 +2755,74 @@ BOOL SmartControllerClass::ChangeLampScenario(UC _nodeID, UC _scenarioID, UC _re
 		if (rowptr)
 		{
 			_findIt = true;
-			String strCmd;
+			rf_cmd_t lv_cmd = {};
+			lv_cmd.node = _nodeID;
+			lv_cmd.msgID = RF_CMD_SET_POWER;
+			lv_cmd.subID = _sensor;
+			lv_cmd.replyTo = _replyTo;
 			if( rowptr->data.sw != DEVICE_SW_DUMMY ) {
-				strCmd = String::format("%d:7:%d", _nodeID, rowptr->data.sw);
-				theRadio.ProcessSend(strCmd, _replyTo, _sensor);
+				lv_cmd.sw = rowptr->data.sw;
+				SendLampCommand(lv_cmd);
 			} else {
 				UC lv_type = devtypCRing3;
 				if( DevStatusRowPtr ) lv_type = DevStatusRowPtr->data.type;
 				if(IS_SUNNY(lv_type)) {
 					if( rowptr->data.ring[0].State == DEVICE_SW_OFF ) {
-						strCmd = String::format("%d:7:0", _nodeID);
+						lv_cmd.sw = DEVICE_SW_OFF;
 					} else {
-						strCmd = String::format("%d:13:%d:%d", _nodeID, rowptr->data.ring[0].BR, rowptr->data.ring[0].CCT);
+						lv_cmd.msgID = RF_CMD_SET_STATUS;
+						lv_cmd.status.br = rowptr->data.ring[0].BR;
+						lv_cmd.status.cct = rowptr->data.ring[0].CCT;
 					}
-					theRadio.ProcessSend(strCmd, _replyTo, _sensor);
+					SendLampCommand(lv_cmd);
 				} else { // Rainbow and Migrage
 					MyMessage tmpMsg;
-					UC payl_buf[MAX_PAYLOAD];
-					UC payl_len;
+					UC payl_buf[SCN_MAX_PACKED_LEN > MAX_PAYLOAD ? SCN_MAX_PACKED_LEN : MAX_PAYLOAD];
+					UC payl_len = 0;
+					Hue_t lv_rings[MAX_RING_NUM];
 
 					// All rings same settings
 					bool bAllRings = (rowptr->data.ring[1].CCT == 256);
-
 					for( UC idx = 0; idx < MAX_RING_NUM; idx++ ) {
-						if( !bAllRings || idx == 0 ) {
-							payl_len = CreateColorPayload(payl_buf, bAllRings ? RING_ID_ALL : idx + 1, rowptr->data.ring[idx].State,
-													rowptr->data.ring[idx].BR, rowptr->data.ring[idx].CCT % 256, rowptr->data.ring[idx].R, rowptr->data.ring[idx].G, rowptr->data.ring[idx].B);
-							tmpMsg.build(_replyTo, _nodeID, _sensor, C_SET, V_RGBW, true);
-							tmpMsg.set((void *)payl_buf, payl_len);
-							theRadio.ProcessSend(&tmpMsg);
+						lv_rings[idx] = rowptr->data.ring[bAllRings ? 0 : idx];
+					}
+					// All rings in one frame, only the fields a single lamp doesn't have yet.
+					// The delta is taken only against rings the lamp reported since the last scene,
+					// the stored row may be stale or never reported; groups and broadcast get all fields
+					const Hue_t *pKnown = NULL;
+					if( DevStatusRowPtr && IS_LAMP_NODEID(_nodeID) ) {
+						bool bConfirmed = true;
+						for( UC idx = 0; idx < MAX_RING_NUM; idx++ ) {
+							if( !(m_hueConfirmed[idx] & (1UL << _nodeID)) ) bConfirmed = false;
+							// Lamp state is unknown until it reports the new scene back
+							m_hueConfirmed[idx] &= ~(1UL << _nodeID);
 						}
-						if( IS_MIRAGE(lv_type) ) {
-							// ToDo: construct mirage message
-							//tmpMsg.build(_replyTo, _nodeID, _sensor, C_SET, V_DISTANCE, true);
-							//tmpMsg.set((void *)payl_buf, payl_len);
-							//theRadio.ProcessSend(&tmpMsg);
+						if( bConfirmed ) pKnown = DevStatusRowPtr->data.ring;
+					}
+					if( IsPackedScene(_nodeID) ) {
+						payl_len = CreateScenePayload(payl_buf, lv_rings, pKnown);
+						tmpMsg.build(_replyTo, _nodeID, _sensor, C_SET, V_RGBW, true);
+						tmpMsg.set((void *)payl_buf, payl_len);
+						theRadio.ProcessSend(&tmpMsg);
+					} else {
+						// Legacy lamps parse V_RGBW as one ring: [ring, State, BR, W, R, G, B]
+						for( UC idx = 0; idx < MAX_RING_NUM; idx++ ) {
+							if( !bAllRings || idx == 0 ) {
+								payl_len = CreateColorPayload(payl_buf, bAllRings ? RING_ID_ALL : idx + 1, lv_rings[idx].State,
+										lv_rings[idx].BR, lv_rings[idx].CCT % 256, lv_rings[idx].R, lv_rings[idx].G, lv_rings[idx].B);
+								tmpMsg.build(_replyTo, _nodeID, _sensor, C_SET, V_RGBW, true);
+								tmpMsg.set((void *)payl_buf, payl_len);
+								theRadio.ProcessSend(&tmpMsg);
+							}
 						}
 					}
+
+					if( IS_MIRAGE(lv_type) ) {
+						// ToDo: construct mirage message
+						//tmpMsg.build(_replyTo, _nodeID, _sensor, C_SET, V_DISTANCE, true);
+						//tmpMsg.set((void *)payl_buf, payl_len);
+						//theRadio.ProcessSend(&tmpMsg);
+					}
 				}
 			}
 			rowptr->data.run_flag = EXECUTED;
@@ -2730,8 +2844,11 @@ BOOL SmartControllerClass::ChangeLampScenario(UC _nodeID, UC _scenarioID, UC _re
 BOOL SmartControllerClass::RequestDeviceStatus(UC _nodeID, const UC subID)
 {
 	BOOL rc = false;
-	String strCmd = String::format("%d:12:%d", _nodeID);
-	rc = theRadio.ProcessSend(strCmd, 0, subID);
+	rf_cmd_t lv_cmd = {};
+	lv_cmd.node = _nodeID;
+	lv_cmd.msgID = RF_CMD_GET_STATUS;
+	lv_cmd.subID = subID;
+	rc = theRadio.SendCommand(lv_cmd);
 	return rc;
 }
 
@@ -2739,20 +2856,24 @@ BOOL SmartControllerClass::ConfirmLampSunnyStatus(UC _nodeID,UC _sid, UC _st, UC
 {
 	BOOL rc = false;
 	UC r_index = (_ringID == RING_ID_ALL ? 0 : _ringID - 1);
+	if( _sid == 0 && r_index == 0 ) m_shadow.Report(_nodeID, SHD_FLD_ALL, _st, _percentage, _cct);
 	ListNode<DevStatusRow_t> *DevStatusRowPtr = UpdateNodeList(_nodeID,_sid);
 	if (DevStatusRowPtr) {
 		if( DevStatusRowPtr->data.ring[r_index].State != _st || DevStatusRowPtr->data.ring[r_index].BR != _percentage || \
-		    DevStatusRowPtr->data.ring[r_index].CCT != _cct) {
+		    DevStatusRowPtr->data.ring[r_index].CCT != _cct || DevStatusRowPtr->data.filter != (_filter & 0x0F)) {
 			//LOGW(LOGTAG_MSG, "set node:%d st:%d,br:%d", _nodeID, _st,_percentage);
 			DevStatusRowPtr->data.present = 1;
+			DevStatusRowPtr->data.filter = _filter;
 			DevStatusRowPtr->data.ring[r_index].State = _st;
 			DevStatusRowPtr->data.ring[r_index].BR = _percentage;
 			DevStatusRowPtr->data.ring[r_index].CCT = _cct;
 			if( _ringID == RING_ID_ALL ) {
 				DevStatusRowPtr->data.ring[1].State = _st;
 				DevStatusRowPtr->data.ring[1].BR = _percentage;
+				DevStatusRowPtr->data.ring[1].CCT = _cct;
 				DevStatusRowPtr->data.ring[2].State = _st;
 				DevStatusRowPtr->data.ring[2].BR = _percentage;
+				DevStatusRowPtr->data.ring[2].CCT = _cct;
 			}
 			DevStatusRowPtr->data.run_flag = EXECUTED;
 			DevStatusRowPtr->data.flash_flag = UNSAVED;
@@ -2768,22 +2889,11 @@ BOOL SmartControllerClass::ConfirmLampSunnyStatus(UC _nodeID,UC _sid, UC _st, UC
 					thePanel.SetOnOff(_st);
 				}
 			}
+			// Publish device status change
+			theStatusFeed.Changed(_nodeID, _sid);
 			rc = true;
 		}
 	}
-	//if(rc)
-	//{
-		// Publish device status event
-		String strTemp;
-		if( _ringID != RING_ID_ALL ) {
-			strTemp = String::format("{'nd':%d,'sid':%d,'Ring':%d,'State':%d,'BR':%d,'CCT':%d,'filter':%d}",
-									 _nodeID,_sid, _ringID, _st, _percentage,_cct,_filter);
-		} else {
-			strTemp = String::format("{'nd':%d,'sid':%d,'State':%d,'BR':%d,'CCT':%d,'filter':%d}",
-									 _nodeID,_sid,  _st, _percentage,_cct,_filter);
-		}
-		PublishMsg(CLT_ID_DeviceStatus,strTemp.c_str(),strTemp.length(),_nodeID,1);
-  //}
 	return rc;
 }
 
@@ -2791,6 +2901,7 @@ BOOL SmartControllerClass::ConfirmLampOnOff(UC _nodeID,UC _sid, UC _st)
 {
 	BOOL rc = false;
 	//m_pMainDev->data.ring[0].State = _st;
+	if( _sid == 0 ) m_shadow.Report(_nodeID, SHD_FLD_SW, _st);
 	ListNode<DevStatusRow_t> *DevStatusRowPtr = SearchDevStatus(_nodeID);
 	if (DevStatusRowPtr) {
 		DevStatusRowPtr->data.present = 1;
@@ -2807,9 +2918,8 @@ BOOL SmartControllerClass::ConfirmLampOnOff(UC _nodeID,UC _sid, UC _st)
 			thePanel.SetOnOff(_st);
 		}
 
-		// Publish device status event
-		String strTemp = String::format("{'nd':%d,'sid':%d,'State':%d}", _nodeID,_sid, _st);
-		PublishMsg(CLT_ID_DeviceStatus,strTemp.c_str(),strTemp.length(),_nodeID);
+		// Publish device status change
+		theStatusFeed.Changed(_nodeID, _sid);
 		rc = true;
 	}
 	return rc;
@@ -2821,6 +2931,7 @@ BOOL SmartControllerClass::ConfirmLampBrightness(UC _nodeID,UC _sid, UC _st, UC
 	BOOL rc = false;
 	UC r_index = (_ringID == RING_ID_ALL ? 0 : _ringID - 1);
 	//m_pMainDev->data.ring[0].BR = _percentage;
+	if( _sid == 0 && r_index == 0 ) m_shadow.Report(_nodeID, SHD_FLD_SW | SHD_FLD_BR, _st, _percentage);
 	ListNode<DevStatusRow_t> *DevStatusRowPtr = UpdateNodeList(_nodeID,_sid);
 	if (DevStatusRowPtr) {
 		if( DevStatusRowPtr->data.ring[r_index].State != _st || DevStatusRowPtr->data.ring[r_index].BR != _percentage ) {
@@ -2848,16 +2959,8 @@ BOOL SmartControllerClass::ConfirmLampBrightness(UC _nodeID,UC _sid, UC _st, UC
 				}
 			}
 
-			// Publish device status event
-			String strTemp;
-			if( _ringID != RING_ID_ALL ) {
-				strTemp = String::format("{'nd':%d,'sid':%d,'Ring':%d,'State':%d,'BR':%d}",
-					_nodeID,_sid, _ringID, _st, _percentage);
-			} else {
-			 	strTemp = String::format("{'nd':%d,'sid':%d,'State':%d,'BR':%d}",
-					_nodeID,_sid,  _st, _percentage);
-			}
-			PublishMsg(CLT_ID_DeviceStatus,strTemp.c_str(),strTemp.length(),_nodeID);
+			// Publish device status change
+			theStatusFeed.Changed(_nodeID, _sid);
 			rc = true;
 		}
 	}
@@ -2869,6 +2972,7 @@ BOOL SmartControllerClass::ConfirmLampCCT(UC _nodeID,UC _sid, US _cct, UC _ringI
 	BOOL rc = false;
 	UC r_index = (_ringID == RING_ID_ALL ? 0 : _ringID - 1);
 	//m_pMainDev->data.ring[0].CCT = _cct;
+	if( _sid == 0 && r_index == 0 ) m_shadow.Report(_nodeID, SHD_FLD_CCT, 0, 0, _cct);
 	ListNode<DevStatusRow_t> *DevStatusRowPtr = UpdateNodeList(_nodeID,_sid);
 	if (DevStatusRowPtr) {
 		if( DevStatusRowPtr->data.ring[r_index].CCT != _cct ) {
@@ -2891,14 +2995,8 @@ BOOL SmartControllerClass::ConfirmLampCCT(UC _nodeID,UC _sid, US _cct, UC _ringI
 				}
 			}
 
-			// Publish device status event
-			String strTemp;
-			if( _ringID != RING_ID_ALL ) {
-				strTemp = String::format("{'nd':%d,'sid':%d,'Ring':%d,'CCT':%d}", _nodeID,_sid, _ringID, _cct);
-			} else {
-			 	strTemp = String::format("{'nd':%d,'sid':%d,'CCT':%d}", _nodeID,_sid, _cct);
-			}
-			PublishMsg(CLT_ID_DeviceStatus,strTemp.c_str(),strTemp.length(),_nodeID);
+			// Publish device status change
+			theStatusFeed.Changed(_nodeID, _sid);
 			rc = true;
 		}
 	}
@@ -2911,6 +3009,12 @@ BOOL SmartControllerClass::ConfirmLampHue(UC _nodeID,UC _sid, UC _white, UC _red
 	UC r_index = (_ringID == RING_ID_ALL ? 0 : _ringID - 1);
 	ListNode<DevStatusRow_t> *DevStatusRowPtr = UpdateNodeList(_nodeID,_sid);
 	if (DevStatusRowPtr) {
+		// Reported by the lamp itself, scene deltas may be taken against it
+		if( IS_LAMP_NODEID(_nodeID) && r_index < MAX_RING_NUM ) {
+			for( UC idx = 0; idx < MAX_RING_NUM; idx++ ) {
+				if( _ringID == RING_ID_ALL || idx == r_index ) m_hueConfirmed[idx] |= (1UL << _nodeID);
+			}
+		}
 		if( (DevStatusRowPtr->data.ring[r_index].CCT % 256) != _white ||
 		    DevStatusRowPtr->data.ring[r_index].R != _red ||
 			  DevStatusRowPtr->data.ring[r_index].G != _green ||
@@ -2935,16 +3039,8 @@ BOOL SmartControllerClass::ConfirmLampHue(UC _nodeID,UC _sid, UC _white, UC _red
 			DevStatusRowPtr->data.op_flag = POST;
 			theConfig.SetDSTChanged(true);
 
-			// Publish device status event
-			String strTemp;
-			if( _ringID != RING_ID_ALL ) {
-				strTemp = String::format("{'nd':%d,'sid':%d,'Ring':%d,'W':%d,'R':%d,'G':%d,'B':%d}",
-				  _nodeID,_sid, _ringID, _white, _red, _green, _blue);
-			} else {
-			 	strTemp = String::format("{'nd':%d,'sid':%d,'W':%d,'R':%d,'G':%d,'B':%d}",
-				  _nodeID,_sid, _white, _red, _green, _blue);
-			}
-			PublishMsg(CLT_ID_DeviceStatus,strTemp.c_str(),strTemp.length(),_nodeID);
+			// Publish device status change
+			theStatusFeed.Changed(_nodeID, _sid);
 			rc = true;
 		}
 	}
@@ -3036,9 +3132,8 @@ BOOL SmartControllerClass::ConfirmLampFilter(UC _nodeID,UC _sid, UC _filter)
 			DevStatusRowPtr->data.op_flag = POST;
 			theConfig.SetDSTChanged(true);
 
-			// Publish device status event
-			String strTemp = String::format("{'nd':%d,'sid':%d,'filter':%d}", _nodeID,_sid, _filter);
-			PublishMsg(CLT_ID_DeviceStatus,strTemp.c_str(),strTemp.length(),_nodeID);
+			// Publish device status change
+			theStatusFeed.Changed(_nodeID, _sid);
 			return true;
 		}
 	}
@@ -3087,6 +3182,7 @@ BOOL SmartControllerClass::ConfirmLampPresent(ListNode<DevStatusRow_t> *pDev, bo
 			if(_up)
 			{
 				PublishMsg(CLT_ID_DeviceStatus,strTemp.c_str(),strTemp.length(),pDev->data.node_id);
+				if( theOfflineStore.IsOffline() ) theOfflineStore.AddPresence(pDev->data.node_id, true);
 			}
 			return true;
 		}
@@ -3149,8 +3245,11 @@ BOOL SmartControllerClass::QueryDeviceStatus(UC _nodeID, UC _ringID)
 
 BOOL SmartControllerClass::RebootNode(UC _nodeID, const UC subID)
 {
-	String strCmd = String::format("%d:1", _nodeID);
-	return theRadio.ProcessSend(strCmd, 0, subID);
+	rf_cmd_t lv_cmd = {};
+	lv_cmd.node = _nodeID;
+	lv_cmd.msgID = RF_CMD_NODE_ID;
+	lv_cmd.subID = subID;
+	return theRadio.SendCommand(lv_cmd);
 }
 
 BOOL SmartControllerClass::IsAllRingHueSame(ListNode<DevStatusRow_t> *pDev)
@@ -3171,170 +3270,193 @@ BOOL SmartControllerClass::IsAllRingHueSame(ListNode<DevStatusRow_t> *pDev)
 	}
 	return true;
 }
-//------------------------------------------------------------------
-// Printing tables/working memory chains
-//------------------------------------------------------------------
-String SmartControllerClass::print_devStatus_table(int row)
-{
-	String strShortDesc = "";
-	if( DevStatus_table.get(row).node_id == 0 ) return(strShortDesc);
-
-	SERIAL_LN("==== DevStatus Row %d ====", row);
-	SERIAL_LN("%cuid = %d, type = %d", DevStatus_table.get(row).node_id == CURRENT_DEVICE ? '*' : ' ', DevStatus_table.get(row).uid, DevStatus_table.get(row).type);
-	SERIAL_LN("node_id = %d, present:%s, filter:%d", DevStatus_table.get(row).node_id,
-	    (DevStatus_table.get(row).present ? "true" : "false"), DevStatus_table.get(row).filter);
-
-	if( IS_SUNNY(DevStatus_table.get(row).type) ) {
-		SERIAL_LN("Status: %s, BR: %d, CCT: %d\n\r", DevStatus_table.get(row).ring[0].State ? "On" : "Off",
-					DevStatus_table.get(row).ring[0].BR, DevStatus_table.get(row).ring[0].CCT);
-		strShortDesc = String::format("%cnid:%d St:%d BR:%d, CCT:%d",
-				DevStatus_table.get(row).node_id == CURRENT_DEVICE ? '*' : ' ',
-				DevStatus_table.get(row).node_id, DevStatus_table.get(row).ring[0].State,
-				DevStatus_table.get(row).ring[0].BR, DevStatus_table.get(row).ring[0].CCT);
-	} else {
-		SERIAL_LN("Status: %s, BR: %d, WRGB: %d,%d,%d,%d\n\r", DevStatus_table.get(row).ring[0].State ? "On" : "Off",
-					DevStatus_table.get(row).ring[0].BR, DevStatus_table.get(row).ring[0].CCT,
-				  DevStatus_table.get(row).ring[0].R, DevStatus_table.get(row).ring[0].G,
-					DevStatus_table.get(row).ring[0].B);
-		strShortDesc = String::format("%cnid:%d St:%d BR:%d, WRGB:%d,%d,%d,%d",
-				DevStatus_table.get(row).node_id == CURRENT_DEVICE ? '*' : ' ',
-				DevStatus_table.get(row).node_id, DevStatus_table.get(row).ring[0].State,
-				DevStatus_table.get(row).ring[0].BR, DevStatus_table.get(row).ring[0].CCT,
-			  DevStatus_table.get(row).ring[0].R, DevStatus_table.get(row).ring[0].G,
-			  DevStatus_table.get(row).ring[0].B);
-	}
-	return(strShortDesc);
+// Send a lamp command and keep it as desired state in the shadow.
+// Only the lamp itself (subID 0) is shadowed, groups are not.
+BOOL SmartControllerClass::SendLampCommand(const rf_cmd_t &cmd)
+{
+	if( cmd.subID == 0 ) {
+		UC lv_first = cmd.node, lv_last = cmd.node;
+		if( cmd.node == NODEID_DUMMY ) {
+			lv_first = 0;
+			lv_last = SHD_MAX_NODES - 1;
+		}
+		const DevShadow_t *pShadow;
+		for( UC nid = lv_first; nid <= lv_last && nid < SHD_MAX_NODES; nid++ ) {
+			pShadow = m_shadow.GetShadow(nid);
+			if( cmd.node == NODEID_DUMMY && !pShadow ) continue;
+			switch( cmd.msgID ) {
+			case RF_CMD_SET_POWER:
+				if( cmd.sw != DEVICE_SW_TOGGLE ) {
+					m_shadow.SetDesired(nid, SHD_FLD_SW, cmd.sw);
+				} else if( pShadow && (pShadow->reported & SHD_FLD_SW) ) {
+					m_shadow.SetDesired(nid, SHD_FLD_SW, !pShadow->reportedSW);
+				}
+				break;
+			case RF_CMD_SET_BR:
+				m_shadow.SetDesired(nid, SHD_FLD_BR, 0, cmd.br);
+				break;
+			case RF_CMD_SET_CCT:
+				m_shadow.SetDesired(nid, SHD_FLD_CCT, 0, 0, cmd.cct);
+				break;
+			case RF_CMD_SET_STATUS:
+				m_shadow.SetDesired(nid, SHD_FLD_BR | SHD_FLD_CCT, 0, cmd.status.br, cmd.status.cct);
+				break;
+			}
+		}
+	}
+	return theRadio.SendCommand(cmd);
+}
 
-/*
-	SERIAL_LN("==========================");
-	SERIAL_LN("==== DevStatus Row %d ====", row);
+// Resend the diff of one lamp whose reported state lags desired
+void SmartControllerClass::ReconcileShadow()
+{
+	if( !m_shadow.GetPendingBitmap() ) return;
 
-	switch (DevStatus_table.get(row).op_flag)
-	{
-	case 0: SERIAL_LN("op_flag = GET"); break;
-	case 1: SERIAL_LN("op_flag = POST"); break;
-	case 2: SERIAL_LN("op_flag = PUT"); break;
-	case 3: SERIAL_LN("op_flag = DELETE"); break;
-	}
-	switch (Schedule_table.get(row).flash_flag)
+	// Lamps known to be away keep their pending version until they are back
+	UL lv_away = 0;
+	ListNode<DevStatusRow_t> *tmp = DevStatus_table.getRoot();
+	while (tmp != NULL)
 	{
-	case 0: SERIAL_LN("flash_flag = UNSAVED"); break;
-	case 1: SERIAL_LN("flash_flag = SAVED"); break;
+		if( !tmp->data.present && tmp->data.node_id < SHD_MAX_NODES ) lv_away |= (1UL << tmp->data.node_id);
+		tmp = tmp->next;
 	}
-	switch (Schedule_table.get(row).run_flag)
-	{
-	case 0: SERIAL_LN("run_flag = UNEXECUTED"); break;
-	case 1: SERIAL_LN("run_flag = EXECUTED"); break;
+
+	UC nid = m_shadow.GetDueNode(millis(), lv_away);
+	if( nid == NODEID_DUMMY ) return;
+	const DevShadow_t *pShadow = m_shadow.GetShadow(nid);
+	UC lv_diff = m_shadow.GetDiff(nid);
+	if( !pShadow || !lv_diff ) return;
+	LOGD(LOGTAG_MSG, "Shadow resend node:%d ver:%d diff:0x%x", nid, pShadow->version, lv_diff);
+
+	rf_cmd_t lv_cmd = {};
+	lv_cmd.node = nid;
+	lv_cmd.msgID = RF_CMD_SET_POWER;
+	if( lv_diff & SHD_FLD_SW ) {
+		lv_cmd.sw = pShadow->desiredSW;
+		theRadio.SendCommand(lv_cmd);
+		if( pShadow->desiredSW == DEVICE_SW_OFF ) return;
+	}
+	if( (lv_diff & (SHD_FLD_BR | SHD_FLD_CCT)) == (SHD_FLD_BR | SHD_FLD_CCT) ) {
+		lv_cmd.msgID = RF_CMD_SET_STATUS;
+		lv_cmd.status.br = pShadow->desiredBR;
+		lv_cmd.status.cct = pShadow->desiredCCT;
+	} else if( lv_diff & SHD_FLD_BR ) {
+		lv_cmd.msgID = RF_CMD_SET_BR;
+		lv_cmd.br = pShadow->desiredBR;
+	} else if( lv_diff & SHD_FLD_CCT ) {
+		lv_cmd.msgID = RF_CMD_SET_CCT;
+		lv_cmd.cct = pShadow->desiredCCT;
+	} else {
+		return;
 	}
-	SERIAL_LN("uid = %d, type = %d", DevStatus_table.get(row).uid, DevStatus_table.get(row).type);
-	SERIAL_LN("node_id = %d, present = %s", DevStatus_table.get(row).node_id, (DevStatus_table.get(row).present ? "true" : "false"));
-	SERIAL_LN("ring1 = %s", hue_to_string(DevStatus_table.get(row).ring1).c_str());
-	SERIAL_LN("ring2 = %s", hue_to_string(DevStatus_table.get(row).ring2).c_str());
-	SERIAL_LN("ring3 = %s", hue_to_string(DevStatus_table.get(row).ring3).c_str());
-	*/
+	theRadio.SendCommand(lv_cmd);
 }
 
-void SmartControllerClass::print_schedule_table(int row)
+//------------------------------------------------------------------
+// Printing tables/working memory chains
+//------------------------------------------------------------------
+// Hue as in the config commands: [State,BR,CCT,R,G,B]
+static int print_hue(char *buf, int size, const Hue_t &hue)
 {
-	SERIAL_LN("====================");
-	SERIAL_LN("==== SCT-Row %d ====", row);
+	return snprintf(buf, size, "[%d,%d,%d,%d,%d,%d]", hue.State, hue.BR, hue.CCT, hue.R, hue.G, hue.B);
+}
 
-	switch (Schedule_table.get(row).op_flag)
-	{
-	case 0: SERIAL_LN("op_flag = GET"); break;
-	case 1: SERIAL_LN("op_flag = POST"); break;
-	case 2: SERIAL_LN("op_flag = PUT"); break;
-	case 3: SERIAL_LN("op_flag = DELETE"); break;
-	}
-	switch (Schedule_table.get(row).flash_flag)
-	{
-	case 0: SERIAL_LN("flash_flag = UNSAVED"); break;
-	case 1: SERIAL_LN("flash_flag = SAVED"); break;
-	}
-	switch (Schedule_table.get(row).run_flag)
-	{
-	case 0: SERIAL_LN("run_flag = UNEXECUTED"); break;
-	case 1: SERIAL_LN("run_flag = EXECUTED"); break;
-	}
-	SERIAL_LN("uid = %d", Schedule_table.get(row).uid);
-	SERIAL_LN("weekdays = %d", Schedule_table.get(row).weekdays);
-	SERIAL_LN("isRepeat = %s", (Schedule_table.get(row).isRepeat ? "true" : "false"));
-	SERIAL_LN("hour = %d", Schedule_table.get(row).hour);
-	SERIAL_LN("min = %d", Schedule_table.get(row).minute);
-	SERIAL_LN("alarm_id = %u", Schedule_table.get(row).alarm_id);
+// [nd,type,present,filter,[State,BR,CCT,R,G,B]], ring 0 only
+void SmartControllerClass::print_devStatus_table(JsonWriterClass &writer, const DevStatusRow_t &row)
+{
+	char strHue[32];
+	print_hue(strHue, sizeof(strHue), row.ring[0]);
+	writer.Add("[%d,%d,%d,%d,%s]", row.node_id, row.type, row.present, row.filter, strHue);
 }
 
-void SmartControllerClass::print_scenario_table(int row)
+// [uid,weekdays,isRepeat,hour,min]
+void SmartControllerClass::print_schedule_table(JsonWriterClass &writer, const ScheduleRow_t &row)
 {
-	ScenarioRow_t rowData = Scenario_table.get(row);
-	SERIAL_LN("====================");
-	SERIAL_LN("==== SNT-Row %d ====", row);
+	writer.Add("[%d,%d,%d,%d,%d]", row.uid, row.weekdays, row.isRepeat, row.hour, row.minute);
+}
 
-	switch (rowData.op_flag)
-	{
-	case 0: SERIAL_LN("op_flag = GET"); break;
-	case 1: SERIAL_LN("op_flag = POST"); break;
-	case 2: SERIAL_LN("op_flag = PUT"); break;
-	case 3: SERIAL_LN("op_flag = DELETE"); break;
-	}
-	switch (rowData.flash_flag)
-	{
-	case 0: SERIAL_LN("flash_flag = UNSAVED"); break;
-	case 1: SERIAL_LN("flash_flag = SAVED"); break;
+// [uid,filter,sw] or [uid,filter,[ring1],[ring2],[ring3]]
+void SmartControllerClass::print_scenario_table(JsonWriterClass &writer, const ScenarioRow_t &row)
+{
+	if( row.sw != DEVICE_SW_DUMMY ) {
+		writer.Add("[%d,%d,%d]", row.uid, row.filter, row.sw);
+		return;
 	}
-	switch (rowData.run_flag)
-	{
-	case 0: SERIAL_LN("run_flag = UNEXECUTED"); break;
-	case 1: SERIAL_LN("run_flag = EXECUTED"); break;
+	char strRow[96];
+	int nPos = snprintf(strRow, sizeof(strRow), "[%d,%d", row.uid, row.filter);
+	for( UC i = 0; i < MAX_RING_NUM; i++ ) {
+		strRow[nPos++] = ',';
+		nPos += print_hue(strRow + nPos, sizeof(strRow) - nPos, row.ring[i]);
 	}
-	SERIAL_LN("uid = %d", rowData.uid);
-	if( rowData.sw != DEVICE_SW_DUMMY ) {
-		SERIAL_LN("switch = %d", rowData.sw);
-	} else {
-		SERIAL_LN("ring1 = %s", hue_to_string(rowData.ring[0]).c_str());
-		SERIAL_LN("ring2 = %s", hue_to_string(rowData.ring[1]).c_str());
-		SERIAL_LN("ring3 = %s", hue_to_string(rowData.ring[2]).c_str());
+	writer.Add("%s]", strRow);
+}
+
+// [uid,node,SCT,SNT,notif,tmr_int,tmr_span,cond0,cond1], condN is 0 or
+// [scope,symbol,connector,sr_id,value1,value2] like the config command
+void SmartControllerClass::print_rule_table(JsonWriterClass &writer, const RuleRow_t &row)
+{
+	char strRow[128];
+	int nPos = snprintf(strRow, sizeof(strRow), "[%d,%d,%d,%d,%d,%d,%d", row.uid, row.node_id,
+			row.SCT_uid, row.SNT_uid, row.notif_uid, row.tmr_int, row.tmr_span);
+	for( UC i = 0; i < MAX_CONDITION_PER_RULE; i++ ) {
+		if( row.actCond[i].enabled ) {
+			nPos += snprintf(strRow + nPos, sizeof(strRow) - nPos, ",[%d,%d,%d,%d,%d,%d]",
+					row.actCond[i].sr_scope, row.actCond[i].symbol, row.actCond[i].connector,
+					row.actCond[i].sr_id, row.actCond[i].sr_value1, row.actCond[i].sr_value2);
+		} else {
+			nPos += snprintf(strRow + nPos, sizeof(strRow) - nPos, ",0");
+		}
 	}
-	SERIAL_LN("filter = %d", rowData.filter);
+	writer.Add("%s]", strRow);
 }
 
-void SmartControllerClass::print_rule_table(int row)
+// Dump a working memory table, all rows or the one of uid (node_id for
+// CLS_LIGHT_STATUS): {'tbl':'r','rows':[[..],[..]]}
+// Return the number of cloud frames, 0 if the queue filled up before the end
+UC SmartControllerClass::print_table(char cls, UC sink, UC uid)
 {
-	SERIAL_LN("===================");
-	SERIAL_LN("==== RT-Row %d ====", row);
+	char strHead[JSW_HEAD_SIZE];
+	JsonWriterClass lv_writer(sink, CLT_ID_DeviceConfig);
+	snprintf(strHead, sizeof(strHead), "{'tbl':'%c','rows':[", cls);
+	lv_writer.Begin(strHead);
 
-	switch (Rule_table.get(row).op_flag)
-	{
-	case 0: SERIAL_LN("op_flag = GET"); break;
-	case 1: SERIAL_LN("op_flag = POST"); break;
-	case 2: SERIAL_LN("op_flag = PUT"); break;
-	case 3: SERIAL_LN("op_flag = DELETE"); break;
-	}
-	switch (Rule_table.get(row).flash_flag)
-	{
-	case 0: SERIAL_LN("flash_flag = UNSAVED"); break;
-	case 1: SERIAL_LN("flash_flag = SAVED"); break;
+	if( cls == CLS_RULE ) {
+		for( ListNode<RuleRow_t> *pRow = Rule_table.getRoot(); pRow; pRow = pRow->next ) {
+			if( uid == 0 || pRow->data.uid == uid ) print_rule_table(lv_writer, pRow->data);
+		}
+	} else if( cls == CLS_SCHEDULE ) {
+		for( ListNode<ScheduleRow_t> *pRow = Schedule_table.getRoot(); pRow; pRow = pRow->next ) {
+			if( uid == 0 || pRow->data.uid == uid ) print_schedule_table(lv_writer, pRow->data);
+		}
+	} else if( cls == CLS_SCENARIO ) {
+		for( ListNode<ScenarioRow_t> *pRow = Scenario_table.getRoot(); pRow; pRow = pRow->next ) {
+			if( uid == 0 || pRow->data.uid == uid ) print_scenario_table(lv_writer, pRow->data);
+		}
+	} else if( cls == CLS_LIGHT_STATUS ) {
+		for( ListNode<DevStatusRow_t> *pRow = DevStatus_table.getRoot(); pRow; pRow = pRow->next ) {
+			if( pRow->data.node_id == 0 ) continue;
+			if( uid == 0 || pRow->data.node_id == uid ) print_devStatus_table(lv_writer, pRow->data);
+		}
 	}
-	switch (Rule_table.get(row).run_flag)
-	{
-	case 0: SERIAL_LN("run_flag = UNEXECUTED"); break;
-	case 1: SERIAL_LN("run_flag = EXECUTED"); break;
+
+	UC lv_frames = lv_writer.End();
+	if( sink == JSW_SINK_SERIAL ) {
+		lv_writer.ShowStatistics();
+	} else if( lv_writer.m_stopped ) {
+		LOGE(LOGTAG_MSG, "Table %c: dump stopped after %d frames, publish queue full", cls, lv_frames);
+		return 0;
+	} else {
+		LOGD(LOGTAG_MSG, "Table %c: %d rows in %d frames, free memory %lu, lowest %lu", cls,
+				lv_writer.m_items, lv_frames, lv_writer.m_heapStart, lv_writer.m_heapMin);
 	}
-	SERIAL_LN("uid = %d", Rule_table.get(row).uid);
-	SERIAL_LN("node_id = %d", Rule_table.get(row).node_id);
-	SERIAL_LN("SCT_uid = %d", Rule_table.get(row).SCT_uid);
-	SERIAL_LN("SNT_uid = %d", Rule_table.get(row).SNT_uid);
-	SERIAL_LN("notif_uid = %d", Rule_table.get(row).notif_uid);
-	SERIAL_LN("tmr_int = %d", Rule_table.get(row).tmr_int);
-	SERIAL_LN("tmr_started = %d", Rule_table.get(row).tmr_started);
-	SERIAL_LN("tmr_span = %d m", Rule_table.get(row).tmr_span);
+	return lv_frames;
 }
 
 //------------------------------------------------------------------
 // Place all util func below
 //------------------------------------------------------------------
 // Copy JSON array to Hue structure
-void SmartControllerClass::Array2Hue(JsonArray& data, Hue_t& hue)
+void SmartControllerClass::Array2Hue(const long *data, Hue_t& hue)
 {
 	hue.State = data[0];
 	hue.BR = data[1];
@@ -3344,30 +3466,6 @@ void SmartControllerClass::Array2Hue(JsonArray& data, Hue_t& hue)
 	hue.B = data[5];
 }
 
-String SmartControllerClass::hue_to_string(Hue_t hue)
-{
-	String out = "";
-	out.concat("State:");
-	out.concat(hue.State);
-	out.concat("|");
-	out.concat("BR:");
-	out.concat(hue.BR);
-	out.concat("|");
-	out.concat("CCT:");
-	out.concat(hue.CCT);
-	out.concat("|");
-	out.concat("R:");
-	out.concat(hue.R);
-	out.concat("|");
-	out.concat("G:");
-	out.concat(hue.G);
-	out.concat("|");
-	out.concat("B:");
-	out.concat(hue.B);
-
-	return out;
-}
-
 UC SmartControllerClass::CreateColorPayload(UC *payl, uint8_t ring, uint8_t State, uint8_t BR, uint8_t W, uint8_t R, uint8_t G, uint8_t B)
 {
 	// Payload length
@@ -3385,6 +3483,105 @@ UC SmartControllerClass::CreateColorPayload(UC *payl, uint8_t ring, uint8_t Stat
 	return payl_len;
 }
 
+static BOOL IsSameHue(const Hue_t &_first, const Hue_t &_second)
+{
+	return( _first.State == _second.State && _first.BR == _second.BR &&
+			_first.CCT % 256 == _second.CCT % 256 && _first.R == _second.R &&
+			_first.G == _second.G && _first.B == _second.B );
+}
+
+// Packed scene of MAX_RING_NUM rings, at most SCN_MAX_PACKED_LEN bytes.
+// With _known, fields equal to the known state are left out
+UC SmartControllerClass::CreateScenePayload(UC *payl, const Hue_t *_rings, const Hue_t *_known)
+{
+	UC payl_len = 0;
+	UC lv_hdr, lv_flags;
+	if( !payl || !_rings ) return 0;
+
+	for( UC idx = 0; idx < MAX_RING_NUM; idx++ ) {
+		const Hue_t &lv_ring = _rings[idx];
+		lv_hdr = SCN_HDR_PACKED | (lv_ring.State ? SCN_HDR_STATE : 0);
+		if( idx > 0 && IsSameHue(lv_ring, _rings[idx - 1]) ) {
+			payl[payl_len++] = lv_hdr | SCN_HDR_SAME;
+			continue;
+		}
+
+		lv_flags = SCN_FLD_ALL;
+		if( _known ) {
+			lv_flags = 0;
+			if( lv_ring.BR != _known[idx].BR ) lv_flags |= SCN_FLD_BR;
+			if( lv_ring.CCT % 256 != _known[idx].CCT % 256 ) lv_flags |= SCN_FLD_W;
+			if( lv_ring.R != _known[idx].R ) lv_flags |= SCN_FLD_R;
+			if( lv_ring.G != _known[idx].G ) lv_flags |= SCN_FLD_G;
+			if( lv_ring.B != _known[idx].B ) lv_flags |= SCN_FLD_B;
+		}
+		payl[payl_len++] = lv_hdr | lv_flags;
+		if( lv_flags & SCN_FLD_BR ) payl[payl_len++] = lv_ring.BR;
+		if( lv_flags & SCN_FLD_W ) payl[payl_len++] = lv_ring.CCT % 256;
+		if( lv_flags & SCN_FLD_R ) payl[payl_len++] = lv_ring.R;
+		if( lv_flags & SCN_FLD_G ) payl[payl_len++] = lv_ring.G;
+		if( lv_flags & SCN_FLD_B ) payl[payl_len++] = lv_ring.B;
+	}
+
+	return payl_len;
+}
+
+// Apply a packed scene onto _rings, which holds the known state.
+// Return bytes used, or 0 if the payload is not a valid packed scene
+UC SmartControllerClass::ParseScenePayload(const UC *payl, UC _len, Hue_t *_rings)
+{
+	UC _pos = 0;
+	UC lv_hdr;
+	if( !payl || !_rings ) return 0;
+
+	for( UC idx = 0; idx < MAX_RING_NUM; idx++ ) {
+		if( _pos >= _len ) return 0;
+		lv_hdr = payl[_pos++];
+		if( !(lv_hdr & SCN_HDR_PACKED) ) return 0;
+		if( lv_hdr & SCN_HDR_SAME ) {
+			if( idx == 0 ) return 0;
+			_rings[idx] = _rings[idx - 1];
+		} else {
+			UC lv_fields = 0;
+			for( UC bit = SCN_FLD_BR; bit & SCN_FLD_ALL; bit <<= 1 ) {
+				if( lv_hdr & bit ) lv_fields++;
+			}
+			if( _pos + lv_fields > _len ) return 0;
+			if( lv_hdr & SCN_FLD_BR ) _rings[idx].BR = payl[_pos++];
+			if( lv_hdr & SCN_FLD_W ) _rings[idx].CCT = payl[_pos++];
+			if( lv_hdr & SCN_FLD_R ) _rings[idx].R = payl[_pos++];
+			if( lv_hdr & SCN_FLD_G ) _rings[idx].G = payl[_pos++];
+			if( lv_hdr & SCN_FLD_B ) _rings[idx].B = payl[_pos++];
+		}
+		_rings[idx].State = ((lv_hdr & SCN_HDR_STATE) ? 1 : 0);
+	}
+
+	return _pos;
+}
+
+// Record whether a lamp node told packed scene support in its presentation
+void SmartControllerClass::SetPackedScene(UC _nodeID, BOOL _packed)
+{
+	if( !IS_LAMP_NODEID(_nodeID) ) return;
+	if( _packed ) m_packedScene |= (1UL << _nodeID);
+	else m_packedScene &= ~(1UL << _nodeID);
+}
+
+// Whether the packed scene frame is understood by every lamp the target reaches.
+// Group and broadcast targets qualify only if all known lamps do
+BOOL SmartControllerClass::IsPackedScene(UC _nodeID)
+{
+	if( IS_LAMP_NODEID(_nodeID) ) return((m_packedScene & (1UL << _nodeID)) != 0);
+
+	BOOL lv_found = false;
+	for( ListNode<DevStatusRow_t> *pRow = DevStatus_table.getRoot(); pRow; pRow = pRow->next ) {
+		if( pRow->data.node_id == 0 || !IS_LAMP_NODEID(pRow->data.node_id) ) continue;
+		if( !(m_packedScene & (1UL << pRow->data.node_id)) ) return false;
+		lv_found = true;
+	}
+	return lv_found;
+}
+
 void SmartControllerClass::SetRelayKeyFlag(const UC _code, const bool _on)
 {
 	theConfig.SetRelayKey(_code, _on);
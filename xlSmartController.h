@@ -7,6 +7,10 @@
 #include "xlxCloudObj.h"
 #include "xlxConfig.h"
 #include "xlxChain.h"
+#include "xlxDevShadow.h"
+#include "xlxJsonWriter.h"
+#include "xlxLiveness.h"
+#include "xlxRF433Server.h"
 #include "MyMessage.h"
 
 //------------------------------------------------------------------
@@ -33,8 +37,9 @@ private:
   UL m_tickLoopKeyCode;
   UC m_relaykeyflag;
   uint8_t m_mac[6];
+  UL m_hueConfirmed[MAX_RING_NUM];    // Per ring, bit per lamp node reported since the last scene
+  UL m_packedScene;                   // Bit per lamp node presenting packed scene support
 
-  String hue_to_string(Hue_t hue);
   bool updateDevStatusRow(MyMessage msg);
 public:
 	void GetMac(uint8_t *mac);
@@ -74,7 +79,7 @@ public:
 
   // Device Control Functions
   int DeviceSwitch(UC sw, UC hwsw = 2, UC dev = 0, const UC subID = 0,UC *arrDevType = NULL,UC devTypeNum = 0);
-  int DevSoftSwitch(UC sw, UC dev = 0, const UC subID = 0,UC *arrDevType = NULL,UC devTypeNum = 0);
+  int DevSoftSwitch(UC sw, UC dev = 0, const UC subID = 0);
   int DevHardSwitch(UC key, UC sw);
   bool HardConfirmOnOff(UC dev, const UC subID = 0, const UC _st = 0);
   bool MakeSureHardSwitchOn(UC dev = 0, const UC subID = 0);
@@ -96,8 +101,12 @@ public:
   int ExeJSONConfig(String jsonData);
 
   // Parsing Functions
-  bool ParseCmdRow(JsonObject& data);
+  bool ParseCmdRow(const jsr_span_t &data);
   UC CreateColorPayload(UC *payl, uint8_t ring, uint8_t State, uint8_t BR, uint8_t W, uint8_t R, uint8_t G, uint8_t B);
+  UC CreateScenePayload(UC *payl, const Hue_t *_rings, const Hue_t *_known = NULL);
+  UC ParseScenePayload(const UC *payl, UC _len, Hue_t *_rings);
+  void SetPackedScene(UC _nodeID, BOOL _packed);
+  BOOL IsPackedScene(UC _nodeID);
 
   // Cloud Interface Action Types
   bool Change_Rule(RuleRow_t row);
@@ -106,7 +115,7 @@ public:
   bool Action_Rule(ListNode<RuleRow_t> *rulePtr);
   bool Action_Schedule(OP_FLAG parentFlag, UC uid, UC rule_uid);
 
-  //bool Check_SensorData(UC _thisNd, UC _scope, UC _sr, UC _nd, UC _symbol, US _val1, US _val2);
+  bool Check_SensorData(UC _thisNd, UC _scope, UC _sr, UC _nd, UC _symbol, US _val1, US _val2);
   bool Execute_Rule(ListNode<RuleRow_t> *rulePtr, bool _init = false, const UC _sr = 255, const UC _nd = 0);
 
   //LinkedLists (Working memory tables)
@@ -115,16 +124,20 @@ public:
   ChainClass<ScenarioRow_t> Scenario_table = ChainClass<ScenarioRow_t>(MAX_TABLE_SIZE);
   ChainClass<RuleRow_t> Rule_table = ChainClass<RuleRow_t>(256); // 65536/24 is too big = (int)(MEM_RULES_LEN / sizeof(RuleRow_t))
 
-  //Print LinkedLists (Working memory tables)
-  String print_devStatus_table(int row);
-  void print_schedule_table(int row);
-  void print_scenario_table(int row);
-  void print_rule_table(int row);
+  // Desired and reported state of lamps
+  DevShadowClass m_shadow;
+  // Keepalive deadlines of nodes
+  LivenessClass m_liveness;
+
+  //Print LinkedLists (Working memory tables), one JSON row each
+  void print_devStatus_table(JsonWriterClass &writer, const DevStatusRow_t &row);
+  void print_schedule_table(JsonWriterClass &writer, const ScheduleRow_t &row);
+  void print_scenario_table(JsonWriterClass &writer, const ScenarioRow_t &row);
+  void print_rule_table(JsonWriterClass &writer, const RuleRow_t &row);
+  UC print_table(char cls, UC sink, UC uid = 0);
 
   // Action Loop & Helper Methods
   void ReadNewRules(bool force = false);
-  bool CreateAlarm(ListNode<ScheduleRow_t>* scheduleRow, uint32_t tag = 0);
-  bool DestoryAlarm(AlarmId alarmID, UC SCT_uid);
   void OnSensorDataChanged(const UC _sr, const UC _nd);
 
   // UID search functions
@@ -163,9 +176,11 @@ public:
   BOOL QueryDeviceStatus(UC _nodeID, UC _ringID = RING_ID_ALL);
   BOOL RebootNode(UC _nodeID, const UC subID = 0);
   BOOL IsAllRingHueSame(ListNode<DevStatusRow_t> *pDev);
+  BOOL SendLampCommand(const rf_cmd_t &cmd);
+  void ReconcileShadow();
 
   // Utils
-  void Array2Hue(JsonArray& data, Hue_t& hue);     // Copy JSON array to Hue structure
+  void Array2Hue(const long *data, Hue_t& hue);     // Copy JSON array to Hue structure
   void SetRelayKeyFlag(const UC _code, const bool _on);
   void PublishRelayKeyFlag();
   void PublishBtnAction();
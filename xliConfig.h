@@ -53,7 +53,7 @@
 #endif
 
 // Main Version. Must change if Config_t structure is updated
-#define VERSION_CONFIG_DATA       27
+#define VERSION_CONFIG_DATA       29
 
 // Xlight Application Identification
 #define XLA_ORGANIZATION          "xlight.ca.pro"               // Default value. Read from EEPROM
@@ -79,6 +79,9 @@
 // Keep alive message timeout
 #define RTE_TM_KEEP_ALIVE         60
 
+// Default sensor telemetry window (seconds)
+#define RTE_TM_TELEMETRY          10
+
 // Panel Operarion Timers
 #define RTE_TM_MAX_CCT_IDLE       6           // Maximum idle time (seconds) in CCT control mode
 #define RTE_TM_HELD_TO_DFU        30          // Held duration threshold for DFU
@@ -104,6 +107,13 @@
 #define MAX_NODE_PER_CONTROLLER     48
 #endif
 
+// Maximum number of sensor nodes (incl. the controller) tracked in sensor store
+#if XLIGHT_EDITION_ID == XLIGHT_HOME_EDITION
+#define MAX_SENSOR_NODES            8
+#else
+#define MAX_SENSOR_NODES            16
+#endif
+
 // Maximum conditions within a rule
 #define MAX_CONDITION_PER_RULE      2
 
@@ -130,6 +140,13 @@
 #define MQ_MAX_CLOUD_MSG        12
 #endif
 
+// Maximum Cloud Publish messages buffered
+#if XLIGHT_EDITION_ID == XLIGHT_HOME_EDITION
+#define MQ_MAX_PUBLISH_MSG      8
+#else
+#define MQ_MAX_PUBLISH_MSG      16
+#endif
+
 // NodeID Convention
 #define NODEID_GATEWAY          254
 #define NODEID_MAINDEVICE       1